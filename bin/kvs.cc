@@ -26,10 +26,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <netdb.h> // getaddrinfo()
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm> // find
+#include <chrono>
 #include <string>
 #include <sstream>
 #include <cstdlib> // system()
 #include <fstream>
+#include <thread>
 
 #include "nvmm/epoch_manager.h"
 #include "nvmm/memory_manager.h"
@@ -114,35 +120,23 @@ int scanKVS(std::string type_str, GlobalPtr root, std::string base="", std::stri
         return -1;
     }
 
-    size_t const max_val_len = 4096;
-    size_t const max_key_len = kvs->MaxKeyLen();
-
     std::string begin_key(KeyValueStore::OPEN_BOUNDARY_KEY, KeyValueStore::OPEN_BOUNDARY_KEY_SIZE);
     std::string end_key(KeyValueStore::OPEN_BOUNDARY_KEY, KeyValueStore::OPEN_BOUNDARY_KEY_SIZE);
 
-    char key_buf[max_key_len];
-    size_t key_len;
-    char val_buf[max_val_len];
-    size_t val_len;
-    ResetBuf(key_buf, key_len, max_key_len);
-    ResetBuf(val_buf, val_len, max_val_len);
-
-    int iter;
-    int ret = kvs->Scan(iter,
-                        key_buf, key_len,
-                        val_buf, val_len,
-                        begin_key.c_str(), begin_key.size(), false,
-                        end_key.c_str(), end_key.size(), false);
-
-    if(ret!=0) {
+    // the workers scan subranges in parallel; the keys are printed in order
+    size_t cnt = 0;
+    int ret = kvs->ParallelScan(begin_key.c_str(), begin_key.size(), false,
+                                end_key.c_str(), end_key.size(), false,
+                                0, true,
+                                [&](size_t worker, char const *key, size_t key_len,
+                                    char const *val, size_t val_len) {
+                                    std::cout << std::string(key, key_len) << " -> " << std::string(val, val_len) << std::endl;
+                                    cnt++;
+                                });
+
+    if(ret!=0 || cnt==0) {
         std::cout << "KVS scan failed... KVS is empty? " << std::endl;
     }
-    while(ret==0) {
-        std::cout << std::string(key_buf, key_len) << " -> " << std::string(val_buf, val_len) << std::endl;
-        ResetBuf(key_buf, key_len, max_key_len);
-        ResetBuf(val_buf, val_len, max_val_len);
-        ret = kvs->GetNext(iter, key_buf, key_len, val_buf, val_len);
-    }
 
     delete kvs;
     return 0;
@@ -276,13 +270,15 @@ void start_servers(std::string config_path, std::string server_path, std::string
     std::cout << "Starting memcached servers..." << std::endl;
     Config conf;
     conf.LoadConfigFile(config_path);
-
-    uint64_t partition_per_node=1;
-    if(conf.GetReplicationScheme() == Config::ReplicationScheme::DYNAMO)
-        partition_per_node=conf.GetReplicationFactor();
+    Cluster c;
+    c.Init(conf);
 
     for(uint64_t i=0; i<conf.GetNodeCnt(); i++) {
-        for(uint64_t j=0; j<partition_per_node; j++) {
+        // a server per slot the node serves a partition in
+        std::vector<KVS> slots = c.FindPartitions(NodeID(i));
+        for(uint64_t j=0; j<slots.size(); j++) {
+            if(slots[j].empty())
+                continue;
             // TODO: -d would run fork() which does not work with nvmm
             std::string cmd = server_path+" -K "+config_path+" -N "+std::to_string(i)+" -Z "+std::to_string(j) + " &";
             if(!prefix.empty()) {
@@ -361,6 +357,149 @@ int bootstrap(std::string path, bool resume) {
     return 0;
 }
 
+// sends a text command to a server, and returns the first line of the reply ("" on error)
+std::string server_command(Location const &loc, std::string cmd) {
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(loc.ip.c_str(), std::to_string(loc.port).c_str(), &hints, &ai)!=0)
+        return "";
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if(fd>=0 && connect(fd, ai->ai_addr, ai->ai_addrlen)!=0) {
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(ai);
+    if(fd<0)
+        return "";
+
+    cmd += "\r\n";
+    std::string reply;
+    if(write(fd, cmd.data(), cmd.size())==(ssize_t)cmd.size()) {
+        char c;
+        while(read(fd, &c, 1)==1 && c!='\n')
+            reply += c;
+        if(!reply.empty() && reply.back()=='\r')
+            reply.pop_back();
+    }
+    close(fd);
+    return reply;
+}
+
+// the range of partition pid is [begin_key, end_key)
+// return the server of the partition
+Location partition_range(Config &conf, PartitionID pid, std::string &begin_key, std::string &end_key) {
+    std::vector<PartitionID> range_partitions = conf.GetRangePartitions();
+    size_t idx = std::find(range_partitions.begin(), range_partitions.end(), pid) - range_partitions.begin();
+    std::vector<std::string> const &split_keys = conf.GetSplitKeys();
+    begin_key = idx>0 ? split_keys[idx-1] : "";
+    end_key = idx<split_keys.size() ? split_keys[idx] : "";
+    Cluster c;
+    c.Init(conf);
+    return c.Locate(ResourceName(begin_key));
+}
+
+bool load_range_config(std::string path, Config &conf, PartitionID pid) {
+    if(conf.LoadConfigFile(path)!=0 || !conf.IsValid()) {
+        std::cout << "Invalid config file: " << path << std::endl;
+        return false;
+    }
+    if(conf.GetPartitionScheme()!=Config::PartitionScheme::RANGE ||
+       conf.GetReplicationScheme()!=Config::ReplicationScheme::NO_REPLICATION) {
+        std::cout << "Only RANGE partitions without replication can be split" << std::endl;
+        return false;
+    }
+    if(conf.GetPartitions().count(pid)==0) {
+        std::cout << "No partition " << pid << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// splits the range of partition pid at split_key, online: the keys from split_key to the end of
+// the range move into a new KVS, created by the server of the partition on its shelves, while the
+// server keeps serving them ("kvs_split" commands of the server); once the new KVS has the range
+// and gets its writes too, it becomes a new partition with a server of its own (see
+// Config::SplitPartition), and the config file is updated
+// then start the new server, reload the clients (KVSServer::Reload()), and run split_finish
+// only for RANGE partitioning with NO_REPLICATION, and servers without write-back
+int split(std::string path, PartitionID pid, std::string split_key) {
+    Config conf;
+    if(!load_range_config(path, conf, pid))
+        return -1;
+
+    // check the split on a copy of the config before moving anything
+    KVS kvs = conf.GetPartitions().at(pid);
+    Config new_conf(conf);
+    PartitionID new_pid;
+    if(new_conf.SplitPartition(pid, split_key, kvs, new_pid)!=0) {
+        std::cout << "Invalid split key: " << split_key << std::endl;
+        return -1;
+    }
+
+    std::string begin_key, end_key;
+    Location loc = partition_range(conf, pid, begin_key, end_key);
+    std::cout << "Moving [" << split_key << ", " << (end_key.empty() ? "+inf" : end_key)
+              << ") of partition " << pid << " (" << loc << ") to partition " << new_pid << "..." << std::endl;
+    std::string reply = server_command(loc, "kvs_split start "+split_key+(end_key.empty() ? "" : " "+end_key));
+    if(reply!="OK") {
+        std::cout << "Failed to start the split: " << (reply.empty() ? "no reply" : reply) << std::endl;
+        return -1;
+    }
+    std::string const dual_write = "SPLIT dual_write ";
+    for(;;) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        reply = server_command(loc, "kvs_split status");
+        if(reply.compare(0, dual_write.size(), dual_write)==0)
+            break;
+        if(reply!="SPLIT copying") {
+            std::cout << "Migration failed; the config is unchanged: " << reply << std::endl;
+            return -1;
+        }
+    }
+
+    kvs["kvs_root"] = reply.substr(dual_write.size());
+    if(conf.SplitPartition(pid, split_key, kvs, new_pid)!=0 || conf.SaveConfigFile(path)!=0) {
+        std::cout << "Failed to update the config file; the server of partition " << pid
+                  << " keeps writing the range to both KVSs" << std::endl;
+        return -1;
+    }
+    std::cout << "Partition " << new_pid << " created at " << kvs["kvs_root"] << std::endl;
+    conf.PrintConfigFile(path);
+    std::cout << "Start its server and reload the clients, then run: kvs split_finish "
+              << path << " " << pid << std::endl;
+    return 0;
+}
+
+// ends the split of partition pid, once no requests for the range that moved go to its server:
+// the server stops writing the range to the new KVS, and purges it from its own
+int split_finish(std::string path, PartitionID pid) {
+    Config conf;
+    if(!load_range_config(path, conf, pid))
+        return -1;
+    std::string begin_key, end_key;
+    Location loc = partition_range(conf, pid, begin_key, end_key);
+    std::string reply = server_command(loc, "kvs_split finish");
+    if(reply!="OK") {
+        std::cout << "Failed to finish the split: " << (reply.empty() ? "no reply" : reply) << std::endl;
+        return -1;
+    }
+    for(;;) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        reply = server_command(loc, "kvs_split status");
+        if(reply=="SPLIT idle")
+            break;
+        if(reply!="SPLIT finishing") {
+            std::cout << "Failed to finish the split; the range is still in partition " << pid
+                      << ": " << reply << std::endl;
+            return -1;
+        }
+    }
+    std::cout << "Split of partition " << pid << " finished" << std::endl;
+    return 0;
+}
+
 int replay(std::string type_str, GlobalPtr root, std::string log, std::string base="", std::string user="") {
     KeyValueStore::IndexType type;
     if(type_str=="radixtree") {
@@ -452,7 +591,7 @@ int heap_stats(GlobalPtr root, std::string base="", std::string user="") {
 
 int main(int argc, char** argv) {
     if (argc < 2) {
-        fprintf(stderr, "usage: kvs {start|reset|create type(radixtree, hashtable) size|scan type root|bootstrap config_path new/resume|start_servers config_path server_path|stop_servers}\n");
+        fprintf(stderr, "usage: kvs {start|reset|create type(radixtree, hashtable) size|scan type root|bootstrap config_path new/resume|split config_path partition split_key|split_finish config_path partition|start_servers config_path server_path|stop_servers}\n");
         exit(1);
     }
 
@@ -602,6 +741,20 @@ int main(int argc, char** argv) {
         }
         return bootstrap(path, mode=="resume"?true:false);
     }
+    else if (command == "split") {
+        if (argc != 5) {
+            std::cout << "Invalid usage: ./kvs split config_path partition split_key" << std::endl;
+            return -1;
+        }
+        return split(argv[2], PartitionID(std::stoul(argv[3])), argv[4]);
+    }
+    else if (command == "split_finish") {
+        if (argc != 4) {
+            std::cout << "Invalid usage: ./kvs split_finish config_path partition" << std::endl;
+            return -1;
+        }
+        return split_finish(argv[2], PartitionID(std::stoul(argv[3])));
+    }
     else if (command == "start_servers") {
         std::string config_path, server_path, prefix="";
         if (argc >= 4) {
@@ -3,7 +3,13 @@
 #include <string.h>
 #include <string>
 #include <iostream>
+#include <atomic>
+#include <deque>
+#include <sstream>
+#include <unordered_set>
+#include <vector>
 #include <cluster/config.h>
+#include <radixtree/kvs_migration.h>
 
 #define ERROR_TRACE		1
 
@@ -14,16 +20,331 @@ using namespace radixtree;
 bool use_slab_sizes;
 uint32_t slab_sizes[MAX_NUMBER_OF_SLAB_CLASSES];
 pthread_mutex_t kvs_global_lock = PTHREAD_MUTEX_INITIALIZER;
-uint64_t num_hit;
 
 //key value store
 KeyValueStore *kvs;
 
-#define HIT() (num_hit++)
+// Counters of a cache policy (CACHE_MODE), exported by "stats" and printed by KVS_Final
+#define POLICY_COUNTER_FIELDS \
+	X(get_hits)	/* found in the cache */ \
+	X(get_misses)	/* not in the cache, read from the KVS */ \
+	X(get_stale)	/* in the cache, but the KVS has a newer version */ \
+	X(get_absent)	/* misses answered by the negative cache */ \
+	X(put_hits)	/* written through the short-cut of a cached item */ \
+	X(put_misses)	/* written by key */ \
+	X(put_back)	/* written to the cache only (write-back mode) */ \
+	X(write_backs)	/* dirty items written to the KVS */
+
+struct policy_counters {
+#define X(name) uint64_t name;
+	POLICY_COUNTER_FIELDS
+#undef X
+};
+
+// Each thread counts in a slot of its own, which only it writes, so that requests do not share
+// a counter; the slots are summed when the counters are read. The slot of a thread that exits
+// keeps its counts and goes to the next thread that counts.
+struct counter_slot {
+	struct {
+#define X(name) std::atomic<uint64_t> name;
+		POLICY_COUNTER_FIELDS
+#undef X
+	} modes[CACHE_MODE_CNT];
+	std::atomic<bool> taken;
+	counter_slot *next;
+};
+static std::atomic<counter_slot *> counter_slots;	// never shrinks
+
+struct counter_owner {
+	counter_slot *slot = NULL;
+	~counter_owner() {
+		if (slot != NULL)
+			slot->taken.store(false, std::memory_order_release);
+	}
+};
+static thread_local counter_owner counters;
 
-item *item_get(const char *key, const size_t nkey, conn *c, const bool do_update)
+static counter_slot *counter_claim()
+{
+	counter_slot *head = counter_slots.load(std::memory_order_acquire);
+	for (counter_slot *s = head; s != NULL; s = s->next) {
+		bool taken = false;
+		if (!s->taken.load(std::memory_order_relaxed) &&
+		    s->taken.compare_exchange_strong(taken, true, std::memory_order_acquire))
+			return s;
+	}
+	counter_slot *s = new counter_slot();	// zeroed
+	s->taken.store(true, std::memory_order_relaxed);
+	s->next = head;
+	while (!counter_slots.compare_exchange_weak(s->next, s, std::memory_order_acq_rel))
+		;
+	return s;
+}
+
+static inline void counter_bump(std::atomic<uint64_t> &n)
+{
+	n.store(n.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+#define COUNT(mode, counter) \
+	counter_bump((counters.slot != NULL ? counters.slot : \
+		      (counters.slot = counter_claim()))->modes[mode].counter)
+
+static void policy_counters_read(int mode, policy_counters *out)
+{
+	memset(out, 0, sizeof(*out));
+	for (counter_slot *s = counter_slots.load(std::memory_order_acquire); s != NULL; s = s->next) {
+#define X(name) out->name += s->modes[mode].name.load(std::memory_order_relaxed);
+		POLICY_COUNTER_FIELDS
+#undef X
+	}
+}
+
+static char const * const cache_mode_names[CACHE_MODE_CNT] =
+	{"memcached", "full", "short", "hybrid", "kvs_only", "cache_only"};
+static char const * const version_mode_names[VERSION_MODE_CNT] = {"off", "on", "force"};
+
+/*
+   Cache policies
+
+   Each CACHE_MODE is a set of functions below; the ones that check versions are templates on the
+   VERSION_MODE, so that the modes are constants on the per-call path. Cache_SetPolicy() picks the
+   set once, before the first request.
+*/
+
+// Cache fills are zero-copy: the KVS copies a value straight into the data of a new, unlinked item,
+// which is allocated once the value size is known (with a connection, the data ends with "\r\n")
+struct item_fill {
+	const char *key;
+	size_t nkey;
+	conn *c;
+	item *it;	// the new item, if the KVS returned a value
+};
+
+static KeyValueStore::ValAlloc item_filler(item_fill *f)
+{
+	return [f](size_t val_len) -> char * {
+		size_t nbytes = f->c != NULL ? val_len + 2 : val_len;
+		f->it = item_alloc(f->key, f->nkey, 0, realtime(0), nbytes);
+		if (f->it == NULL) {
+#if ERROR_TRACE	== 1
+			printf("MC_get: Allocation error (%lu bytes)!\n", (unsigned long)nbytes);
+#endif
+			return NULL;
+		}
+		if (f->c != NULL)
+			memcpy((char *)ITEM_data(f->it) + val_len, "\r\n", 2);
+		return ITEM_data(f->it);
+	};
+}
+
+// an item the KVS filled but that is not used after all
+static void drop_fill(item_fill *f)
+{
+	if (f->it != NULL) {
+		do_item_remove(f->it);
+		f->it = NULL;
+	}
+}
+
+/*
+   Negative cache: keys that the KVS does not have, so that lookups of them are answered from DRAM
+   instead of a walk of the index. An entry is revalidated on every hit, which takes a few FAM
+   reads: for a deleted key, the version of its key node (a later put bumps it); for a key without
+   a key node, the word of the index that an insert of the key would change (kvs->Absent()).
+   Direct-mapped on the key hash, settings.absent_cache_size entries (0: off); an entry is only
+   touched under its stripe lock, taken inside the item lock of the key.
+*/
+struct absent_entry {
+	Gptr skey;		// the key node of a deleted key, or null
+	uint64_t sgen;		// and the key generation it was taken in
+	TagGptr val_ptr;	// its (null) value pointer and version
+	KeyMiss miss;		// if there is no key node: where the lookup ended
+	size_t nkey;		// the key (nkey bytes) follows the entry
+};
+
+static inline char *absent_key(absent_entry *e)
+{
+	return (char *)(e + 1);
+}
+
+#define ABSENT_LOCKS 1024
+static absent_entry **absent_table;
+static uint32_t absent_mask;
+static pthread_mutex_t absent_locks[ABSENT_LOCKS];
+
+static void absent_init()
+{
+	if (settings.absent_cache_size <= 0)
+		return;
+	uint32_t size = 1;
+	while (size < (uint32_t)settings.absent_cache_size && size < (1U << 31))
+		size <<= 1;
+	absent_table = (absent_entry **)calloc(size, sizeof(absent_entry *));
+	if (absent_table == NULL) {
+		fprintf(stderr, "Failed to allocate the negative cache\n");
+		return;
+	}
+	absent_mask = size - 1;
+	for (int i = 0; i < ABSENT_LOCKS; i++)
+		pthread_mutex_init(&absent_locks[i], NULL);
+}
+
+static void absent_final()
+{
+	if (absent_table == NULL)
+		return;
+	for (uint32_t i = 0; i <= absent_mask; i++)
+		free(absent_table[i]);
+	free(absent_table);
+	absent_table = NULL;
+}
+
+// copies out the entry of the key, if there is one
+static bool absent_find(const char *key, const size_t nkey, uint32_t hv, absent_entry *e)
+{
+	uint32_t i = hv & absent_mask;
+	bool found = false;
+	mutex_lock(&absent_locks[i % ABSENT_LOCKS]);
+	absent_entry *cur = absent_table[i];
+	if (cur != NULL && cur->nkey == nkey && memcmp(absent_key(cur), key, nkey) == 0) {
+		*e = *cur;
+		found = true;
+	}
+	mutex_unlock(&absent_locks[i % ABSENT_LOCKS]);
+	return found;
+}
+
+// adds (or updates) the entry of the key, evicting whichever key had the slot
+static void absent_set(const char *key, const size_t nkey, uint32_t hv, Gptr skey,
+	uint64_t sgen, TagGptr val_ptr, KeyMiss const &miss)
+{
+	uint32_t i = hv & absent_mask;
+	mutex_lock(&absent_locks[i % ABSENT_LOCKS]);
+	absent_entry *cur = absent_table[i];
+	if (cur == NULL || cur->nkey != nkey || memcmp(absent_key(cur), key, nkey) != 0) {
+		free(cur);
+		cur = (absent_entry *)malloc(sizeof(absent_entry) + nkey);
+		if (cur != NULL) {
+			cur->nkey = nkey;
+			memcpy(absent_key(cur), key, nkey);
+		}
+		absent_table[i] = cur;
+	}
+	if (cur != NULL) {
+		cur->skey = skey;
+		cur->sgen = sgen;
+		cur->val_ptr = val_ptr;
+		cur->miss = miss;
+	}
+	mutex_unlock(&absent_locks[i % ABSENT_LOCKS]);
+}
+
+static void absent_drop(const char *key, const size_t nkey, uint32_t hv)
+{
+	uint32_t i = hv & absent_mask;
+	mutex_lock(&absent_locks[i % ABSENT_LOCKS]);
+	absent_entry *cur = absent_table[i];
+	if (cur != NULL && cur->nkey == nkey && memcmp(absent_key(cur), key, nkey) == 0) {
+		free(cur);
+		absent_table[i] = NULL;
+	}
+	mutex_unlock(&absent_locks[i % ABSENT_LOCKS]);
+}
+
+// With the item lock of the key held: the KVS Get of a key that is not in the cache. If the
+// negative cache has the key and it is still absent, this returns 0 with a null val_ptr (and
+// the skey of a deleted key) without a walk; otherwise it is a plain kvs->Get(). sgen is the key
+// generation of skey.
+static int kvs_get_uncached(const char *key, const size_t nkey, uint32_t hv, item_fill *fill,
+	Gptr &skey, uint64_t &sgen, TagGptr &val_ptr)
+{
+	sgen = kvs->KeyGen();
+	if (absent_table == NULL)
+		return kvs->Get(key, nkey, item_filler(fill), skey, val_ptr);
+
+	int kvs_ret;
+	absent_entry e;
+	if (absent_find(key, nkey, hv, &e)) {
+		if (e.skey.IsValid()) {
+			// deleted: the key node has the latest version, unless compaction took it
+			skey = e.skey;
+			val_ptr = e.val_ptr;
+			kvs_ret = kvs->Get(skey, val_ptr, item_filler(fill), false, e.sgen);
+			if (kvs_ret == 0 && !val_ptr.IsValid()) {
+				COUNT(settings.cache_mode, get_absent);
+				sgen = e.sgen;
+				if (val_ptr != e.val_ptr)
+					absent_set(key, nkey, hv, skey, sgen, val_ptr, e.miss);
+				return 0;
+			}
+			absent_drop(key, nkey, hv);
+			if (kvs_ret == 0) {
+				sgen = e.sgen;
+				return 0;	// the key is back, and its value is in fill
+			}
+			drop_fill(fill);
+		} else if (kvs->Absent(e.miss)) {
+			COUNT(settings.cache_mode, get_absent);
+			skey = Gptr();
+			val_ptr = TagGptr();
+			return 0;
+		} else {
+			absent_drop(key, nkey, hv);
+		}
+	}
+
+	KeyMiss miss;
+	kvs_ret = kvs->Get(key, nkey, item_filler(fill), skey, val_ptr, miss);
+	// only if it can be revalidated
+	if (kvs_ret == 0 && !val_ptr.IsValid() && (skey.IsValid() || miss.node != 0))
+		absent_set(key, nkey, hv, skey, sgen, val_ptr, miss);
+	return kvs_ret;
+}
+
+/*
+   kvs->Compact() frees the key nodes of deleted keys, so a short-cut is only good in the key
+   generation it was taken in (sgen). The KVS turns down a short-cut of an older generation
+   (STALE_KEY_PTR), and these go back to the key, which also renews skey and sgen.
+*/
+static int kvs_get_short(const char *key, const size_t nkey, Gptr &skey, uint64_t &sgen,
+	TagGptr &val_ptr, item_fill *fill, bool get_value = false)
+{
+	if (skey.IsValid()) {
+		int kvs_ret = kvs->Get(skey, val_ptr, item_filler(fill), get_value, sgen);
+		if (kvs_ret != KeyValueStore::STALE_KEY_PTR)
+			return kvs_ret;
+	}
+	sgen = kvs->KeyGen();
+	return kvs->Get(key, nkey, item_filler(fill), skey, val_ptr);
+}
+
+static int kvs_put_short(const char *key, const size_t nkey, Gptr &skey, uint64_t &sgen,
+	TagGptr &val_ptr, const char *val, const size_t val_len)
+{
+	if (skey.IsValid()) {
+		int kvs_ret = kvs->Put(skey, val_ptr, val, val_len, sgen);
+		if (kvs_ret != KeyValueStore::STALE_KEY_PTR)
+			return kvs_ret;
+	}
+	sgen = kvs->KeyGen();
+	return kvs->Put(key, nkey, val, val_len, skey, val_ptr);
+}
+
+static int kvs_del_short(const char *key, const size_t nkey, Gptr skey, uint64_t sgen,
+	TagGptr &val_ptr)
+{
+	if (skey.IsValid()) {
+		int kvs_ret = kvs->Del(skey, val_ptr, sgen);
+		if (kvs_ret != KeyValueStore::STALE_KEY_PTR)
+			return kvs_ret;
+	}
+	return kvs->Del(key, nkey);
+}
+
+// CACHE_MODE_MEMCACHED_KVS
+static item *get_memcached_kvs(const char *key, const size_t nkey, conn *c, const bool do_update)
 {
-#if CACHE_MODE == 0
 	//find from cache
 	//if cannot find from cache -> find from kvs
 	//if find from cache -> return
@@ -32,11 +353,14 @@ item *item_get(const char *key, const size_t nkey, conn *c, const bool do_update
 	item_lock(hv);
 	item *it = do_item_get(key, nkey, hv, c, do_update);
 	if (it == NULL) {
+		COUNT(CACHE_MODE_MEMCACHED_KVS, get_misses);
 		int kvs_ret;
-		char val[2048];
-		size_t val_len = 2048;
-		kvs_ret = kvs->Get(key, nkey, val, val_len);
-		if (kvs_ret != 0) {
+		item_fill fill = {key, nkey, c, NULL};
+		Gptr skey;
+		uint64_t sgen;
+		TagGptr val_ptr_;
+		kvs_ret = kvs_get_uncached(key, nkey, hv, &fill, skey, sgen, val_ptr_);
+		if (kvs_ret != 0 || fill.it == NULL) {
 #if ERROR_TRACE	== 1
 			printf("Get fail: key cannot be found\n");
 #endif
@@ -45,59 +369,55 @@ item *item_get(const char *key, const size_t nkey, conn *c, const bool do_update
 		}
 
 		//Cache store
-		item *it;
-		if (c != NULL)
-			it = item_alloc(key, nkey, 0, realtime(0), val_len + 2);
-		else
-			it = item_alloc(key, nkey, 0, realtime(0), val_len);
-		if (it == NULL) {
-#if ERROR_TRACE	== 1
-			printf("MC_get1: Allocation error!\n");
-#endif
-			item_unlock(hv);
-			return NULL;
-		}
-
-		memcpy(ITEM_data(it), val, val_len);
-		if (c != NULL)
-			memcpy((char*)ITEM_data(it) + val_len, "\r\n", 2);
+		// the version tells store_item whether a concurrent write is newer
+		it = fill.it;
+		it->skey = skey;
+		it->sgen = sgen;
+		it->val_ptr.vptr = val_ptr_.gptr_;
+		it->val_ptr.tag = val_ptr_.tag_;
 
 		do_item_link(it, hv);
 		item_unlock(hv);
 		return it;
 	} else {
-		HIT();
+		COUNT(CACHE_MODE_MEMCACHED_KVS, get_hits);
 		item_unlock(hv);
 		return it;
 	}
-#elif CACHE_MODE == 4
+}
+
+// CACHE_MODE_KVS_ONLY
+static item *get_kvs_only(const char *key, const size_t nkey, conn *c, const bool do_update)
+{
         // always return from kvs
+        COUNT(CACHE_MODE_KVS_ONLY, get_misses);
         int kvs_ret;
-        char val[2048];
-        size_t val_len = 2048;
-        kvs_ret = kvs->Get(key, nkey, val, val_len);
+        item_fill fill = {key, nkey, c, NULL};
+        kvs_ret = kvs->Get(key, nkey, item_filler(&fill));
         if (kvs_ret != 0) {
 #if ERROR_TRACE	== 1
             printf("Get fail: key cannot be found\n");
 #endif
             return NULL;
         }
+        return fill.it;
+}
 
-        item *it;
-        it = item_alloc(key, nkey, 0, realtime(0), val_len + 2);
-        if (it == NULL) {
-#if ERROR_TRACE	== 1
-            printf("MC_get1: Allocation error!\n");
-#endif
-            return NULL;
-        }
-
-        memcpy(ITEM_data(it), val, val_len);
-        memcpy((char*)ITEM_data(it) + val_len, "\r\n", 2);
+// CACHE_MODE_CACHE_ONLY
+static item *get_cache_only(const char *key, const size_t nkey, conn *c, const bool do_update)
+{
+        item *it = item_get_internal(key, nkey, c, do_update);
+        if (it != NULL)
+            COUNT(CACHE_MODE_CACHE_ONLY, get_hits);
+        else
+            COUNT(CACHE_MODE_CACHE_ONLY, get_misses);
         return it;
-#elif CACHE_MODE == 5
-        return item_get_internal(key, nkey, c, do_update);
-#elif CACHE_MODE == 1
+}
+
+// CACHE_MODE_FULL
+template <int VersionMode>
+static item *get_full(const char *key, const size_t nkey, conn *c, const bool do_update)
+{
 	//Find key from mc
 	//Compare version between KVS and mc
 	//If versions are same, return the value
@@ -108,34 +428,33 @@ item *item_get(const char *key, const size_t nkey, conn *c, const bool do_update
 	item_lock(hv);
 	item *res = do_item_get(key, nkey, hv, c, do_update);
 	if (res != NULL) {
-#if VERSION_MODE == 0
-            HIT();
-            item_unlock(hv);
-            return res;
-#else
-            HIT();
-            char val[2048];
-            size_t val_len = 2048;
+            COUNT(CACHE_MODE_FULL, get_hits);
+            if (VersionMode == VERSION_MODE_OFF) {
+                item_unlock(hv);
+                return res;
+            }
+
+            item_fill fill = {key, nkey, c, NULL};
             Gptr skey = res->skey;
+            uint64_t sgen = res->sgen;
             TagGptr val_ptr_;
             val_ptr_.gptr_ = res->val_ptr.vptr;
             val_ptr_.tag_ = res->val_ptr.tag;
 
             do_item_remove(res);
             item_unlock(hv);
-#if VERSION_MODE == 1
-            kvs_ret = kvs->Get(skey, val_ptr_, val, val_len);
-#else
-            kvs_ret = kvs->Get(skey, val_ptr_, val, val_len, true); // force reading value from FAM
-#endif
+            // VERSION_MODE_FORCE: force reading value from FAM
+            kvs_ret = kvs_get_short(key, nkey, skey, sgen, val_ptr_, &fill,
+                VersionMode == VERSION_MODE_FORCE);
             item_lock(hv);
             res = do_item_get(key, nkey, hv, c, do_update);
             if (res == NULL) {
+                drop_fill(&fill);
                 goto full_null;
             }
 
             if (kvs_ret == 0 && val_ptr_.gptr_ == 0) {
-                //This case is that the data we found is previously deleted data. 
+                //This case is that the data we found is previously deleted data.
                 //Even though we return NULL now, cache data is kept for following search.
 #if ERROR_TRACE == 1
                 printf("MC_get: gptr is invalid or 0\n");
@@ -143,50 +462,25 @@ item *item_get(const char *key, const size_t nkey, conn *c, const bool do_update
                 do_item_remove(res);
                 res = NULL;
             } else if (kvs_ret == 0) {
-#if VERSION_MODE == 1
                 if (res->val_ptr.tag < val_ptr_.tag_) {
+                    // version mismatch
+                    COUNT(CACHE_MODE_FULL, get_stale);
                     if (c) {
-                        // version mismatch
                         c->thread->stats.decr_misses++;
                     }
-#else
-                if (true) {
-#endif
-                        item *it = res;
-                        if (c != NULL) {
-                            if (res->nbytes != val_len + 2) {
-                                res = item_alloc(key, nkey, 0, realtime(0), val_len + 2);
-                                if (res == NULL) {
-#if ERROR_TRACE	== 1
-                                    printf("MC_get: Allocation error1!\n");
-#endif
-                                    item_unlock(hv);
-                                    return NULL;
-                                }
-                                do_item_replace(it, res, hv);
-                                do_item_remove(it);
-                            }
-                        } else {
-                            if (res->nbytes != val_len) {
-                                res = item_alloc(key, nkey, 0, realtime(0), val_len);
-                                if (res == NULL) {
-#if ERROR_TRACE	== 1
-                                    printf("MC_get: Allocation error1!\n");
-#endif
-                                    item_unlock(hv);
-                                    return NULL;
-                                }
-                                do_item_replace(it, res, hv);
-                                do_item_remove(it);
-                            }
-                        }
-
-                        res->skey = skey;
-                        res->val_ptr.vptr = val_ptr_.gptr_;
-                        res->val_ptr.tag = val_ptr_.tag_;
-                        memcpy(ITEM_data(res), val, val_len);
-                        if (c != NULL)
-                            memcpy((char *)ITEM_data(res) + val_len, "\r\n", 2);
+                }
+                // VERSION_MODE_FORCE refreshes the item with the value just read from FAM
+                if (fill.it != NULL &&
+                    (VersionMode == VERSION_MODE_FORCE || res->val_ptr.tag < val_ptr_.tag_)) {
+                        item *it = fill.it;
+                        fill.it = NULL;
+                        it->skey = skey;
+                        it->sgen = sgen;
+                        it->val_ptr.vptr = val_ptr_.gptr_;
+                        it->val_ptr.tag = val_ptr_.tag_;
+                        do_item_replace(res, it, hv);
+                        do_item_remove(res);
+                        res = it;
                     }
 		} else {
 #if ERROR_TRACE == 1
@@ -196,46 +490,36 @@ item *item_get(const char *key, const size_t nkey, conn *c, const bool do_update
                     do_item_remove(res);
                     res = NULL;
 		}
-#endif
+                drop_fill(&fill);
             } else {
             full_null:
+                COUNT(CACHE_MODE_FULL, get_misses);
                 if (c) {
                     // get misses
-                    c->thread->stats.get_misses++;                        
+                    c->thread->stats.get_misses++;
                 }
-		char val[2048];
-		size_t val_len = 2048;
+		item_fill fill = {key, nkey, c, NULL};
 		Gptr skey;
+		uint64_t sgen;
 		TagGptr val_ptr_;
-		kvs_ret = kvs->Get(key, nkey, val, val_len, skey, val_ptr_);
-		if (kvs_ret == 0) {
-                    if (skey.IsValid() && val_ptr_.IsValid()) {
-                        if (c != NULL)
-                            res = item_alloc(key, nkey, 0, realtime(0), val_len + 2);
-                        else
-                            res = item_alloc(key, nkey, 0, realtime(0), val_len);
-                        if (res == NULL) {
-#if ERROR_TRACE	== 1
-                            printf("MC_get: Allocation error2!\n");
-#endif
-                            item_unlock(hv);
-                            return NULL;
-                        }
-
-                        do_item_link(res, hv);
-                        res->skey = skey;
-                        res->val_ptr.vptr = val_ptr_.gptr_;
-                        res->val_ptr.tag = val_ptr_.tag_;
-                        memcpy(ITEM_data(res), val, val_len);
-                        if (c != NULL)
-                            memcpy((char*)ITEM_data(res) + val_len, "\r\n", 2);
-                    }
+		kvs_ret = kvs_get_uncached(key, nkey, hv, &fill, skey, sgen, val_ptr_);
+		if (kvs_ret == 0 && fill.it != NULL) {
+                    res = fill.it;
+                    do_item_link(res, hv);
+                    res->skey = skey;
+                    res->sgen = sgen;
+                    res->val_ptr.vptr = val_ptr_.gptr_;
+                    res->val_ptr.tag = val_ptr_.tag_;
 		}
             }
-                
+
             item_unlock(hv);
             return res;
-#elif CACHE_MODE == 2
+}
+
+// CACHE_MODE_SHORT
+static item *get_short(const char *key, const size_t nkey, conn *c, const bool do_update)
+{
 	//Find key from mc
 	//Compare version between KVS and mc
 	//If versions are same, return the value
@@ -246,73 +530,49 @@ item *item_get(const char *key, const size_t nkey, conn *c, const bool do_update
 	item_lock(hv);
 	item *res = do_item_get(key, nkey, hv, c, DO_UPDATE);
 	if (res != NULL) {
-		HIT();
-		char val[2048];
-		size_t val_len = 2048;
+		COUNT(CACHE_MODE_SHORT, get_hits);
+		item_fill fill = {key, nkey, c, NULL};
 		Gptr skey = res->skey;
+		uint64_t sgen = res->sgen;
 		TagGptr val_ptr_;
 		val_ptr_.gptr_ = res->val_ptr.vptr;
 		val_ptr_.tag_ = res->val_ptr.tag;
-		
+
 		do_item_remove(res);
 		item_unlock(hv);
-		kvs_ret = kvs->Get(skey, val_ptr_, val, val_len, true);
+		kvs_ret = kvs_get_short(key, nkey, skey, sgen, val_ptr_, &fill, true);
 
 		item_lock(hv);
 		res = do_item_get(key, nkey, hv, c, DO_UPDATE);
 		if (res == NULL) {
+			drop_fill(&fill);
 			goto short_null;
 		}
 
 		if (kvs_ret == 0 && val_ptr_.gptr_ == 0) {
-			//This case is that the data we found is previously deleted data. 
+			//This case is that the data we found is previously deleted data.
 			//Even though we return NULL now, cache data is kept for following search.
 #if ERROR_TRACE == 1
 			printf("MC_get: gptr is invalid or 0\n");
 #endif
+			do_item_remove(res);
 			res = NULL;
 		} else if (kvs_ret == 0) {
-			item *it;
 			if (res->val_ptr.tag <= val_ptr_.tag_) {
-				res->skey = skey;
-				res->val_ptr.vptr = val_ptr_.gptr_;
-				res->val_ptr.tag = val_ptr_.tag_;
-				if (c != NULL)
-					it = item_alloc(ITEM_key(res), res->nkey, 0, realtime(0), val_len + 2);
-				else
-					it = item_alloc(ITEM_key(res), res->nkey, 0, realtime(0), val_len);
-				if (it == NULL) {
-#if ERROR_TRACE	== 1
-					printf("MC_get: Allocation error #2\n");
-#endif
-					item_unlock(hv);
-					return NULL;
-				}
-				memcpy(ITEM_data(it), val, val_len);
-				if (c != NULL)
-					memcpy((char *)ITEM_data(it) + val_len, "\r\n", 2);
+				if (res->val_ptr.tag < val_ptr_.tag_)
+					COUNT(CACHE_MODE_SHORT, get_stale);
 			} else {
-				kvs_ret = kvs->Get(skey, val_ptr_, val, val_len, true);
-				res->skey = skey;
-				res->val_ptr.vptr = val_ptr_.gptr_;
-				res->val_ptr.tag = val_ptr_.tag_;
-				if (c != NULL)
-					it = item_alloc(ITEM_key(res), res->nkey, 0, realtime(0), val_len + 2);
-				else
-					it = item_alloc(ITEM_key(res), res->nkey, 0, realtime(0), val_len);
-				if (it == NULL) {
-#if ERROR_TRACE	== 1
-					printf("MC_get: Allocation error #1\n");
-#endif
-					item_unlock(hv);
-					return NULL;
-				}
-				memcpy(ITEM_data(it), val, val_len);
-				if (c != NULL)
-					memcpy((char *)ITEM_data(it) + val_len, "\r\n", 2);
+				drop_fill(&fill);
+				kvs_ret = kvs_get_short(key, nkey, skey, sgen, val_ptr_, &fill, true);
 			}
+			res->skey = skey;
+			res->sgen = sgen;
+			res->val_ptr.vptr = val_ptr_.gptr_;
+			res->val_ptr.tag = val_ptr_.tag_;
 			do_item_remove(res);
-			res = it;
+			// the value is returned in an item of its own; only the short-cut stays cached
+			res = fill.it;
+			fill.it = NULL;
 		} else {
 #if ERROR_TRACE == 1
 			printf("MC_get: error occurs in only short-cut based search\n");
@@ -321,52 +581,43 @@ item *item_get(const char *key, const size_t nkey, conn *c, const bool do_update
 			do_item_remove(res);
 			res = NULL;
 		}
+		drop_fill(&fill);
 	} else {
 short_null:
-		char val[2048];
-		size_t val_len = 2048;
+		COUNT(CACHE_MODE_SHORT, get_misses);
+		item_fill fill = {key, nkey, c, NULL};
 		Gptr skey;
+		uint64_t sgen;
 		TagGptr val_ptr_;
-		kvs_ret = kvs->Get(key, nkey, val, val_len, skey, val_ptr_);
-		if (kvs_ret == 0) {
-			if (skey.IsValid() && val_ptr_.IsValid()) {
-				res = item_alloc(key, nkey, 0, realtime(0), 2);
-
-				if (res != NULL) {
-					do_item_link(res, hv);
-					res->skey = skey;
-					res->val_ptr.vptr = val_ptr_.gptr_;
-					res->val_ptr.tag = val_ptr_.tag_;
-					memcpy(ITEM_data(res), "\r\n", 2);
-					refcount_decr(res);
-				} else {
-#if ERROR_TRACE	== 1
-					printf("MC_get: Allocation error #3\n");
-#endif
-				}
+		kvs_ret = kvs_get_uncached(key, nkey, hv, &fill, skey, sgen, val_ptr_);
+		if (kvs_ret == 0 && fill.it != NULL) {
+			res = item_alloc(key, nkey, 0, realtime(0), 2);
 
-				item *it;
-				if (c != NULL)
-					it = item_alloc(key, nkey, 0, realtime(0), val_len + 2);
-				else
-					it = item_alloc(key, nkey, 0, realtime(0), val_len);
-				if (it == NULL) {
+			if (res != NULL) {
+				do_item_link(res, hv);
+				res->skey = skey;
+				res->sgen = sgen;
+				res->val_ptr.vptr = val_ptr_.gptr_;
+				res->val_ptr.tag = val_ptr_.tag_;
+				memcpy(ITEM_data(res), "\r\n", 2);
+				refcount_decr(res);
+			} else {
 #if ERROR_TRACE	== 1
-					printf("MC_get: Allocation error #4\n");
+				printf("MC_get: Allocation error #3\n");
 #endif
-					item_unlock(hv);
-					return NULL;
-				}
-				memcpy(ITEM_data(it), val, val_len);
-				if (c != NULL)
-					memcpy((char *)ITEM_data(it) + val_len, "\r\n", 2);
-				res = it;
 			}
+
+			res = fill.it;
 		}
 	}
 	item_unlock(hv);
 	return res;
-#elif CACHE_MODE == 3
+}
+
+// CACHE_MODE_HYBRID
+template <int VersionMode>
+static item *get_hybrid(const char *key, const size_t nkey, conn *c, const bool do_update)
+{
 	//Find key from mc
 	//Compare version between KVS and mc
 	//If versions are same, return the value
@@ -378,53 +629,49 @@ short_null:
 	item *res = do_item_get(key, nkey, hv, c, do_update);
 	if (res != NULL) {
 		if (res->nbytes != 2) {
-#if VERSION_MODE == 0
-			HIT();
-			item_unlock(hv);
-			return res;
-#else
-			HIT();
-			char val[2048];
-			size_t val_len = 2048;
+			COUNT(CACHE_MODE_HYBRID, get_hits);
+			if (VersionMode == VERSION_MODE_OFF) {
+				item_unlock(hv);
+				return res;
+			}
+
+			item_fill fill = {key, nkey, c, NULL};
 			Gptr skey = res->skey;
+			uint64_t sgen = res->sgen;
 			TagGptr val_ptr_;
 			val_ptr_.gptr_ = res->val_ptr.vptr;
 			val_ptr_.tag_ = res->val_ptr.tag;
 
 			do_item_remove(res);
 			item_unlock(hv);
-			kvs_ret = kvs->Get(skey, val_ptr_, val, val_len);
+			kvs_ret = kvs_get_short(key, nkey, skey, sgen, val_ptr_, &fill);
 
 			item_lock(hv);
 			res = do_item_get(key, nkey, hv, c, do_update);
 			if (res == NULL) {
+				drop_fill(&fill);
 				goto hybrid_null;
 			} else if (res->nbytes == 2) {
 				item *it;
 				if (res->val_ptr.tag >= val_ptr_.tag_) {
-					val_len = 2048;
-					kvs_ret = kvs->Get(skey, val_ptr_, val, val_len, true);
+					drop_fill(&fill);
+					kvs_ret = kvs_get_short(key, nkey, skey, sgen, val_ptr_, &fill, true);
 				}
 
-				if (c != NULL)
-					it = item_alloc(ITEM_key(res), res->nkey, 0, realtime(0), val_len + 2);
-				else
-					it = item_alloc(ITEM_key(res), res->nkey, 0, realtime(0), val_len);
-
+				it = fill.it;
 				if (it == NULL) {
 #if ERROR_TRACE	== 1
 					printf("MC_get: Allocation error #2\n");
 #endif
+					do_item_remove(res);
 					item_unlock(hv);
 					return NULL;
 				}
 
 				it->skey = skey;
+				it->sgen = sgen;
 				it->val_ptr.vptr = val_ptr_.gptr_;
 				it->val_ptr.tag = val_ptr_.tag_;
-				memcpy(ITEM_data(it), val, val_len);
-				if (c != NULL)
-					memcpy((char *)ITEM_data(it) + val_len, "\r\n", 2);
 
 				do_item_replace(res, it, hv);
 				do_item_remove(res);
@@ -434,7 +681,7 @@ short_null:
 			}
 
 			if (kvs_ret == 0 && val_ptr_.gptr_ == 0) {
-				//This case is that the data we found is previously deleted data. 
+				//This case is that the data we found is previously deleted data.
 				//Even though we return NULL now, cache data is kept for following search.
 #if ERROR_TRACE == 1
 				printf("MC_get: gptr is invalid or 0\n");
@@ -442,40 +689,17 @@ short_null:
 				do_item_remove(res);
 				res = NULL;
 			} else if (kvs_ret == 0) {
-				if (res->val_ptr.tag < val_ptr_.tag_) {
-					item *it = res;
-					if (c != NULL) {
-						if (res->nbytes != val_len + 2) {
-							res = item_alloc(key, nkey, 0, realtime(0), val_len + 2);
-							if (res == NULL) {
-#if ERROR_TRACE	== 1
-								printf("MC_get: Allocation error1!\n");
-#endif
-								item_unlock(hv);
-								return NULL;
-							}
-						}
-					} else {
-						if (res->nbytes != val_len) {
-							res = item_alloc(key, nkey, 0, realtime(0), val_len);
-							if (res == NULL) {
-#if ERROR_TRACE	== 1
-								printf("MC_get: Allocation error1!\n");
-#endif
-								item_unlock(hv);
-								return NULL;
-							}
-						}
-					}
-					do_item_replace(it, res, hv);
-					do_item_remove(it);
-
-					res->skey = skey;
-					res->val_ptr.vptr = val_ptr_.gptr_;
-					res->val_ptr.tag = val_ptr_.tag_;
-					memcpy(ITEM_data(res), val, val_len);
-					if (c != NULL)
-						memcpy((char *)ITEM_data(res) + val_len, "\r\n", 2);
+				if (res->val_ptr.tag < val_ptr_.tag_ && fill.it != NULL) {
+					COUNT(CACHE_MODE_HYBRID, get_stale);
+					item *it = fill.it;
+					fill.it = NULL;
+					it->skey = skey;
+					it->sgen = sgen;
+					it->val_ptr.vptr = val_ptr_.gptr_;
+					it->val_ptr.tag = val_ptr_.tag_;
+					do_item_replace(res, it, hv);
+					do_item_remove(res);
+					res = it;
 				}
 			} else {
 #if ERROR_TRACE == 1
@@ -485,98 +709,74 @@ short_null:
 				do_item_remove(res);
 				res = NULL;
 			}
-#endif
+			drop_fill(&fill);
 		} else {
-			HIT();
-			char val[2048];
-			size_t val_len = 2048;
+			COUNT(CACHE_MODE_HYBRID, get_hits);
+			item_fill fill = {key, nkey, c, NULL};
 			Gptr skey = res->skey;
+			uint64_t sgen = res->sgen;
 			TagGptr val_ptr_;
 			val_ptr_.gptr_ = res->val_ptr.vptr;
 			val_ptr_.tag_ = res->val_ptr.tag;
 
 			do_item_remove(res);
 			item_unlock(hv);
-			kvs_ret = kvs->Get(skey, val_ptr_, val, val_len, true);
+			kvs_ret = kvs_get_short(key, nkey, skey, sgen, val_ptr_, &fill, true);
 
 			item_lock(hv);
 			res = do_item_get(key, nkey, hv, c, DO_UPDATE);
 			if (res == NULL) {
+				drop_fill(&fill);
 				goto hybrid_null;
 			} else if (res->nbytes != 2) {
-				if (res->val_ptr.tag < val_ptr_.tag_) {
-					item *it = res;
-					if (c != NULL) {
-						if (res->nbytes != val_len + 2) {
-							res = item_alloc(key, nkey, 0, realtime(0), val_len + 2);
-							if (res == NULL) {
-#if ERROR_TRACE	== 1
-								printf("MC_get: Allocation error1!\n");
-#endif
-								item_unlock(hv);
-								return NULL;
-							}
-							do_item_replace(it, res, hv);
-							do_item_remove(it);
-						}
-					} else {
-						if (res->nbytes != val_len) {
-							res = item_alloc(key, nkey, 0, realtime(0), val_len);
-							if (res == NULL) {
-#if ERROR_TRACE	== 1
-								printf("MC_get: Allocation error1!\n");
-#endif
-								item_unlock(hv);
-								return NULL;
-							}
-							do_item_replace(it, res, hv);
-							do_item_remove(it);
-						}
-					}
-
-					res->skey = skey;
-					res->val_ptr.vptr = val_ptr_.gptr_;
-					res->val_ptr.tag = val_ptr_.tag_;
-					memcpy(ITEM_data(res), val, val_len);
-					if (c != NULL)
-						memcpy((char *)ITEM_data(res) + val_len, "\r\n", 2);
+				if (res->val_ptr.tag < val_ptr_.tag_ && fill.it != NULL) {
+					COUNT(CACHE_MODE_HYBRID, get_stale);
+					item *it = fill.it;
+					fill.it = NULL;
+					it->skey = skey;
+					it->sgen = sgen;
+					it->val_ptr.vptr = val_ptr_.gptr_;
+					it->val_ptr.tag = val_ptr_.tag_;
+					do_item_replace(res, it, hv);
+					do_item_remove(res);
+					res = it;
 				}
+				drop_fill(&fill);
 				item_unlock(hv);
 				return res;
 			}
 
 			if (kvs_ret == 0 && val_ptr_.gptr_ == 0) {
-				//This case is that the data we found is previously deleted data. 
+				//This case is that the data we found is previously deleted data.
 				//Even though we return NULL now, cache data is kept for following search.
 #if ERROR_TRACE == 1
 				printf("MC_get: gptr is invalid or 0\n");
 #endif
+				do_item_remove(res);
 				res = NULL;
 			} else if (kvs_ret == 0) {
 				item *it;
 				if (res->val_ptr.tag > val_ptr_.tag_) {
-					val_len = 2048;
-					kvs_ret = kvs->Get(skey, val_ptr_, val, val_len, true);
+					drop_fill(&fill);
+					kvs_ret = kvs_get_short(key, nkey, skey, sgen, val_ptr_, &fill, true);
 				}
 
-				if (c != NULL)
-					it = item_alloc(ITEM_key(res), res->nkey, 0, realtime(0), val_len + 2);
-				else
-					it = item_alloc(ITEM_key(res), res->nkey, 0, realtime(0), val_len);
+				it = fill.it;
+				fill.it = NULL;
 				if (it == NULL) {
 #if ERROR_TRACE	== 1
 					printf("MC_get: Allocation error #2\n");
 #endif
+					do_item_remove(res);
 					item_unlock(hv);
 					return NULL;
 				}
 
+				// promote the short-cut to a full item
 				it->skey = skey;
+				it->sgen = sgen;
 				it->val_ptr.vptr = val_ptr_.gptr_;
 				it->val_ptr.tag = val_ptr_.tag_;
-				memcpy(ITEM_data(it), val, val_len);
-				if (c != NULL)
-					memcpy((char *)ITEM_data(it) + val_len, "\r\n", 2);
 
 				do_item_replace(res, it, hv);
 				do_item_remove(res);
@@ -589,183 +789,214 @@ short_null:
 				do_item_remove(res);
 				res = NULL;
 			}
+			drop_fill(&fill);
 		}
 	} else {
 hybrid_null:
-		char val[2048];
-		size_t val_len = 2048;
+		COUNT(CACHE_MODE_HYBRID, get_misses);
+		item_fill fill = {key, nkey, c, NULL};
 		Gptr skey;
+		uint64_t sgen;
 		TagGptr val_ptr_;
-		kvs_ret = kvs->Get(key, nkey, val, val_len, skey, val_ptr_);
-		if (kvs_ret == 0) {
-			if (skey.IsValid() && val_ptr_.IsValid()) {
-				if (c != NULL)
-					res = item_alloc(key, nkey, 0, realtime(0), val_len + 2);
-				else
-					res = item_alloc(key, nkey, 0, realtime(0), val_len);
-				if (res == NULL) {
-#if ERROR_TRACE	== 1
-					printf("MC_get: Allocation error2!\n");
-#endif
-					item_unlock(hv);
-					return NULL;
-				}
-
-				do_item_link(res, hv);
-				res->skey = skey;
-				res->val_ptr.vptr = val_ptr_.gptr_;
-				res->val_ptr.tag = val_ptr_.tag_;
-				memcpy(ITEM_data(res), val, val_len);
-				if (c != NULL)
-					memcpy((char*)ITEM_data(res) + val_len, "\r\n", 2);
-			}
+		kvs_ret = kvs_get_uncached(key, nkey, hv, &fill, skey, sgen, val_ptr_);
+		if (kvs_ret == 0 && fill.it != NULL) {
+			res = fill.it;
+			do_item_link(res, hv);
+			res->skey = skey;
+			res->sgen = sgen;
+			res->val_ptr.vptr = val_ptr_.gptr_;
+			res->val_ptr.tag = val_ptr_.tag_;
 		}
 	}
 	item_unlock(hv);
 	return res;
-#endif
 }
 
-enum store_item_type store_item(item *it, int comm, conn* c)
+// nothing to read into: is_latest only wants the value pointer
+static char *no_value(size_t val_len)
+{
+	return NULL;
+}
+
+// With the stripe lock held: has no write or delete of the key come after the one that returned
+// val_ptr? Only needed when there is no cached item to compare versions with, as a delete unlinks
+// the item. This reads the value pointer from FAM, which is much cheaper than the write itself.
+static bool is_latest(Gptr skey, uint64_t sgen, TagGptr val_ptr)
+{
+	TagGptr cur_val_ptr = val_ptr;
+	// -1 if there is a newer value (or an error), -3 if compaction has run since
+	if (kvs->Get(skey, cur_val_ptr, no_value, false, sgen) != 0)
+		return false;
+	return cur_val_ptr == val_ptr;
+}
+
+// The FAM write runs without the stripe lock, so that writers of keys in the same stripe do not
+// wait for each other's writes. Writes to the same key may then finish in any order; the version
+// (tag) returned by the KVS decides which one the cache keeps.
+
+// CACHE_MODE_MEMCACHED_KVS
+static enum store_item_type store_memcached_kvs(item *it, int comm, conn* c)
 {
-#if CACHE_MODE == 0
 	//put to kvs first
 	//put to cache second
-    uint32_t hv;
-    hv = hash(ITEM_key(it), it->nkey);
-    item_lock(hv);
+	uint32_t hv;
+	hv = hash(ITEM_key(it), it->nkey);
 	int kvs_ret;
+	Gptr skey = 0;
+	uint64_t sgen = kvs->KeyGen();
+	TagGptr val_ptr_;
 	if (c != NULL)
-		kvs_ret = kvs->Put(ITEM_key(it), it->nkey, ITEM_data(it), it->nbytes - 2);
+		kvs_ret = kvs->Put(ITEM_key(it), it->nkey, ITEM_data(it), it->nbytes - 2, skey, val_ptr_);
 	else
-		kvs_ret = kvs->Put(ITEM_key(it), it->nkey, ITEM_data(it), it->nbytes);
+		kvs_ret = kvs->Put(ITEM_key(it), it->nkey, ITEM_data(it), it->nbytes, skey, val_ptr_);
 
 	if (kvs_ret == 0) {
-		do_store_item(it, comm, c, hv);
+		it->skey = skey;
+		it->sgen = sgen;
+		it->val_ptr.vptr = val_ptr_.gptr_;
+		it->val_ptr.tag = val_ptr_.tag_;
+
+		item_lock(hv);
+		item *res = do_item_get(ITEM_key(it), it->nkey, hv, c, DONT_UPDATE);
+		if (res != NULL) {
+			COUNT(CACHE_MODE_MEMCACHED_KVS, put_hits);
+			// keep a newer value
+			if (res->val_ptr.tag < val_ptr_.tag_)
+				do_store_item(it, comm, c, hv);
+			do_item_remove(res);
+		} else {
+			COUNT(CACHE_MODE_MEMCACHED_KVS, put_misses);
+			if (is_latest(skey, sgen, val_ptr_))
+				do_store_item(it, comm, c, hv);
+		}
 		item_unlock(hv);
 		return STORED;
 	} else {
 #if ERROR_TRACE == 1
 		printf("KVS_Put: Put Failed\n");
 #endif
-		item_unlock(hv);
 		return NOT_STORED;
 	}
-#elif CACHE_MODE == 4
+}
+
+// CACHE_MODE_KVS_ONLY
+static enum store_item_type store_kvs_only(item *it, int comm, conn* c)
+{
 	//put to kvs first
 	int kvs_ret;
-        kvs_ret = kvs->Put(ITEM_key(it), it->nkey, ITEM_data(it), it->nbytes - 2);
+	COUNT(CACHE_MODE_KVS_ONLY, put_misses);
+	if (c != NULL)
+		kvs_ret = kvs->Put(ITEM_key(it), it->nkey, ITEM_data(it), it->nbytes - 2);
+	else
+		kvs_ret = kvs->Put(ITEM_key(it), it->nkey, ITEM_data(it), it->nbytes);
 	if (kvs_ret == 0) {
             return STORED;
 	} else {
 #if ERROR_TRACE == 1
             printf("KVS_Put: Put Failed\n");
 #endif
-            return NOT_STORED;
-	}
-#elif CACHE_MODE == 5
-        return store_item_internal(it, comm, c);
-#elif ((CACHE_MODE == 1) || (CACHE_MODE==3))
-	int kvs_ret;
-	uint32_t hv;
-	hv = hash(ITEM_key(it), it->nkey);
-	item_lock(hv);
-	item *res = do_item_get(ITEM_key(it), it->nkey, hv, c, DONT_UPDATE);
-	if (res != NULL) {
-		HIT();
-		Gptr old_skey = res->skey;
-		TagGptr old_val_ptr;
-		old_val_ptr.gptr_ = res->val_ptr.vptr;
-		old_val_ptr.tag_ = res->val_ptr.tag;
-
-		if (c != NULL)
-			kvs_ret = kvs->Put(old_skey, old_val_ptr, ITEM_data(it), it->nbytes - 2);
-		else
-			kvs_ret = kvs->Put(old_skey, old_val_ptr, ITEM_data(it), it->nbytes);
-		if (kvs_ret == 0) {
-			if (!(old_skey.IsValid()) || !(old_val_ptr.IsValid())) {
-#if ERROR_TRACE == 1
-				printf("Put error: case 1\n");
-#endif
-				refcount_decr(res);
-				item_unlock(hv);
-				return NOT_STORED;
-			}
-
-			if (res->val_ptr.tag != old_val_ptr.tag_ || res->val_ptr.vptr != old_val_ptr.gptr_) {
-				do_item_replace(res, it, hv);
-				do_item_remove(res);
-				it->skey = old_skey;
-				it->val_ptr.vptr = old_val_ptr.gptr_;
-				it->val_ptr.tag = old_val_ptr.tag_;
-			}
-			item_unlock(hv);
-			return STORED;
-		} else {
-#if ERROR_TRACE == 1
-			printf("Put error: case 2\n");
-#endif
-			refcount_decr(res);
-			item_unlock(hv);
-			return NOT_STORED;
-		}
+            return NOT_STORED;
 	}
-        else {
-            if (c) {
-                // put misses
-                c->thread->stats.cas_misses++;                        
-            }            
-        }
+}
+
+// CACHE_MODE_CACHE_ONLY
+static enum store_item_type store_cache_only(item *it, int comm, conn* c)
+{
+        COUNT(CACHE_MODE_CACHE_ONLY, put_misses);
+        return store_item_internal(it, comm, c);
+}
+
+// CACHE_MODE_FULL and CACHE_MODE_HYBRID
+template <int CacheMode>
+static enum store_item_type store_full(item *it, int comm, conn* c)
+{
+	int kvs_ret;
+	uint32_t hv;
+	hv = hash(ITEM_key(it), it->nkey);
 
+	// take the short-cut of a cached item, if any
 	Gptr skey = 0;
+	uint64_t sgen = 0;
 	TagGptr val_ptr_;
-	val_ptr_.gptr_ = 0;
-	val_ptr_.tag_ = 0;
+	item_lock(hv);
+	item *res = do_item_get(ITEM_key(it), it->nkey, hv, c, DONT_UPDATE);
+	if (res != NULL) {
+		COUNT(CacheMode, put_hits);
+		skey = res->skey;
+		sgen = res->sgen;
+		val_ptr_.gptr_ = res->val_ptr.vptr;
+		val_ptr_.tag_ = res->val_ptr.tag;
+		do_item_remove(res);
+	}
+	else {
+		COUNT(CacheMode, put_misses);
+		if (c) {
+			// put misses
+			c->thread->stats.cas_misses++;
+		}
+	}
+	item_unlock(hv);
 
 	if (c != NULL)
-		kvs_ret = kvs->Put(ITEM_key(it), it->nkey, ITEM_data(it), it->nbytes - 2, skey, val_ptr_);
+		kvs_ret = kvs_put_short(ITEM_key(it), it->nkey, skey, sgen, val_ptr_, ITEM_data(it),
+			it->nbytes - 2);
 	else
-		kvs_ret = kvs->Put(ITEM_key(it), it->nkey, ITEM_data(it), it->nbytes, skey, val_ptr_);
-	if (kvs_ret == 0) {
-		if (!(skey.IsValid()) || !(val_ptr_.IsValid())) {
+		kvs_ret = kvs_put_short(ITEM_key(it), it->nkey, skey, sgen, val_ptr_, ITEM_data(it),
+			it->nbytes);
+	if (kvs_ret != 0) {
 #if ERROR_TRACE == 1
-			printf("Put error: case 3\n");
+		printf("Put error: case 2\n");
 #endif
-			item_unlock(hv);
-			return NOT_STORED;
-		}
-
-		it->skey = skey;
-		it->val_ptr.tag = val_ptr_.tag_;
-		it->val_ptr.vptr = val_ptr_.gptr_;
-
-		do_item_link(it, hv);
-		item_unlock(hv);
-		return STORED;
-	} else {
+		return NOT_STORED;
+	}
+	if (!(skey.IsValid()) || !(val_ptr_.IsValid())) {
 #if ERROR_TRACE == 1
-		printf("Put error: case 4\n");
+		printf("Put error: case 1\n");
 #endif
-		item_unlock(hv);
 		return NOT_STORED;
 	}
-#elif CACHE_MODE == 2
+
+	it->skey = skey;
+	it->sgen = sgen;
+	it->val_ptr.vptr = val_ptr_.gptr_;
+	it->val_ptr.tag = val_ptr_.tag_;
+
+	// (re-)link the item, unless a newer write or a delete got to the cache first
+	item_lock(hv);
+	res = do_item_get(ITEM_key(it), it->nkey, hv, c, DONT_UPDATE);
+	if (res != NULL) {
+		if (res->val_ptr.tag < val_ptr_.tag_)
+			do_item_replace(res, it, hv);
+		do_item_remove(res);
+	} else if (is_latest(skey, sgen, val_ptr_)) {
+		do_item_link(it, hv);
+	}
+	item_unlock(hv);
+	return STORED;
+}
+
+// CACHE_MODE_SHORT
+static enum store_item_type store_short(item *it, int comm, conn* c)
+{
 	int kvs_ret;
 	uint32_t hv;
 	hv = hash(ITEM_key(it), it->nkey);
 	item_lock(hv);
 	item *res = do_item_get(ITEM_key(it), it->nkey, hv, c, DONT_UPDATE);
 	if (res != NULL) {
-		HIT();
+		COUNT(CACHE_MODE_SHORT, put_hits);
 		Gptr old_skey = res->skey;
+		uint64_t old_sgen = res->sgen;
 		TagGptr old_val_ptr;
 		old_val_ptr.gptr_ = res->val_ptr.vptr;
 		old_val_ptr.tag_ = res->val_ptr.tag;
 
 		if (c != NULL)
-			kvs_ret = kvs->Put(old_skey, old_val_ptr, ITEM_data(it), it->nbytes - 2);
+			kvs_ret = kvs_put_short(ITEM_key(it), it->nkey, old_skey, old_sgen, old_val_ptr,
+				ITEM_data(it), it->nbytes - 2);
 		else
-			kvs_ret = kvs->Put(old_skey, old_val_ptr, ITEM_data(it), it->nbytes);
+			kvs_ret = kvs_put_short(ITEM_key(it), it->nkey, old_skey, old_sgen, old_val_ptr,
+				ITEM_data(it), it->nbytes);
 
 		if (kvs_ret == 0) {
 			if (!(old_skey.IsValid()) || !(old_val_ptr.IsValid())) {
@@ -779,6 +1010,7 @@ enum store_item_type store_item(item *it, int comm, conn* c)
 
 			if (res->val_ptr.tag != old_val_ptr.tag_ || res->val_ptr.vptr != old_val_ptr.gptr_) {
 				res->skey = old_skey;
+				res->sgen = old_sgen;
 				res->val_ptr.vptr = old_val_ptr.gptr_;
 				res->val_ptr.tag = old_val_ptr.tag_;
 			}
@@ -794,8 +1026,10 @@ enum store_item_type store_item(item *it, int comm, conn* c)
 			return NOT_STORED;
 		}
 	}
+	COUNT(CACHE_MODE_SHORT, put_misses);
 
 	Gptr skey = 0;
+	uint64_t sgen = kvs->KeyGen();
 	TagGptr val_ptr_;
 	val_ptr_.gptr_ = 0;
 	val_ptr_.tag_ = 0;
@@ -819,6 +1053,7 @@ enum store_item_type store_item(item *it, int comm, conn* c)
 			memcpy(ITEM_data(res), "\r\n", 2);
 
 			res->skey = skey;
+			res->sgen = sgen;
 			res->val_ptr.tag = val_ptr_.tag_;
 			res->val_ptr.vptr = val_ptr_.gptr_;
 
@@ -834,63 +1069,407 @@ enum store_item_type store_item(item *it, int comm, conn* c)
 #endif
 		return NOT_STORED;
 	}
-#endif
 }
 
-void item_remove(item *item) 
+/*
+   Write-back mode (settings.write_back_age > 0)
+
+   A write only goes to the cache: the linked item is marked ITEM_DIRTY, and the flusher thread
+   writes it to the KVS once its key has been dirty for write_back_age seconds, or right away while
+   more than write_back_bytes are dirty. Writes to a dirty key fold into the one pending write, as
+   the new item takes over the dirty state (and the short-cut and version) of the item it replaces.
+   An item never leaves the cache dirty: it is written back (item_write_back()) before it is
+   evicted, expired or flushed, with its item lock held but no LRU lock (see lru_pull_tail()); a
+   delete drops the pending write.
+
+   All writes of a key to the KVS happen under its item lock, so they reach the KVS in order. Only
+   for policies that keep whole values and trust them without a version check (store_back).
+*/
+struct dirty_key {
+	std::string key;
+	uint32_t hv;
+	time_t time;	// when the key became dirty
+};
+
+// every key with a dirty item is queued once, oldest first; taken under the item lock of the key
+// a delete leaves its key queued, so dirty_queued keeps a rewrite of the key from queueing it again
+static std::deque<dirty_key> dirty_keys;
+static std::unordered_set<std::string> dirty_queued;
+static std::atomic<uint64_t> dirty_bytes;
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dirty_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher_tid;
+static bool flusher_started;
+static bool flusher_stop;
+static bool write_back;
+
+#define WRITE_BACK_BATCH 256
+
+// "\r\n" after the value of items from a connection, none in local mode
+static size_t value_suffix = 2;
+
+static void dirty_set(item *it)
+{
+	it->it_flags |= ITEM_DIRTY;
+	dirty_bytes.fetch_add(ITEM_ntotal(it), std::memory_order_relaxed);
+}
+
+static void dirty_clear(item *it)
+{
+	it->it_flags &= ~ITEM_DIRTY;
+	dirty_bytes.fetch_sub(ITEM_ntotal(it), std::memory_order_relaxed);
+}
+
+static void dirty_enqueue(const char *key, const size_t nkey, uint32_t hv)
+{
+	pthread_mutex_lock(&dirty_lock);
+	if (dirty_queued.insert(std::string(key, nkey)).second)
+		dirty_keys.push_back({std::string(key, nkey), hv, time(NULL)});
+	if (dirty_bytes.load(std::memory_order_relaxed) > settings.write_back_bytes)
+		pthread_cond_signal(&dirty_cond);
+	pthread_mutex_unlock(&dirty_lock);
+}
+
+// With the item lock held: writes a dirty item to the KVS, and keeps the short-cut and version the
+// write returns for the next one
+void item_write_back(item *it, const uint32_t hv)
 {
-#if CACHE_MODE == 4
-    do_item_remove(item);
-#else
-    item_remove_internal(item);
+	dirty_clear(it);
+	COUNT(settings.cache_mode, write_backs);
+	Gptr skey = it->skey;
+	uint64_t sgen = it->sgen;
+	TagGptr val_ptr_;
+	val_ptr_.gptr_ = it->val_ptr.vptr;
+	val_ptr_.tag_ = it->val_ptr.tag;
+	int kvs_ret = kvs_put_short(ITEM_key(it), it->nkey, skey, sgen, val_ptr_, ITEM_data(it),
+		it->nbytes - value_suffix);
+	if (kvs_ret != 0 || !skey.IsValid() || !val_ptr_.IsValid()) {
+#if ERROR_TRACE == 1
+		printf("Write-back error\n");
 #endif
+		return;
+	}
+	it->skey = skey;
+	it->sgen = sgen;
+	it->val_ptr.vptr = val_ptr_.gptr_;
+	it->val_ptr.tag = val_ptr_.tag_;
+}
+
+static void *write_back_flusher(void *arg)
+{
+	std::vector<dirty_key> batch;
+	batch.reserve(WRITE_BACK_BATCH);
+	pthread_mutex_lock(&dirty_lock);
+	for (;;) {
+		// on stop, everything goes
+		bool all = flusher_stop ||
+			dirty_bytes.load(std::memory_order_relaxed) > settings.write_back_bytes;
+		time_t due = time(NULL) - settings.write_back_age;
+		while (!dirty_keys.empty() && batch.size() < WRITE_BACK_BATCH &&
+		       (all || dirty_keys.front().time <= due)) {
+			dirty_queued.erase(dirty_keys.front().key);
+			batch.push_back(std::move(dirty_keys.front()));
+			dirty_keys.pop_front();
+		}
+		if (batch.empty()) {
+			if (flusher_stop)
+				break;
+			struct timespec ts;
+			ts.tv_sec = dirty_keys.empty() ? time(NULL) + settings.write_back_age
+				: dirty_keys.front().time + settings.write_back_age;
+			ts.tv_nsec = 0;
+			pthread_cond_timedwait(&dirty_cond, &dirty_lock, &ts);
+			continue;
+		}
+		pthread_mutex_unlock(&dirty_lock);
+
+		for (dirty_key &d : batch) {
+			item_lock(d.hv);
+			item *it = do_item_get(d.key.data(), d.key.size(), d.hv, NULL, DONT_UPDATE);
+			if (it != NULL) {
+				// unless a delete dropped the write
+				if (it->it_flags & ITEM_DIRTY)
+					item_write_back(it, d.hv);
+				do_item_remove(it);
+			}
+			item_unlock(d.hv);
+		}
+		batch.clear();
+		pthread_mutex_lock(&dirty_lock);
+	}
+	pthread_mutex_unlock(&dirty_lock);
+	return NULL;
+}
+
+static void write_back_final()
+{
+	if (!flusher_started)
+		return;
+	write_back = false;
+	pthread_mutex_lock(&dirty_lock);
+	flusher_stop = true;
+	pthread_cond_signal(&dirty_cond);
+	pthread_mutex_unlock(&dirty_lock);
+	pthread_join(flusher_tid, NULL);
+	flusher_started = false;
+}
+
+static void write_back_init()
+{
+	if (settings.write_back_age <= 0 || settings.cache_mode == CACHE_MODE_KVS_ONLY)
+		return;
+	flusher_stop = false;
+	if (pthread_create(&flusher_tid, NULL, write_back_flusher, NULL) != 0) {
+		fprintf(stderr, "Can't create the write-back flusher thread\n");
+		exit(EXIT_FAILURE);
+	}
+	flusher_started = true;
+	write_back = true;
+	// the server exits from its signal handler
+	atexit(write_back_final);
+}
+
+// Write-back mode: CACHE_MODE_MEMCACHED_KVS, and CACHE_MODE_FULL and CACHE_MODE_HYBRID without
+// version checks
+static enum store_item_type store_back(item *it, int comm, conn* c)
+{
+	uint32_t hv;
+	hv = hash(ITEM_key(it), it->nkey);
+	bool was_dirty = false;
+	item_lock(hv);
+	item *old = do_item_get(ITEM_key(it), it->nkey, hv, c, DONT_UPDATE);
+	if (old != NULL) {
+		COUNT(settings.cache_mode, put_hits);
+		it->skey = old->skey;
+		it->sgen = old->sgen;
+		it->val_ptr = old->val_ptr;
+		// the pending write of old becomes that of it
+		was_dirty = (old->it_flags & ITEM_DIRTY) != 0;
+		if (was_dirty)
+			dirty_clear(old);
+	} else {
+		COUNT(settings.cache_mode, put_misses);
+		it->skey = 0;
+		it->sgen = 0;
+		it->val_ptr.vptr = 0;
+		it->val_ptr.tag = 0;
+	}
+
+	enum store_item_type ret = do_store_item(it, comm, c, hv);
+	if (ret == STORED) {
+		COUNT(settings.cache_mode, put_back);
+		// it, or the new item of an append or prepend
+		item *cur = do_item_get(ITEM_key(it), it->nkey, hv, c, DONT_UPDATE);
+		if (cur != NULL) {
+			if (cur != it) {
+				cur->skey = it->skey;
+				cur->sgen = it->sgen;
+				cur->val_ptr = it->val_ptr;
+			}
+			dirty_set(cur);
+			do_item_remove(cur);
+		}
+		if (!was_dirty)
+			dirty_enqueue(ITEM_key(it), it->nkey, hv);
+	} else if (was_dirty) {
+		dirty_set(old);
+	}
+	if (old != NULL)
+		do_item_remove(old);
+	item_unlock(hv);
+	return ret;
 }
 
-void item_unlink(item *item) 
+// CACHE_MODE_MEMCACHED_KVS
+static void unlink_memcached_kvs(item *item)
 {
-#if CACHE_MODE == 0
     uint32_t hv;
     hv = hash(ITEM_key(item), item->nkey);
     item_lock(hv);
+    // a delete drops the pending write
+    if (item->it_flags & ITEM_DIRTY)
+        dirty_clear(item);
     do_item_unlink(item, hv);
     kvs->Del(ITEM_key(item), item->nkey);
     item_unlock(hv);
-#elif CACHE_MODE == 4
+}
+
+// CACHE_MODE_KVS_ONLY
+static void unlink_kvs_only(item *item)
+{
     kvs->Del(ITEM_key(item), item->nkey);
-#elif CACHE_MODE == 5
-    item_unlink_internal(item);
-#else
+}
+
+// CACHE_MODE_FULL, CACHE_MODE_SHORT and CACHE_MODE_HYBRID
+static void unlink_short_cut(item *item)
+{
     uint32_t hv;
     hv = hash(ITEM_key(item), item->nkey);
     item_lock(hv);
+    // a delete drops the pending write
+    if (item->it_flags & ITEM_DIRTY)
+        dirty_clear(item);
     do_item_unlink(item, hv);
-    Gptr skey = item->skey;
     TagGptr val_ptr_;
     val_ptr_.gptr_ = item->val_ptr.vptr;
     val_ptr_.tag_ = item->val_ptr.tag;
-    kvs->Del(skey, val_ptr_);
+    // a key that was never written back has no short-cut yet
+    kvs_del_short(ITEM_key(item), item->nkey, item->skey, item->sgen, val_ptr_);
     item_unlock(hv);
-#endif
+}
+
+static int unlink_kvs(const char *key, const size_t nkey)
+{
+	return kvs->Del(key, nkey);
+}
+
+// CACHE_MODE_CACHE_ONLY: there is no KVS to delete from
+static int unlink_kvs_none(const char *key, const size_t nkey)
+{
+	return -1;
+}
+
+// Local Mode
+static int put_cache(char const *key, size_t const key_len, char const *val, size_t const val_len);
+static int get_cache(char const *key, size_t const key_len, char *val, size_t &val_len);
+static int del_cache(char const *key, size_t const key_len);
+static int put_kvs(char const *key, size_t const key_len, char const *val, size_t const val_len);
+static int get_kvs(char const *key, size_t const key_len, char *val, size_t &val_len);
+static int del_kvs(char const *key, size_t const key_len);
+
+struct cache_policy {
+	item *(*get)(const char *key, const size_t nkey, conn *c, const bool do_update);
+	enum store_item_type (*store)(item *it, int comm, conn *c);
+	enum store_item_type (*store_back)(item *it, int comm, conn *c);	// NULL: no write-back
+	void (*remove)(item *it);
+	void (*unlink)(item *it);
+	int (*unlink_kvs)(const char *key, const size_t nkey);
+
+	// Local Mode
+	int (*put)(char const *key, size_t const key_len, char const *val, size_t const val_len);
+	int (*get_local)(char const *key, size_t const key_len, char *val, size_t &val_len);
+	int (*del)(char const *key, size_t const key_len);
+};
+
+#define MEMCACHED_KVS_POLICY \
+	{get_memcached_kvs, store_memcached_kvs, store_back, item_remove_internal, unlink_memcached_kvs, \
+	 unlink_kvs, put_cache, get_cache, del_cache}
+#define FULL_POLICY(version_mode) \
+	{get_full<version_mode>, store_full<CACHE_MODE_FULL>, \
+	 version_mode == VERSION_MODE_OFF ? store_back : NULL, item_remove_internal, unlink_short_cut, \
+	 unlink_kvs, put_cache, get_cache, del_cache}
+#define SHORT_POLICY \
+	{get_short, store_short, NULL, item_remove_internal, unlink_short_cut, \
+	 unlink_kvs, put_cache, get_cache, del_cache}
+#define HYBRID_POLICY(version_mode) \
+	{get_hybrid<version_mode>, store_full<CACHE_MODE_HYBRID>, \
+	 version_mode == VERSION_MODE_OFF ? store_back : NULL, item_remove_internal, unlink_short_cut, \
+	 unlink_kvs, put_cache, get_cache, del_cache}
+#define KVS_ONLY_POLICY \
+	{get_kvs_only, store_kvs_only, NULL, do_item_remove, unlink_kvs_only, \
+	 unlink_kvs, put_kvs, get_kvs, del_kvs}
+#define CACHE_ONLY_POLICY \
+	{get_cache_only, store_cache_only, NULL, item_remove_internal, item_unlink_internal, \
+	 unlink_kvs_none, put_cache, get_cache, del_cache}
+
+// [cache mode][version mode]; the version mode only matters to CACHE_MODE_FULL and CACHE_MODE_HYBRID
+static const cache_policy policies[CACHE_MODE_CNT][VERSION_MODE_CNT] = {
+	{MEMCACHED_KVS_POLICY, MEMCACHED_KVS_POLICY, MEMCACHED_KVS_POLICY},
+	{FULL_POLICY(VERSION_MODE_OFF), FULL_POLICY(VERSION_MODE_ON), FULL_POLICY(VERSION_MODE_FORCE)},
+	{SHORT_POLICY, SHORT_POLICY, SHORT_POLICY},
+	{HYBRID_POLICY(VERSION_MODE_OFF), HYBRID_POLICY(VERSION_MODE_ON), HYBRID_POLICY(VERSION_MODE_FORCE)},
+	{KVS_ONLY_POLICY, KVS_ONLY_POLICY, KVS_ONLY_POLICY},
+	{CACHE_ONLY_POLICY, CACHE_ONLY_POLICY, CACHE_ONLY_POLICY},
+};
+
+// matches the defaults in settings_init()
+static cache_policy const *policy = &policies[CACHE_MODE_MEMCACHED_KVS][VERSION_MODE_OFF];
+
+item *item_get(const char *key, const size_t nkey, conn *c, const bool do_update)
+{
+	return policy->get(key, nkey, c, do_update);
+}
+
+enum store_item_type store_item(item *it, int comm, conn* c)
+{
+	if (write_back)
+		return policy->store_back(it, comm, c);
+	return policy->store(it, comm, c);
+}
+
+void item_remove(item *item)
+{
+    policy->remove(item);
+}
+
+void item_unlink(item *item)
+{
+    policy->unlink(item);
 }
 
 int item_unlink_kvs(const char *key, const size_t nkey)
 {
-	int kvs_ret;
-	kvs_ret = kvs->Del(key, nkey);
-	return kvs_ret;
+	return policy->unlink_kvs(key, nkey);
+}
+
+// accepts a mode by name or by number; an empty string is the default mode
+static int str2mode(std::string const &str, char const * const names[], int cnt)
+{
+	if (str.empty())
+		return 0;
+	for (int i = 0; i < cnt; i++) {
+		if (str == names[i] || str == std::to_string(i))
+			return i;
+	}
+	return -1;
+}
+
+static void print_policy()
+{
+	std::cout << "Cache mode: " << cache_mode_names[settings.cache_mode] << std::endl;
+	std::cout << "Versioned mode: " << version_mode_names[settings.version_mode] << std::endl;
+	if (settings.write_back_age > 0)
+		std::cout << "Write-back: " << settings.write_back_age << " s, "
+			<< settings.write_back_bytes/1024UL/1024UL << " MB dirty" << std::endl;
+}
+
+void cache_policy_stats(ADD_STAT add_stats, conn *c)
+{
+	policy_counters cnt;
+	policy_counters_read(settings.cache_mode, &cnt);
+	APPEND_STAT("cache_mode", "%s", cache_mode_names[settings.cache_mode]);
+	APPEND_STAT("version_mode", "%s", version_mode_names[settings.version_mode]);
+#define X(name) APPEND_STAT("cache_" #name, "%llu", (unsigned long long)cnt.name);
+	POLICY_COUNTER_FIELDS
+#undef X
+	APPEND_STAT("cache_dirty_bytes", "%llu", (unsigned long long)dirty_bytes.load());
 }
 
-void Cache_Init(size_t cache_size)
+void Cache_Init(size_t cache_size, int threads)
 {
     //std::cout << " hash table : " << HASHPOWER_DEFAULT << std::endl;
+	// keep the policy picked by Cache_SetPolicy()
+	enum cache_mode cache_mode = settings.cache_mode;
+	enum version_mode version_mode = settings.version_mode;
+	int absent_cache_size = settings.absent_cache_size;
+	int write_back_age = settings.write_back_age;
+	size_t write_back_bytes = settings.write_back_bytes;
 	settings_init();
+	settings.cache_mode = cache_mode;
+	settings.version_mode = version_mode;
+	settings.absent_cache_size = absent_cache_size;
+	settings.write_back_age = write_back_age;
+	settings.write_back_bytes = write_back_bytes;
+	// values are stored without "\r\n"
+	value_suffix = 0;
 //	settings.maxbytes = ((size_t)cache_size) * 1024 * 1024UL;
 	settings.maxbytes = (size_t)cache_size;
 	settings.hashpower_init = 27;
 	settings.factor = 1.6;
 	settings.verbose = 1;
         //settings.verbose = 3;
-	settings.num_threads = 0;
+	// application threads that may call into the cache at once
+	settings.num_threads = threads > 0 ? threads : 1;
 
 	// These options are same with "-o modern" of memcached server
 	settings.slab_reassign = true;
@@ -910,7 +1489,7 @@ void Cache_Init(size_t cache_size)
 
 	slabs_init(settings.maxbytes, settings.factor, 0, use_slab_sizes ? slab_sizes : NULL);
 	logger_init();
-	memcached_thread_init(1);
+	memcached_local_thread_init(settings.num_threads);
 
 	if (start_assoc_maintenance_thread() == -1) {
 		printf("maintenance_thread start error\n");
@@ -955,55 +1534,222 @@ nvmm::GlobalPtr str2gptr(std::string root_str) {
    Public APIs
 */
 
+// Local and Server Mode
+int Cache_SetPolicy(std::string cache_mode, std::string version_mode)
+{
+	int cm = str2mode(cache_mode, cache_mode_names, CACHE_MODE_CNT);
+	int vm = str2mode(version_mode, version_mode_names, VERSION_MODE_CNT);
+	if (cm < 0 || vm < 0) {
+		std::cout << "Cache_SetPolicy: invalid cache mode " << cache_mode
+			<< " or version mode " << version_mode << std::endl;
+		return -1;
+	}
+	if (settings.write_back_age > 0 && policies[cm][vm].store_back == NULL) {
+		std::cout << "Cache_SetPolicy: no write-back with cache mode " << cache_mode_names[cm]
+			<< " and version mode " << version_mode_names[vm] << std::endl;
+		return -1;
+	}
+	settings.cache_mode = (enum cache_mode)cm;
+	settings.version_mode = (enum version_mode)vm;
+	policy = &policies[cm][vm];
+	return 0;
+}
+
+// Local and Server Mode
+int Cache_SetWriteBack(int max_age, size_t max_dirty_bytes)
+{
+	if (max_age > 0 && policy->store_back == NULL) {
+		std::cout << "Cache_SetWriteBack: no write-back with cache mode "
+			<< cache_mode_names[settings.cache_mode] << " and version mode "
+			<< version_mode_names[settings.version_mode] << std::endl;
+		return -1;
+	}
+	settings.write_back_age = max_age > 0 ? max_age : 0;
+	settings.write_back_bytes = max_dirty_bytes;
+	return 0;
+}
+
+/*
+   Online split (Server Mode): moves the keys in [begin_key, end_key) of the KVS to a new KVS on the
+   same shelves while the server keeps serving them (see KVSMigration, and "kvs split"):
+   1. kvs_split_start(): kvs becomes a KVSMigration from the KVS to the new one, and a thread of its
+      own copies the range and catches up, after which the writes of the range go to both
+   2. the range is routed to the new KVS (Config::SplitPartition(), a server for it, and
+      KVSServer::Reload() on the clients)
+   3. kvs_split_finish(): once no requests for the range come here, kvs goes back to the KVS, and
+      the range is purged from it
+
+   kvs changes with all worker and background threads paused (pause_threads()), so no request is
+   still writing to the KVS directly once the migration starts logging; a worker thread cannot
+   wait for that, which is one reason the steps run on a split thread. Writes through a short-cut
+   get STALE_KEY_PTR from the migration and go back to the key, so they are tracked too.
+   Not with write-back: a pending write of the range would reach only the KVS after the split.
+*/
+enum split_state {
+	SPLIT_IDLE,
+	SPLIT_COPYING,		// Start(), Copy() and CatchUp()
+	SPLIT_DUAL_WRITE,	// waiting for kvs_split_finish()
+	SPLIT_FINISHING,	// Finish() and Purge()
+	SPLIT_FAILED
+};
+static const char *split_state_names[] = {"idle", "copying", "dual_write", "finishing", "failed"};
+
+static radixtree::KVS split_kvs_config;	// of the KVS, for the new one
+static std::atomic<int> split_state(SPLIT_IDLE);
+static KeyValueStore *split_src;
+static KeyValueStore *split_dst;
+static KVSMigration *migration;
+static std::string split_dst_root;
+
+static void kvs_switch(KeyValueStore *to)
+{
+	pause_threads(PAUSE_ALL_THREADS);
+	kvs = to;
+	pause_threads(RESUME_ALL_THREADS);
+}
+
+static void split_cleanup(int state)
+{
+	delete migration;
+	migration = NULL;
+	delete split_dst;
+	split_dst = NULL;
+	split_state = state;
+}
+
+static void *split_copier(void *arg)
+{
+	kvs_switch(migration);
+	if (migration->Start() != 0 || migration->Copy() != 0 || migration->CatchUp() != 0) {
+		fprintf(stderr, "KVS split: copy to %s failed\n", split_dst_root.c_str());
+		kvs_switch(split_src);
+		split_cleanup(SPLIT_FAILED);
+		return NULL;
+	}
+	split_state = SPLIT_DUAL_WRITE;
+	return NULL;
+}
+
+static void *split_finisher(void *arg)
+{
+	int ret = migration->Finish();
+	kvs_switch(split_src);
+	// a failed write to the new KVS leaves the range here for recovery
+	if (ret != 0 || migration->Purge() != 0) {
+		fprintf(stderr, "KVS split: finish failed\n");
+		split_cleanup(SPLIT_FAILED);
+		return NULL;
+	}
+	split_cleanup(SPLIT_IDLE);
+	return NULL;
+}
+
+static int split_run(void *(*f)(void *))
+{
+	pthread_t tid;
+	if (pthread_create(&tid, NULL, f, NULL) != 0)
+		return -1;
+	pthread_detach(tid);
+	return 0;
+}
+
+int kvs_split_start(const char *begin_key, const size_t begin_key_len,
+	const char *end_key, const size_t end_key_len)
+{
+	if (split_kvs_config.empty() || write_back || begin_key_len == 0)
+		return -1;
+	int state = split_state.load();
+	if ((state != SPLIT_IDLE && state != SPLIT_FAILED) ||
+	    !split_state.compare_exchange_strong(state, SPLIT_COPYING))
+		return -1;
+
+	split_dst = KeyValueStore::MakeKVS(split_kvs_config["kvs_type"], 0,
+		split_kvs_config["shelf_base"], split_kvs_config["shelf_user"],
+		(size_t)stoul(split_kvs_config["kvs_size"]));
+	if (split_dst == NULL) {
+		split_state = SPLIT_FAILED;
+		return -1;
+	}
+	std::stringstream ss;
+	ss << split_dst->Location();
+	split_dst_root = ss.str();
+	split_src = kvs;
+	migration = new KVSMigration(split_src, split_dst, std::string(begin_key, begin_key_len),
+		std::string(end_key, end_key_len));
+	if (split_run(split_copier) != 0) {
+		split_cleanup(SPLIT_FAILED);
+		return -1;
+	}
+	return 0;
+}
+
+int kvs_split_finish(void)
+{
+	int state = SPLIT_DUAL_WRITE;
+	if (!split_state.compare_exchange_strong(state, SPLIT_FINISHING))
+		return -1;
+	if (split_run(split_finisher) != 0) {
+		split_state = SPLIT_DUAL_WRITE;
+		return -1;
+	}
+	return 0;
+}
+
+// "SPLIT <state>", and the location of the new KVS once the range is copied
+void kvs_split_status(char *buf, const size_t len)
+{
+	int state = split_state.load();
+	if (state == SPLIT_DUAL_WRITE)
+		snprintf(buf, len, "SPLIT %s %s", split_state_names[state], split_dst_root.c_str());
+	else
+		snprintf(buf, len, "SPLIT %s", split_state_names[state]);
+}
+
 // Local Mode
 void KVS_Final() {
-#if CACHE_MODE !=5
+	// the cache may still hold the only copy of some writes
+	write_back_final();
 	if (kvs != NULL) {
         kvs->ReportMetrics();
+		absent_final();
 		delete kvs;
     }
-#endif
 //	slabs_print();
-//	double hit_rate = (double)(num_hit / 5000000) * 100;
-//	std::cout << "hit_rate = " << hit_rate << std::endl;
-	std::cout << "hit = " << num_hit << std::endl;
-#if CACHE_MODE !=4
+	policy_counters cnt;
+	policy_counters_read(settings.cache_mode, &cnt);
+	std::cout << "hit = " << cnt.get_hits << " miss = " << cnt.get_misses
+		<< " stale = " << cnt.get_stale << " absent = " << cnt.get_absent << std::endl;
+	if (settings.write_back_age > 0)
+		std::cout << "put_back = " << cnt.put_back << " write_backs = " << cnt.write_backs
+			<< std::endl;
+	if (settings.cache_mode != CACHE_MODE_KVS_ONLY) {
+		struct thread_stats ts;
+		struct slab_stats ss;
+		threadlocal_stats_aggregate(&ts);
+		slab_stats_aggregate(&ts, &ss);
+		std::cout << "threads = " << settings.num_threads << " gets = " << ts.get_cmds
+			<< " get_hits = " << ss.get_hits << " get_misses = " << ts.get_misses
+			<< " sets = " << ss.set_cmds << " delete_hits = " << ss.delete_hits
+			<< " delete_misses = " << ts.delete_misses << std::endl;
         Cache_Final();
-#endif
+	}
 }
 
 
 // Local Mode
-void KVS_Init(radixtree::KeyValueStore::IndexType type, std::string root, std::string base, std::string user, size_t size, size_t cache_size)
+void KVS_Init(radixtree::KeyValueStore::IndexType type, std::string root, std::string base, std::string user, size_t size, size_t cache_size, int threads)
 {
-	num_hit = 0;
-#if CACHE_MODE !=4
-        Cache_Init(cache_size);
+	if (settings.cache_mode != CACHE_MODE_KVS_ONLY) {
+        Cache_Init(cache_size, threads);
         std::cout << "Cache Size (MB): " << cache_size/1024UL/1024UL << std::endl;
-#endif
+	}
 	std::cout << "FAM Size (GB) : " << (size/1024UL/1024UL/1024UL) << std::endl;
 
-#if CACHE_MODE == 0
-	std::cout << "Cache mode: original memcached" << std::endl;
-#elif CACHE_MODE == 1
-	std::cout << "Cache mode: full" << std::endl;
-#elif CACHE_MODE == 2
-	std::cout << "Cache mode: short" << std::endl;
-#elif CACHE_MODE == 3
-	std::cout << "Cache mode: hybrid" << std::endl;
-#elif CACHE_MODE == 4
-	std::cout << "Cache mode: kvs only" << std::endl;
-#elif CACHE_MODE == 5
-	std::cout << "Cache mode: memcached only" << std::endl;
-#endif
+	print_policy();
 
-#if VERSION_MODE == 0
-	std::cout << "Versioned mode: Off" << std::endl;
-#else
-	std::cout << "Versioned mode: On" << std::endl;
-#endif
+	if (settings.cache_mode == CACHE_MODE_CACHE_ONLY)
+		return;
 
-#if CACHE_MODE != 5
 	KeyValueStore::Start(base, user);
 	nvmm::GlobalPtr root_ptr = str2gptr(root);
 	if(root_ptr==0)
@@ -1017,39 +1763,25 @@ void KVS_Init(radixtree::KeyValueStore::IndexType type, std::string root, std::s
 	}
 	std::cout << "KVS Type: " << type << std::endl;
 	std::cout << "KVS_Init: KVS opened at " << kvs->Location() << std::endl;
-#endif
+	if (settings.cache_mode != CACHE_MODE_KVS_ONLY) {
+		absent_init();
+		write_back_init();
+	}
 }
 
-void KVS_Init(std::string type, std::string root, std::string base, std::string user, size_t size, size_t cache_size)
+void KVS_Init(std::string type, std::string root, std::string base, std::string user, size_t size, size_t cache_size, int threads)
 {
-	num_hit = 0;
-#if CACHE_MODE !=4
-        Cache_Init(cache_size);
+	if (settings.cache_mode != CACHE_MODE_KVS_ONLY) {
+        Cache_Init(cache_size, threads);
         std::cout << "Cache Size (MB): " << cache_size/1024UL/1024UL << std::endl;
-#endif
+	}
 	std::cout << "FAM Size (GB) : " << (size/1024UL/1024UL/1024UL) << std::endl;
 
-#if CACHE_MODE == 0
-	std::cout << "Cache mode: original memcached" << std::endl;
-#elif CACHE_MODE == 1
-	std::cout << "Cache mode: full" << std::endl;
-#elif CACHE_MODE == 2
-	std::cout << "Cache mode: short" << std::endl;
-#elif CACHE_MODE == 3
-	std::cout << "Cache mode: hybrid" << std::endl;
-#elif CACHE_MODE == 4
-	std::cout << "Cache mode: kvs only" << std::endl;
-#elif CACHE_MODE == 5
-	std::cout << "Cache mode: memcached only" << std::endl;
-#endif
+	print_policy();
 
-#if VERSION_MODE == 0
-	std::cout << "Versioned mode: Off" << std::endl;
-#else
-	std::cout << "Versioned mode: On" << std::endl;
-#endif
+	if (settings.cache_mode == CACHE_MODE_CACHE_ONLY)
+		return;
 
-#if CACHE_MODE != 5
 	KeyValueStore::Start(base, user);
 	nvmm::GlobalPtr root_ptr = str2gptr(root);
 	if(root_ptr==0)
@@ -1063,38 +1795,24 @@ void KVS_Init(std::string type, std::string root, std::string base, std::string
 	}
 	std::cout << "KVS Type: " << type << std::endl;
 	std::cout << "KVS_Init: KVS opened at " << kvs->Location() << std::endl;
-#endif
+	if (settings.cache_mode != CACHE_MODE_KVS_ONLY) {
+		absent_init();
+		write_back_init();
+	}
 }
 
 // Server Mode
 // don't need Cache_Init
 void KVS_Init(radixtree::KVS kvs_config)
 {
-	num_hit = 0;
         std::cout << "Cache Size (MB): " << std::stoul(kvs_config["cache_size"])/1024UL/1024UL << std::endl;
         std::cout << "FAM Size (GB) : " << std::stoul(kvs_config["kvs_size"])/1024UL/1024UL/1024UL << std::endl;
 
-#if CACHE_MODE == 0
-	std::cout << "Cache mode: original memcached" << std::endl;
-#elif CACHE_MODE == 1
-	std::cout << "Cache mode: full" << std::endl;
-#elif CACHE_MODE == 2
-	std::cout << "Cache mode: short" << std::endl;
-#elif CACHE_MODE == 3
-	std::cout << "Cache mode: hybrid" << std::endl;
-#elif CACHE_MODE == 4
-	std::cout << "Cache mode: kvs only" << std::endl;
-#elif CACHE_MODE == 5
-	std::cout << "Cache mode: memcached only" << std::endl;
-#endif
+	print_policy();
 
-#if VERSION_MODE == 0
-	std::cout << "Versioned mode: Off" << std::endl;
-#else
-	std::cout << "Versioned mode: On" << std::endl;
-#endif
+	if (settings.cache_mode == CACHE_MODE_CACHE_ONLY)
+		return;
 
-#if CACHE_MODE != 5
 	std::string loc=kvs_config["kvs_root"];
 	nvmm::GlobalPtr location;
 	if(loc.empty() || str2gptr(loc)==0) {
@@ -1114,15 +1832,84 @@ void KVS_Init(radixtree::KVS kvs_config)
             printf("KVS_Init: Init error\n");
             exit(1);
 	}
+	split_kvs_config = kvs_config;
 	std::cout << "KVS Type: " << type << std::endl;
 	std::cout << "KVS_Init: KVS opened at " << kvs->Location() << std::endl;
-#endif
+	if (settings.cache_mode != CACHE_MODE_KVS_ONLY) {
+		absent_init();
+		write_back_init();
+	}
+}
+
+// Local Mode: the slot of the calling thread, given back when the thread exits
+struct local_slot {
+    LIBEVENT_THREAD *me = NULL;
+    bool registered = false; // asked for a slot, so Cache_* do not ask again
+    ~local_slot() {
+        if (me != NULL)
+            memcached_thread_unregister(me);
+    }
+};
+static thread_local local_slot local;
+
+static inline LIBEVENT_THREAD *local_self()
+{
+    if (!local.registered)
+        Cache_RegisterThread();
+    return local.me;
 }
 
 // Local Mode
+int Cache_RegisterThread()
+{
+    local.registered = true;
+    if (local.me == NULL && settings.cache_mode != CACHE_MODE_KVS_ONLY)
+        local.me = memcached_thread_register();
+    return local.me != NULL ? 0 : -1;
+}
+
+void Cache_UnregisterThread()
+{
+    if (local.me != NULL)
+        memcached_thread_unregister(local.me);
+    local.me = NULL;
+    local.registered = false;
+}
+
 int Cache_Put(char const *key, size_t const key_len, char const *val, size_t const val_len)
 {
-#if CACHE_MODE != 4
+    local_self();
+    return policy->put(key, key_len, val, val_len);
+}
+
+int Cache_Get(char const *key, size_t const key_len, char *val, size_t &val_len)
+{
+    LIBEVENT_THREAD *me = local_self();
+    int ret = policy->get_local(key, key_len, val, val_len);
+    if (me != NULL) {
+        pthread_mutex_lock(&me->stats.mutex);
+        me->stats.get_cmds++;
+        if (ret != 0)
+            me->stats.get_misses++;
+        pthread_mutex_unlock(&me->stats.mutex);
+    }
+    return ret;
+}
+
+int Cache_Del(char const *key, size_t const key_len)
+{
+    LIBEVENT_THREAD *me = local_self();
+    int ret = policy->del(key, key_len);
+    if (me != NULL && ret != 0) {
+        pthread_mutex_lock(&me->stats.mutex);
+        me->stats.delete_misses++;
+        pthread_mutex_unlock(&me->stats.mutex);
+    }
+    return ret;
+}
+
+static int put_cache(char const *key, size_t const key_len, char const *val, size_t const val_len)
+{
     item *it = item_alloc(key, key_len, 0, realtime(0), val_len);
     if (it == NULL) {
         printf("Cache_Put: item allocation error %d %d\n", key_len, val_len);
@@ -1132,6 +1919,11 @@ int Cache_Put(char const *key, size_t const key_len, char const *val, size_t con
     memcpy(ITEM_data(it), val, val_len);
 
     enum store_item_type ret = store_item(it, NREAD_SET, NULL);
+    if (local.me != NULL) {
+        pthread_mutex_lock(&local.me->stats.mutex);
+        local.me->stats.slab_stats[ITEM_clsid(it)].set_cmds++;
+        pthread_mutex_unlock(&local.me->stats.mutex);
+    }
     item_remove(it);
     if (ret == STORED || ret == EXISTS) {
         return 0;
@@ -1139,16 +1931,17 @@ int Cache_Put(char const *key, size_t const key_len, char const *val, size_t con
         printf("Cache_Put: Put error %d \n", ret);
         return -1;
     }
-#else
-    return kvs->Put(key, key_len, val, val_len);
-#endif
 }
 
-int Cache_Get(char const *key, size_t const key_len, char *val, size_t &val_len)
+static int get_cache(char const *key, size_t const key_len, char *val, size_t &val_len)
 {
-#if CACHE_MODE != 4
     item *it = item_get(key, key_len, NULL, DO_UPDATE);
     if (it != NULL) {
+        if (local.me != NULL) {
+            pthread_mutex_lock(&local.me->stats.mutex);
+            local.me->stats.lru_hits[it->slabs_clsid]++;
+            pthread_mutex_unlock(&local.me->stats.mutex);
+        }
         val_len = it->nbytes;
         memcpy(val, ITEM_data(it), it->nbytes);
         item_remove(it);
@@ -1157,30 +1950,41 @@ int Cache_Get(char const *key, size_t const key_len, char *val, size_t &val_len)
         printf("Cache_Get: Get error\n");
         return -1;
     }
-#else
-    return kvs->Get(key, key_len, val, val_len);
-#endif
 }
 
-int Cache_Del(char const *key, size_t const key_len)
+static int del_cache(char const *key, size_t const key_len)
 {
-#if CACHE_MODE != 4
     item *it = item_get_internal(key, key_len, NULL, DONT_UPDATE);
     if (it != NULL) {
+        if (local.me != NULL) {
+            pthread_mutex_lock(&local.me->stats.mutex);
+            local.me->stats.slab_stats[ITEM_clsid(it)].delete_hits++;
+            pthread_mutex_unlock(&local.me->stats.mutex);
+        }
         item_unlink(it);
         item_remove(it);
         return 0;
     }
-#if CACHE_MODE == 5
-    else {
-        int ret;
-        ret = item_unlink_kvs(key, key_len);
-        return ret;
-    }
-#endif // CACHE_MODE == 5
-#else // CACHE_MODE !=4
+    // not cached, but may still be in the KVS
+    return item_unlink_kvs(key, key_len);
+}
+
+// CACHE_MODE_KVS_ONLY
+static int put_kvs(char const *key, size_t const key_len, char const *val, size_t const val_len)
+{
+    COUNT(CACHE_MODE_KVS_ONLY, put_misses);
+    return kvs->Put(key, key_len, val, val_len);
+}
+
+static int get_kvs(char const *key, size_t const key_len, char *val, size_t &val_len)
+{
+    COUNT(CACHE_MODE_KVS_ONLY, get_misses);
+    return kvs->Get(key, key_len, val, val_len);
+}
+
+static int del_kvs(char const *key, size_t const key_len)
+{
     return kvs->Del(key, key_len);
-#endif
 }
 
 /*
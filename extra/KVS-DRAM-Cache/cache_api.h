@@ -13,6 +13,27 @@ extern "C" enum store_item_type store_item(item *item, int comm, conn* c);
 extern "C" void item_remove(item *item);
 extern "C" void item_unlink(item *item);
 extern "C" int item_unlink_kvs(const char *key, const size_t nkey);
+extern "C" void cache_policy_stats(ADD_STAT add_stats, conn *c);
+extern "C" void item_write_back(item *it, const uint32_t hv);
+
+// Server Mode: online split of the KVS ("kvs_split" commands; see cache_api.cc)
+// kvs_split_start: begin_key is not empty; an empty end_key means +inf
+// return 0 (no error); -1 (error, e.g., a split is already on)
+extern "C" int kvs_split_start(const char *begin_key, const size_t begin_key_len,
+                               const char *end_key, const size_t end_key_len);
+extern "C" int kvs_split_finish(void);
+extern "C" void kvs_split_status(char *buf, const size_t len);
+
+// Local and Server Mode
+// picks the cache policy (enum cache_mode, enum version_mode in memcached.h) by name, e.g.
+// "hybrid" and "on", or by number (empty for the default); must be called before KVS_Init()
+int Cache_SetPolicy(std::string cache_mode, std::string version_mode="");
+
+// Local and Server Mode
+// write-back: a write stays in the cache for up to max_age seconds (0: write-through), or until
+// more than max_dirty_bytes are dirty, and repeated writes of a key reach the KVS as one; only for
+// the memcached policy, and full and hybrid with version mode off; must be called before KVS_Init()
+int Cache_SetWriteBack(int max_age, size_t max_dirty_bytes=64*1024*1024UL);
 
 // Local Mode
 // it calls Cache_Final()
@@ -21,24 +42,32 @@ void KVS_Final();
 // Local Mode
 // called from application
 // it calls Cache_Init()
+// threads: the number of application threads that may use the cache at once
 void KVS_Init(radixtree::KeyValueStore::IndexType type, std::string root="", std::string base="", std::string user="",
-              size_t size=64*1024*1024*1024UL, size_t cache_size=0);
+              size_t size=64*1024*1024*1024UL, size_t cache_size=0, int threads=1);
 
 void KVS_Init(std::string type, std::string root="", std::string base="", std::string user="",
-              size_t size=64*1024*1024*1024UL, size_t cache_size=0);
+              size_t size=64*1024*1024*1024UL, size_t cache_size=0, int threads=1);
 
 // Cluster/Server Mode
 // called from server frontend, which already initialized cache
 // it does not call Cache_Init()
 void KVS_Init(radixtree::KVS kvs_config);
 
+// Local Mode
+// gives the calling thread one of the threads slots of KVS_Init() (its own stats),
+// -1 if all are taken; Cache_Put/Get/Del register a thread on its first call,
+// a thread that is done with the cache should give its slot back
+int Cache_RegisterThread();
+void Cache_UnregisterThread();
+
 // Local Mode
 int Cache_Put(char const *key, size_t const key_len, char const *val, size_t const val_len);
 int Cache_Get(char const *key, size_t const key_len, char *val, size_t &val_len);
 int Cache_Del(char const *key, size_t const key_len);
 
 // // Local Mode: cache only
-// // requires CACHE==5
+// // requires cache mode cache_only
 // int mc_Put(char const *key, size_t const key_len, char const *val, size_t const val_len);
 // int mc_Get(char const *key, size_t const key_len, char *val, size_t &val_len);
 // int mc_Del(char const *key, size_t const key_len);
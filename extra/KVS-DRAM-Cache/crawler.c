@@ -177,8 +177,10 @@ static void crawler_expired_eval(crawler_module_t *cm, item *search, uint32_t hv
     pthread_mutex_lock(&d->lock);
     crawlerstats_t *s = &d->crawlerstats[i];
     int is_flushed = item_is_flushed(search);
-    if ((search->exptime != 0 && search->exptime < current_time)
-        || is_flushed) {
+    /* write-back mode: a dirty item is left to the flusher, which writes it
+     * back and unlinks it without holding the LRU lock we hold here */
+    if (((search->exptime != 0 && search->exptime < current_time)
+         || is_flushed) && (search->it_flags & ITEM_DIRTY) == 0) {
         crawlers[i].reclaimed++;
         s->reclaimed++;
 
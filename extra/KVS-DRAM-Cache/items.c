@@ -21,6 +21,9 @@
 static void item_link_q(item *it);
 static void item_unlink_q(item *it);
 
+/* cache_api.cc: writes a dirty item to the KVS, with its item lock held */
+void item_write_back(item *it, const uint32_t hv);
+
 static unsigned int lru_type_map[4] = {HOT_LRU, WARM_LRU, COLD_LRU, TEMP_LRU};
 
 #define LARGEST_ID POWER_LARGEST
@@ -188,7 +191,8 @@ static item *do_item_alloc_pull(const size_t ntotal, const unsigned int id) {
 	 * occasional OOM's, rather than internally work around them.
 	 * This also gives one fewer code path for slab alloc/free
 	 */
-#if CACHE_MODE == 3
+	/* CACHE_MODE_HYBRID: the short-cut slab class (1) gives up after a few tries */
+	if (settings.cache_mode == CACHE_MODE_HYBRID) {
 	if (id != 1) {
 		while (1) {
 			i++;
@@ -239,7 +243,7 @@ static item *do_item_alloc_pull(const size_t ntotal, const unsigned int id) {
 			}
 		}
 	}
-#else
+	} else {
 	//Allocation failure can be occur where there are a lot of thread contention
 	//To avoid allocation failure, finite loop is changed with infinite loop
 	//<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
@@ -269,7 +273,7 @@ static item *do_item_alloc_pull(const size_t ntotal, const unsigned int id) {
 			break;
 		}
 	}
-#endif
+	}
 
     if (i > 0) {
         pthread_mutex_lock(&lru_locks[id]);
@@ -525,6 +529,9 @@ int do_item_link(item *it, const uint32_t hv) {
 void do_item_unlink(item *it, const uint32_t hv) {
     MEMCACHED_ITEM_UNLINK(ITEM_key(it), it->nkey, it->nbytes);
     if ((it->it_flags & ITEM_LINKED) != 0) {
+        /* write-back mode: the cache may have the only copy of the value */
+        if (it->it_flags & ITEM_DIRTY)
+            item_write_back(it, hv);
         it->it_flags &= ~ITEM_LINKED;
         STATS_LOCK();
         stats_state.curr_bytes -= ITEM_ntotal(it);
@@ -538,6 +545,8 @@ void do_item_unlink(item *it, const uint32_t hv) {
 }
 
 /* FIXME: Is it necessary to keep this copy/pasted code? */
+/* The caller holds an LRU lock, so a dirty item is not written back here: the
+ * caller does it once that lock is dropped, with the item lock still held. */
 void do_item_unlink_nolock(item *it, const uint32_t hv) {
     MEMCACHED_ITEM_UNLINK(ITEM_key(it), it->nkey, it->nbytes);
     if ((it->it_flags & ITEM_LINKED) != 0) {
@@ -1120,6 +1129,8 @@ static int lru_pull_tail(const int orig_id, const int cur_lru,
     item *search;
     item *next_it;
     void *hold_lock = NULL;
+    uint32_t it_hv = 0;
+    int reclaimed = 0;
     unsigned int move_to_lru = 0;
     uint64_t limit = 0;
     id |= cur_lru;
@@ -1152,7 +1163,8 @@ static int lru_pull_tail(const int orig_id, const int cur_lru,
             /* In case of refcount leaks, enable for quick workaround. */
             /* WARNING: This can cause terrible corruption */
             if (settings.tail_repair_time &&
-                    search->time + settings.tail_repair_time < current_time) {
+                    search->time + settings.tail_repair_time < current_time &&
+                    (search->it_flags & ITEM_DIRTY) == 0) {
                 itemstats[id].tailrepairs++;
                 search->refcount = 1;
                 /* This will call item_remove -> item_free since refcnt is 1 */
@@ -1171,10 +1183,17 @@ static int lru_pull_tail(const int orig_id, const int cur_lru,
             }
             /* refcnt 2 -> 1 */
             do_item_unlink_nolock(search, hv);
+            removed++;
+            if (search->it_flags & ITEM_DIRTY) {
+                /* written back below, without the LRU lock */
+                it = search;
+                it_hv = hv;
+                reclaimed = 1;
+                break;
+            }
             /* refcnt 1 -> 0 -> item_free */
             do_item_remove(search);
             item_trylock_unlock(hold_lock);
-            removed++;
 
             /* If all we're finding are expired, can keep going */
             continue;
@@ -1237,6 +1256,7 @@ static int lru_pull_tail(const int orig_id, const int cur_lru,
                     }
             	   	//LOGGER_LOG(NULL, LOG_EVICTIONS, LOGGER_EVICTION, search);
                     do_item_unlink_nolock(search, hv);
+                    it_hv = hv;
 					removed++;
 					if (settings.slab_automove == 2) {
 						slabs_reassign(-1, orig_id);
@@ -1261,19 +1281,24 @@ static int lru_pull_tail(const int orig_id, const int cur_lru,
     pthread_mutex_unlock(&lru_locks[id]);
 
 	if (it != NULL) {
-#if CACHE_MODE == 3
+        /* write-back mode: an evicted or expired item may have the only copy
+         * of its value; the item lock keeps the key's KVS writes in order */
+        if ((it->it_flags & (ITEM_LINKED|ITEM_DIRTY)) == ITEM_DIRTY)
+            item_write_back(it, it_hv);
         if (move_to_lru) {
 			it->slabs_clsid = ITEM_clsid(it);
 			it->slabs_clsid |= move_to_lru;
 	
             item_link_q(it);
-		} else {
-			if ((flags & LRU_PULL_EVICT) && orig_id != 1) {
+		} else if (settings.cache_mode == CACHE_MODE_HYBRID) {
+			/* an evicted item leaves its short-cut behind */
+			if ((flags & LRU_PULL_EVICT) && orig_id != 1 && !reclaimed) {
 				uint32_t hv = hash(ITEM_key(it), it->nkey);
 				item *rescue = do_item_alloc(ITEM_key(it), 
 						it->nkey, 0, 0, 2);
 				if (rescue != NULL) {
 					rescue->skey = it->skey;
+					rescue->sgen = it->sgen;
 					rescue->val_ptr.tag = it->val_ptr.tag;
 					rescue->val_ptr.vptr = it->val_ptr.vptr;
 					memcpy(ITEM_data(rescue), "\r\n", rescue->nbytes);
@@ -1282,14 +1307,6 @@ static int lru_pull_tail(const int orig_id, const int cur_lru,
 				}
 			}
 		}
-#else
-        if (move_to_lru) {
-			it->slabs_clsid = ITEM_clsid(it);
-			it->slabs_clsid |= move_to_lru;
-	
-            item_link_q(it);
-		}
-#endif
 
 		do_item_remove(it);
         item_trylock_unlock(hold_lock);
@@ -111,7 +111,10 @@ int main(int argc, char **argv)
 	int *arg;
 
         size_t heap_size = 64*1024*1024*1024UL;
-	KVS_Init(kvs_type, "", "" , "", heap_size, cache_size);
+	// optional cache policy: cache_mode [version_mode]
+	if (Cache_SetPolicy(argc > 4 ? argv[4] : "", argc > 5 ? argv[5] : "") != 0)
+		return 1;
+	KVS_Init(kvs_type, "", "" , "", heap_size, cache_size, NUM_THREADS + 1); // workers and the loader
 
 	pthread_t *thread = (pthread_t *)malloc(sizeof(pthread_t) * NUM_THREADS);
 	t = (struct timespec *)calloc(1, sizeof(struct timespec) * 2);
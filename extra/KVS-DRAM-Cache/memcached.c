@@ -65,6 +65,11 @@ enum store_item_type store_item(item *item, int comm, conn* c);
 void item_remove(item *it);
 void item_unlink(item *it);
 int item_unlink_kvs(const char *key, const size_t nkey);
+void cache_policy_stats(ADD_STAT add_stats, conn *c);
+int kvs_split_start(const char *begin_key, const size_t begin_key_len,
+		const char *end_key, const size_t end_key_len);
+int kvs_split_finish(void);
+void kvs_split_status(char *buf, const size_t len);
 
 /*
  * forward declarations
@@ -260,6 +265,11 @@ void settings_init(void) {
 	settings.crawls_persleep = 1000;
 	settings.logger_watcher_buf_size = LOGGER_WATCHER_BUF_SIZE;
 	settings.logger_buf_size = LOGGER_BUF_SIZE;
+	settings.cache_mode = CACHE_MODE_MEMCACHED_KVS;
+	settings.version_mode = VERSION_MODE_OFF;
+	settings.absent_cache_size = 65536;
+	settings.write_back_age = 0;
+	settings.write_back_bytes = 64 * 1024 * 1024;
 }
 
 /*
@@ -2976,6 +2986,7 @@ void server_stats(ADD_STAT add_stats, conn *c) {
 	APPEND_STAT("listen_disabled_num", "%llu", (unsigned long long)stats.listen_disabled_num);
 	APPEND_STAT("time_in_listen_disabled_us", "%llu", stats.time_in_listen_disabled_us);
 	APPEND_STAT("threads", "%d", settings.num_threads);
+	cache_policy_stats(add_stats, c);
 	APPEND_STAT("conn_yields", "%llu", (unsigned long long)thread_stats.conn_yields);
 	APPEND_STAT("hash_power_level", "%u", stats_state.hash_power_level);
 	APPEND_STAT("hash_bytes", "%llu", (unsigned long long)stats_state.hash_bytes);
@@ -3058,6 +3069,11 @@ void process_stat_settings(ADD_STAT add_stats, void *c) {
 	APPEND_STAT("idle_timeout", "%d", settings.idle_timeout);
 	APPEND_STAT("watcher_logbuf_size", "%u", settings.logger_watcher_buf_size);
 	APPEND_STAT("worker_logbuf_size", "%u", settings.logger_buf_size);
+	APPEND_STAT("cache_mode", "%d", settings.cache_mode);
+	APPEND_STAT("version_mode", "%d", settings.version_mode);
+	APPEND_STAT("absent_cache_size", "%d", settings.absent_cache_size);
+	APPEND_STAT("write_back_age", "%d", settings.write_back_age);
+	APPEND_STAT("write_back_bytes", "%llu", (unsigned long long)settings.write_back_bytes);
 	APPEND_STAT("track_sizes", "%s", item_stats_sizes_status() ? "yes" : "no");
 	APPEND_STAT("inline_ascii_response", "%s", settings.inline_ascii_response ? "yes" : "no");
 }
@@ -3833,13 +3849,9 @@ void process_delete_command(conn *c, token_t *tokens, const size_t ntokens) {
 		pthread_mutex_lock(&c->thread->stats.mutex);
 		c->thread->stats.delete_misses++;
 		pthread_mutex_unlock(&c->thread->stats.mutex);
-#if CACHE_MODE == 5
-		//<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<
-		out_string(c, "NOT_FOUND");
-		//>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-#else
 		//This codes are added for covering the case where 
 		//cached data was not found but, need to delete KVS data
+		//(there is no KVS with CACHE_MODE_CACHE_ONLY)
 		int ret;
 		ret = item_unlink_kvs(key, nkey);
 		if (ret == 0)
@@ -3847,7 +3859,6 @@ void process_delete_command(conn *c, token_t *tokens, const size_t ntokens) {
 		else
 			out_string(c, "NOT_FOUND");
 		//>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-#endif
 	}
 }
 
@@ -3962,6 +3973,40 @@ void process_memlimit_command(conn *c, token_t *tokens, const size_t ntokens) {
 	}
 }
 
+/*
+ * Online split of the KVS (see kvs_split_start() in cache_api.cc, and "kvs split"):
+ *   kvs_split start <begin_key> [<end_key>]
+ *   kvs_split status
+ *   kvs_split finish
+ */
+void process_kvs_split_command(conn *c, token_t *tokens, const size_t ntokens) {
+	char buf[KEY_MAX_LENGTH + 64];
+	assert(c != NULL);
+
+	if ((ntokens == 4 || ntokens == 5) && strcmp(tokens[COMMAND_TOKEN + 1].value, "start") == 0) {
+		const char *end_key = ntokens == 5 ? tokens[3].value : "";
+		const size_t end_key_len = ntokens == 5 ? tokens[3].length : 0;
+		if (tokens[2].length > KEY_MAX_LENGTH || end_key_len > KEY_MAX_LENGTH) {
+			out_string(c, "CLIENT_ERROR bad command line format");
+			return;
+		}
+		if (kvs_split_start(tokens[2].value, tokens[2].length, end_key, end_key_len) != 0)
+			out_string(c, "SERVER_ERROR cannot start a split");
+		else
+			out_string(c, "OK");
+	} else if (ntokens == 3 && strcmp(tokens[COMMAND_TOKEN + 1].value, "finish") == 0) {
+		if (kvs_split_finish() != 0)
+			out_string(c, "SERVER_ERROR no split to finish");
+		else
+			out_string(c, "OK");
+	} else if (ntokens == 3 && strcmp(tokens[COMMAND_TOKEN + 1].value, "status") == 0) {
+		kvs_split_status(buf, sizeof(buf));
+		out_string(c, buf);
+	} else {
+		out_string(c, "ERROR");
+	}
+}
+
 void process_lru_command(conn *c, token_t *tokens, const size_t ntokens) {
 	uint32_t pct_hot;
 	uint32_t pct_warm;
@@ -4304,6 +4349,8 @@ void process_command(conn *c, char *command) {
 		process_verbosity_command(c, tokens, ntokens);
 	} else if (ntokens >= 3 && strcmp(tokens[COMMAND_TOKEN].value, "lru") == 0) {
 		process_lru_command(c, tokens, ntokens);
+	} else if (ntokens >= 3 && strcmp(tokens[COMMAND_TOKEN].value, "kvs_split") == 0) {
+		process_kvs_split_command(c, tokens, ntokens);
 	} else {
 		out_string(c, "ERROR");
 	}
@@ -5643,6 +5690,17 @@ void usage(void) {
 			"              - modern: Enables 'modern' defaults. Options that will be default in future.\n"
 			"                enables: slab_chunk_max:512k,slab_reassign,slab_automove=1,maxconns_fast,\n"
 			"                         hash_algorithm=murmur3,lru_crawler,lru_maintainer,no_inline_ascii_resp\n"
+			"              - cache_mode: How the cache and the KVS are used together, overrides the\n"
+			"                KVS config. options: memcached (default), full, short, hybrid, kvs_only, cache_only\n"
+			"              - version_mode: How cached items are checked against the KVS (full, hybrid)\n"
+			"                options: off (default), on, force\n"
+			"              - absent_cache: Entries of the negative cache, which answers repeated\n"
+			"                lookups of keys that are not in the KVS from DRAM (default: 65536, 0: off)\n"
+			"              - write_back: Seconds a write may stay in the cache before it is written to\n"
+			"                the KVS (default: 0, write-through); memcached, or full and hybrid with\n"
+			"                version_mode off\n"
+			"              - write_back_bytes: Dirty bytes that start a write-back right away\n"
+			"                (default: 67108864)\n"
 			);
 	return;
 }
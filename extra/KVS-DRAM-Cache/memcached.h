@@ -323,6 +323,25 @@ struct stats_state {
 
 #define MAX_VERBOSITY_LEVEL 2
 
+/* How the cache and the KVS are used together; picked at start-up (see cache_api.cc) */
+enum cache_mode {
+    CACHE_MODE_MEMCACHED_KVS = 0, /* default memcached + KVS */
+    CACHE_MODE_FULL = 1,          /* store whole data block with short-cut pointer */
+    CACHE_MODE_SHORT = 2,         /* only store short-cut pointer */
+    CACHE_MODE_HYBRID = 3,        /* hybrid mode (hot-cold) */
+    CACHE_MODE_KVS_ONLY = 4,      /* KVS only, no cache */
+    CACHE_MODE_CACHE_ONLY = 5,    /* cache only, no KVS */
+    CACHE_MODE_CNT
+};
+
+/* How cached items are checked against the KVS (CACHE_MODE_FULL and CACHE_MODE_HYBRID) */
+enum version_mode {
+    VERSION_MODE_OFF = 0,   /* partitioned mode that doesn't need version verification */
+    VERSION_MODE_ON = 1,    /* version based sharing mode */
+    VERSION_MODE_FORCE = 2, /* version based sharing mode, and will force a read from FAM */
+    VERSION_MODE_CNT
+};
+
 /* When adding a setting, be sure to update process_stat_settings */
 /**
  * Globally accessible settings as derived from the commandline.
@@ -381,6 +400,11 @@ struct settings {
     int idle_timeout;       /* Number of seconds to let connections idle */
     unsigned int logger_watcher_buf_size; /* size of logger's per-watcher buffer */
     unsigned int logger_buf_size; /* size of per-thread logger buffer */
+    enum cache_mode cache_mode;     /* how the cache and the KVS are used together */
+    enum version_mode version_mode; /* how cached items are checked against the KVS */
+    int absent_cache_size;          /* entries of the negative cache of keys the KVS lacks */
+    int write_back_age;             /* seconds a write may stay in the cache only (0: write-through) */
+    size_t write_back_bytes;        /* dirty bytes that make the cache write back right away */
 };
 
 extern struct stats stats;
@@ -401,8 +425,9 @@ extern struct settings settings;
 /* If an item's storage are chained chunks. */
 #define ITEM_CHUNKED 32
 #define ITEM_CHUNK 64
+/* Written to the cache, not yet to the KVS (write-back mode) */
+#define ITEM_DIRTY 128
 
-#if CACHE_MODE == 1 || CACHE_MODE == 2 || CACHE_MODE == 3
 //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 typedef struct TagPtr TagPtr;
 struct TagPtr {
@@ -410,7 +435,6 @@ struct TagPtr {
 	uint64_t vptr;
 };
 //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-#endif
 
 /**
  * Structure for storing items within memcached.
@@ -429,13 +453,13 @@ struct _stritem {
     uint8_t         it_flags;   /* ITEM_* above */
     uint8_t         slabs_clsid;/* which slab class we're in */
     uint8_t         nkey;       /* key length, w/terminating null and padding */
-#if CACHE_MODE == 1 || CACHE_MODE == 2 || CACHE_MODE == 3
 	//>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-	/* these variables are for short-cut scheme */
+	/* these variables are for short-cut scheme (CACHE_MODE_MEMCACHED_KVS only uses the version,
+	 * to order writes; CACHE_MODE_KVS_ONLY and CACHE_MODE_CACHE_ONLY do not use them) */
 	uint64_t		skey;		/* short-cut */
+	uint64_t		sgen;		/* key generation the short-cut was taken in */
 	TagPtr			val_ptr;	/* version number, value pointer pointing to FAM area */
 	//>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-#endif
     /* this odd type prevents type-punning issues when we do
      * the little shuffle to save space when not using CAS. */
     union {
@@ -714,6 +738,7 @@ void process_slabs_automove_command(conn *c, token_t *tokens, const size_t ntoke
 void process_watch_command(conn *c, token_t *tokens, const size_t ntokens);
 void process_memlimit_command(conn *c, token_t *tokens, const size_t ntokens);
 void process_lru_command(conn *c, token_t *tokens, const size_t ntokens);
+void process_kvs_split_command(conn *c, token_t *tokens, const size_t ntokens);
 int read_into_chunked_item(conn *c);
 void maximize_sndbuf(const int sfd);
 int new_socket_unix(void);
@@ -754,6 +779,9 @@ int server_sockets(int port, enum network_transport transport,
  */
 
 void memcached_thread_init(int nthreads);
+void memcached_local_thread_init(int nthreads);
+LIBEVENT_THREAD *memcached_thread_register(void);
+void memcached_thread_unregister(LIBEVENT_THREAD *me);
 void redispatch_conn(conn *c);
 void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags, int read_buffer_size, enum network_transport transport);
 void sidethread_conn_close(conn *c);
@@ -50,6 +50,8 @@ int main (int argc, char **argv) {
     radixtree::NodeID nid=0;
     size_t idx=0;
     bool use_cluster=false;
+    std::string cache_mode;
+    std::string version_mode;
 
     int c;
     bool lock_memory = false;
@@ -108,7 +110,12 @@ int main (int argc, char **argv) {
         SLAB_CHUNK_MAX,
         TRACK_SIZES,
         NO_INLINE_ASCII_RESP,
-        MODERN
+        MODERN,
+        KVS_CACHE_MODE,
+        KVS_VERSION_MODE,
+        KVS_ABSENT_CACHE,
+        KVS_WRITE_BACK,
+        KVS_WRITE_BACK_BYTES
     };
     char *const subopts_tokens[] = {
         [MAXCONNS_FAST] = "maxconns_fast",
@@ -136,6 +143,11 @@ int main (int argc, char **argv) {
         [TRACK_SIZES] = "track_sizes",
         [NO_INLINE_ASCII_RESP] = "no_inline_ascii_resp",
         [MODERN] = "modern",
+        [KVS_CACHE_MODE] = "cache_mode",
+        [KVS_VERSION_MODE] = "version_mode",
+        [KVS_ABSENT_CACHE] = "absent_cache",
+        [KVS_WRITE_BACK] = "write_back",
+        [KVS_WRITE_BACK_BYTES] = "write_back_bytes",
         NULL
     };
 
@@ -631,6 +643,41 @@ int main (int argc, char **argv) {
                 start_lru_crawler = true;
                 start_lru_maintainer = true;
                 break;
+            case KVS_CACHE_MODE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing cache_mode argument\n");
+                    return 1;
+                }
+                cache_mode = subopts_value;
+                break;
+            case KVS_VERSION_MODE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing version_mode argument\n");
+                    return 1;
+                }
+                version_mode = subopts_value;
+                break;
+            case KVS_ABSENT_CACHE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing numeric argument for absent_cache\n");
+                    return 1;
+                }
+                settings.absent_cache_size = atoi(subopts_value);
+                break;
+            case KVS_WRITE_BACK:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing numeric argument for write_back\n");
+                    return 1;
+                }
+                settings.write_back_age = atoi(subopts_value);
+                break;
+            case KVS_WRITE_BACK_BYTES:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing numeric argument for write_back_bytes\n");
+                    return 1;
+                }
+                settings.write_back_bytes = strtoull(subopts_value, NULL, 10);
+                break;
             default:
                 printf("Illegal suboption \"%s\"\n", subopts_value);
                 return 1;
@@ -661,14 +708,19 @@ int main (int argc, char **argv) {
         // TODO: udp?
         tcp_specified = true;
 
-        // based on partition idx, get port number
+        // based on partition idx (the slot on the node), get port number
         settings.hashpower_init = 27;
 	settings.factor = 1.6;
+        std::vector<radixtree::KVS> slots = cluster.FindPartitions(nid);
+        if (idx >= slots.size() || slots[idx].empty()) {
+            fprintf(stderr, "Node %lu serves no partition in slot %zu\n", (unsigned long)nid, idx);
+            return 1;
+        }
         settings.port = cluster.FindPorts(nid)[idx];
         //std::cout << "Port: " << settings.port << std::endl;
 
         // based on partition idx, get KVS info
-        radixtree::KVS kvs = cluster.FindPartitions(nid)[idx];
+        radixtree::KVS kvs = slots[idx];
         for(auto i:kvs) {
             std::cout << i.first << ": " << i.second << std::endl;
         }
@@ -694,7 +746,17 @@ int main (int argc, char **argv) {
                     " your machine or less.\n");
         }
 
+        // cache policy, unless given with -o
+        if (cache_mode.empty() && kvs.count("cache_mode"))
+            cache_mode = kvs["cache_mode"];
+        if (version_mode.empty() && kvs.count("version_mode"))
+            version_mode = kvs["version_mode"];
+        if (Cache_SetPolicy(cache_mode, version_mode) != 0)
+            return 1;
+
         KVS_Init(kvs);
+    } else if (Cache_SetPolicy(cache_mode, version_mode) != 0) {
+        return 1;
     }
 
     if (settings.slab_chunk_size_max > settings.item_size_max) {
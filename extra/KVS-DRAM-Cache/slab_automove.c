@@ -88,11 +88,8 @@ void slab_automove_run(void *arg, int *src, int *dst) {
 	// In order to prevent preallocated slabs (slab number 1) for short cut 
 	// from being reassigned from slab maintainer, initial value for traversing slabs
 	// is started from (POWER_SMALLEST + 1).
-#if CACHE_MODE == 3
-    for (n = (POWER_SMALLEST + 1); n < MAX_NUMBER_OF_SLAB_CLASSES; n++) {
-#else
-    for (n = (POWER_SMALLEST); n < MAX_NUMBER_OF_SLAB_CLASSES; n++) {
-#endif
+    for (n = (settings.cache_mode == CACHE_MODE_HYBRID ? POWER_SMALLEST + 1 : POWER_SMALLEST);
+         n < MAX_NUMBER_OF_SLAB_CLASSES; n++) {
         int w_offset = n * a->window_size;
         struct window_data *wd = &a->window_data[w_offset + (a->window_cur % a->window_size)];
         memset(wd, 0, sizeof(struct window_data));
@@ -153,22 +153,22 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc, co
         }
 
 	}
-#if CACHE_MODE == 3
+	if (settings.cache_mode == CACHE_MODE_HYBRID) {
 //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-	size_t j;
-	// Slabs for short cut are preallocated
-	// In current implementation, preallocated slabs 
-	// for short cut is 50% of total cache size
-	for (j = 0; j < ((limit/(1024*1024UL)))/2; j++) {
-		if (do_slabs_newslab(1) == 0) {
-			fprintf(stderr, "Error while preallocating slab memory!\n"
-					"If using -L or other prealloc options, max memory must be "
-					"at least %d megabytes.\n", power_largest);
-			break;
+		size_t j;
+		// Slabs for short cut are preallocated
+		// In current implementation, preallocated slabs 
+		// for short cut is 50% of total cache size
+		for (j = 0; j < ((limit/(1024*1024UL)))/2; j++) {
+			if (do_slabs_newslab(1) == 0) {
+				fprintf(stderr, "Error while preallocating slab memory!\n"
+						"If using -L or other prealloc options, max memory must be "
+						"at least %d megabytes.\n", power_largest);
+				break;
+			}
 		}
-	}
 //>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-#endif
+	}
     if (prealloc) {
         slabs_preallocate(power_largest);
     }
@@ -915,6 +915,8 @@ static int slab_rebalance_move(void) {
                         /* These are definitely required. else fails assert */
                         new_it->it_flags &= ~ITEM_LINKED;
                         new_it->refcount = 0;
+                        /* the copy keeps any pending write-back */
+                        it->it_flags &= ~ITEM_DIRTY;
                         do_item_replace(it, new_it, hv);
                         /* Need to walk the chunks and repoint head  */
                         if (new_it->it_flags & ITEM_CHUNKED) {
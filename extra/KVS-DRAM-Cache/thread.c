@@ -707,25 +707,13 @@ void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out) {
 }
 
 /*
- * Initializes the thread subsystem, creating various worker threads.
- *
- * nthreads  Number of worker event handler threads to spawn
+ * Allocates the item lock table, sized to the number of threads that use the
+ * cache at once.
  */
-void memcached_thread_init(int nthreads) {
+static void item_locks_init(int nthreads) {
     int         i;
     int         power;
 
-    for (i = 0; i < POWER_LARGEST; i++) {
-        pthread_mutex_init(&lru_locks[i], NULL);
-    }
-    pthread_mutex_init(&worker_hang_lock, NULL);
-
-    pthread_mutex_init(&init_lock, NULL);
-    pthread_cond_init(&init_cond, NULL);
-
-    pthread_mutex_init(&cqi_freelist_lock, NULL);
-    cqi_freelist = NULL;
-
     /* Want a wide lock table, but don't waste memory */
     if (nthreads < 3) {
         power = 10;
@@ -760,6 +748,28 @@ void memcached_thread_init(int nthreads) {
     for (i = 0; i < item_lock_count; i++) {
         pthread_mutex_init(&item_locks[i], NULL);
     }
+}
+
+/*
+ * Initializes the thread subsystem, creating various worker threads.
+ *
+ * nthreads  Number of worker event handler threads to spawn
+ */
+void memcached_thread_init(int nthreads) {
+    int         i;
+
+    for (i = 0; i < POWER_LARGEST; i++) {
+        pthread_mutex_init(&lru_locks[i], NULL);
+    }
+    pthread_mutex_init(&worker_hang_lock, NULL);
+
+    pthread_mutex_init(&init_lock, NULL);
+    pthread_cond_init(&init_cond, NULL);
+
+    pthread_mutex_init(&cqi_freelist_lock, NULL);
+    cqi_freelist = NULL;
+
+    item_locks_init(nthreads);
 
     threads = calloc(nthreads, sizeof(LIBEVENT_THREAD));
     if (! threads) {
@@ -793,3 +803,82 @@ void memcached_thread_init(int nthreads) {
     pthread_mutex_unlock(&init_lock);
 }
 
+/* Local (library) mode: slots of application threads, and which of them are taken */
+static bool *local_taken;
+static int local_threads;
+
+/*
+ * Initializes the thread subsystem for local mode: no worker threads, no
+ * connections, but up to nthreads application threads that call into the
+ * cache directly, each of them with a slot of its own (its stats, logger and
+ * LRU bump buffer), taken with memcached_thread_register().
+ */
+void memcached_local_thread_init(int nthreads) {
+    int         i;
+
+    for (i = 0; i < POWER_LARGEST; i++) {
+        pthread_mutex_init(&lru_locks[i], NULL);
+    }
+    pthread_mutex_init(&worker_hang_lock, NULL);
+
+    pthread_mutex_init(&init_lock, NULL);
+    pthread_cond_init(&init_cond, NULL);
+
+    item_locks_init(nthreads);
+
+    threads = calloc(nthreads, sizeof(LIBEVENT_THREAD));
+    local_taken = calloc(nthreads, sizeof(bool));
+    if (! threads || ! local_taken) {
+        perror("Can't allocate thread descriptors");
+        exit(1);
+    }
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_mutex_init(&threads[i].stats.mutex, NULL) != 0) {
+            perror("Failed to initialize mutex");
+            exit(EXIT_FAILURE);
+        }
+    }
+    local_threads = nthreads;
+}
+
+/*
+ * Local mode: gives the calling thread a free slot, or NULL if there is none.
+ * A slot keeps its logger and bump buffer when it is released, for the next
+ * thread to take it.
+ */
+LIBEVENT_THREAD *memcached_thread_register(void) {
+    LIBEVENT_THREAD *me = NULL;
+    int i;
+
+    pthread_mutex_lock(&init_lock);
+    for (i = 0; i < local_threads; i++) {
+        if (!local_taken[i]) {
+            local_taken[i] = true;
+            me = &threads[i];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&init_lock);
+    if (me == NULL)
+        return NULL;
+
+    me->thread_id = pthread_self();
+    if (me->l == NULL) {
+        me->l = logger_create();
+        me->lru_bump_buf = item_lru_bump_buf_create();
+        if (me->l == NULL || me->lru_bump_buf == NULL) {
+            abort();
+        }
+    } else {
+        pthread_setspecific(logger_key, me->l);
+    }
+    return me;
+}
+
+void memcached_thread_unregister(LIBEVENT_THREAD *me) {
+    pthread_mutex_lock(&init_lock);
+    local_taken[me - threads] = false;
+    pthread_mutex_unlock(&init_lock);
+}
+
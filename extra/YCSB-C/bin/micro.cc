@@ -353,6 +353,8 @@ void *put_worker(void *thread_arg)
 
     //std::cout << "put " << start << " " << end << std::endl;
 
+    Cache_RegisterThread();
+
     HRTime tstart, tend;
     tstart = get_hrtime();
     int ret;
@@ -368,6 +370,7 @@ void *put_worker(void *thread_arg)
     tend = get_hrtime();
     // latency
     arg->latency = ((double)(diff_hrtime_us(tstart, tend)))/((double)(arg->record_cnt));
+    Cache_UnregisterThread();
 
     return NULL;
 }
@@ -388,6 +391,8 @@ void *get_worker(void *thread_arg)
     size_t val_len=arg->max_val_len;
     char *val_buf = new char[arg->max_val_len];
 
+    Cache_RegisterThread();
+
     HRTime tstart, tend;
     tstart = get_hrtime();
     int ret;
@@ -406,6 +411,7 @@ void *get_worker(void *thread_arg)
     tend = get_hrtime();
     // latency
     arg->latency = ((double)(diff_hrtime_us(tstart, tend)))/((double)(arg->record_cnt));
+    Cache_UnregisterThread();
 
     delete val_buf;
     return NULL;
@@ -484,7 +490,7 @@ void do_work(argument args, thread_argument *thread_args) {
 }
 
 void micro(argument args) {
-    KVS_Init(args.kvs_type, args.kvs_loc, args.kvs_path, "", args.kvs_size, args.cache_size);
+    KVS_Init(args.kvs_type, args.kvs_loc, args.kvs_path, "", args.kvs_size, args.cache_size, args.thread_cnt);
 
     HRTime start, end;
 
@@ -51,6 +51,43 @@ uint64_t DelegateLoadClient(ycsbc::DB *db, ycsbc::CoreWorkload *wl, utils::Prope
   return oks;
 }
 
+// loads num_ops records in batches of batch_size, each inserted at once with threads threads
+uint64_t BulkLoadClient(ycsbc::DB *db, ycsbc::CoreWorkload *wl, utils::Properties *props, const uint64_t num_ops, const uint64_t batch_size, const uint64_t threads) {
+  utils::Properties p=*props;
+  if(p["dbname"]=="kvs_server") {
+      db = ycsbc::DBFactory::CreateDB(p);
+      if (!db) {
+          cout << "Unknown database name " << p["dbname"] << endl;
+          exit(0);
+      }
+  }
+  db->Init();
+  uint64_t oks = 0;
+  vector<string> keys;
+  vector<vector<ycsbc::DB::KVPair>> values;
+  vector<uint64_t> key_nums;
+  for (uint64_t i = 0; i < num_ops; i += batch_size) {
+      uint64_t const n = min(batch_size, num_ops - i);
+      keys.resize(n);
+      values.assign(n, vector<ycsbc::DB::KVPair>());
+      key_nums.resize(n);
+      for (uint64_t j = 0; j < n; j++) {
+          keys[j] = wl->NextSequenceKey(key_nums[j]);
+          wl->BuildValues(values[j]);
+      }
+      if (db->BulkInsert(wl->NextTable(), keys, values, threads) == ycsbc::DB::kOK) {
+          oks += n;
+          for (uint64_t key_num : key_nums)
+              wl->AckSequenceKey(key_num);
+      }
+  }
+  db->Close();
+  if(p["dbname"]=="kvs_server") {
+      delete db;
+  }
+  return oks;
+}
+
 uint64_t DelegateRunClient(ycsbc::DB *db, ycsbc::CoreWorkload *wl, utils::Properties *props, const uint64_t num_ops, uint64_t &ops_so_far) {
   // ycsbc::CoreWorkload wl;
   // wl.InitRun(*props);
@@ -129,16 +166,24 @@ int main(const int argc, const char *argv[]) {
       wl.InitLoad(props);
       uint64_t *ops_so_far = new uint64_t[num_threads];
 
+      const uint64_t bulk_load = stoul(props.GetProperty("bulkload", "0"));
+
       utils::Timer<double> timer;
       timer.Start();
-      for (uint64_t i = 0; i < num_threads; ++i) {
-          if (i==num_threads-1) {
-              records_per_thread += remainder_records;
-          }
+      if (bulk_load > 0) {
+          // the threads work on one batch at a time instead
           actual_ops.emplace_back(async(launch::async,
-                                        DelegateLoadClient, db, &wl, &props, records_per_thread, std::ref(ops_so_far[i])));
+                                        BulkLoadClient, db, &wl, &props, total_records, bulk_load, num_threads));
+      } else {
+          for (uint64_t i = 0; i < num_threads; ++i) {
+              if (i==num_threads-1) {
+                  records_per_thread += remainder_records;
+              }
+              actual_ops.emplace_back(async(launch::async,
+                                            DelegateLoadClient, db, &wl, &props, records_per_thread, std::ref(ops_so_far[i])));
+          }
+          assert(actual_ops.size() == num_threads);
       }
-      assert(actual_ops.size() == num_threads);
 
       sum=0;
       for (auto &n : actual_ops) {
@@ -302,6 +347,14 @@ string ParseCommandLine(int argc, const char *argv[], utils::Properties &props)
         exit(0);
       }
       argindex++;
+    } else if (strcmp(argv[argindex], "-bulkload") == 0) {
+      argindex++;
+      if (argindex >= argc) {
+        UsageMessage(argv[0]);
+        exit(0);
+      }
+      props.SetProperty("bulkload", argv[argindex]);
+      argindex++;
     } else if (strcmp(argv[argindex], "-location") == 0) {
       argindex++;
       if (argindex >= argc) {
@@ -365,6 +418,7 @@ void UsageMessage(const char *command) {
   cout << "                   be specified, and will be processed in the order specified" << endl;
   cout << "  -mode modename: \"load\" - load data only; \"run\" - run benchmarks only (default: load and run)" << endl;
   cout << "  -location name: specify the location of the database, e.g., a root pointer" << endl;
+  cout << "  -bulkload n: load the records in bulk, n at a time (default: 0, one by one)" << endl;
 }
 
 inline bool StrStartWith(const char *str, const char *pre) {
@@ -93,6 +93,25 @@ class DB {
   /// @return Zero on success, a non-zero error code on error.
   ///
   virtual int Delete(const std::string &table, const std::string &key) = 0;
+  ///
+  /// Inserts a batch of records at once, for loading.
+  /// The default implementation inserts them one by one.
+  ///
+  /// @param table The name of the table.
+  /// @param keys The keys of the records to insert.
+  /// @param values For each key, a vector of field/value pairs to insert in the record.
+  /// @param threads The number of threads the DB may use.
+  /// @return Zero on success, a non-zero error code on error.
+  ///
+  virtual int BulkInsert(const std::string &table, std::vector<std::string> const &keys,
+                         std::vector<std::vector<KVPair>> &values, size_t threads) {
+    for (size_t i = 0; i < keys.size(); i++) {
+      int ret = Insert(table, keys[i], values[i]);
+      if (ret != kOK)
+        return ret;
+    }
+    return kOK;
+  }
   
   virtual ~DB() { }
 };
@@ -60,16 +60,17 @@ DB* DBFactory::CreateDB(utils::Properties &props) {
       const std::string nvmm_user = props.GetProperty("nvmm_user", "");
       const size_t nvmm_size = stoul(props.GetProperty("nvmm_size", "1073741824"));
       const size_t cache_size = stoul(props.GetProperty("cache_size", "268435456"));
+      const int threads = stoi(props.GetProperty("threadcount", "1"));
       
       // remember to re-build memcached with different CACHE and VERSION values
       if (props["dbname"] == "kvs_radixtree") {
-          return new KVS_CACHE(KeyValueStore::RADIX_TREE, location, nvmm_base, nvmm_user, nvmm_size, cache_size);
+          return new KVS_CACHE(KeyValueStore::RADIX_TREE, location, nvmm_base, nvmm_user, nvmm_size, cache_size, threads);
       }
       else if (props["dbname"] == "kvs_radixtree_tiny") {
-          return new KVS_CACHE_TINY(KeyValueStore::RADIX_TREE_TINY, location, nvmm_base, nvmm_user, nvmm_size, cache_size);
+          return new KVS_CACHE_TINY(KeyValueStore::RADIX_TREE_TINY, location, nvmm_base, nvmm_user, nvmm_size, cache_size, threads);
       }
       else if (props["dbname"] == "kvs_hashtable") {
-          return new KVS_CACHE(KeyValueStore::HASH_TABLE, location, nvmm_base, nvmm_user, nvmm_size, cache_size);
+          return new KVS_CACHE(KeyValueStore::HASH_TABLE, location, nvmm_base, nvmm_user, nvmm_size, cache_size, threads);
       }
       else
           return NULL;
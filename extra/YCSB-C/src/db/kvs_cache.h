@@ -30,9 +30,9 @@ namespace ycsbc {
 
 class KVS_CACHE : public DB {
  public:
-    KVS_CACHE(KeyValueStore::IndexType type, std::string root, std::string base, std::string user, size_t size, size_t cache_size) {
+    KVS_CACHE(KeyValueStore::IndexType type, std::string root, std::string base, std::string user, size_t size, size_t cache_size, int threads=1) {
         //std::cout << "KVS_CACHE() " << root << std::endl;
-        KVS_Init(type, root, base, user, size, cache_size);
+        KVS_Init(type, root, base, user, size, cache_size, threads);
     }
 
     ~KVS_CACHE() {
@@ -40,6 +40,15 @@ class KVS_CACHE : public DB {
         KVS_Final();
     }
 
+    // each client thread takes a cache thread slot of its own
+    void Init() {
+        Cache_RegisterThread();
+    }
+
+    void Close() {
+        Cache_UnregisterThread();
+    }
+
     int Read(const std::string &table, const std::string &key,
              const std::vector<std::string> *fields,
              std::vector<KVPair> &result) {
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "core/properties.h"
 
@@ -181,6 +182,28 @@ class KVSDB : public DB {
         return ret;
     }
 
+    int BulkInsert(const std::string &table, std::vector<std::string> const &keys,
+                   std::vector<std::vector<KVPair>> &values, size_t threads) {
+        // encode keys and values
+        std::vector<std::string> key_bufs, val_bufs;
+        for (size_t i = 0; i < keys.size(); i++) {
+            key_bufs.push_back(table+keys[i]);
+            assert(key_bufs.back().size()<=kvs_->MaxKeyLen());
+            std::stringstream ss;
+            {
+                cereal::BinaryOutputArchive oarchive(ss);
+                oarchive(values[i]);
+            }
+            val_bufs.push_back(ss.str());
+        }
+
+        std::vector<int> rets;
+        int ret = kvs_->BulkLoad(key_bufs, val_bufs, rets, threads);
+        if(ret!=0)
+            std::cout << "BULK INSERT error " << ret << std::endl;
+        return ret;
+    }
+
     int Delete(const std::string &table, const std::string &key) {
         //std::cout << "DELETE " << table << ' ' << key << std::endl;
 
@@ -216,56 +239,42 @@ class KVSDB : public DB {
         std::string end_key(KeyValueStore::OPEN_BOUNDARY_KEY, KeyValueStore::OPEN_BOUNDARY_KEY_SIZE);
         assert(end_key.size()<=kvs_->MaxKeyLen());
 
-        // value buf
-        static size_t const max_val_len = 4096;
-        char val_buf[max_val_len];
-        size_t val_len = max_val_len;
-
-        // key buf
-        static size_t const max_key_len = kvs_->MaxKeyLen();
-        char key_buf[max_key_len];
-        size_t key_len = max_key_len;
-
-        // scan
-        int iter;
-        int ret = kvs_->Scan(iter,
-                             key_buf, key_len,
-                             val_buf, val_len,
-                             begin_key.c_str(), begin_key.size(), true,
-                             end_key.c_str(), end_key.size(), false);
-        if(ret==0) {
-            // decode value
-            std::vector<KVPair> kvp;
-            std::stringstream ss;
-            ss.rdbuf()->pubsetbuf(val_buf, val_len);
-            {
-                cereal::BinaryInputArchive iarchive(ss);
-                iarchive(kvp);
-            }
-            result.push_back(kvp);
-            key_len = max_key_len;
-            val_len = max_val_len;
-        }
-        else
-            return ret; // TODO: return error?
-
-        while(--len) {
-            ret = kvs_->GetNext(iter,
-                                key_buf, key_len,
-                                val_buf, val_len);
-            if (ret!=0)
+        // record buf, reused across scans
+        static size_t const max_buf_len = 256*1024;
+        static thread_local std::vector<uint64_t> buf(max_buf_len/sizeof(uint64_t));
+
+        // scan, one batch of records at a time
+        bool begin_key_inclusive = true;
+        while(len>0) {
+            size_t buf_len = max_buf_len;
+            size_t cnt;
+            int ret = kvs_->ScanBatch(begin_key.c_str(), begin_key.size(), begin_key_inclusive,
+                                      end_key.c_str(), end_key.size(), false,
+                                      len, (char*)buf.data(), buf_len, cnt);
+            if(ret!=0) {
+                if(result.empty())
+                    return ret; // TODO: return error?
                 break;
-            // decode value
-            std::vector<KVPair> kvp;
-            std::stringstream ss;
-            ss.rdbuf()->pubsetbuf(val_buf, val_len);
-            {
-                cereal::BinaryInputArchive iarchive(ss);
-                iarchive(kvp);
             }
-            result.push_back(kvp);
-            key_len = max_key_len;
-            val_len = max_val_len;
+            char *p = (char*)buf.data();
+            KeyValueStore::ScanRecord *rec = nullptr;
+            for(size_t i=0; i<cnt; i++) {
+                rec = (KeyValueStore::ScanRecord*)p;
+                // decode value
+                std::vector<KVPair> kvp;
+                std::stringstream ss;
+                ss.rdbuf()->pubsetbuf(const_cast<char*>(rec->val()), rec->val_len);
+                {
+                    cereal::BinaryInputArchive iarchive(ss);
+                    iarchive(kvp);
+                }
+                result.push_back(kvp);
+                p += rec->size();
+            }
+            // the rest of the range (if any) did not fit; go on after the last key
+            begin_key.assign(rec->key(), rec->key_len);
+            begin_key_inclusive = false;
+            len -= (int)cnt;
         }
 
         //std::cout << "# of records: " << result.size() << " (" << len << ") " << std::endl;
@@ -230,6 +230,8 @@ class KVSDB_TINY : public DB {
             key_len = max_key_len;
             val_len = max_val_len;
         }
+        if (ret!=-2)
+            kvs_->CloseIter(iter); // stopped before the end of the range
 
         //std::cout << "# of records: " << result.size() << " (" << len << ") " << std::endl;
         // for(auto record: result) {
@@ -38,6 +38,7 @@ class ResourceManager;
 class PartitionManager;
 class NodeManager;
 class ServerManager;
+class ReplicaSelector;
 
 struct ResourceName {
     ResourceName(std::string name) {
@@ -81,12 +82,26 @@ public:
     void Final();
 
     // find resource
+    // random: pick one of the replicas, favoring those that have been answering faster (see
+    // StartRequest and FinishRequest); otherwise the "master" replica
     Location Locate(ResourceName resource, bool random=false);
 
-    // node ID -> KVS 
+    // find the partitions a range scan over [begin, end] must visit, one location per partition,
+    // in key order when partitions are range-partitioned; an empty end means +inf
+    std::vector<Location> LocateRange(ResourceName begin, ResourceName end, bool random=false);
+
+    // feedback for picking replicas: a request to loc starts; it is done after latency_us
+    // microseconds (failed: it did not succeed)
+    void StartRequest(Location const &loc);
+    void FinishRequest(Location const &loc, uint64_t latency_us, bool failed=false);
+    // loc is down: Locate() does not pick it again unless all the replicas are down
+    // return true if it was not marked failed before
+    bool MarkFailed(Location const &loc);
+
+    // node ID -> KVS, by slot (empty for a slot the node does not serve)
     std::vector<KVS> FindPartitions(NodeID nid);
 
-    // node ID -> Ports
+    // node ID -> Ports, by slot
     std::vector<uint64_t> FindPorts(NodeID nid);
 
     // print cluster state
@@ -97,6 +112,12 @@ private:
     PartitionManager *pmgr_;
     NodeManager *nmgr_;
     ServerManager *smgr_;
+    ReplicaSelector *selector_;
+
+    std::vector<std::vector<size_t>> replicas_; // partition id -> replica ids in selector_
+
+    Location LocatePartition(PartitionID pid, bool random);
+    Location LocateReplica(PartitionID pid, size_t nid_idx);
 };
 
 } // namespace radixtree
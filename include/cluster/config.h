@@ -31,6 +31,7 @@
 #include <iostream>
 #include <assert.h>
 #include <string>
+#include <vector>
 
 namespace radixtree {
 
@@ -53,10 +54,21 @@ public:
         MODC //
     };
 
+    // how keys are mapped to partitions
+    // HASH: by a stable hash of the key (CityHash64)
+    // RANGE: by key order; range i, the keys in [split_keys[i-1], split_keys[i]), goes to partition
+    // range_partitions[i] (by default, partition i)
+    enum class PartitionScheme {
+        INVALID, //
+        HASH, //
+        RANGE //
+    };
+
     Config()
         : shelf_base_(""), shelf_user_(""),
           partition_cnt_(0), server_cnt_(0), node_cnt_(0), kvs_type_(""), kvs_size_(0), cache_size_(0), 
-          replication_scheme_(ReplicationScheme::NO_REPLICATION)
+          partition_scheme_(PartitionScheme::HASH),
+          replication_scheme_(ReplicationScheme::NO_REPLICATION), vnode_cnt_(0)
         {
         }
 
@@ -100,6 +112,9 @@ public:
     ReplicationScheme str2rs(std::string str);
     std::string rs2str(ReplicationScheme rs);
 
+    PartitionScheme str2ps(std::string str);
+    std::string ps2str(PartitionScheme ps);
+
     void SetPartitionCnt(size_t partition_cnt) {
         partition_cnt_ = partition_cnt;
     }
@@ -132,6 +147,30 @@ public:
         server_thread_ = cnt;
     }
 
+    void SetPartitionScheme(PartitionScheme partition_scheme) {
+        partition_scheme_ = partition_scheme;
+    }
+
+    // for RANGE: partition_cnt-1 keys in strictly increasing order
+    void SetSplitKeys(std::vector<std::string> const &split_keys) {
+        split_keys_ = split_keys;
+    }
+
+    // for RANGE: a permutation of the partition ids, one per range (empty: range i -> partition i)
+    void SetRangePartitions(std::vector<PartitionID> const &range_partitions) {
+        range_partitions_ = range_partitions;
+    }
+
+    // for RANGE: split the range of partition pid at split_key, which has to be inside it; the
+    // upper part, [split_key, end of the range), goes to a new partition new_pid (partition_cnt)
+    // with the given KVS; with NO_REPLICATION, also a new node and server new_pid, on the address
+    // of the server of pid
+    // the keys of the upper part are to be moved to the new KVS first (see KVSMigration); the
+    // new config then takes effect once saved and reloaded by the clients
+    // return 0 (no error); -1 (error, e.g., split_key is not inside the range; the config is
+    // unchanged)
+    int SplitPartition(PartitionID pid, std::string split_key, KVS kvs, PartitionID &new_pid);
+
     void SetReplicationScheme(ReplicationScheme replication_scheme) {
         replication_scheme_ = replication_scheme;
     }
@@ -165,6 +204,17 @@ public:
         }
     }
 
+    // DYNAMO: place partitions on a consistent-hash ring with vnode_cnt virtual nodes per unit of
+    // node weight (0: partition pid goes to nodes pid, pid+1, ...)
+    void SetVnodeCnt(uint64_t vnode_cnt) {
+        vnode_cnt_ = vnode_cnt;
+    }
+
+    // a node of weight w gets w times as many virtual nodes (and partitions) as one of weight 1
+    void SetNodeWeight(NodeID nid, uint64_t weight) {
+        node_weight_[nid] = weight;
+    }
+
     size_t GetPartitionCnt() {
         return partition_cnt_;
     }
@@ -209,6 +259,23 @@ public:
         return server_;
     }
 
+    PartitionScheme GetPartitionScheme() {
+        return partition_scheme_;
+    }
+
+    std::vector<std::string> const &GetSplitKeys() {
+        return split_keys_;
+    }
+
+    std::vector<PartitionID> GetRangePartitions() {
+        if(!range_partitions_.empty())
+            return range_partitions_;
+        std::vector<PartitionID> range_partitions;
+        for(PartitionID pid=0; pid<partition_cnt_; pid++)
+            range_partitions.push_back(pid);
+        return range_partitions;
+    }
+
     ReplicationScheme GetReplicationScheme() {
         return replication_scheme_;
     }
@@ -217,6 +284,15 @@ public:
         return replication_factor_;
     }
 
+    uint64_t GetVnodeCnt() {
+        return vnode_cnt_;
+    }
+
+    uint64_t GetNodeWeight(NodeID nid) {
+        auto found = node_weight_.find(nid);
+        return found==node_weight_.end() ? 1 : found->second;
+    }
+
     // TODO: read current state from FAM
 
 private:
@@ -243,9 +319,19 @@ private:
     //std::map<NodeID, Port> node_;
     std::map<ServerID, Addr> server_;
 
+    PartitionScheme partition_scheme_;
+    std::vector<std::string> split_keys_;
+    std::vector<PartitionID> range_partitions_;
+
     ReplicationScheme replication_scheme_;
     uint64_t replication_factor_;
 
+    uint64_t vnode_cnt_;
+    std::map<NodeID, uint64_t> node_weight_;
+
+    bool IsValidPartitionScheme();
+    bool IsValidRing();
+
     int AddPartition(PartitionID pid, KVS kvs);
     int AddServer(ServerID sid, Addr ip);
     //int AddNode(NodeID nid, Port port);
@@ -31,7 +31,10 @@
 #include <string.h>
 #include <string>
 #include <cstddef> // size_t
+#include <memory> // shared_ptr
 #include <unordered_map>
+#include <vector>
+#include <mutex>
 #include <functional> // hash
 
 #include "cluster/config.h"
@@ -48,7 +51,7 @@ struct LocationHash {
     }
 };
 
-// TODO: the server map is NOT thread-safe
+// thread-safe: each server has a pool of connections, and a call takes one for its duration
 class KVSServer {
 public:
     KVSServer();
@@ -57,12 +60,39 @@ public:
     int Init (std::string config_file);
     void Final();
 
+    // switch to a new config file, e.g., after a partition split (see "kvs split"); calls already
+    // under way finish with the old one, and connections to servers are kept
+    // return 0 (no error); -1 (error, e.g., invalid config; the old one stays)
+    int Reload (std::string config_file);
+
+    // Get and Del return -2 if the key does not exist; a miss does not count against the server
     int Put (char const *key, size_t const key_len,
              char const *val, size_t const val_len);
     int Get (char const *key, size_t const key_len,
              char *val, size_t &val_len);
     int Del (char const *key, size_t const key_len);
 
+    // batched APIs
+    // the keys are grouped by server and each server gets all of its keys in one pipelined
+    // request, so a batch costs one round trip per server rather than one per key
+    // rets[i] is 0 (no error), -1 (error) or, for MultiGet, -2 (key does not exist)
+    // MultiPut: a store that a reachable server rejects (e.g., out of memory) is -1 for its key,
+    // and so is a key the memcached text protocol cannot carry (empty, too long, or with spaces or
+    // control characters)
+    // return 0 (no error; rets may still hold -2); -1 (error on some key)
+    int MultiPut (std::vector<std::string> const &keys,
+                  std::vector<std::string> const &vals,
+                  std::vector<int> &rets);
+    int MultiGet (std::vector<std::string> const &keys,
+                  std::vector<std::string> &vals,
+                  std::vector<int> &rets);
+
+    // servers a range scan over [begin_key, end_key] has to visit, one per partition that overlaps
+    // the range (every partition when keys are hash-partitioned), in key order when they are
+    // range-partitioned; end_key_len == 0 means +inf
+    std::vector<Location> LocateRange (char const *begin_key, size_t const begin_key_len,
+                                       char const *end_key, size_t const end_key_len);
+
     void PrintCluster();
     void WipeServers();
 
@@ -70,14 +100,24 @@ public:
     size_t MaxKeyLen() {return 40;}
 
 private:
-    std::unordered_map<Location, memcached_st*, LocationHash> servers_;
-    Config config_;
-    Cluster cluster_;
+    // MultiPut sends at most this many sets to a server before reading their replies
+    static size_t const kPipelineDepth = 1024;
+
+    class ServerPool; // the connections to one server
+    struct Batch; // the keys of a batched call that go to one server
+
+    std::mutex servers_lock_; // protects servers_ (the pools themselves are thread-safe)
+    std::unordered_map<Location, ServerPool*, LocationHash> servers_;
+    // replaced as a whole by Reload(); each call takes it once (std::atomic_load) and uses that
+    std::shared_ptr<Cluster> cluster_;
 
-    Location pick_a_server(char const *key, size_t const key_len);
+    Location pick_a_server(Cluster &cluster, char const *key, size_t const key_len);
     int server_init(Location loc);
     bool server_exist(Location loc);
-    memcached_st **get_server(char const *key, size_t const key_len);
+    ServerPool *get_server(Cluster &cluster, char const *key, size_t const key_len);
+    // pipelined: a socket instead of a libmemcached connection for each batch (MultiPut)
+    void group_by_server(Cluster &cluster, std::vector<std::string> const &keys,
+                         std::vector<size_t> const &idx, bool pipelined, std::vector<Batch> &batches);
 };
 
 }
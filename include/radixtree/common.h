@@ -114,6 +114,18 @@ inline bool operator!= (const TagGptr &pt1,
     return !(pt1 == pt2);
 }
 
+// for negative caching: where a lookup of a key that did not exist ended, i.e., a word in an
+// inner node that an insert of the key would have to change first; a null node means the
+// lookup cannot be revalidated
+struct KeyMiss {
+    KeyMiss() : node(0), offset(0), word(0), replaced(0) {}
+
+    Gptr node;
+    uint64_t offset;   // of the word in node
+    uint64_t word;     // its value at the time of the lookup
+    uint64_t replaced; // the replacement count of node at the time of the lookup
+};
+
 } // end radixtree
 
 #endif
@@ -27,6 +27,9 @@
 #define KVS_H
 
 #include <cstddef> // size_t
+#include <functional>
+#include <string>
+#include <vector>
 
 #include "nvmm/global_ptr.h" // GlobalPtr
 #include "radixtree/common.h" // TagGptr
@@ -54,6 +57,7 @@ public:
     };
 
     enum ErrorCode {
+        STALE_KEY_PTR=-3,
         KEY_DOES_NOT_EXIST=-2,
         ERROR=-1,
         NO_ERROR=0
@@ -77,6 +81,12 @@ public:
     // doing some maintenance work (e.g., free up memory that was delayed freed
     virtual void Maintenance () = 0;
 
+    // prune the key nodes that deleted keys leave behind, online (radixtree only); they are freed
+    // once no concurrent operation can see them any more
+    // return 0 with the number of key nodes pruned; -1 (error)
+    virtual int Compact (size_t &pruned)
+        {return -1;};
+
 
     // return the root global pointer of the kvs
     virtual nvmm::GlobalPtr Location () = 0;
@@ -106,8 +116,43 @@ public:
     // return 0 (key exists); -1 (error); -2 (key does not exist)
     virtual int Del (char const *key, size_t const key_len) = 0;
 
+    // zero-copy Get: the value is copied into the buffer that alloc(val_len) returns, once the
+    // value size is known (e.g., the data of a freshly allocated cache item); alloc is not called
+    // if there is no value, and it may return nullptr to give up, in which case Get returns -1
+    // the default implementations read into a temporary buffer first
+    typedef std::function<char *(size_t val_len)> ValAlloc;
+
+    // return 0 (key exists); -1 (error); -2 (key does not exist)
+    virtual int Get (char const *key, size_t const key_len, ValAlloc const &alloc);
+
+
+    // batched APIs
+    // rets[i] is what the single-key call returns for keys[i]; vals[i] is the value of keys[i]
+    // the default implementations simply loop over the single-key calls
+    // return 0 (no error; rets may still hold -2); -1 (error on some key)
+    virtual int MultiPut (std::vector<std::string> const &keys,
+                          std::vector<std::string> const &vals,
+                          std::vector<int> &rets);
+
+    virtual int MultiGet (std::vector<std::string> const &keys,
+                          std::vector<std::string> &vals,
+                          std::vector<int> &rets);
+
+    virtual int MultiDel (std::vector<std::string> const &keys,
+                          std::vector<int> &rets);
+
+    // bulk load: puts all the keys, as MultiPut does, to load a store that is empty (or holds
+    // few of the keys) in one go; the keys may come in any order, but sorted keys save a sort
+    // up to threads workers load at the same time (0: one per hardware thread)
+    // the default implementation is MultiPut
+    virtual int BulkLoad (std::vector<std::string> const &keys,
+                          std::vector<std::string> const &vals,
+                          std::vector<int> &rets, size_t threads=0);
+
 
     // scan APIs (radixtree only)
+    // an iterator handle is released once Scan or GetNext returns -2 (no more keys); a caller
+    // that stops before that must release it with CloseIter
     // return 0 (key exists); -1 (error); -2 (no key in range)
     virtual int Scan (int &iter_handle,
                       char *key, size_t &key_len,
@@ -124,6 +169,56 @@ public:
                         char *val, size_t &val_len)
         {return -1;};
 
+    // return 0 (released); -1 (error, e.g., the handle was already released)
+    virtual int CloseIter(int iter_handle)
+        {return -1;};
+
+    // a record in the buffer filled by ScanBatch: the key (key_len bytes) followed by the value
+    // (val_len bytes), right after the header; the next record starts at the next 8-byte
+    // boundary (size())
+    struct ScanRecord {
+        size_t key_len;
+        size_t val_len;
+
+        char *data() {return reinterpret_cast<char *>(this + 1);}
+        char const *key() const {return reinterpret_cast<char const *>(this + 1);}
+        char const *val() const {return key() + key_len;}
+        static size_t size(size_t key_len, size_t val_len)
+            {return (sizeof(ScanRecord) + key_len + val_len + 7) & ~(size_t)7;}
+        size_t size() const {return size(key_len, val_len);}
+    };
+
+    // batched scan: fills buf with the records of up to limit keys in range, in key order; the
+    // begin and end keys are as in Scan, and no iterator handle is held between calls
+    // buf (8-byte aligned) is buf_len bytes long; buf_len returns the bytes used and cnt the
+    // number of records
+    // a range that does not fit is continued with the last key returned as an exclusive begin key
+    // the default implementation runs Scan and GetNext
+    // return 0 (cnt > 0); -1 (error, e.g., the first record does not fit in buf, in which case
+    // buf_len returns its size); -2 (no key in range)
+    virtual int ScanBatch(char const *begin_key, size_t const begin_key_len,
+                          bool const begin_key_inclusive,
+                          char const *end_key, size_t const end_key_len,
+                          bool const end_key_inclusive,
+                          size_t const limit, char *buf, size_t &buf_len, size_t &cnt);
+
+    // parallel scan: the range is split into subranges that up to threads workers scan at the
+    // same time, calling f(worker, key, key_len, val, val_len) for every key in range; worker
+    // (0 to threads-1) tells which worker f runs on, e.g., to pick per-worker state
+    // ordered: f is called for one key at a time, in key order (subranges that are done before
+    // their turn are held in memory); otherwise the workers call f concurrently, and the keys of
+    // a subrange come in key order
+    // threads == 0: one worker per hardware thread
+    // return 0 (no error); -1 (error)
+    typedef std::function<void(size_t worker, char const *key, size_t key_len,
+                               char const *val, size_t val_len)> ScanCallback;
+    virtual int ParallelScan(char const *begin_key, size_t const begin_key_len,
+                             bool const begin_key_inclusive,
+                             char const *end_key, size_t const end_key_len,
+                             bool const end_key_inclusive,
+                             size_t threads, bool ordered, ScanCallback f)
+        {return -1;};
+
     static constexpr const char *OPEN_BOUNDARY_KEY = "\0";
     static constexpr const size_t OPEN_BOUNDARY_KEY_SIZE = 1;
 
@@ -142,8 +237,19 @@ public:
       structures to the caching layer
         - the caller is now responsible for checking if the returned key pointer and value pointer
       are valid or null
+      - Compact() may free the key node of a deleted key, so a key pointer is only good in the key
+      generation it was taken in: the caller reads KeyGen() before the call that returns the key
+      pointer, and passes it along (key_gen) with the key pointer
+        - the calls using key ptr return -3 (STALE_KEY_PTR) when the key node may be gone, and the
+      caller has to go back to the key
+        - NO_KEY_GEN skips the check, for callers that never run Compact()
     */
 
+    static uint64_t const NO_KEY_GEN = ~0ULL;
+
+    virtual uint64_t KeyGen()
+        {return 0;};
+
     // for non-cached put
     // return 0 with key_ptr and new val_ptr (no error)
     // return -1 (error)
@@ -156,7 +262,8 @@ public:
     // return 0 with new val_ptr (no error)
     // return -1 (error)
     virtual int Put (Gptr const key_ptr, TagGptr &val_ptr,
-                     char const *val, size_t const val_len)
+                     char const *val, size_t const val_len,
+                     uint64_t const key_gen=NO_KEY_GEN)
         {return -1;};
 
     // for non-cached Get
@@ -179,9 +286,30 @@ public:
     // NOTE: caller is responsible for checking if the returned val_ptr is null
     // NOTE: caller is responsible for checking if the given val_ptr matches the returned val_ptr
     virtual int Get (Gptr const key_ptr, TagGptr &val_ptr,
-                     char *val, size_t &val_len, bool get_value=false)
+                     char *val, size_t &val_len, bool get_value=false,
+                     uint64_t const key_gen=NO_KEY_GEN)
         {return -1;};
 
+    // zero-copy versions of the two Gets above (see ValAlloc); alloc is called when the above
+    // would return a value in val
+    virtual int Get (char const *key, size_t const key_len, ValAlloc const &alloc,
+                     Gptr &key_ptr, TagGptr &val_ptr);
+
+    virtual int Get (Gptr const key_ptr, TagGptr &val_ptr,
+                     ValAlloc const &alloc, bool get_value=false,
+                     uint64_t const key_gen=NO_KEY_GEN);
+
+    // for negative caching: the zero-copy Get with key_ptr above, plus, if the key node does not
+    // exist, a miss that Absent() can later check without a walk
+    // the default implementation gives a null miss, which is never absent
+    virtual int Get (char const *key, size_t const key_len, ValAlloc const &alloc,
+                     Gptr &key_ptr, TagGptr &val_ptr, KeyMiss &miss);
+
+    // return true if the key node of miss still does not exist
+    // return false if it may exist now (do a Get to find out)
+    virtual bool Absent (KeyMiss const &miss)
+        {return false;};
+
     // for non-cached Del
     // return 0 with key_ptr and val_ptr
     // - if key_ptr is null, key node is not found and there is no val_ptr
@@ -195,7 +323,8 @@ public:
     // for cached Del using key ptr
     // return 0 with val_ptr (key node found and val_ptr is set to null)
     // the value pointer of the key node will be set to null (even if it wae already null)
-    virtual int Del (Gptr const key_ptr, TagGptr &val_ptr)
+    virtual int Del (Gptr const key_ptr, TagGptr &val_ptr,
+                     uint64_t const key_gen=NO_KEY_GEN)
         {return -1;};
 
     virtual void ReportMetrics()
@@ -0,0 +1,222 @@
+/*
+ *  (c) Copyright 2016-2021 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This software is available to you under a choice of one of two
+ *  licenses. You may choose to be licensed under the terms of the
+ *  GNU Lesser General Public License Version 3, or (at your option)
+ *  later with exceptions included below, or under the terms of the
+ *  MIT license (Expat) available in COPYING file in the source tree.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#ifndef KVS_MIGRATION_H
+#define KVS_MIGRATION_H
+
+#include <atomic>
+#include <cstddef> // size_t
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "radixtree/kvs.h"
+
+namespace radixtree {
+
+// moves the keys in [begin_key, end_key) out of one KVS (src) into another (dst) while src keeps
+// serving, e.g., to split a hot partition
+//
+// a KVSMigration is a KeyValueStore that stands in for src while the migration is on: reads go
+// to src, and so do writes, but writes in the range are also tracked for dst:
+// 1. Start(): writes in the range are logged
+// 2. Copy(): a scan of the range in src is copied into dst
+// 3. CatchUp(): the log is replayed into dst until it is short; then, with writes in the range
+//    held for a moment, the rest is replayed and writes in the range go to both src and dst
+// 4. the caller flips the routing of the range to dst (e.g., Config::SplitPartition)
+// 5. Finish(): once no requests for the range go to src anymore, stop writing to dst;
+//    Purge() then frees the range in src
+//
+// the writes to a key and its log entries are ordered by a lock (one of kStripes, by key hash),
+// so replaying the log after the copy leaves dst with the latest value of every key
+// all writes to src must go through this object while the migration is on; the writes that take a
+// key pointer (for the DRAM caching layer) cannot tell which key they are for, so they return
+// STALE_KEY_PTR, and the caching layer goes back to the key
+class KVSMigration : public KeyValueStore {
+public:
+    static size_t const kStripes = 64;
+    // CatchUp() holds writes only once a pass over the log replays at most this many entries
+    static size_t const kCatchUpLogLen = 1024;
+    // scan buffer size for Copy() and Purge() (it grows for larger records)
+    static size_t const kCopyBufLen = 1024*1024;
+    // keys per ScanBatch() call of Copy() and Purge(), which page through the range from the last
+    // key returned; a batch is read in one go, so this bounds the work and memory of a call
+    static size_t const kScanBatchKeys = 4096;
+
+    // an empty begin_key (end_key) means -inf (+inf)
+    // src and dst are not owned
+    KVSMigration(KeyValueStore *src, KeyValueStore *dst,
+                 std::string begin_key, std::string end_key);
+    ~KVSMigration();
+
+    // return 0 (no error); -1 (error)
+    int Start();
+    int Copy();
+    int CatchUp();
+    int Finish();
+    int Purge();
+
+    /*
+      KeyValueStore APIs: as src, with the writes in the range tracked for dst
+    */
+    void Maintenance() {src_->Maintenance();}
+    nvmm::GlobalPtr Location() {return src_->Location();}
+    size_t MaxKeyLen() {return src_->MaxKeyLen();}
+    size_t MaxValLen() {return src_->MaxValLen();}
+
+    int Put (char const *key, size_t const key_len,
+             char const *val, size_t const val_len);
+    int Get (char const *key, size_t const key_len,
+             char *val, size_t &val_len)
+        {return src_->Get(key, key_len, val, val_len);}
+    int FindOrCreate(char const *key, size_t const key_len,
+                     char const *val, size_t const val_len,
+                     char *ret_val, size_t &ret_len);
+    int Del (char const *key, size_t const key_len);
+
+    int MultiGet (std::vector<std::string> const &keys,
+                  std::vector<std::string> &vals,
+                  std::vector<int> &rets)
+        {return src_->MultiGet(keys, vals, rets);}
+
+    int Scan (int &iter_handle,
+              char *key, size_t &key_len,
+              char *val, size_t &val_len,
+              char const *begin_key, size_t const begin_key_len,
+              bool const begin_key_inclusive,
+              char const *end_key, size_t const end_key_len,
+              bool const end_key_inclusive)
+        {return src_->Scan(iter_handle, key, key_len, val, val_len,
+                           begin_key, begin_key_len, begin_key_inclusive,
+                           end_key, end_key_len, end_key_inclusive);}
+    int GetNext(int iter_handle,
+                char *key, size_t &key_len,
+                char *val, size_t &val_len)
+        {return src_->GetNext(iter_handle, key, key_len, val, val_len);}
+    int CloseIter(int iter_handle)
+        {return src_->CloseIter(iter_handle);}
+    int ScanBatch(char const *begin_key, size_t const begin_key_len,
+                  bool const begin_key_inclusive,
+                  char const *end_key, size_t const end_key_len,
+                  bool const end_key_inclusive,
+                  size_t const limit, char *buf, size_t &buf_len, size_t &cnt)
+        {return src_->ScanBatch(begin_key, begin_key_len, begin_key_inclusive,
+                                end_key, end_key_len, end_key_inclusive,
+                                limit, buf, buf_len, cnt);}
+    int ParallelScan(char const *begin_key, size_t const begin_key_len,
+                     bool const begin_key_inclusive,
+                     char const *end_key, size_t const end_key_len,
+                     bool const end_key_inclusive,
+                     size_t threads, bool ordered, ScanCallback f)
+        {return src_->ParallelScan(begin_key, begin_key_len, begin_key_inclusive,
+                                   end_key, end_key_len, end_key_inclusive,
+                                   threads, ordered, f);}
+
+    void ReportMetrics() {src_->ReportMetrics();}
+
+    /*
+      for the DRAM caching layer: as above
+    */
+    uint64_t KeyGen() {return src_->KeyGen();}
+
+    int Put (char const *key, size_t const key_len,
+             char const *val, size_t const val_len,
+             Gptr &key_ptr, TagGptr &val_ptr);
+    int Put (Gptr const key_ptr, TagGptr &val_ptr,
+             char const *val, size_t const val_len,
+             uint64_t const key_gen=NO_KEY_GEN)
+        {return STALE_KEY_PTR;}
+
+    int Get (char const *key, size_t const key_len, ValAlloc const &alloc)
+        {return src_->Get(key, key_len, alloc);}
+    int Get (char const *key, size_t const key_len,
+             char *val, size_t &val_len,
+             Gptr &key_ptr, TagGptr &val_ptr)
+        {return src_->Get(key, key_len, val, val_len, key_ptr, val_ptr);}
+    int Get (Gptr const key_ptr, TagGptr &val_ptr,
+             char *val, size_t &val_len, bool get_value=false,
+             uint64_t const key_gen=NO_KEY_GEN)
+        {return src_->Get(key_ptr, val_ptr, val, val_len, get_value, key_gen);}
+    int Get (char const *key, size_t const key_len, ValAlloc const &alloc,
+             Gptr &key_ptr, TagGptr &val_ptr)
+        {return src_->Get(key, key_len, alloc, key_ptr, val_ptr);}
+    int Get (Gptr const key_ptr, TagGptr &val_ptr,
+             ValAlloc const &alloc, bool get_value=false,
+             uint64_t const key_gen=NO_KEY_GEN)
+        {return src_->Get(key_ptr, val_ptr, alloc, get_value, key_gen);}
+    int Get (char const *key, size_t const key_len, ValAlloc const &alloc,
+             Gptr &key_ptr, TagGptr &val_ptr, KeyMiss &miss)
+        {return src_->Get(key, key_len, alloc, key_ptr, val_ptr, miss);}
+    bool Absent (KeyMiss const &miss)
+        {return src_->Absent(miss);}
+
+    int Del (char const *key, size_t const key_len,
+             Gptr &key_ptr, TagGptr &val_ptr);
+    int Del (Gptr const key_ptr, TagGptr &val_ptr,
+             uint64_t const key_gen=NO_KEY_GEN)
+        {return STALE_KEY_PTR;}
+
+private:
+    enum State {
+        IDLE, // writes go to src only
+        LOGGING, // writes in the range are logged
+        DUAL_WRITE // writes in the range go to src and dst
+    };
+
+    struct LogEntry {
+        std::string key;
+        std::string val;
+        bool del;
+    };
+
+    struct Stripe {
+        std::mutex lock;
+        std::vector<LogEntry> log;
+    };
+
+    KeyValueStore *src_;
+    KeyValueStore *dst_;
+    std::string begin_key_;
+    std::string end_key_;
+    std::atomic<State> state_;
+    std::atomic<bool> dst_failed_; // a dual write to dst failed
+    Stripe stripes_[kStripes];
+
+    bool in_range(char const *key, size_t const key_len);
+    Stripe &stripe(char const *key, size_t const key_len);
+    void lock_all();
+    void unlock_all();
+    void set_state(State state);
+    // with the lock of s held, after a write of the key to src: logs it or writes it to dst
+    void track(Stripe &s, char const *key, size_t const key_len,
+               char const *val, size_t const val_len, bool del);
+    int replay(std::vector<LogEntry> const &log);
+    int scan(KeyValueStore *kvs, std::function<int(std::string const &key, std::string const &val)> f);
+};
+
+} // namespace radixtree
+
+#endif
@@ -27,12 +27,14 @@
 #define RADIX_TREE_H
 
 #include <functional>
-#include <stack>
+#include <string>
 #include <utility> // pair
+#include <vector>
 
 #include "nvmm/global_ptr.h"
 #include "nvmm/memory_manager.h"
 #include "nvmm/heap.h"
+#include "nvmm/epoch_manager.h"
 
 #include "radixtree/common.h"
 
@@ -44,6 +46,8 @@ using Gptr = nvmm::GlobalPtr;
 using Mmgr = nvmm::MemoryManager;
 using Heap = nvmm::Heap;
 
+class SlabHeap;
+
 typedef enum {
 
     FIND_OR_CREATE = 0,
@@ -72,11 +76,25 @@ public:
         std::string key; // current key
         TagGptr value; // current value
 
-        // traversal history
-        std::stack<std::pair<Gptr, uint64_t>> path;
+        // the replacement count of the current node when it was reached (see replaced_count())
+        uint64_t replaced;
+
+        // traversal history: the nodes above the current one, each with the byte of the child
+        // being visited and its replacement count when it was reached; if one of these counts
+        // has changed, the node may have been freed and get_next() starts over from the
+        // current key
+        // a vector, so that an Iter reused for another scan keeps its capacity
+        struct Step {
+            Gptr node;
+            uint64_t byte;
+            uint64_t replaced;
+        };
+        std::vector<Step> path;
     };
 
-    static const size_t MAX_KEY_LEN = 40;
+    // keys are stored in nodes sized to fit them; this only bounds the key
+    // buffers callers have to provide (e.g., for scan)
+    static const size_t MAX_KEY_LEN = 1024;
 
     // NOTE:
     // - an open key (inf) == '\0' and exclusive
@@ -88,10 +106,23 @@ public:
     static constexpr char const * OPEN_BOUNDARY_KEY = "\0";
     static const size_t OPEN_BOUNDARY_KEY_SIZE = 1;
 
+    // a value of up to MAX_INLINE_LEN bytes may live in the value word itself instead of behind
+    // a gptr (see KVSRadixTree::NewVal): INLINE_VALUE (bit 1, always clear in a heap gptr) marks
+    // it, bits 2-4 hold its length and the upper 7 bytes hold the value; such a word must not be
+    // dereferenced
+    static const size_t MAX_INLINE_LEN = 7;
+    static const uint64_t INLINE_VALUE = 2;
+    static bool inline_value(Gptr value) { return ((uint64_t)value & INLINE_VALUE) != 0; }
+
     // a radix tree is uniquely identified by the memory manager instance, the heap id, and the root pointer 
     // when Root=0, create a new radix tree with the provied memory manager and heap; get_root() will return the root pointer
     // when Root!=0, open an existing radix tree whose root pointer is Root, with the provied memory manager and heap
-    RadixTree(Mmgr *Mmgr, Heap *Heap, RadixTreeMetrics* Metrics, Gptr Root=0);
+    // inner nodes that are replaced when they grow are freed through the epoch manager, so concurrent
+    // callers should run inside an nvmm::EpochOp (as the KVS layer does)
+    // nodes are allocated through Slab, which is shared with whoever else allocates from Heap
+    // (e.g., the values of a KVS); when Slab=nullptr, the tree has a SlabHeap of its own
+    RadixTree(Mmgr *Mmgr, Heap *Heap, RadixTreeMetrics* Metrics, Gptr Root=0,
+              SlabHeap *Slab=nullptr);
     virtual ~RadixTree();
 
     // returns the root ptr of the radix tree
@@ -114,6 +145,48 @@ public:
     // returns old value if any; caller owns it
     TagGptr destroy (const char * key, const size_t key_size);
 
+    // batched put, get and destroy
+    // values[i] (old_values[i]) is what the single-key call returns for keys[i]
+    // the keys are processed in sorted order, so that the walk down to a common prefix of
+    // neighboring keys is shared
+    void put(std::vector<std::string> const &keys, std::vector<Gptr> const &values,
+             UpdateFlags update, std::vector<TagGptr> &old_values);
+    void get(std::vector<std::string> const &keys, std::vector<TagGptr> &values);
+
+    // interleaved batched get: up to width lookups are in flight at once; each one prefetches
+    // the next node on its path and then yields to the next lookup instead of waiting for it,
+    // so that the memory stalls of different lookups overlap
+    void get(std::vector<std::string> const &keys, std::vector<TagGptr> &values, size_t width);
+    void destroy(std::vector<std::string> const &keys, std::vector<TagGptr> &old_values);
+
+    // bulk load: puts keys[i] = values[i] as the batched put does with UPDATE, but the keys that
+    // fall into empty slots of the tree are built into subtrees bottom-up, and each subtree is
+    // persisted at once and then linked with a single cas; the other keys are put one by one
+    // the keys are sorted first, unless they already are; of equal keys the last one wins
+    // up to threads workers build the subtrees (split further when there are too few of them,
+    // e.g., when all the keys share a first byte) and put the other keys
+    // meant for loading a tree that is empty, or whose keys are mostly elsewhere
+    void load(std::vector<std::string> const &keys, std::vector<Gptr> const &values,
+              std::vector<TagGptr> &old_values, size_t threads=1);
+
+    // DRAM mirror of the upper levels of the tree: lookups by key (get(), getC(), destroy() and
+    // the interleaved batched get()) go through copies of the inner nodes of the first levels
+    // levels in DRAM, and start their walk in FAM from the node below them
+    // - a lookup may start from a node the mirror points to as long as the node's replacement
+    // count is what it was when the mirror was built: until then the node is still in the tree,
+    // maybe further down after a split; one FAM read checks that
+    // - that count is shared only with the nodes that hash to the same word, not with the whole
+    // tree, but it is still a read in place of the one the mirror saves at its deepest level, so
+    // a mirror of one level (the root) saves nothing; it pays off from two levels on
+    // - a lookup that does not find its key through the mirror (which may have missed an insert)
+    // walks again from the root
+    // - a stale mirror is rebuilt by a lookup once about as many lookups have walked from the
+    // root as the mirror has nodes
+    // the copies take up to budget bytes, the upper nodes first; levels=0 turns the mirror off
+    // (the default); lookups must run inside an epoch op, as old mirrors are freed through it
+    static const size_t MIRROR_BUDGET = 64 * 1024 * 1024;
+    void set_mirror(size_t levels, size_t budget=MIRROR_BUDGET);
+
     void list(std::function<void(const char*, const size_t, Gptr)> f);
 
     void structure();
@@ -126,9 +199,28 @@ public:
              const char * end_key, const size_t end_key_size, const bool end_key_inclusive);
 
     // return -1 if there is no next key
+    // the calls of one scan need not share an epoch op
     int get_next(Iter &iter,
                  char * key, size_t& key_size, TagGptr &value);
 
+    // batched scan: the keys in range (up to limit of them) and their values, in key order,
+    // gathered in one traversal; keys and values are overwritten
+    // unlike get_next(), this does not look out for replaced nodes, so concurrent callers
+    // must run it inside an epoch op
+    // returns -1 if there is no key in range
+    int scan_batch(std::vector<std::string> &keys, std::vector<TagGptr> &values, size_t limit,
+                   const char * begin_key, const size_t begin_key_size, const bool begin_key_inclusive,
+                   const char * end_key, const size_t end_key_size, const bool end_key_inclusive);
+
+    // for parallel scans
+    // bounds returns, in order, the keys that split the range into subranges at the child
+    // boundaries of the root, and of the second level too when the root alone gives fewer than
+    // min_parts subranges; bounds[i] is the (inclusive) begin key of the (i+1)-th subrange
+    // the subranges are only a hint for dividing up work: keys may come and go at any time
+    void scan_split(std::vector<std::string> &bounds, size_t min_parts,
+                    const char * begin_key, const size_t begin_key_size, const bool begin_key_inclusive,
+                    const char * end_key, const size_t end_key_size, const bool end_key_inclusive);
+
 
     /*
       for consistent DRAM caching
@@ -136,7 +228,7 @@ public:
       NOTE:
       - when we say "key did not exist", we mean the key NODE did not exist
       - when we say "key was deleted", we mean the key NODE still exists but the value pointer was
-      set to null with a valid version number
+      set to null with a valid version number (until compact() prunes the key node)
       - old_value is the previous value pointer in the key node before put or destroy, or null with
       version 0 if the key node did not exist
     */
@@ -161,6 +253,13 @@ public:
     // old value ptr could be null with a valid version if the key was deleted
     TagGptr getC(Gptr const key_ptr);
 
+    // same as getC(key) above; if the key did not exist, miss records where the lookup ended
+    std::pair<Gptr, TagGptr> getC(const char * key, const size_t key_size, KeyMiss &miss);
+
+    // false if the key of a miss may have been inserted since the lookup that returned it
+    // (true means it has not); no walk, just a few reads; must run inside an epoch op
+    bool absent(KeyMiss const &miss);
+
     // return both key ptr and new value ptr
     // old value ptr is returned through old_value
     // old value ptr could be null with a valid version if the key was deleted or the key did not exist
@@ -172,18 +271,55 @@ public:
     // old value ptr could be null with a valid version if the key was deleted
     TagGptr destroyC(Gptr const key_ptr, TagGptr &old_value);
 
+    // NOTE: the calls by key ptr above do nothing to a key node that compact() has pruned, and
+    // return its value, for which pruned() is true; the key ptr must not be used again
+
+    /*
+      compaction
+    */
+
+    // prunes the key nodes of keys that were deleted before the call, and swings out (or shrinks)
+    // the inner nodes that are left with a single child; runs alongside all other calls, and
+    // alongside other compactions
+    // unlinked nodes are freed through the epoch manager, so it must run inside an epoch op
+    // returns the number of key nodes pruned
+    size_t compact();
+
+    // the key generation, which changes with every compact(); read it before the call that returns
+    // a key ptr
+    uint64_t key_gen();
+
+    // true if a key ptr taken in key_gen cannot have been pruned (and freed) since; the key ptr is
+    // then safe to use until the end of the epoch op this is called in
+    bool key_ptr_valid(uint64_t key_gen);
+
+    // true if value is that of a pruned key node
+    static bool pruned(TagGptr value);
+
 private:
-    // when under high contention, current heap implementation may return 0 even if there is free
-    // space (false negative)
-    // our best option is to retry
-    static int const alloc_retry_cnt = 1000;
-    struct Node;
+    struct Node; // header shared by all node types
+    struct Leaf;
+    struct Node4;
+    struct Node16;
+    struct Node48;
+    struct Node256;
     struct TreeStructure;
+    struct Load; // state of a bulk load
+    struct Mirror; // a DRAM copy of the upper levels
+    struct Mirrors; // the current mirror, and the old ones that may still be read
+
+    // inner nodes visited by a lookup, with their prefix sizes
+    typedef std::vector<std::pair<Gptr, size_t>> Path;
 
     Mmgr *mmgr;
     Heap *heap;
+    SlabHeap *slab;
+    bool own_slab;
     RadixTreeMetrics *metrics;
     Gptr root;
+    nvmm::EpochManager *emgr;
+    Mirrors *mirrors;
+    uint64_t *replaced; // the replacement counts, in FAM (see replaced_count())
 
     RadixTree(const RadixTree&);              // disable copying
     RadixTree& operator=(const RadixTree&);   // disable assignment
@@ -193,6 +329,40 @@ private:
     //***************************
     // convert global address to local pointer
     void* toLocal(const Gptr &gptr);
+    Gptr alloc_node(size_t size);
+    void free_node(Gptr node, size_t size);
+    void retire(Gptr node);
+    uint64_t *replaced_count(Gptr node);
+    uint64_t replaced_of(Gptr *p, Gptr &seen);
+    bool path_valid(Iter const &iter);
+    uint64_t *key_gen_word();
+    TagGptr first_value(Gptr value);
+    Gptr new_leaf(const char *key, const size_t key_size, TagGptr value);
+    TagGptr value_of(Node *n);
+    TagGptr update_value(Gptr leaf_ptr, Gptr value, TagGptr &old_value);
+    bool unlink_leaf(Gptr *p, Gptr q);
+    void replace(Gptr *p, Gptr q);
+    size_t compact(Gptr *p, Gptr q, uint64_t before);
+    void shrink(Gptr *p, Gptr q);
+    void load_put(Load &l, size_t k);
+    void load_plan(Load &l, size_t lo, size_t hi, Gptr *p);
+    void load_split(Load &l, size_t lo, size_t hi, Gptr *slot, bool publish);
+    Gptr load_node(Load &l, size_t lo, size_t hi, std::vector<Gptr> &nodes,
+                   std::vector<std::pair<size_t, size_t>> &groups);
+    Gptr load_leaf(Load &l, size_t k, std::vector<Gptr> &nodes);
+    Gptr load_build(Load &l, size_t lo, size_t hi, std::vector<Gptr> &nodes);
+    void load_publish(Load &l, size_t lo, size_t hi, Gptr *p, Gptr q);
+    void free_subtree(Gptr q);
+    Gptr find_leaf(const char *key, const size_t key_size);
+    Gptr find_leaf(const char *key, const size_t key_size, Gptr q, size_t depth, Path *path);
+    Gptr find_leaf(std::string const &key, std::string const *prev_key, Path &path);
+    Gptr find_leaf(const char *key, const size_t key_size, KeyMiss &miss);
+    bool find_leaf_step(const char *key, const size_t key_size, Gptr &q, size_t &depth, Path *path);
+    void prefetch(Gptr q);
+    bool mirror_start(const char *key, const size_t key_size, Gptr &q, size_t &depth);
+    void mirror_build();
+    void mirror_count(bool hit);
+    Gptr find_or_create_leaf(const char *key, const size_t key_size, Gptr value, bool &created, TagGptr &first);
     void recursive_list(Gptr parent, std::function<void(const char*, const size_t, Gptr)> f, uint64_t &level, uint64_t &depth, uint64_t &value_cnt, uint64_t &node_cnt);
     void recursive_structure(Gptr parent, int level, TreeStructure& structure);
     bool lower_bound(Iter &iter);
@@ -202,7 +372,7 @@ private:
 		    bool flag_rec,
 		    char *ubuf,
 		    size_t ubuf_size);
-    int printNodeInfo(Node *n,
+    int printNodeInfo(const char *key,
 		    void *vptr,
 		    int level,
 		    bool flag_rec,
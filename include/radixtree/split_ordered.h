@@ -46,11 +46,14 @@ typedef nvmm::EpochOp Eop;
 
 class SplitOrderedList {
 public:
-    typedef char ByteKey[40];
     typedef uint64_t UKey;
     typedef uint64_t SoKey;
     typedef uint64_t Value;
 
+    // keys are stored in nodes sized to fit them; this only bounds the key
+    // buffers callers have to provide
+    static const size_t MAX_KEY_LEN = 1024;
+
     // A split ordered list is uniquely identified by the memory manager 
     // instance, the heap id, and the descriptor pointer.
     // When sld==0, create a new split ordered list with the provived memory 
@@ -64,19 +67,22 @@ public:
     // returns the descriptor ptr of the split list
     Gptr get_descriptor();
 
-    int FindOrInsert(Eop& op, const ByteKey& byte_key, const size_t byte_key_size, SplitOrderedList::Value& value);
+    // the inserts and Delete return -1 when the heap is out of memory for the
+    // key's node or its bucket; the list is unchanged
+
+    int FindOrInsert(Eop& op, const char *byte_key, const size_t byte_key_size, SplitOrderedList::Value& value);
 
-    int Insert(Eop& op, const ByteKey& key, const size_t byte_key_size, Value value);
+    int Insert(Eop& op, const char *byte_key, const size_t byte_key_size, Value value);
     
-    int InsertOrUpdate(Eop& op, const ByteKey& key, const size_t byte_key_size, Value value, Gptr* old_ptr);
+    int InsertOrUpdate(Eop& op, const char *byte_key, const size_t byte_key_size, Value value, Gptr* old_ptr);
 
     // returns 0 if not found
-    Value Find(Eop& op, const ByteKey& key, const size_t byte_key_size);
+    Value Find(Eop& op, const char *byte_key, const size_t byte_key_size);
 
     // returns old value if any; caller owns it
-    int Delete(Eop& op, const ByteKey& key, const size_t byte_key_size, Gptr* ocurptr);
+    int Delete(Eop& op, const char *byte_key, const size_t byte_key_size, Gptr* ocurptr);
 
-    void foreach(std::function<void(SplitOrderedList*, SplitOrderedList::ByteKey, size_t, SplitOrderedList::Value)> f);
+    void foreach(std::function<void(SplitOrderedList*, char*, size_t, SplitOrderedList::Value)> f);
 
     template<typename T>
     T* toLocal(const Gptr &gptr) 
@@ -101,11 +107,18 @@ private:
     template<typename T>
     Gptr toGlobal(T* ptr);
 
-    Value ListFind(Eop& op, TagGptr *head_tgptr, const ByteKey& byte_key, size_t byte_key_size, SoKey key, TagGptr **oprev_ptr, TagGptr  *ocur_ptr, TagGptr  *onext_ptr);
+    Value ListFind(Eop& op, TagGptr *head_tgptr, const char *byte_key, size_t byte_key_size, SoKey key, TagGptr **oprev_ptr, TagGptr  *ocur_ptr, TagGptr  *onext_ptr);
     int ListInsert(Eop& op, TagGptr *head_tgptr, TagGptr node_ptr, TagGptr *ocur_ptr);
-    int ListDelete(Eop& op, TagGptr *head_tgptr, const ByteKey& byte_key, size_t byte_key_size, SoKey key, TagGptr* ocur_ptr);
-
-    void InitializeBucket (Eop& op, uint64_t bucket);
+    int ListDelete(Eop& op, TagGptr *head_tgptr, const char *byte_key, size_t byte_key_size, SoKey key, TagGptr* ocur_ptr);
+
+    // these return -1 (NULL, 0) when the heap is out of memory
+    int InitializeBucket (Eop& op, uint64_t bucket);
+    // the list head of a bucket, in the segment of the bucket directory that holds it
+    TagGptr* BucketHead (uint64_t bucket);
+    // the same, with the bucket initialized
+    TagGptr* InitializedBucketHead (Eop& op, uint64_t bucket);
+    // the block in *slot, zeroed and installed first if there is none yet
+    Gptr InstallBlock (Gptr* slot, size_t size);
 };
 
 } // end radixtree
@@ -25,7 +25,6 @@
 
 #include <assert.h>
 #include <vector>
-#include <cstdlib> // rand()
 
 #include "cluster/cluster.h"
 #include "cluster/config.h"
@@ -34,11 +33,13 @@
 #include "partition_manager.h"
 #include "node_manager.h"
 #include "server_manager.h"
+#include "replica_selector.h"
 
 namespace radixtree {
 
 Cluster::Cluster()
-    : config_(nullptr), rmgr_(nullptr), pmgr_(nullptr), nmgr_(nullptr), smgr_(nullptr) {
+    : config_(nullptr), rmgr_(nullptr), pmgr_(nullptr), nmgr_(nullptr), smgr_(nullptr),
+      selector_(nullptr) {
 }
 
 Cluster::~Cluster() {
@@ -65,9 +66,24 @@ void Cluster::Init(Config &config) {
     smgr_ = new ServerManager(config_);
     assert(smgr_);
     smgr_->Init();
+
+    selector_ = new ReplicaSelector();
+    assert(selector_);
+    replicas_.resize(config_->GetPartitionCnt());
+    for(PartitionID pid=0; pid<replicas_.size(); pid++) {
+        size_t replica_cnt = pmgr_->FindNodes(pid).size();
+        for(size_t nid_idx=0; nid_idx<replica_cnt; nid_idx++)
+            replicas_[pid].push_back(selector_->Add(LocateReplica(pid, nid_idx)));
+    }
 }
 
 void Cluster::Final() {
+    if(selector_) {
+        delete selector_;
+        selector_=nullptr;
+    }
+    replicas_.clear();
+
     if(smgr_) {
         delete smgr_;
         smgr_=nullptr;
@@ -97,32 +113,54 @@ void Cluster::Final() {
 Location Cluster::Locate(ResourceName resource, bool random) {
     Resource r(resource.name);
     PartitionID pid = rmgr_->FindPartition(r);
+    return LocatePartition(pid, random);
+}
 
-    // pick a node and the correct port
-    // TODO, for now the mapping for DYNAMO is like this:
-    // pid -> [nid0, nid1, nid2]
-    // nid -> [port0, port1, port2]
-    NodeID nid;
-    size_t nid_idx;
+std::vector<Location> Cluster::LocateRange(ResourceName begin, ResourceName end, bool random) {
+    std::vector<Location> locs;
+    for(auto pid : rmgr_->FindPartitions(Resource(begin.name), Resource(end.name)))
+        locs.push_back(LocatePartition(pid, random));
+    return locs;
+}
+
+Location Cluster::LocatePartition(PartitionID pid, bool random) {
     if(random) {
-        // randomly pick a node
-        std::vector<NodeID> nids = pmgr_->FindNodes(pid);
-        nid_idx = std::rand()%nids.size();
-        nid = nids[nid_idx];
+        // pick a replica
+        return selector_->Select(replicas_[pid]);
     }
     else {
         // pick the "master" node
-        std::vector<NodeID> nids = pmgr_->FindNodes(pid);
-        nid_idx = 0;
-        nid = nids[nid_idx];
+        return LocateReplica(pid, 0);
     }
+}
+
+Location Cluster::LocateReplica(PartitionID pid, size_t nid_idx) {
+    // pick the node and the correct port
+    // for DYNAMO, a partition is on several nodes and a node serves several partitions:
+    // pid -> [nid0, nid1, nid2]
+    // nid -> [port0, port1, port2], port i serving the partition in slot i of the node (FindSlot)
+    std::vector<NodeID> nids = pmgr_->FindNodes(pid);
+    assert(nid_idx<nids.size());
+    NodeID nid = nids[nid_idx];
     Node n = nmgr_->GetNode(nid);
     ServerID sid = nmgr_->FindServer(nid);
     Server s = smgr_->GetServer(sid);
-    size_t port_idx = n.ports.size()>1?nid_idx:0;
+    size_t port_idx = n.ports.size()>1?pmgr_->FindSlot(nid, pid):0;
     return Location(s.ip, n.ports[port_idx]);
 }
 
+void Cluster::StartRequest(Location const &loc) {
+    selector_->Start(loc);
+}
+
+void Cluster::FinishRequest(Location const &loc, uint64_t latency_us, bool failed) {
+    selector_->Finish(loc, latency_us, failed);
+}
+
+bool Cluster::MarkFailed(Location const &loc) {
+    return selector_->MarkFailed(loc);
+}
+
 std::vector<uint64_t> Cluster::FindPorts(NodeID nid) {
     return nmgr_->GetNode(nid).ports;
 }
@@ -137,6 +175,7 @@ void Cluster::Print() {
     pmgr_->Print();
     nmgr_->Print();
     smgr_->Print();
+    selector_->Print();
 }
 
 } // namespace radixtree
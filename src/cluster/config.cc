@@ -1,7 +1,10 @@
+#include <algorithm> // find
 #include <cstddef> // size_t
+#include <cstdio> // rename, remove
 #include <map>
 #include <iostream>
 #include <fstream>
+#include <vector>
 
 #include "cluster/config.h"
 #include "yaml-cpp/yaml.h"
@@ -144,6 +147,22 @@ int Config::LoadConfigFile(std::string path) {
     if(kvs["server_thread"]) {
         SetServerThread(kvs["server_thread"].as<uint64_t>());
     }
+    if(kvs["partition_scheme"]) {
+        std::string str = kvs["partition_scheme"].as<std::string>();
+        PartitionScheme ps = str2ps(str);
+        if(ps==PartitionScheme::INVALID) {
+            std::cout << "Invalid partition_scheme" << std::endl;
+            ret=-1;
+        }
+        else
+            SetPartitionScheme(ps);
+    }
+    if(kvs["split_keys"]) {
+        SetSplitKeys(kvs["split_keys"].as<std::vector<std::string>>());
+    }
+    if(kvs["range_partitions"]) {
+        SetRangePartitions(kvs["range_partitions"].as<std::vector<PartitionID>>());
+    }
     if(kvs["replication_scheme"]) {
         std::string str = kvs["replication_scheme"].as<std::string>();
         ReplicationScheme rs = str2rs(str);
@@ -157,6 +176,15 @@ int Config::LoadConfigFile(std::string path) {
     if(kvs["replication_factor"]) {
         SetReplicationFactor(kvs["replication_factor"].as<uint64_t>());
     }
+    if(kvs["vnode_cnt"]) {
+        SetVnodeCnt(kvs["vnode_cnt"].as<uint64_t>());
+    }
+    if(kvs["node_weights"]) {
+        YAML::Node const &config = kvs["node_weights"];
+        for (YAML::const_iterator i=config.begin(); i!=config.end(); i++) {
+            SetNodeWeight(NodeID(i->first.as<uint64_t>()), i->second.as<uint64_t>());
+        }
+    }
     if(kvs["partitions"]) {
         YAML::Node const &config = kvs["partitions"];
         for (YAML::const_iterator i=config.begin(); i!=config.end(); i++) {
@@ -240,12 +268,35 @@ int Config::SaveConfigFile(std::string path) {
     out << YAML::Key << "server_thread";
     out << YAML::Value << server_thread_;
 
+    out << YAML::Key << "partition_scheme";
+    out << YAML::Value << ps2str(partition_scheme_);
+
+    if(!split_keys_.empty()) {
+        out << YAML::Key << "split_keys";
+        out << YAML::Value << split_keys_;
+    }
+
+    if(!range_partitions_.empty()) {
+        out << YAML::Key << "range_partitions";
+        out << YAML::Value << YAML::Flow << range_partitions_;
+    }
+
     out << YAML::Key << "replication_scheme";
     out << YAML::Value << rs2str(replication_scheme_);
 
     out << YAML::Key << "replication_factor";
     out << YAML::Value << replication_factor_;
 
+    if(vnode_cnt_>0) {
+        out << YAML::Key << "vnode_cnt";
+        out << YAML::Value << vnode_cnt_;
+    }
+
+    if(!node_weight_.empty()) {
+        out << YAML::Key << "node_weights";
+        out << YAML::Value << node_weight_;
+    }
+
     out << YAML::Key << "partitions";
     out << YAML::Value << partition_;
 
@@ -261,8 +312,20 @@ int Config::SaveConfigFile(std::string path) {
     out << YAML::EndMap; // root
 
 
-    std::ofstream fout(path);
-    fout << out.c_str() << std::endl;
+    // write a new file and rename it over the old one, so that a reader never sees half a config
+    std::string tmp_path = path+".tmp";
+    {
+        std::ofstream fout(tmp_path);
+        fout << out.c_str() << std::endl;
+        if(!fout)
+            ret=-1;
+    }
+    if(ret==0 && rename(tmp_path.c_str(), path.c_str())!=0)
+        ret=-1;
+    if(ret!=0) {
+        std::cout << "Failed to save " << path << std::endl;
+        remove(tmp_path.c_str());
+    }
 
     return ret;
 }
@@ -281,6 +344,42 @@ int Config::UpdateRoot(PartitionID pid, std::string root) {
     return 0;
 }
 
+int Config::SplitPartition(PartitionID pid, std::string split_key, KVS kvs, PartitionID &new_pid) {
+    if(partition_scheme_!=PartitionScheme::RANGE)
+        return -1;
+
+    std::vector<PartitionID> range_partitions = GetRangePartitions();
+    auto found = std::find(range_partitions.begin(), range_partitions.end(), pid);
+    if(found==range_partitions.end())
+        return -1;
+    size_t idx = found - range_partitions.begin();
+    // range idx is [split_keys_[idx-1], split_keys_[idx])
+    if(idx>0 && !(split_keys_[idx-1] < split_key))
+        return -1;
+    if(idx<split_keys_.size() && !(split_key < split_keys_[idx]))
+        return -1;
+
+    // make the change on a copy, and take it only if it is valid
+    Config config(*this);
+    new_pid = partition_cnt_;
+    config.split_keys_.insert(config.split_keys_.begin()+idx, split_key);
+    range_partitions.insert(range_partitions.begin()+idx+1, new_pid);
+    config.range_partitions_ = range_partitions;
+    config.partition_cnt_++;
+    if(replication_scheme_==ReplicationScheme::NO_REPLICATION) {
+        // one node and one server per partition: the new one runs where pid does
+        auto server = server_.find(ServerID(pid));
+        if(server==server_.end() || config.AddServer(ServerID(new_pid), server->second)!=0)
+            return -1;
+        config.node_cnt_++;
+        config.server_cnt_++;
+    }
+    if(config.AddPartition(new_pid, kvs)!=0 || !config.IsValid())
+        return -1;
+    *this = config;
+    return 0;
+}
+
 int Config::AddPartition(PartitionID pid, KVS kvs) {
     auto found = partition_.find(pid);
     if(found==partition_.end()) {
@@ -335,8 +434,23 @@ void Config::Print() {
     std::cout << "- server_cnt: " << server_cnt_ << std::endl;
     std::cout << "- node_cnt: " << node_cnt_ << std::endl;
     std::cout << "- starting_port: " << starting_port_ << std::endl;
+    std::cout << "- partition_scheme: " << ps2str(partition_scheme_) << std::endl;
+    std::cout << "- split_keys: " << std::endl;
+    for(auto &k:split_keys_) {
+        std::cout << "  " << k << std::endl;
+    }
+    std::cout << "- range_partitions: ";
+    for(auto pid:GetRangePartitions()) {
+        std::cout << pid << " ";
+    }
+    std::cout << std::endl;
     std::cout << "- replication_scheme: " << (int)replication_scheme_ << std::endl;
     std::cout << "- replication_factor: " << replication_factor_ << std::endl;
+    std::cout << "- vnode_cnt: " << vnode_cnt_ << std::endl;
+    std::cout << "- node_weights: " << std::endl;
+    for(auto i:node_weight_) {
+        std::cout << "  " << i.first << ": " << i.second << std::endl;
+    }
     std::cout << "- kvs_type: " << kvs_type_ << std::endl;
     std::cout << "- kvs_size: " << kvs_size_ << std::endl;
     std::cout << "- cache_size: " << cache_size_ << std::endl;
@@ -363,7 +477,49 @@ bool Config::IsValid() {
         partition_.size() == partition_cnt_ &&
         //node_.size() == node_cnt_ &&
         server_.size() == server_cnt_ &&
-        server_cnt_ >= replication_factor_ && replication_scheme_!=ReplicationScheme::INVALID;
+        server_cnt_ >= replication_factor_ && replication_scheme_!=ReplicationScheme::INVALID &&
+        IsValidPartitionScheme() && IsValidRing();
+}
+
+bool Config::IsValidRing() {
+    if(vnode_cnt_==0)
+        return node_weight_.empty();
+    if(replication_scheme_!=ReplicationScheme::DYNAMO)
+        return false;
+    for(auto i:node_weight_) {
+        if(i.first>=node_cnt_ || i.second==0)
+            return false;
+    }
+    return true;
+}
+
+bool Config::IsValidPartitionScheme() {
+    switch(partition_scheme_) {
+    case PartitionScheme::HASH:
+        return true;
+    case PartitionScheme::RANGE:
+        if(split_keys_.size()+1 != partition_cnt_)
+            return false;
+        for(size_t i=1; i<split_keys_.size(); i++) {
+            if(!(split_keys_[i-1] < split_keys_[i]))
+                return false;
+        }
+        if(!range_partitions_.empty()) {
+            // a permutation of 0 .. partition_cnt_-1
+            if(range_partitions_.size() != partition_cnt_)
+                return false;
+            std::vector<bool> seen(partition_cnt_, false);
+            for(auto pid:range_partitions_) {
+                if(pid>=partition_cnt_ || seen[pid])
+                    return false;
+                seen[pid]=true;
+            }
+        }
+        return true;
+    case PartitionScheme::INVALID:
+    default:
+        return false;
+    }
 }
 
 Config::ReplicationScheme Config::str2rs(std::string str) {
@@ -395,4 +551,25 @@ std::string Config::rs2str(Config::ReplicationScheme rs) {
     }
 }
 
+Config::PartitionScheme Config::str2ps(std::string str) {
+    if(str == "HASH" || str == "hash")
+        return PartitionScheme::HASH;
+    else if(str == "RANGE" || str == "range")
+        return PartitionScheme::RANGE;
+    else
+        return PartitionScheme::INVALID;
+}
+
+std::string Config::ps2str(Config::PartitionScheme ps) {
+    switch(ps) {
+    case PartitionScheme::HASH:
+        return "HASH";
+    case PartitionScheme::RANGE:
+        return "RANGE";
+    case PartitionScheme::INVALID:
+    default:
+        return "INVALID";
+    }
+}
+
 } // namespace radixtree
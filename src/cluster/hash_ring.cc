@@ -0,0 +1,69 @@
+/*
+ *  (c) Copyright 2016-2017, 2021 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This software is available to you under a choice of one of two
+ *  licenses. You may choose to be licensed under the terms of the
+ *  GNU Lesser General Public License Version 3, or (at your option)
+ *  later with exceptions included below, or under the terms of the
+ *  MIT license (Expat) available in COPYING file in the source tree.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <assert.h>
+#include <algorithm> // sort, upper_bound, find
+
+#include "city.h"
+#include "hash_ring.h"
+
+namespace radixtree {
+
+HashRing::HashRing()
+    : node_cnt_(0) {
+}
+
+HashRing::~HashRing() {
+}
+
+void HashRing::AddNode(NodeID nid, size_t point_cnt) {
+    for(size_t i=0; i<point_cnt; i++) {
+        std::string point = std::to_string(nid)+"#"+std::to_string(i);
+        points_.push_back(std::make_pair(CityHash64(point.data(), point.size()), nid));
+    }
+    std::sort(points_.begin(), points_.end());
+    if(point_cnt>0)
+        node_cnt_++;
+}
+
+std::vector<NodeID> HashRing::FindNodes(std::string const &name, size_t cnt) {
+    std::vector<NodeID> nids;
+    if(points_.empty())
+        return nids;
+    cnt = std::min(cnt, node_cnt_);
+    uint64_t hash = CityHash64(name.data(), name.size());
+    auto it = std::upper_bound(points_.begin(), points_.end(),
+                               std::make_pair(hash, (NodeID)-1));
+    while(nids.size()<cnt) {
+        if(it==points_.end())
+            it=points_.begin();
+        if(std::find(nids.begin(), nids.end(), it->second)==nids.end())
+            nids.push_back(it->second);
+        it++;
+    }
+    return nids;
+}
+
+} // namespace radixtree
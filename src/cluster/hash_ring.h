@@ -0,0 +1,63 @@
+/*
+ *  (c) Copyright 2016-2017, 2021 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This software is available to you under a choice of one of two
+ *  licenses. You may choose to be licensed under the terms of the
+ *  GNU Lesser General Public License Version 3, or (at your option)
+ *  later with exceptions included below, or under the terms of the
+ *  MIT license (Expat) available in COPYING file in the source tree.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#ifndef HASH_RING_H
+#define HASH_RING_H
+
+#include <cstddef> // size_t
+#include <string>
+#include <utility> // pair
+#include <vector>
+
+#include "cluster/config.h"
+
+namespace radixtree {
+
+// consistent-hash ring: every node has a number of points (virtual nodes) on the ring, and an
+// object goes to the nodes that own the first points clockwise from its hash
+// adding or removing a node only moves the objects next to its points, i.e., about 1/N of them
+class HashRing {
+public:
+    HashRing();
+    ~HashRing();
+
+    // add a node with point_cnt points
+    void AddNode(NodeID nid, size_t point_cnt);
+
+    // the first (up to) cnt distinct nodes clockwise from the hash of name
+    std::vector<NodeID> FindNodes(std::string const &name, size_t cnt);
+
+    size_t Size() {
+        return points_.size();
+    }
+
+private:
+    std::vector<std::pair<uint64_t, NodeID>> points_; // sorted by hash
+    size_t node_cnt_;
+};
+
+} // namespace radixtree
+
+#endif
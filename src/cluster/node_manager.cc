@@ -59,6 +59,19 @@ void NodeManager::Init() {
             node_[nid]=Node(ports);
         }
     }
+    else if(replication_scheme_ == Config::ReplicationScheme::DYNAMO && config_->GetVnodeCnt()>0) {
+        // a port for every partition (its slot, see FindSlot), from a base port of the node's own,
+        // so adding or removing a node changes no port of the others; only the ports of the
+        // partitions the node serves are used
+        size_t partition_cnt = config_->GetPartitionCnt();
+        for(NodeID nid=0; nid<node_cnt_; nid++) {
+            std::vector<Port> ports;
+            for(PartitionID pid=0; pid<partition_cnt; pid++) {
+                ports.push_back(starting_port_+nid*partition_cnt+pid);
+            }
+            node_[nid]=Node(ports);
+        }
+    }
     else if(replication_scheme_ == Config::ReplicationScheme::DYNAMO) {
         // 1+ partitions per node
         for(NodeID nid=0; nid<node_cnt_; nid++) {
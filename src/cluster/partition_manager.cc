@@ -24,11 +24,14 @@
  */
 
 #include <assert.h>
+#include <algorithm> // find
 #include <map>
 #include <iostream>
+#include <string>
 
 #include "cluster/config.h"
 #include "partition_manager.h"
+#include "hash_ring.h"
 
 namespace radixtree {
 
@@ -45,6 +48,7 @@ void PartitionManager::Init() {
     node_cnt_ = config_->GetNodeCnt();
     replication_scheme_ = config_->GetReplicationScheme();
     replication_factor_ = config_->GetReplicationFactor();
+    vnode_cnt_ = config_->GetVnodeCnt();
 
     // load kvs info from config
     for(auto &p:config_->GetPartitions()) {
@@ -63,6 +67,17 @@ void PartitionManager::Init() {
             }
         }
     }
+    else if(replication_scheme_ == Config::ReplicationScheme::DYNAMO && vnode_cnt_>0) {
+        // consistent hashing: the replicas of a partition are on the first nodes clockwise from
+        // it on the ring, so adding or removing a node moves only about 1/N of the partitions
+        HashRing ring;
+        for(NodeID nid=0; nid<node_cnt_; nid++) {
+            ring.AddNode(nid, vnode_cnt_*config_->GetNodeWeight(nid));
+        }
+        for(PartitionID pid=0; pid<partition_cnt_; pid++) {
+            partition2node_[pid] = ring.FindNodes(std::to_string(pid), replication_factor_);
+        }
+    }
     else if(replication_scheme_ == Config::ReplicationScheme::DYNAMO) {
         for(PartitionID pid=0; pid<partition_cnt_; pid++) {
             for(uint64_t r=0; r<replication_factor_; r++) {
@@ -91,6 +106,13 @@ void PartitionManager::Init() {
             }
         }
     }
+    else if(replication_scheme_ == Config::ReplicationScheme::DYNAMO && vnode_cnt_>0) {
+        for(PartitionID pid=0; pid<partition_cnt_; pid++) {
+            for(NodeID nid:partition2node_[pid]) {
+                node2partition_[nid].push_back(pid);
+            }
+        }
+    }
     else if(replication_scheme_ == Config::ReplicationScheme::DYNAMO) {
         for(NodeID nid=0; nid<node_cnt_; nid++) {
             for(uint64_t r=0; r<replication_factor_; r++) {
@@ -140,6 +162,14 @@ std::vector<KVS> PartitionManager::FindPartitionsByNode(NodeID n) {
     if(replication_scheme_ == Config::ReplicationScheme::NO_REPLICATION) {
         ret.push_back(partition_[(PartitionID)n]);
     }
+    else if(replication_scheme_ == Config::ReplicationScheme::DYNAMO && vnode_cnt_>0) {
+        ret.resize(partition_cnt_);
+        if(node2partition_.find(n)!=node2partition_.end()) {
+            for(auto const &p:node2partition_[n]) {
+                ret[p] = partition_[p];
+            }
+        }
+    }
     else {
         if(node2partition_.find(n)!=node2partition_.end()) {
             for(auto const &p:node2partition_[n]) {
@@ -150,6 +180,23 @@ std::vector<KVS> PartitionManager::FindPartitionsByNode(NodeID n) {
     return ret;
 }
 
+size_t PartitionManager::FindSlot(NodeID n, PartitionID p) {
+    if(replication_scheme_ == Config::ReplicationScheme::DYNAMO && vnode_cnt_>0) {
+        // the partition itself, which does not depend on the other partitions of the node
+        auto found = node2partition_.find(n);
+        assert(found!=node2partition_.end());
+        assert(std::find(found->second.begin(), found->second.end(), p)!=found->second.end());
+        (void)found;
+        return (size_t)p;
+    }
+    else {
+        // the r-th replica of a partition is on port r of its node
+        std::vector<NodeID> nids = FindNodes(p);
+        auto slot = std::find(nids.begin(), nids.end(), n);
+        assert(slot!=nids.end());
+        return slot-nids.begin();
+    }
+}
 
 void PartitionManager::Print() {
     std::cout << "PartitionManager " << std::endl;
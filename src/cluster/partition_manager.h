@@ -44,8 +44,15 @@ public:
     NodeID FindNode(PartitionID p);
     std::vector<NodeID> FindNodes(PartitionID p);
 
+    // the partitions node n serves, by slot; with vnodes, a slot per partition, and the ones of the
+    // partitions it does not serve are empty
     std::vector<KVS> FindPartitionsByNode(NodeID n);
 
+    // the slot of partition p on node n, which is also the index of the port node n serves it on:
+    // the replica index of n for p, or, with vnodes, p itself, so that the slots of a node stay
+    // the same when other nodes come and go
+    size_t FindSlot(NodeID n, PartitionID p);
+
     void Print();
 private:
     Config *config_;
@@ -53,6 +60,7 @@ private:
     size_t node_cnt_;
     Config::ReplicationScheme replication_scheme_;
     uint64_t replication_factor_;
+    uint64_t vnode_cnt_;
 
     std::map<PartitionID, KVS> partition_;
     std::map<PartitionID, std::vector<NodeID>> partition2node_;
@@ -0,0 +1,152 @@
+/*
+ *  (c) Copyright 2016-2017, 2021 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This software is available to you under a choice of one of two
+ *  licenses. You may choose to be licensed under the terms of the
+ *  GNU Lesser General Public License Version 3, or (at your option)
+ *  later with exceptions included below, or under the terms of the
+ *  MIT license (Expat) available in COPYING file in the source tree.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <assert.h>
+#include <algorithm> // min, max
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include "cluster/cluster.h"
+#include "replica_selector.h"
+
+namespace radixtree {
+
+static uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ReplicaSelector::ReplicaSelector(uint64_t decay_us)
+    : decay_us_(decay_us) {
+}
+
+ReplicaSelector::~ReplicaSelector() {
+}
+
+size_t ReplicaSelector::Add(Location const &loc) {
+    auto key = std::make_pair(loc.ip, loc.port);
+    auto found = ids_.find(key);
+    if(found!=ids_.end())
+        return found->second;
+    size_t id = locs_.size();
+    locs_.push_back(loc);
+    stats_.emplace_back();
+    ids_[key]=id;
+    return id;
+}
+
+ReplicaSelector::Stats *ReplicaSelector::find(Location const &loc) {
+    auto found = ids_.find(std::make_pair(loc.ip, loc.port));
+    if(found==ids_.end())
+        return nullptr;
+    return &stats_[found->second];
+}
+
+uint64_t ReplicaSelector::cost(size_t id, uint64_t now_us) {
+    Stats &s = stats_[id];
+    uint64_t ewma = s.ewma_us.load(std::memory_order_relaxed);
+    uint64_t idle = now_us - std::min(now_us, s.updated_us.load(std::memory_order_relaxed));
+    uint64_t halvings = idle/decay_us_;
+    ewma = halvings>=64 ? 0 : ewma>>halvings;
+    int64_t outstanding = s.outstanding.load(std::memory_order_relaxed);
+    // a replica without samples costs 0, so that it gets tried
+    return ewma*(uint64_t)(std::max(outstanding, (int64_t)0)+1);
+}
+
+Location const &ReplicaSelector::Select(std::vector<size_t> const &ids) {
+    assert(!ids.empty());
+    if(ids.size()==1)
+        return locs_[ids[0]];
+
+    // the k-th replica that is up
+    auto up = [&](size_t k) -> size_t {
+        for(auto id:ids) {
+            if(!stats_[id].failed.load(std::memory_order_relaxed) && k--==0)
+                return id;
+        }
+        return ids[0];
+    };
+    size_t up_cnt = 0;
+    for(auto id:ids) {
+        if(!stats_[id].failed.load(std::memory_order_relaxed))
+            up_cnt++;
+    }
+    if(up_cnt<=1)
+        return locs_[up(0)];
+
+    static thread_local std::minstd_rand rand(std::random_device{}());
+    size_t a = rand()%up_cnt;
+    size_t b = rand()%(up_cnt-1);
+    if(b>=a)
+        b++;
+    size_t id_a = up(a);
+    size_t id_b = up(b);
+    uint64_t now = now_us();
+    uint64_t cost_a = cost(id_a, now);
+    uint64_t cost_b = cost(id_b, now);
+    return locs_[cost_b<cost_a ? id_b : id_a];
+}
+
+bool ReplicaSelector::MarkFailed(Location const &loc) {
+    Stats *s = find(loc);
+    if(!s)
+        return false;
+    return !s->failed.exchange(true, std::memory_order_relaxed);
+}
+
+void ReplicaSelector::Start(Location const &loc) {
+    Stats *s = find(loc);
+    if(s)
+        s->outstanding.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ReplicaSelector::Finish(Location const &loc, uint64_t latency_us, bool failed) {
+    Stats *s = find(loc);
+    if(!s)
+        return;
+    s->outstanding.fetch_sub(1, std::memory_order_relaxed);
+    if(failed)
+        latency_us = std::max(latency_us, kFailedUs);
+    // concurrent updates may overwrite each other; the EWMA only needs to be roughly right
+    uint64_t ewma = s->ewma_us.load(std::memory_order_relaxed);
+    if(ewma==0)
+        ewma = latency_us; // first sample
+    else
+        ewma = (ewma*((1<<kEwmaShift)-1) + latency_us)>>kEwmaShift;
+    s->ewma_us.store(ewma, std::memory_order_relaxed);
+    s->updated_us.store(now_us(), std::memory_order_relaxed);
+}
+
+void ReplicaSelector::Print() {
+    std::cout << "ReplicaSelector " << std::endl;
+    for(size_t id=0; id<locs_.size(); id++) {
+        std::cout << locs_[id] << ": ewma_us " << stats_[id].ewma_us
+                  << " outstanding " << stats_[id].outstanding
+                  << (stats_[id].failed ? " failed" : "") << std::endl;
+    }
+}
+
+} // namespace radixtree
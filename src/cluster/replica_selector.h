@@ -0,0 +1,98 @@
+/*
+ *  (c) Copyright 2016-2017, 2021 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This software is available to you under a choice of one of two
+ *  licenses. You may choose to be licensed under the terms of the
+ *  GNU Lesser General Public License Version 3, or (at your option)
+ *  later with exceptions included below, or under the terms of the
+ *  MIT license (Expat) available in COPYING file in the source tree.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#ifndef REPLICA_SELECTOR_H
+#define REPLICA_SELECTOR_H
+
+#include <atomic>
+#include <cstddef> // size_t
+#include <deque>
+#include <map>
+#include <string>
+#include <utility> // pair
+#include <vector>
+
+#include "cluster/cluster.h"
+
+namespace radixtree {
+
+// picks which replica of a partition a request goes to
+// every replica location has an EWMA of its observed latency and a count of outstanding requests;
+// Select() samples two of the given replicas and takes the one with the lower
+// ewma*(outstanding+1) (power of two choices), so that load spreads out while slow or busy
+// servers (e.g., in a GC pause or behind a slow FAM link) get fewer requests
+// a latency that has not been updated for a while decays, so that a server that was slow gets
+// tried again; a server that is down (MarkFailed) is not picked at all, as its cost would decay
+// too and win over the live replicas
+class ReplicaSelector {
+public:
+    // decay_us: an idle latency halves every decay_us microseconds
+    ReplicaSelector(uint64_t decay_us=kDecayUs);
+    ~ReplicaSelector();
+
+    // register a replica location and return its id (the same id for the same location)
+    // not thread-safe: call this before any of the calls below
+    size_t Add(Location const &loc);
+
+    // thread-safe
+    // picks among the given replicas that are not marked failed; if all of them are, one of them
+    Location const &Select(std::vector<size_t> const &ids);
+
+    // loc is down: it is not picked again
+    // return true if it was not marked failed before
+    bool MarkFailed(Location const &loc);
+
+    // feedback: a request to loc starts; it is done after latency_us microseconds
+    // a failed request counts as a very slow one
+    void Start(Location const &loc);
+    void Finish(Location const &loc, uint64_t latency_us, bool failed=false);
+
+    void Print();
+
+private:
+    struct Stats {
+        Stats() : ewma_us(0), outstanding(0), updated_us(0), failed(false) {}
+        std::atomic<uint64_t> ewma_us;
+        std::atomic<int64_t> outstanding;
+        std::atomic<uint64_t> updated_us; // when ewma_us was last updated
+        std::atomic<bool> failed;
+    };
+
+    static uint64_t const kEwmaShift = 3; // the weight of a new sample is 1/8
+    static uint64_t const kDecayUs = 1000000; // an idle latency halves every second
+    static uint64_t const kFailedUs = 1000000; // the latency a failed request counts as
+
+    uint64_t decay_us_;
+    std::vector<Location> locs_;
+    std::deque<Stats> stats_; // stats_[id]; a deque since Stats cannot be moved
+    std::map<std::pair<Addr, Port>, size_t> ids_;
+
+    Stats *find(Location const &loc);
+    uint64_t cost(size_t id, uint64_t now_us);
+};
+
+} // namespace radixtree
+
+#endif
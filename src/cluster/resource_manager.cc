@@ -24,10 +24,11 @@
  */
 
 #include <assert.h>
+#include <algorithm> // upper_bound
 #include <cstddef> // size_t
-#include <functional> // hash
 #include <iostream>
 
+#include "city.h"
 #include "cluster/config.h"
 #include "resource_manager.h"
 
@@ -46,14 +47,43 @@ void ResourceManager::Init() {
     partition_cnt_ = config_->GetPartitionCnt();
     assert(partition_cnt_>0);
     range_per_partition_ = hash_max/partition_cnt_;
+    partition_scheme_ = config_->GetPartitionScheme();
+    split_keys_ = config_->GetSplitKeys();
+    range_partitions_ = config_->GetRangePartitions();
+}
+
+// the number of split keys <= key
+size_t ResourceManager::FindRange(Resource r) {
+    return std::upper_bound(split_keys_.begin(), split_keys_.end(), r.key) - split_keys_.begin();
 }
 
 PartitionID ResourceManager::FindPartition(Resource r) {
-    return (PartitionID)(std::hash<std::string>()(r.key)/range_per_partition_);
+    if(partition_scheme_==Config::PartitionScheme::RANGE)
+        return range_partitions_[FindRange(r)];
+    // CityHash64 gives the same placement on every client and build, unlike std::hash
+    // the last partition also takes the few hashes past partition_cnt_*range_per_partition_
+    PartitionID pid = (PartitionID)(CityHash64(r.key.data(), r.key.size())/range_per_partition_);
+    return std::min(pid, (PartitionID)(partition_cnt_-1));
+}
+
+std::vector<PartitionID> ResourceManager::FindPartitions(Resource begin, Resource end) {
+    std::vector<PartitionID> pids;
+    if(partition_scheme_==Config::PartitionScheme::RANGE) {
+        size_t first = FindRange(begin);
+        size_t last = end.key.empty() ? split_keys_.size() : FindRange(end);
+        for(size_t idx=first; idx<=last; idx++)
+            pids.push_back(range_partitions_[idx]);
+    }
+    else {
+        for(PartitionID pid=0; pid<partition_cnt_; pid++)
+            pids.push_back(pid);
+    }
+    return pids;
 }
 
 void ResourceManager::Print() {
     std::cout << "ResrouceManager " << std::endl;
+    std::cout << "partition_scheme: " << config_->ps2str(partition_scheme_) << std::endl;
     std::cout << "range_per_partition: " << range_per_partition_ << std::endl;
 }
 
@@ -29,6 +29,7 @@
 #include <cstddef> // size_t
 #include <string>
 #include <limits>
+#include <vector>
 
 #include "cluster/config.h"
 
@@ -49,11 +50,20 @@ public:
     void Init();
     PartitionID FindPartition(Resource r);
 
+    // partitions that may hold keys in [begin, end], in key order for RANGE (all partitions for
+    // HASH); an empty end key means +inf
+    std::vector<PartitionID> FindPartitions(Resource begin, Resource end);
+
     void Print();
 private:
     Config *config_;
     size_t partition_cnt_;
     size_t range_per_partition_;
+    Config::PartitionScheme partition_scheme_;
+    std::vector<std::string> split_keys_;
+    std::vector<PartitionID> range_partitions_; // range index -> partition id
+
+    size_t FindRange(Resource r);
 };
 
 } // namespace radixtree
@@ -23,8 +23,10 @@
  *
  */
 
+#include <algorithm> // min
 #include <iostream>
 #include <string>
+#include <string.h> // memcpy
 
 #include "nvmm/global_ptr.h"
 #include "nvmm/memory_manager.h"
@@ -84,6 +86,185 @@ KeyValueStore *KeyValueStore::MakeKVS(std::string type_str, nvmm::GlobalPtr loca
     return MakeKVS(type, location, base, user, heap_size, heap_id);
 }
     
+int KeyValueStore::MultiPut(std::vector<std::string> const &keys,
+                            std::vector<std::string> const &vals,
+                            std::vector<int> &rets) {
+    if (keys.size() != vals.size())
+        return -1;
+    int ret = 0;
+    rets.assign(keys.size(), 0);
+    for (size_t i = 0; i < keys.size(); i++) {
+        rets[i] = Put(keys[i].data(), keys[i].size(), vals[i].data(), vals[i].size());
+        if (rets[i] == -1)
+            ret = -1;
+    }
+    return ret;
+}
+
+int KeyValueStore::BulkLoad(std::vector<std::string> const &keys,
+                            std::vector<std::string> const &vals,
+                            std::vector<int> &rets, size_t threads) {
+    return MultiPut(keys, vals, rets);
+}
+
+int KeyValueStore::MultiGet(std::vector<std::string> const &keys,
+                            std::vector<std::string> &vals,
+                            std::vector<int> &rets) {
+    int ret = 0;
+    rets.assign(keys.size(), 0);
+    vals.assign(keys.size(), std::string());
+    std::string val_buf(4096, '\0');
+    for (size_t i = 0; i < keys.size(); i++) {
+        size_t val_len = val_buf.size();
+        rets[i] = Get(keys[i].data(), keys[i].size(), &val_buf[0], val_len);
+        if (rets[i] == -1 && val_len > val_buf.size()) {
+            // the buffer was too small; Get() told us the size we need
+            val_buf.resize(val_len);
+            rets[i] = Get(keys[i].data(), keys[i].size(), &val_buf[0], val_len);
+        }
+        if (rets[i] == 0)
+            vals[i].assign(val_buf.data(), val_len);
+        else if (rets[i] == -1)
+            ret = -1;
+    }
+    return ret;
+}
+
+int KeyValueStore::MultiDel(std::vector<std::string> const &keys,
+                            std::vector<int> &rets) {
+    int ret = 0;
+    rets.assign(keys.size(), 0);
+    for (size_t i = 0; i < keys.size(); i++) {
+        rets[i] = Del(keys[i].data(), keys[i].size());
+        if (rets[i] == -1)
+            ret = -1;
+    }
+    return ret;
+}
+
+// the zero-copy Gets read into a buffer, and grow it if Get() tells us it was too small
+int KeyValueStore::Get(char const *key, size_t const key_len, ValAlloc const &alloc) {
+    std::string val_buf(4096, '\0');
+    size_t val_len = val_buf.size();
+    int ret = Get(key, key_len, &val_buf[0], val_len);
+    if (ret == -1 && val_len > val_buf.size()) {
+        val_buf.resize(val_len);
+        ret = Get(key, key_len, &val_buf[0], val_len);
+    }
+    if (ret != 0)
+        return ret;
+    char *val = alloc(val_len);
+    if (!val)
+        return -1;
+    memcpy(val, val_buf.data(), val_len);
+    return 0;
+}
+
+int KeyValueStore::Get(char const *key, size_t const key_len, ValAlloc const &alloc,
+                       Gptr &key_ptr, TagGptr &val_ptr) {
+    std::string val_buf(4096, '\0');
+    size_t val_len = val_buf.size();
+    int ret = Get(key, key_len, &val_buf[0], val_len, key_ptr, val_ptr);
+    if (ret == -1 && val_len > val_buf.size()) {
+        val_buf.resize(val_len);
+        ret = Get(key, key_len, &val_buf[0], val_len, key_ptr, val_ptr);
+    }
+    if (ret != 0 || !key_ptr.IsValid() || !val_ptr.IsValid())
+        return ret;
+    char *val = alloc(val_len);
+    if (!val)
+        return -1;
+    memcpy(val, val_buf.data(), val_len);
+    return 0;
+}
+
+int KeyValueStore::Get(char const *key, size_t const key_len, ValAlloc const &alloc,
+                       Gptr &key_ptr, TagGptr &val_ptr, KeyMiss &miss) {
+    miss = KeyMiss();
+    return Get(key, key_len, alloc, key_ptr, val_ptr);
+}
+
+int KeyValueStore::Get(Gptr const key_ptr, TagGptr &val_ptr, ValAlloc const &alloc,
+                       bool get_value, uint64_t const key_gen) {
+    std::string val_buf(4096, '\0');
+    size_t val_len = val_buf.size();
+    TagGptr cur_val_ptr = val_ptr;
+    int ret = Get(key_ptr, cur_val_ptr, &val_buf[0], val_len, get_value, key_gen);
+    if (ret == -1 && val_len > val_buf.size()) {
+        val_buf.resize(val_len);
+        cur_val_ptr = val_ptr;
+        ret = Get(key_ptr, cur_val_ptr, &val_buf[0], val_len, get_value, key_gen);
+    }
+    if (ret != 0)
+        return ret;
+    // val holds a value only if one was fetched: always with get_value, otherwise only when
+    // val_ptr was stale
+    bool fetched = cur_val_ptr.IsValid() && (get_value || cur_val_ptr != val_ptr);
+    val_ptr = cur_val_ptr;
+    if (!fetched)
+        return 0;
+    char *val = alloc(val_len);
+    if (!val)
+        return -1;
+    memcpy(val, val_buf.data(), val_len);
+    return 0;
+}
+
+int KeyValueStore::ScanBatch(char const *begin_key, size_t const begin_key_len,
+                             bool const begin_key_inclusive,
+                             char const *end_key, size_t const end_key_len,
+                             bool const end_key_inclusive,
+                             size_t const limit, char *buf, size_t &buf_len,
+                             size_t &cnt) {
+    cnt = 0;
+    if (limit == 0)
+        return -1;
+
+    std::string key_buf(MaxKeyLen(), '\0');
+    std::string val_buf;
+    size_t used = 0;
+    int iter_handle = -1;
+    int ret = 0;
+    size_t key_len, val_len;
+    while (cnt < limit) {
+        size_t room = buf_len - used;
+        key_len = key_buf.size();
+        // a value that does not fit in what is left of buf cannot make a record
+        val_len = std::min(room, MaxValLen());
+        if (val_buf.size() < val_len)
+            val_buf.resize(val_len);
+        if (cnt == 0)
+            ret = Scan(iter_handle, &key_buf[0], key_len, &val_buf[0], val_len,
+                       begin_key, begin_key_len, begin_key_inclusive,
+                       end_key, end_key_len, end_key_inclusive);
+        else
+            ret = GetNext(iter_handle, &key_buf[0], key_len, &val_buf[0], val_len);
+        if (ret == 0 && ScanRecord::size(key_len, val_len) > room)
+            ret = -1;
+        if (ret != 0)
+            break;
+
+        ScanRecord *rec = (ScanRecord *)(buf + used);
+        rec->key_len = key_len;
+        rec->val_len = val_len;
+        memcpy(rec->data(), key_buf.data(), key_len);
+        memcpy(rec->data() + key_len, val_buf.data(), val_len);
+        used += rec->size();
+        cnt++;
+    }
+    if (ret != -2)
+        CloseIter(iter_handle); // -2 has released it already
+
+    if (cnt == 0) {
+        if (ret == -1)
+            buf_len = ScanRecord::size(key_len, val_len);
+        return ret;
+    }
+    // a key that did not fit is where the next call starts
+    buf_len = used;
+    return 0;
+}
+
 void KeyValueStore::Start(std::string base, std::string user) {
     nvmm::StartNVMM(base, user);
 }
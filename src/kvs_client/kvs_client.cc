@@ -25,12 +25,25 @@
 
 #include "kvs_client/kvs_client.h"
 
+#include <ctype.h> // isgraph
+#include <netdb.h> // getaddrinfo
+#include <netinet/in.h>
+#include <netinet/tcp.h> // TCP_NODELAY
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h> // timeval
+#include <unistd.h>
 #include <string>
 #include <cstddef> // size_t
+#include <algorithm> // find
+#include <atomic>
+#include <chrono>
+#include <memory> // shared_ptr
+#include <mutex>
 #include <unordered_map>
+#include <vector>
 #include <functional> // hash
 
 #include "libmemcached/memcached.h"
@@ -39,6 +52,162 @@
 
 namespace radixtree {
 
+// the connections to one server
+// idle connections are kept for reuse and new ones are cloned from proto_ when there are none,
+// so there are as many connections as callers using the server at the same time
+// MultiPut uses plain sockets instead (see there), kept the same way
+// once a connection has an error, the server is not used again
+class KVSServer::ServerPool {
+public:
+    ServerPool(Location loc, memcached_st *proto)
+        : loc_(loc), proto_(proto), failed_(proto==NULL) {
+    }
+
+    ~ServerPool() {
+        for(auto conn:idle_)
+            memcached_free(conn);
+        for(auto fd:idle_sockets_)
+            close(fd);
+        memcached_free(proto_);
+    }
+
+    // return NULL on error
+    memcached_st *Acquire() {
+        std::lock_guard<std::mutex> lock(lock_);
+        if(!idle_.empty()) {
+            memcached_st *conn = idle_.back();
+            idle_.pop_back();
+            return conn;
+        }
+        return memcached_clone(NULL, proto_);
+    }
+
+    void Release(memcached_st *conn, bool failed=false) {
+        if(failed) {
+            failed_=true;
+            memcached_free(conn);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(lock_);
+        idle_.push_back(conn);
+    }
+
+    // return -1 on error
+    int AcquireSocket();
+
+    void ReleaseSocket(int fd, bool failed=false) {
+        if(failed) {
+            failed_=true;
+            close(fd);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(lock_);
+        idle_sockets_.push_back(fd);
+    }
+
+    bool Failed() {
+        return failed_;
+    }
+
+    Location const &GetLocation() {
+        return loc_;
+    }
+
+private:
+    Location loc_;
+    std::mutex lock_;
+    memcached_st *proto_;
+    std::vector<memcached_st*> idle_;
+    std::vector<int> idle_sockets_;
+    std::atomic<bool> failed_;
+};
+
+int KVSServer::ServerPool::AcquireSocket() {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        if(!idle_sockets_.empty()) {
+            int fd = idle_sockets_.back();
+            idle_sockets_.pop_back();
+            return fd;
+        }
+    }
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(loc_.ip.c_str(), std::to_string(loc_.port).c_str(), &hints, &ai)!=0)
+        return -1;
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if(fd>=0) {
+        // the same timeout as the libmemcached connections, so a server that is gone fails the
+        // batch instead of holding it up
+        struct timeval tv = {MEMCACHED_DEFAULT_TIMEOUT/1000, (MEMCACHED_DEFAULT_TIMEOUT%1000)*1000};
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if(connect(fd, ai->ai_addr, ai->ai_addrlen)!=0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(ai);
+    return fd;
+}
+
+// the keys of a batched call that go to one server
+struct KVSServer::Batch {
+    ServerPool *server;
+    memcached_st *conn;
+    int fd; // a socket instead of conn (pipelined)
+    std::string rbuf; // what was read from fd past the last reply line
+    std::vector<size_t> idx; // into keys
+    bool failed;
+    std::chrono::steady_clock::time_point start;
+};
+
+static uint64_t elapsed_us(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now()-start).count();
+}
+
+// a key that the text protocol can carry as a single token
+static bool text_key(std::string const &key) {
+    if(key.empty() || key.size()>=MEMCACHED_MAX_KEY)
+        return false;
+    for(char c:key) {
+        if(!isgraph((unsigned char)c))
+            return false;
+    }
+    return true;
+}
+
+static bool send_all(int fd, std::string const &buf) {
+    size_t sent=0;
+    while(sent<buf.size()) {
+        ssize_t ret = send(fd, buf.data()+sent, buf.size()-sent, MSG_NOSIGNAL);
+        if(ret<=0)
+            return false;
+        sent+=ret;
+    }
+    return true;
+}
+
+// one reply line (without "\r\n"); rbuf holds what was read past it
+static bool read_line(int fd, std::string &rbuf, std::string &line) {
+    size_t end;
+    while((end=rbuf.find("\r\n"))==std::string::npos) {
+        char buf[4096];
+        ssize_t ret = recv(fd, buf, sizeof(buf), 0);
+        if(ret<=0)
+            return false;
+        rbuf.append(buf, ret);
+    }
+    line.assign(rbuf, 0, end);
+    rbuf.erase(0, end+2);
+    return true;
+}
+
 KVSServer::KVSServer() {
 }
 
@@ -46,42 +215,48 @@ KVSServer::~KVSServer() {
 }
 
 int KVSServer::Init (std::string config_file) {
-    int ret = config_.LoadConfigFile(config_file);
-    if(ret==0) {
-        assert(config_.IsValid());
-        cluster_.Init(config_);
-    }
-    return ret;
+    return Reload(config_file);
 }
 
 void KVSServer::Final() {
-    cluster_.Final();
+    std::atomic_store(&cluster_, std::shared_ptr<Cluster>());
+    std::lock_guard<std::mutex> lock(servers_lock_);
     for(auto i:servers_) {
-        memcached_free(i.second);
+        delete i.second;
     }
+    servers_.clear();
 }
 
 int KVSServer::Put (char const *key, size_t const key_len,
                     char const *val, size_t const val_len) {
+    std::shared_ptr<Cluster> cluster = std::atomic_load(&cluster_);
+    if(!cluster)
+        return -1;
     bool failed_once=false;
     int ret=0;
     do {
-        memcached_st **server = get_server(key, key_len);
-        //assert(server);
+        ServerPool *server = get_server(*cluster, key, key_len);
+        memcached_st *conn = server ? server->Acquire() : NULL;
+        if(!conn)
+            return -1;
         ret=0;
-        memcached_return_t rc = memcached_set(*server, key, key_len, val, val_len, (time_t)0, (uint32_t)0);
+        auto start = std::chrono::steady_clock::now();
+        cluster->StartRequest(server->GetLocation());
+        memcached_return_t rc = memcached_set(conn, key, key_len, val, val_len, (time_t)0, (uint32_t)0);
+        cluster->FinishRequest(server->GetLocation(), elapsed_us(start), rc!=MEMCACHED_SUCCESS);
         if(rc!=MEMCACHED_SUCCESS) {
-            std::cout << "KVSServer put error: " << memcached_strerror(*server, rc) << std::endl;
-            *server=NULL;
+            std::cout << "KVSServer put error: " << memcached_strerror(conn, rc) << std::endl;
+            server->Release(conn, true);
             if(failed_once) return -1;
             else failed_once=true;
             ret=-1;
         }
-#ifdef DEBUG
         else {
+#ifdef DEBUG
             std::cout << "KVSServer put: " << std::string(key, key_len) << " -> " << std::string(val, val_len) << std::endl;
-        }
 #endif
+            server->Release(conn);
+        }
     }
     while(ret==-1);
     return ret;
@@ -89,75 +264,309 @@ int KVSServer::Put (char const *key, size_t const key_len,
 
 int KVSServer::Get (char const *key, size_t const key_len,
                     char *val, size_t &val_len){
+    std::shared_ptr<Cluster> cluster = std::atomic_load(&cluster_);
+    if(!cluster)
+        return -1;
     bool failed_once=false;
     int ret=0;
     do {
-        memcached_st **server = get_server(key, key_len);
-        //assert(server);
+        ServerPool *server = get_server(*cluster, key, key_len);
+        memcached_st *conn = server ? server->Acquire() : NULL;
+        if(!conn)
+            return -1;
         ret=0;
+        auto start = std::chrono::steady_clock::now();
+        cluster->StartRequest(server->GetLocation());
         memcached_return_t rc;
         uint32_t flags;
-        char *res = memcached_get(*server, key, key_len, &val_len, &flags, &rc);
-        if(!res) {
-            std::cout << "KVSServer get error: " << memcached_strerror(*server, rc) << std::endl;
-            *server=NULL;
+        char *res = memcached_get(conn, key, key_len, &val_len, &flags, &rc);
+        cluster->FinishRequest(server->GetLocation(), elapsed_us(start), !res && rc!=MEMCACHED_NOTFOUND);
+        if(!res && rc==MEMCACHED_NOTFOUND) {
+            // a miss, not a server error
+            server->Release(conn);
+            return -2;
+        }
+        else if(!res) {
+            std::cout << "KVSServer get error: " << memcached_strerror(conn, rc) << std::endl;
+            server->Release(conn, true);
             if(failed_once) return -1;
             else failed_once=true;
             ret=-1;
         }
-#ifdef DEBUG
         else {
+#ifdef DEBUG
             std::cout << "KVSServer get: " << std::string(key, key_len) << " -> " << std::string(res, val_len) << std::endl;
-        }
 #endif
-        memcpy(val, res, val_len);
-        free(res);
+            server->Release(conn);
+            memcpy(val, res, val_len);
+            free(res);
+        }
     }
     while(ret==-1);
     return ret;
 }
 
 int KVSServer::Del (char const *key, size_t const key_len) {
+    std::shared_ptr<Cluster> cluster = std::atomic_load(&cluster_);
+    if(!cluster)
+        return -1;
     bool failed_once=false;
     int ret=0;
     do {
-        memcached_st **server = get_server(key, key_len);
-        //assert(server);
+        ServerPool *server = get_server(*cluster, key, key_len);
+        memcached_st *conn = server ? server->Acquire() : NULL;
+        if(!conn)
+            return -1;
         ret=0;
-        memcached_return_t rc = memcached_delete(*server, key, key_len, (time_t)0);
-        if(rc!=MEMCACHED_SUCCESS) {
-            std::cout << "KVSServer del error: " << memcached_strerror(*server, rc) << std::endl;
-            *server=NULL;
+        auto start = std::chrono::steady_clock::now();
+        cluster->StartRequest(server->GetLocation());
+        memcached_return_t rc = memcached_delete(conn, key, key_len, (time_t)0);
+        cluster->FinishRequest(server->GetLocation(), elapsed_us(start),
+                               rc!=MEMCACHED_SUCCESS && rc!=MEMCACHED_NOTFOUND);
+        if(rc==MEMCACHED_NOTFOUND) {
+            server->Release(conn);
+            return -2;
+        }
+        else if(rc!=MEMCACHED_SUCCESS) {
+            std::cout << "KVSServer del error: " << memcached_strerror(conn, rc) << std::endl;
+            server->Release(conn, true);
             if(failed_once) return -1;
             else failed_once=true;
             ret=-1;
         }
-#ifdef DEBUG
         else {
+#ifdef DEBUG
             std::cout << "KVSServer del: " << std::string(key, key_len) << std::endl;
-        }
 #endif
+            server->Release(conn);
+        }
     }
     while(ret==-1);
     return ret;
 }
 
+int KVSServer::MultiPut (std::vector<std::string> const &keys,
+                         std::vector<std::string> const &vals,
+                         std::vector<int> &rets) {
+    assert(keys.size()==vals.size());
+    rets.assign(keys.size(), -1);
+
+    std::shared_ptr<Cluster> cluster = std::atomic_load(&cluster_);
+    if(!cluster)
+        return -1;
+    // a key that is not a single token would throw the replies out of step with the sets
+    std::vector<size_t> todo;
+    for(size_t i=0; i<keys.size(); i++) {
+        if(text_key(keys[i]))
+            todo.push_back(i);
+    }
+
+    bool failed_once=false;
+    while(!todo.empty()) {
+        std::vector<Batch> batches;
+        group_by_server(*cluster, keys, todo, true, batches);
+
+        // libmemcached drops the replies to buffered sets, so the sets go out on a plain socket in
+        // the text protocol, where a server replies to each in order with one line
+        // every server gets kPipelineDepth sets at a time before any reply is read, so the round
+        // trips overlap, and the replies stay few enough that the server never waits on us
+        for(size_t first=0; ; first+=kPipelineDepth) {
+            bool sent=false;
+            for(auto &b:batches) {
+                if(b.failed || first>=b.idx.size())
+                    continue;
+                std::string req;
+                for(size_t k=first; k<std::min(first+kPipelineDepth, b.idx.size()); k++) {
+                    size_t i = b.idx[k];
+                    req += "set "+keys[i]+" 0 0 "+std::to_string(vals[i].size())+"\r\n";
+                    req += vals[i];
+                    req += "\r\n";
+                }
+                if(!send_all(b.fd, req)) {
+                    std::cout << "KVSServer multiput error: send to " << b.server->GetLocation() << " failed" << std::endl;
+                    b.failed=true;
+                }
+                sent=true;
+            }
+            if(!sent)
+                break;
+
+            for(auto &b:batches) {
+                if(b.failed || first>=b.idx.size())
+                    continue;
+                for(size_t k=first; k<std::min(first+kPipelineDepth, b.idx.size()); k++) {
+                    std::string line;
+                    if(!read_line(b.fd, b.rbuf, line)) {
+                        std::cout << "KVSServer multiput error: no reply from " << b.server->GetLocation() << std::endl;
+                        b.failed=true;
+                        break;
+                    }
+                    // a store the server rejects (e.g., out of memory) stays -1
+                    if(line=="STORED")
+                        rets[b.idx[k]]=0;
+                    else
+                        std::cout << "KVSServer multiput error: " << line << std::endl;
+                }
+            }
+        }
+
+        std::vector<size_t> retry;
+        for(auto &b:batches) {
+            if(b.fd>=0) {
+                cluster->FinishRequest(b.server->GetLocation(), elapsed_us(b.start), b.failed);
+                b.server->ReleaseSocket(b.fd, b.failed);
+            }
+            for(auto i:b.idx) {
+                if(b.failed && rets[i]!=0)
+                    retry.push_back(i);
+            }
+        }
+
+        // the keys on a failed server get one more try, on another replica if there is one
+        if(failed_once)
+            break;
+        failed_once=true;
+        todo.swap(retry);
+    }
+    return std::find(rets.begin(), rets.end(), -1)==rets.end() ? 0 : -1;
+}
+
+int KVSServer::MultiGet (std::vector<std::string> const &keys,
+                         std::vector<std::string> &vals,
+                         std::vector<int> &rets) {
+    vals.resize(keys.size());
+    rets.assign(keys.size(), -1);
+
+    std::shared_ptr<Cluster> cluster = std::atomic_load(&cluster_);
+    if(!cluster)
+        return -1;
+    std::vector<size_t> todo(keys.size());
+    for(size_t i=0; i<todo.size(); i++)
+        todo[i]=i;
+
+    bool failed_once=false;
+    while(!todo.empty()) {
+        std::vector<Batch> batches;
+        group_by_server(*cluster, keys, todo, false, batches);
+
+        // send to every server before reading any reply, so that the round trips overlap
+        for(auto &b:batches) {
+            if(b.failed)
+                continue;
+            std::vector<char const*> ks;
+            std::vector<size_t> lens;
+            for(auto i:b.idx) {
+                ks.push_back(keys[i].data());
+                lens.push_back(keys[i].size());
+            }
+            memcached_return_t rc = memcached_mget(b.conn, ks.data(), lens.data(), ks.size());
+            if(rc!=MEMCACHED_SUCCESS) {
+                std::cout << "KVSServer multiget error: " << memcached_strerror(b.conn, rc) << std::endl;
+                b.failed=true;
+            }
+        }
+
+        std::vector<size_t> retry;
+        for(auto &b:batches) {
+            if(!b.failed) {
+                // keys that are not found get no reply
+                std::unordered_map<std::string, std::vector<size_t>> pending;
+                for(auto i:b.idx)
+                    pending[keys[i]].push_back(i);
+
+                memcached_result_st result;
+                memcached_result_create(b.conn, &result);
+                memcached_return_t rc;
+                while(memcached_fetch_result(b.conn, &result, &rc)) {
+                    auto found = pending.find(std::string(memcached_result_key_value(&result),
+                                                          memcached_result_key_length(&result)));
+                    if(found==pending.end())
+                        continue;
+                    for(auto i:found->second) {
+                        vals[i].assign(memcached_result_value(&result), memcached_result_length(&result));
+                        rets[i]=0;
+                    }
+                }
+                memcached_result_free(&result);
+                if(rc!=MEMCACHED_END && rc!=MEMCACHED_NOTFOUND) {
+                    std::cout << "KVSServer multiget error: " << memcached_strerror(b.conn, rc) << std::endl;
+                    b.failed=true;
+                }
+            }
+            if(b.conn) {
+                cluster->FinishRequest(b.server->GetLocation(), elapsed_us(b.start), b.failed);
+                b.server->Release(b.conn, b.failed);
+            }
+            for(auto i:b.idx) {
+                if(rets[i]==0)
+                    continue;
+                if(b.failed)
+                    retry.push_back(i);
+                else
+                    rets[i]=-2;
+            }
+        }
+
+        // the keys on a failed server get one more try, on another replica if there is one
+        if(failed_once)
+            break;
+        failed_once=true;
+        todo.swap(retry);
+    }
+    return std::find(rets.begin(), rets.end(), -1)==rets.end() ? 0 : -1;
+}
+
+std::vector<Location> KVSServer::LocateRange (char const *begin_key, size_t const begin_key_len,
+                                              char const *end_key, size_t const end_key_len) {
+    ResourceName begin(std::string(begin_key, begin_key_len));
+    ResourceName end(std::string(end_key, end_key_len));
+    std::shared_ptr<Cluster> cluster = std::atomic_load(&cluster_);
+    if(!cluster)
+        return std::vector<Location>();
+    return cluster->LocateRange(begin, end, true);
+}
+
+int KVSServer::Reload (std::string config_file) {
+    Config config;
+    if(config.LoadConfigFile(config_file)!=0 || !config.IsValid()) {
+        std::cout << "KVSServer invalid config file: " << config_file << std::endl;
+        return -1;
+    }
+    // the last call that uses the old cluster frees it
+    std::shared_ptr<Cluster> cluster(new Cluster(), [](Cluster *c) {
+            c->Final();
+            delete c;
+        });
+    cluster->Init(config);
+    std::atomic_store(&cluster_, cluster);
+    return 0;
+}
+
 void KVSServer::PrintCluster() {
-    cluster_.Print();
+    std::shared_ptr<Cluster> cluster = std::atomic_load(&cluster_);
+    if(cluster)
+        cluster->Print();
 }
 
 void KVSServer::WipeServers() {
+    std::lock_guard<std::mutex> lock(servers_lock_);
     for(auto i:servers_) {
-        int ret=memcached_flush(i.second, (time_t)0);
+        if(i.second->Failed())
+            continue;
+        memcached_st *conn = i.second->Acquire();
+        assert(conn);
+        int ret=memcached_flush(conn, (time_t)0);
         assert(ret==MEMCACHED_SUCCESS);
+        i.second->Release(conn);
     }
 }
 
-Location KVSServer::pick_a_server(char const *key, size_t const key_len) {
+Location KVSServer::pick_a_server(Cluster &cluster, char const *key, size_t const key_len) {
     ResourceName r(std::string(key, key_len));
-    return cluster_.Locate(r, true);
+    return cluster.Locate(r, true);
 }
 
+// the caller holds servers_lock_
 int KVSServer::server_init(Location loc) {
     int ret=0;
     std::string dest = "--SERVER="+loc.ip+":"+std::to_string(loc.port);
@@ -172,38 +581,64 @@ int KVSServer::server_init(Location loc) {
     }
 #endif
     assert(servers_.find(loc)==servers_.end());
-    servers_[loc]=server;
+    servers_[loc]=new ServerPool(loc, server);
     return ret;
 }
 
+// the caller holds servers_lock_
 bool KVSServer::server_exist(Location loc) {
     return servers_.find(loc)!=servers_.end();
 }
 
-memcached_st **KVSServer::get_server(char const *key, size_t const key_len) {
-    Location loc;
-    int cnt=0;
+// a server that is down is marked failed in the cluster, so that the next pick goes to another
+// replica; once the pick is a server that was already marked, every replica is down (the pick
+// only falls back to a failed one then)
+KVSServer::ServerPool *KVSServer::get_server(Cluster &cluster, char const *key, size_t const key_len) {
+    bool marked_before=false;
     do {
-        loc = pick_a_server(key, key_len);
-        if(!server_exist(loc)) {
-            int ret = server_init(loc);
-            if(ret!=0)
+        Location loc = pick_a_server(cluster, key, key_len);
+        std::lock_guard<std::mutex> lock(servers_lock_);
+        if(!server_exist(loc))
+            server_init(loc); // on error, the pool is a failed one
+        ServerPool *server = servers_[loc];
+        if(!server->Failed())
+            return server;
+        if(!cluster.MarkFailed(loc)) {
+            // marked by another call in between, or all the replicas are down
+            if(marked_before)
                 return nullptr;
+            marked_before=true;
         }
-        if(servers_[loc]==NULL) {
-            // TODO: fix this
-            cnt++;
-            if(cnt>=100)
-                return nullptr;
+    }
+    while(1);
+}
+
+void KVSServer::group_by_server(Cluster &cluster, std::vector<std::string> const &keys,
+                                std::vector<size_t> const &idx, bool pipelined,
+                                std::vector<Batch> &batches) {
+    std::unordered_map<ServerPool*, size_t> batch_of;
+    for(auto i:idx) {
+        ServerPool *server = get_server(cluster, keys[i].data(), keys[i].size());
+        if(!server)
+            continue; // rets[i] stays -1
+        auto found = batch_of.find(server);
+        if(found==batch_of.end()) {
+            found = batch_of.emplace(server, batches.size()).first;
+            batches.push_back(Batch{server, NULL, -1, std::string(), {}, false, {}});
         }
-        else {
-            break;
+        batches[found->second].idx.push_back(i);
+    }
+    for(auto &b:batches) {
+        if(pipelined)
+            b.fd = b.server->AcquireSocket();
+        else
+            b.conn = b.server->Acquire();
+        b.failed = (b.conn==NULL && b.fd<0);
+        if(!b.failed) {
+            b.start = std::chrono::steady_clock::now();
+            cluster.StartRequest(b.server->GetLocation());
         }
     }
-    while(1);
-            
-    //std::cout << "Using server " << loc << std::endl;
-    return &servers_[loc];
 }
 
 }
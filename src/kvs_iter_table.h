@@ -0,0 +1,145 @@
+/*
+ *  (c) Copyright 2016-2021 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This software is available to you under a choice of one of two
+ *  licenses. You may choose to be licensed under the terms of the
+ *  GNU Lesser General Public License Version 3, or (at your option)
+ *  later with exceptions included below, or under the terms of the
+ *  MIT license (Expat) available in COPYING file in the source tree.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#ifndef KVS_ITER_TABLE_H
+#define KVS_ITER_TABLE_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "radixtree/radix_tree.h"
+
+namespace radixtree {
+
+// scan iterators of a KVS, handed out as int handles
+// - slots are claimed and released without locks (a tagged free list)
+// - each slot keeps its Iter, so a new scan reuses the memory the strings and
+// the path of an earlier scan have grown
+// - a handle carries the generation of its slot, so a handle that was closed
+// is rejected even after its slot has been reused
+// a handle must not be used by two threads at the same time
+class IterTable {
+public:
+    static int const kSlotBits = 12;
+    static int const kMaxIters = 1 << kSlotBits;
+
+    IterTable() {
+        for (int i = 0; i < kMaxIters; i++) {
+            slots_[i].state.store(0, std::memory_order_relaxed);
+            slots_[i].next.store(i < kMaxIters - 1 ? (uint64_t)i + 2 : 0,
+                                 std::memory_order_relaxed);
+            slots_[i].iter = nullptr;
+        }
+        free_.store(1, std::memory_order_release);
+    }
+
+    ~IterTable() {
+        for (int i = 0; i < kMaxIters; i++)
+            delete slots_[i].iter;
+    }
+
+    // returns a free iterator and its handle; nullptr if all are in use
+    RadixTree::Iter *Open(int &handle) {
+        uint64_t head = free_.load(std::memory_order_acquire);
+        for (;;) {
+            uint32_t top = (uint32_t)head;
+            if (top == 0)
+                return nullptr;
+            uint64_t next = slots_[top - 1].next.load(std::memory_order_relaxed);
+            uint64_t new_head = ((head >> 32) + 1) << 32 | next;
+            if (free_.compare_exchange_weak(head, new_head,
+                                            std::memory_order_acq_rel))
+                break;
+        }
+
+        int slot = (int)(uint32_t)head - 1;
+        Slot &s = slots_[slot];
+        if (!s.iter)
+            s.iter = new RadixTree::Iter();
+        uint32_t state = s.state.load(std::memory_order_relaxed) + 1; // open
+        s.state.store(state, std::memory_order_release);
+        handle = make_handle(slot, state);
+        return s.iter;
+    }
+
+    // returns the iterator of an open handle; nullptr if the handle is not open
+    RadixTree::Iter *Find(int handle) {
+        if (handle < 0)
+            return nullptr;
+        Slot &s = slots_[handle & (kMaxIters - 1)];
+        uint32_t state = s.state.load(std::memory_order_acquire);
+        if (!(state & 1) || make_handle(handle & (kMaxIters - 1), state) != handle)
+            return nullptr;
+        return s.iter;
+    }
+
+    // return 0 (closed); -1 (the handle is not open)
+    int Close(int handle) {
+        if (handle < 0)
+            return -1;
+        int slot = handle & (kMaxIters - 1);
+        Slot &s = slots_[slot];
+        uint32_t state = s.state.load(std::memory_order_acquire);
+        if (!(state & 1) || make_handle(slot, state) != handle)
+            return -1;
+        if (!s.state.compare_exchange_strong(state, state + 1,
+                                             std::memory_order_acq_rel))
+            return -1; // closed by someone else
+
+        uint64_t head = free_.load(std::memory_order_acquire);
+        for (;;) {
+            s.next.store((uint32_t)head, std::memory_order_relaxed);
+            uint64_t new_head = ((head >> 32) + 1) << 32 | (uint64_t)(slot + 1);
+            if (free_.compare_exchange_weak(head, new_head,
+                                            std::memory_order_acq_rel))
+                return 0;
+        }
+    }
+
+private:
+    struct Slot {
+        std::atomic<uint32_t> state; // 2 * generation, plus 1 while open
+        std::atomic<uint64_t> next;  // 1 + next free slot; 0: none
+        RadixTree::Iter *iter;
+    };
+
+    // tag (high 32 bits) and 1 + top free slot (low 32 bits); the tag keeps
+    // a pop from succeeding on a top that was popped and pushed back meanwhile
+    std::atomic<uint64_t> free_;
+    Slot slots_[kMaxIters];
+
+    static int make_handle(int slot, uint32_t state) {
+        uint32_t generation = (state >> 1) & ((1u << (31 - kSlotBits)) - 1);
+        return (int)(generation << kSlotBits | (uint32_t)slot);
+    }
+
+    IterTable(const IterTable&);              // disable copying
+    IterTable& operator=(const IterTable&);   // disable assignment
+};
+
+} // namespace radixtree
+
+#endif
@@ -0,0 +1,291 @@
+/*
+ *  (c) Copyright 2016-2017, 2021 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This software is available to you under a choice of one of two
+ *  licenses. You may choose to be licensed under the terms of the 
+ *  GNU Lesser General Public License Version 3, or (at your option)  
+ *  later with exceptions included below, or under the terms of the  
+ *  MIT license (Expat) available in COPYING file in the source tree.
+ * 
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+#include <algorithm> // min
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <string.h> // memcmp
+#include <vector>
+
+#include "city.h"
+
+#include "radixtree/kvs.h"
+#include "radixtree/kvs_migration.h"
+
+namespace radixtree {
+
+KVSMigration::KVSMigration(KeyValueStore *src, KeyValueStore *dst,
+                           std::string begin_key, std::string end_key)
+    : src_(src), dst_(dst), begin_key_(begin_key), end_key_(end_key),
+      state_(IDLE), dst_failed_(false) {
+}
+
+KVSMigration::~KVSMigration() {
+}
+
+static int compare(char const *key, size_t const key_len, std::string const &other) {
+    int ret = memcmp(key, other.data(), std::min(key_len, other.size()));
+    if(ret!=0)
+        return ret;
+    return key_len<other.size() ? -1 : (key_len>other.size() ? 1 : 0);
+}
+
+bool KVSMigration::in_range(char const *key, size_t const key_len) {
+    return (begin_key_.empty() || compare(key, key_len, begin_key_)>=0) &&
+        (end_key_.empty() || compare(key, key_len, end_key_)<0);
+}
+
+KVSMigration::Stripe &KVSMigration::stripe(char const *key, size_t const key_len) {
+    return stripes_[CityHash64(key, key_len)%kStripes];
+}
+
+void KVSMigration::lock_all() {
+    for(auto &s:stripes_)
+        s.lock.lock();
+}
+
+void KVSMigration::unlock_all() {
+    for(auto &s:stripes_)
+        s.lock.unlock();
+}
+
+// waits for the writes in the range that are under way
+void KVSMigration::set_state(State state) {
+    lock_all();
+    state_=state;
+    unlock_all();
+}
+
+void KVSMigration::track(Stripe &s, char const *key, size_t const key_len,
+                         char const *val, size_t const val_len, bool del) {
+    switch(state_.load()) {
+    case LOGGING:
+        s.log.push_back(LogEntry{std::string(key, key_len),
+                    del ? std::string() : std::string(val, val_len), del});
+        break;
+    case DUAL_WRITE:
+        if(del ? dst_->Del(key, key_len)==-1 : dst_->Put(key, key_len, val, val_len)!=0)
+            dst_failed_=true;
+        break;
+    case IDLE:
+    default:
+        break;
+    }
+}
+
+int KVSMigration::Put (char const *key, size_t const key_len,
+                       char const *val, size_t const val_len) {
+    if(!in_range(key, key_len))
+        return src_->Put(key, key_len, val, val_len);
+
+    Stripe &s = stripe(key, key_len);
+    std::lock_guard<std::mutex> lock(s.lock);
+    int ret = src_->Put(key, key_len, val, val_len);
+    if(ret!=0)
+        return ret;
+    track(s, key, key_len, val, val_len, false);
+    return ret;
+}
+
+int KVSMigration::FindOrCreate(char const *key, size_t const key_len,
+                               char const *val, size_t const val_len,
+                               char *ret_val, size_t &ret_len) {
+    if(!in_range(key, key_len))
+        return src_->FindOrCreate(key, key_len, val, val_len, ret_val, ret_len);
+
+    Stripe &s = stripe(key, key_len);
+    std::lock_guard<std::mutex> lock(s.lock);
+    int ret = src_->FindOrCreate(key, key_len, val, val_len, ret_val, ret_len);
+    if(ret!=1)
+        return ret; // nothing was inserted
+    track(s, key, key_len, val, val_len, false);
+    return ret;
+}
+
+int KVSMigration::Del (char const *key, size_t const key_len) {
+    if(!in_range(key, key_len))
+        return src_->Del(key, key_len);
+
+    Stripe &s = stripe(key, key_len);
+    std::lock_guard<std::mutex> lock(s.lock);
+    int ret = src_->Del(key, key_len);
+    if(ret!=0)
+        return ret; // nothing was deleted
+    track(s, key, key_len, nullptr, 0, true);
+    return ret;
+}
+
+int KVSMigration::Put (char const *key, size_t const key_len,
+                       char const *val, size_t const val_len,
+                       Gptr &key_ptr, TagGptr &val_ptr) {
+    if(!in_range(key, key_len))
+        return src_->Put(key, key_len, val, val_len, key_ptr, val_ptr);
+
+    Stripe &s = stripe(key, key_len);
+    std::lock_guard<std::mutex> lock(s.lock);
+    int ret = src_->Put(key, key_len, val, val_len, key_ptr, val_ptr);
+    if(ret!=0)
+        return ret;
+    track(s, key, key_len, val, val_len, false);
+    return ret;
+}
+
+int KVSMigration::Del (char const *key, size_t const key_len,
+                       Gptr &key_ptr, TagGptr &val_ptr) {
+    if(!in_range(key, key_len))
+        return src_->Del(key, key_len, key_ptr, val_ptr);
+
+    Stripe &s = stripe(key, key_len);
+    std::lock_guard<std::mutex> lock(s.lock);
+    int ret = src_->Del(key, key_len, key_ptr, val_ptr);
+    if(ret!=0 || !key_ptr.IsValid())
+        return ret; // nothing was deleted
+    track(s, key, key_len, nullptr, 0, true);
+    return ret;
+}
+
+int KVSMigration::replay(std::vector<LogEntry> const &log) {
+    for(auto &e:log) {
+        int ret = e.del ? dst_->Del(e.key.data(), e.key.size())
+            : dst_->Put(e.key.data(), e.key.size(), e.val.data(), e.val.size());
+        if(ret==-1)
+            return -1;
+    }
+    return 0;
+}
+
+// calls f for every key in the range of kvs, in key order; stops when f returns non-zero
+int KVSMigration::scan(KeyValueStore *kvs,
+                       std::function<int(std::string const &key, std::string const &val)> f) {
+    std::vector<uint64_t> buf(kCopyBufLen/sizeof(uint64_t)); // 8-byte aligned
+    std::string begin_key = begin_key_.empty() ?
+        std::string(OPEN_BOUNDARY_KEY, OPEN_BOUNDARY_KEY_SIZE) : begin_key_;
+    bool begin_key_inclusive = !begin_key_.empty();
+    std::string end_key = end_key_.empty() ?
+        std::string(OPEN_BOUNDARY_KEY, OPEN_BOUNDARY_KEY_SIZE) : end_key_;
+
+    for(;;) {
+        size_t buf_len = buf.size()*sizeof(uint64_t);
+        size_t cnt;
+        int ret = kvs->ScanBatch(begin_key.data(), begin_key.size(), begin_key_inclusive,
+                                 end_key.data(), end_key.size(), false,
+                                 kScanBatchKeys, (char*)buf.data(), buf_len, cnt);
+        if(ret==-2)
+            return 0;
+        if(ret==-1) {
+            if(buf_len<=buf.size()*sizeof(uint64_t))
+                return -1;
+            buf.resize((buf_len+sizeof(uint64_t)-1)/sizeof(uint64_t)); // a larger record
+            continue;
+        }
+        char *p = (char*)buf.data();
+        for(size_t i=0; i<cnt; i++) {
+            ScanRecord *rec = (ScanRecord*)p;
+            begin_key.assign(rec->key(), rec->key_len);
+            if(f(begin_key, std::string(rec->val(), rec->val_len))!=0)
+                return -1;
+            p += rec->size();
+        }
+        begin_key_inclusive = false;
+    }
+}
+
+int KVSMigration::Start() {
+    if(state_!=IDLE)
+        return -1;
+    set_state(LOGGING);
+    return 0;
+}
+
+int KVSMigration::Copy() {
+    if(state_!=LOGGING)
+        return -1;
+    return scan(src_, [&](std::string const &key, std::string const &val) {
+            return dst_->Put(key.data(), key.size(), val.data(), val.size());
+        });
+}
+
+int KVSMigration::CatchUp() {
+    if(state_!=LOGGING)
+        return -1;
+
+    // replay while writes go on, until a pass has little left to do (or it does not seem to get
+    // there)
+    for(int pass=0; pass<16; pass++) {
+        size_t replayed=0;
+        for(auto &s:stripes_) {
+            std::vector<LogEntry> log;
+            {
+                std::lock_guard<std::mutex> lock(s.lock);
+                log.swap(s.log);
+            }
+            if(replay(log)!=0)
+                return -1;
+            replayed+=log.size();
+        }
+        if(replayed<=kCatchUpLogLen)
+            break;
+    }
+
+    // hold the writes in the range for the rest of the log
+    int ret=0;
+    lock_all();
+    for(auto &s:stripes_) {
+        if(ret==0)
+            ret = replay(s.log);
+        s.log.clear();
+    }
+    if(ret==0)
+        state_=DUAL_WRITE;
+    unlock_all();
+    return ret;
+}
+
+int KVSMigration::Finish() {
+    if(state_!=DUAL_WRITE)
+        return -1;
+    set_state(IDLE);
+    return dst_failed_ ? -1 : 0;
+}
+
+int KVSMigration::Purge() {
+    if(state_!=IDLE)
+        return -1;
+    std::vector<std::string> keys;
+    int ret = scan(src_, [&](std::string const &key, std::string const &val) {
+            keys.push_back(key);
+            return 0;
+        });
+    if(ret!=0)
+        return ret;
+    for(auto &key:keys) {
+        if(src_->Del(key.data(), key.size())==-1)
+            ret=-1;
+    }
+    return ret;
+}
+
+} // namespace radixtree
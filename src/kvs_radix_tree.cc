@@ -26,9 +26,14 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h> // getenv, strtoull
+#include <algorithm> // min, max
+#include <atomic>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <string.h> // memset, memcpy
+#include <thread>
 #include <utility>  // pair
 
 #include "nvmm/error_code.h"
@@ -47,7 +52,8 @@ KVSRadixTree::KVSRadixTree(Gptr root, std::string base, std::string user,
                            size_t heap_size, nvmm::PoolId heap_id,
                            RadixTreeMetrics *metrics)
     : heap_id_(heap_id), heap_size_(heap_size), mmgr_(Mmgr::GetInstance()),
-      emgr_(Emgr::GetInstance()), heap_(nullptr), tree_(nullptr), root_(root),
+      emgr_(Emgr::GetInstance()), heap_(nullptr), slab_(nullptr), tree_(nullptr),
+      root_(root),
       metrics_(metrics) {
     int ret = Open();
     assert(ret == 0);
@@ -60,6 +66,12 @@ KVSRadixTree::~KVSRadixTree() {
 
 void KVSRadixTree::Maintenance() { heap_->OfflineFree(); }
 
+int KVSRadixTree::Compact(size_t &pruned) {
+    Eop op(emgr_);
+    pruned = tree_->compact();
+    return 0;
+}
+
 int KVSRadixTree::Open() {
     nvmm::ErrorCode ret;
 
@@ -87,12 +99,22 @@ int KVSRadixTree::Open() {
     //     else
     //         std::cout << "open an existing radix tree: ";
     // #endif
-    tree_ = new RadixTree(mmgr_, heap_, metrics_, root_);
+    slab_ = new SlabHeap(heap_, emgr_);
+    tree_ = new RadixTree(mmgr_, heap_, metrics_, root_, slab_);
     if (!tree_) {
+        delete slab_;
         delete heap_;
         return -1;
     }
     root_ = tree_->get_root();
+
+    // the DRAM mirror of the upper levels of the tree (RadixTree::set_mirror()) is off unless
+    // KVS_MIRROR_LEVELS says how many levels to mirror; KVS_MIRROR_BUDGET caps its size in bytes
+    char const *levels = getenv("KVS_MIRROR_LEVELS");
+    char const *budget = getenv("KVS_MIRROR_BUDGET");
+    if (levels)
+        tree_->set_mirror(strtoull(levels, NULL, 10),
+                          budget ? strtoull(budget, NULL, 10) : RadixTree::MIRROR_BUDGET);
     // #ifdef DEBUG
     //     std::cout << (uint64_t)root_ << std::endl;
     // #endif
@@ -110,6 +132,9 @@ int KVSRadixTree::Close() {
         delete tree_;
         tree_ = nullptr;
     }
+    // gives the cached blocks back to the heap
+    delete slab_;
+    slab_ = nullptr;
 
     // close the heap
     if (heap_ && heap_->IsOpen()) {
@@ -119,12 +144,6 @@ int KVSRadixTree::Close() {
         delete heap_;
         heap_ = nullptr;
     }
-
-    // delete all iters
-    for (auto iter : iters_) {
-        if (iter)
-            delete iter;
-    }
     return 0;
 }
 
@@ -140,25 +159,12 @@ int KVSRadixTree::Put(char const *key, size_t const key_len, char const *val,
 
     Eop op(emgr_);
 
-    Gptr val_gptr = heap_->Alloc(op, val_len + sizeof(ValBuf));
-    if (!val_gptr.IsValid()) {
-        size_t size = heap_->Size();
-        nvmm::ErrorCode ret = heap_->Resize(2 * size);
-        if (ret != NO_ERROR)
-            return -1;
-        val_gptr = heap_->Alloc(op, val_len + sizeof(ValBuf));
-        if (!val_gptr.IsValid())
-            return -1;
-    }
+    Gptr val_gptr = NewVal(val, val_len);
+    if (!val_gptr.IsValid())
+        return -1;
 
     // std::cout << " allocated memory at " << val_gptr << std::endl;
 
-    ValBuf *val_ptr = (ValBuf *)mmgr_->GlobalToLocal(val_gptr);
-
-    val_ptr->size = val_len;
-    memcpy((char *)val_ptr->val, (char const *)val, val_len);
-    fam_persist(val_ptr, sizeof(ValBuf) + val_len);
-
     TagGptr old_value = tree_->put(key, key_len, val_gptr, UPDATE);
     if (old_value.IsValid()) {
         // #ifdef DEBUG
@@ -175,7 +181,7 @@ int KVSRadixTree::Put(char const *key, size_t const key_len, char const *val,
         // #endif
         //        std::cout << "  delayed free memory at " << old_value <<
         // std::endl;
-        heap_->Free(op, old_value.gptr());
+        FreeVal(op, old_value.gptr());
     } else {
         // #ifdef DEBUG
         //         std::cout << "  successfully inserted "
@@ -202,9 +208,7 @@ int KVSRadixTree::Get(char const *key, size_t const key_len, char *val,
         return -2;
     }
 
-    ValBuf *val_p = (ValBuf *)mmgr_->GlobalToLocal(val_ptr.gptr());
-    fam_invalidate(&val_p->size, sizeof(size_t));
-    size_t val_size = val_p->size;
+    size_t val_size = ValLen(val_ptr.gptr());
     if (val_len < val_size) {
         std::cout << "  val buffer is too small: " << val_len << " -> "
                   << val_size << std::endl;
@@ -212,8 +216,7 @@ int KVSRadixTree::Get(char const *key, size_t const key_len, char *val,
         return -1;
     }
     val_len = val_size;
-    fam_invalidate(&val_p->val, val_len);
-    fam_memcpy((char *)val, (char *)val_p->val, val_len);
+    ReadVal(val_ptr.gptr(), val, val_len);
     // #ifdef DEBUG
     //     std::cout << "  successfully fetched "
     //               << std::string(key, key_len) << " -> " << std::string(val,
@@ -222,6 +225,18 @@ int KVSRadixTree::Get(char const *key, size_t const key_len, char *val,
     return 0;
 }
 
+int KVSRadixTree::Get(char const *key, size_t const key_len, ValAlloc const &alloc) {
+    if (key_len > kMaxKeyLen)
+        return -1;
+
+    Eop op(emgr_);
+
+    TagGptr val_ptr = tree_->get(key, key_len);
+    if (!val_ptr.IsValid())
+        return -2;
+    return CopyVal(val_ptr.gptr(), alloc);
+}
+
 int KVSRadixTree::Del(char const *key, size_t const key_len) {
     // std::cout << "DEL" << " " << std::string(key, key_len) << std::endl;
     if (key_len > kMaxKeyLen)
@@ -242,7 +257,7 @@ int KVSRadixTree::Del(char const *key, size_t const key_len) {
         //         std::cout << "  delayed free memory at " << val_gptr <<
         // std::endl;
         // #endif
-        heap_->Free(op, val_gptr.gptr());
+        FreeVal(op, val_gptr.gptr());
         return 0;
     } else {
         // #ifdef DEBUG
@@ -253,6 +268,179 @@ int KVSRadixTree::Del(char const *key, size_t const key_len) {
     }
 }
 
+// the keys the tree can take, and their positions in keys; the other keys get
+// -1 in rets
+static int batch_of_valid_keys(std::vector<std::string> const &keys,
+                               std::vector<int> &rets,
+                               std::vector<std::string> &batch_keys,
+                               std::vector<size_t> &batch_idx) {
+    int ret = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i].empty() || keys[i].size() > KVSRadixTree::kMaxKeyLen) {
+            rets[i] = -1;
+            ret = -1;
+            continue;
+        }
+        batch_keys.push_back(keys[i]);
+        batch_idx.push_back(i);
+    }
+    return ret;
+}
+
+int KVSRadixTree::MultiPut(std::vector<std::string> const &keys,
+                           std::vector<std::string> const &vals,
+                           std::vector<int> &rets) {
+    if (keys.size() != vals.size())
+        return -1;
+
+    rets.assign(keys.size(), 0);
+    std::vector<std::string> batch_keys;
+    std::vector<Gptr> batch_vals;
+
+    Eop op(emgr_);
+
+    int ret = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        size_t const key_len = keys[i].size();
+        size_t const val_len = vals[i].size();
+        if (key_len == 0 || key_len > kMaxKeyLen || val_len > kMaxValLen) {
+            rets[i] = -1;
+            ret = -1;
+            continue;
+        }
+
+        Gptr val_gptr = NewVal(vals[i].data(), val_len);
+        if (!val_gptr.IsValid()) {
+            rets[i] = -1;
+            ret = -1;
+            continue;
+        }
+
+        batch_keys.push_back(keys[i]);
+        batch_vals.push_back(val_gptr);
+    }
+
+    std::vector<TagGptr> old_values;
+    tree_->put(batch_keys, batch_vals, UPDATE, old_values);
+    for (size_t j = 0; j < old_values.size(); j++) {
+        if (old_values[j].IsValid())
+            FreeVal(op, old_values[j].gptr());
+    }
+    return ret;
+}
+
+int KVSRadixTree::BulkLoad(std::vector<std::string> const &keys,
+                           std::vector<std::string> const &vals,
+                           std::vector<int> &rets, size_t threads) {
+    if (keys.size() != vals.size())
+        return -1;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::max<size_t>(1, std::min(threads, keys.size()));
+
+    rets.assign(keys.size(), 0);
+    std::vector<Gptr> val_gptrs(keys.size());
+    size_t const stripe = (keys.size() + threads - 1) / threads;
+    auto write_vals = [&](size_t t) {
+        size_t const end = std::min(keys.size(), (t + 1) * stripe);
+        for (size_t i = t * stripe; i < end; i++) {
+            size_t const key_len = keys[i].size();
+            size_t const val_len = vals[i].size();
+            if (key_len == 0 || key_len > kMaxKeyLen || val_len > kMaxValLen) {
+                rets[i] = -1;
+                continue;
+            }
+
+            Gptr val_gptr = NewVal(vals[i].data(), val_len);
+            if (!val_gptr.IsValid()) {
+                rets[i] = -1;
+                continue;
+            }
+            val_gptrs[i] = val_gptr;
+        }
+    };
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; t++)
+        pool.emplace_back(write_vals, t);
+    write_vals(0);
+    for (auto &t : pool)
+        t.join();
+
+    int ret = 0;
+    std::vector<std::string> batch_keys;
+    std::vector<Gptr> batch_vals;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (rets[i] == -1) {
+            ret = -1;
+            continue;
+        }
+        batch_keys.push_back(keys[i]);
+        batch_vals.push_back(val_gptrs[i]);
+    }
+
+    Eop op(emgr_);
+
+    std::vector<TagGptr> old_values;
+    tree_->load(batch_keys, batch_vals, old_values, threads);
+    for (size_t j = 0; j < old_values.size(); j++) {
+        if (old_values[j].IsValid())
+            FreeVal(op, old_values[j].gptr());
+    }
+    return ret;
+}
+
+int KVSRadixTree::MultiGet(std::vector<std::string> const &keys,
+                           std::vector<std::string> &vals,
+                           std::vector<int> &rets) {
+    rets.assign(keys.size(), 0);
+    vals.assign(keys.size(), std::string());
+    std::vector<std::string> batch_keys;
+    std::vector<size_t> batch_idx;
+    int ret = batch_of_valid_keys(keys, rets, batch_keys, batch_idx);
+
+    Eop op(emgr_);
+
+    std::vector<TagGptr> val_ptrs;
+    tree_->get(batch_keys, val_ptrs, kLookupWidth);
+
+    // start fetching all the values before copying the first one
+    for (size_t j = 0; j < batch_idx.size(); j++) {
+        if (val_ptrs[j].IsValid())
+            PrefetchVal(val_ptrs[j].gptr());
+    }
+
+    for (size_t j = 0; j < batch_idx.size(); j++) {
+        size_t i = batch_idx[j];
+        if (!val_ptrs[j].IsValid()) {
+            rets[i] = -2;
+            continue;
+        }
+        vals[i].resize(ValLen(val_ptrs[j].gptr()));
+        ReadVal(val_ptrs[j].gptr(), &vals[i][0], vals[i].size());
+    }
+    return ret;
+}
+
+int KVSRadixTree::MultiDel(std::vector<std::string> const &keys,
+                           std::vector<int> &rets) {
+    rets.assign(keys.size(), 0);
+    std::vector<std::string> batch_keys;
+    std::vector<size_t> batch_idx;
+    int ret = batch_of_valid_keys(keys, rets, batch_keys, batch_idx);
+
+    Eop op(emgr_);
+
+    std::vector<TagGptr> old_values;
+    tree_->destroy(batch_keys, old_values);
+    for (size_t j = 0; j < batch_idx.size(); j++) {
+        if (old_values[j].IsValid())
+            FreeVal(op, old_values[j].gptr());
+        else
+            rets[batch_idx[j]] = -2;
+    }
+    return ret;
+}
+
 int KVSRadixTree::Scan(int &iter_handle, char *key, size_t &key_len, char *val,
                        size_t &val_len, char const *begin_key,
                        size_t const begin_key_len,
@@ -268,18 +456,20 @@ int KVSRadixTree::Scan(int &iter_handle, char *key, size_t &key_len, char *val,
 
     Eop op(emgr_);
 
-    RadixTree::Iter *iter = new RadixTree::Iter();
+    RadixTree::Iter *iter = iters_.Open(iter_handle);
+    if (!iter)
+        return -1; // too many open iterators
     TagGptr val_gptr;
     int ret = tree_->scan(*iter, key, key_len, val_gptr, begin_key,
                           begin_key_len, begin_key_inclusive, end_key,
                           end_key_len, end_key_inclusive);
-    if (ret != 0)
+    if (ret != 0) {
+        iters_.Close(iter_handle);
         return -2; // no key in range
+    }
 
     // copy val
-    ValBuf *val_ptr = (ValBuf *)mmgr_->GlobalToLocal(val_gptr.gptr());
-    fam_invalidate(&val_ptr->size, sizeof(size_t));
-    size_t val_size = val_ptr->size;
+    size_t val_size = ValLen(val_gptr.gptr());
     if (val_len < val_size) {
         std::cout << "  val buffer is too small: " << val_len << " -> "
                   << val_size << std::endl;
@@ -287,19 +477,13 @@ int KVSRadixTree::Scan(int &iter_handle, char *key, size_t &key_len, char *val,
         return -1;
     }
     val_len = val_size;
-    fam_invalidate(&val_ptr->val, val_len);
-    fam_memcpy((char *)val, (char *)val_ptr->val, val_len);
+    ReadVal(val_gptr.gptr(), val, val_len);
     // #ifdef DEBUG
     // std::cout << "  SCAN: successfully fetched "
     //           << std::string(key, key_len) << " -> "
     //           << std::string(val, val_len)
     //           << std::endl;
     // #endif
-
-    // assign iter handle
-    std::lock_guard<std::mutex> lock(mutex_);
-    iters_.push_back(iter);
-    iter_handle = (int)(iters_.size() - 1);
     return 0;
 }
 
@@ -309,24 +493,21 @@ int KVSRadixTree::GetNext(int iter_handle, char *key, size_t &key_len,
         return -1;
     if (val_len > kMaxValLen)
         return -1;
-    if (iter_handle < 0 || iter_handle >= (int)iters_.size())
+    RadixTree::Iter *iter = iters_.Find(iter_handle);
+    if (!iter)
         return -1;
 
-    TagGptr val_gptr;
+    Eop op(emgr_);
 
-    RadixTree::Iter *iter;
-    {
-        // std::lock_guard<std::mutex> lock(mutex_);
-        iter = iters_[iter_handle];
-    }
+    TagGptr val_gptr;
     int ret = tree_->get_next(*iter, key, key_len, val_gptr);
-    if (ret != 0)
+    if (ret != 0) {
+        iters_.Close(iter_handle);
         return -2; // no next key
+    }
 
     // copy val
-    ValBuf *val_ptr = (ValBuf *)mmgr_->GlobalToLocal(val_gptr.gptr());
-    fam_invalidate(&val_ptr->size, sizeof(size_t));
-    size_t val_size = val_ptr->size;
+    size_t val_size = ValLen(val_gptr.gptr());
     if (val_len < val_size) {
         std::cout << "  val buffer is too small: " << val_len << " -> "
                   << val_size << std::endl;
@@ -334,8 +515,7 @@ int KVSRadixTree::GetNext(int iter_handle, char *key, size_t &key_len,
         return -1;
     }
     val_len = val_size;
-    fam_invalidate(&val_ptr->val, val_len);
-    fam_memcpy((char *)val, (char *)val_ptr->val, val_len);
+    ReadVal(val_gptr.gptr(), val, val_len);
     // #ifdef DEBUG
     //     std::cout << "  GET_NEXT: successfully fetched "
     //               << std::string(key, key_len) << " -> "
@@ -345,10 +525,191 @@ int KVSRadixTree::GetNext(int iter_handle, char *key, size_t &key_len,
     return 0;
 }
 
+int KVSRadixTree::CloseIter(int iter_handle) {
+    return iters_.Close(iter_handle);
+}
+
+int KVSRadixTree::ScanBatch(char const *begin_key, size_t const begin_key_len,
+                            bool const begin_key_inclusive,
+                            char const *end_key, size_t const end_key_len,
+                            bool const end_key_inclusive, size_t const limit,
+                            char *buf, size_t &buf_len, size_t &cnt) {
+    cnt = 0;
+    if (begin_key_len > kMaxKeyLen || end_key_len > kMaxKeyLen)
+        return -1;
+    if (limit == 0)
+        return -1;
+
+    Eop op(emgr_);
+
+    std::vector<std::string> keys;
+    std::vector<TagGptr> val_ptrs;
+    int ret = tree_->scan_batch(keys, val_ptrs, limit, begin_key, begin_key_len,
+                                begin_key_inclusive, end_key, end_key_len,
+                                end_key_inclusive);
+    if (ret != 0)
+        return -2; // no key in range
+
+    // start fetching all the values before copying the first one
+    for (size_t j = 0; j < val_ptrs.size(); j++)
+        PrefetchVal(val_ptrs[j].gptr());
+
+    size_t used = 0;
+    for (size_t j = 0; j < keys.size(); j++) {
+        size_t val_size = ValLen(val_ptrs[j].gptr());
+        size_t rec_size = ScanRecord::size(keys[j].size(), val_size);
+        if (used + rec_size > buf_len) {
+            if (j == 0) {
+                buf_len = rec_size;
+                return -1;
+            }
+            break; // the next call starts from the last key we return
+        }
+
+        ScanRecord *rec = (ScanRecord *)(buf + used);
+        rec->key_len = keys[j].size();
+        rec->val_len = val_size;
+        memcpy(rec->data(), keys[j].data(), rec->key_len);
+        ReadVal(val_ptrs[j].gptr(), rec->data() + rec->key_len, val_size);
+        used += rec_size;
+        cnt++;
+    }
+    buf_len = used;
+    return 0;
+}
+
+int KVSRadixTree::ParallelScan(char const *begin_key, size_t const begin_key_len,
+                               bool const begin_key_inclusive,
+                               char const *end_key, size_t const end_key_len,
+                               bool const end_key_inclusive, size_t threads,
+                               bool ordered, ScanCallback f) {
+    if (begin_key_len == 0 || begin_key_len > kMaxKeyLen)
+        return -1;
+    if (end_key_len == 0 || end_key_len > kMaxKeyLen)
+        return -1;
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::string const begin(begin_key, begin_key_len);
+    std::string const end(end_key, end_key_len);
+
+    // subrange i is [bounds[i-1], bounds[i]), with the caller's begin and end
+    // keys at either end
+    std::vector<std::string> bounds;
+    {
+        Eop op(emgr_);
+        tree_->scan_split(bounds, threads * kScanPartsPerWorker, begin_key,
+                          begin_key_len, begin_key_inclusive, end_key,
+                          end_key_len, end_key_inclusive);
+    }
+    size_t const parts = bounds.size() + 1;
+    threads = std::min(threads, parts);
+
+    typedef std::vector<std::pair<std::string, std::string>> Records;
+    std::atomic<size_t> next_part(0);
+    // ordered: the records of a subrange wait in done[] until the subranges
+    // before it have been delivered; one worker at a time delivers
+    std::mutex mutex;
+    std::vector<Records> done(ordered ? parts : 0);
+    std::vector<bool> finished(ordered ? parts : 0, false);
+    size_t next_delivery = 0;
+    bool delivering = false;
+
+    auto work = [&](size_t worker) {
+        Records records;
+        for (size_t i; (i = next_part++) < parts;) {
+            std::string const &from = i == 0 ? begin : bounds[i - 1];
+            std::string const &to = i + 1 == parts ? end : bounds[i];
+            bool const from_inclusive = i == 0 ? begin_key_inclusive : true;
+            bool const to_inclusive = i + 1 == parts ? end_key_inclusive : false;
+            if (!ordered) {
+                ScanRange(from, from_inclusive, to, to_inclusive,
+                          [&](std::string const &key, std::string const &val) {
+                              f(worker, key.data(), key.size(), val.data(),
+                                val.size());
+                          });
+                continue;
+            }
+
+            ScanRange(from, from_inclusive, to, to_inclusive,
+                      [&](std::string const &key, std::string const &val) {
+                          records.emplace_back(key, val);
+                      });
+            std::unique_lock<std::mutex> lock(mutex);
+            done[i].swap(records);
+            finished[i] = true;
+            if (delivering)
+                continue; // the worker that is delivering will get to it
+            delivering = true;
+            while (next_delivery < parts && finished[next_delivery]) {
+                records.swap(done[next_delivery++]);
+                lock.unlock();
+                for (auto &r : records)
+                    f(worker, r.first.data(), r.first.size(), r.second.data(),
+                      r.second.size());
+                records.clear();
+                lock.lock();
+            }
+            delivering = false;
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < threads; t++)
+        pool.emplace_back(work, t);
+    work(0);
+    for (auto &t : pool)
+        t.join();
+    return 0;
+}
+
+void KVSRadixTree::ScanRange(
+    std::string begin_key, bool begin_key_inclusive, std::string const &end_key,
+    bool end_key_inclusive,
+    std::function<void(std::string const &key, std::string const &val)> f) {
+    std::vector<std::string> keys;
+    std::vector<TagGptr> val_ptrs;
+    std::vector<std::string> vals;
+    for (;;) {
+        {
+            Eop op(emgr_);
+            int ret = tree_->scan_batch(keys, val_ptrs, kScanBatch,
+                                        begin_key.data(), begin_key.size(),
+                                        begin_key_inclusive, end_key.data(),
+                                        end_key.size(), end_key_inclusive);
+            if (ret != 0)
+                return; // no more keys in range
+
+            // start fetching all the values before copying the first one
+            for (size_t j = 0; j < val_ptrs.size(); j++)
+                PrefetchVal(val_ptrs[j].gptr());
+
+            vals.resize(keys.size());
+            for (size_t j = 0; j < keys.size(); j++) {
+                vals[j].resize(ValLen(val_ptrs[j].gptr()));
+                ReadVal(val_ptrs[j].gptr(), &vals[j][0], vals[j].size());
+            }
+        }
+
+        for (size_t j = 0; j < keys.size(); j++)
+            f(keys[j], vals[j]);
+        if (keys.size() < kScanBatch)
+            return;
+        begin_key.swap(keys.back());
+        begin_key_inclusive = false;
+    }
+}
+
 /*
   for consistent DRAM caching
 */
 
+uint64_t KVSRadixTree::KeyGen() { return tree_->key_gen(); }
+
+bool KVSRadixTree::KeyPtrStale(uint64_t const key_gen) {
+    return key_gen != NO_KEY_GEN && !tree_->key_ptr_valid(key_gen);
+}
+
 int KVSRadixTree::Put(char const *key, size_t const key_len, char const *val,
                       size_t const val_len, Gptr &key_ptr, TagGptr &val_ptr) {
     // std::cout << "PUT" << " " << std::string(key, key_len) << " " <<
@@ -361,29 +722,16 @@ int KVSRadixTree::Put(char const *key, size_t const key_len, char const *val,
 
     Eop op(emgr_);
 
-    Gptr val_gptr = heap_->Alloc(op, val_len + sizeof(ValBuf));
-    if (!val_gptr.IsValid()) {
-        size_t size = heap_->Size();
-        nvmm::ErrorCode ret = heap_->Resize(2 * size);
-        if (ret != NO_ERROR)
-            return -1;
-        val_gptr = heap_->Alloc(op, val_len + sizeof(ValBuf));
-        if (!val_gptr.IsValid())
-            return -1;
-    }
-
-    ValBuf *val_p = (ValBuf *)mmgr_->GlobalToLocal(val_gptr);
-
-    val_p->size = val_len;
-    memcpy((char *)val_p->val, (char const *)val, val_len);
-    fam_persist(val_p, sizeof(ValBuf) + val_len);
+    Gptr val_gptr = NewVal(val, val_len);
+    if (!val_gptr.IsValid())
+        return -1;
 
     TagGptr old_value;
     std::pair<Gptr, TagGptr> kv_ptr =
         tree_->putC(key, key_len, val_gptr, old_value);
     assert(kv_ptr.first.IsValid());
     if (old_value.IsValid()) {
-        heap_->Free(op, old_value.gptr());
+        FreeVal(op, old_value.gptr());
     }
 
     key_ptr = kv_ptr.first;
@@ -393,7 +741,7 @@ int KVSRadixTree::Put(char const *key, size_t const key_len, char const *val,
 }
 
 int KVSRadixTree::Put(Gptr const key_ptr, TagGptr &val_ptr, char const *val,
-                      size_t const val_len) {
+                      size_t const val_len, uint64_t const key_gen) {
     // std::cout << "PUT" << " " << std::string(key, key_len) << " " <<
     // std::string(val, val_len) << std::endl;
 
@@ -402,29 +750,24 @@ int KVSRadixTree::Put(Gptr const key_ptr, TagGptr &val_ptr, char const *val,
 
     Eop op(emgr_);
 
-    Gptr val_gptr = heap_->Alloc(op, val_len + sizeof(ValBuf));
-    if (!val_gptr.IsValid()) {
-        size_t size = heap_->Size();
-        nvmm::ErrorCode ret = heap_->Resize(2 * size);
-        if (ret != NO_ERROR)
-            return -1;
-        val_gptr = heap_->Alloc(op, val_len + sizeof(ValBuf));
-        if (!val_gptr.IsValid())
-            return -1;
-    }
-
-    // std::cout << " allocated memory at " << val_gptr << std::endl;
+    if (KeyPtrStale(key_gen))
+        return STALE_KEY_PTR;
 
-    ValBuf *val_p = (ValBuf *)mmgr_->GlobalToLocal(val_gptr);
+    Gptr val_gptr = NewVal(val, val_len);
+    if (!val_gptr.IsValid())
+        return -1;
 
-    val_p->size = val_len;
-    memcpy((char *)val_p->val, (char const *)val, val_len);
-    fam_persist(val_p, sizeof(ValBuf) + val_len);
+    // std::cout << " allocated memory at " << val_gptr << std::endl;
 
     TagGptr old_value;
-    val_ptr = tree_->putC(key_ptr, val_gptr, old_value);
+    TagGptr new_value = tree_->putC(key_ptr, val_gptr, old_value);
+    if (RadixTree::pruned(new_value)) {
+        FreeVal(op, val_gptr);
+        return STALE_KEY_PTR;
+    }
+    val_ptr = new_value;
     if (old_value.IsValid()) {
-        heap_->Free(op, old_value.gptr());
+        FreeVal(op, old_value.gptr());
     }
 
     return 0;
@@ -452,25 +795,22 @@ int KVSRadixTree::Get(char const *key, size_t const key_len, char *val,
     // key node exists
     if (kv_ptr.second.IsValid()) {
         // val ptr is not null
-        ValBuf *val_p = (ValBuf *)mmgr_->GlobalToLocal(kv_ptr.second.gptr());
-        fam_invalidate(&val_p->size, sizeof(size_t));
-        size_t val_size = val_p->size;
+        size_t val_size = ValLen(kv_ptr.second.gptr());
         if (val_len < val_size) {
             std::cout << "  val buffer is too small: " << val_len << " -> "
                       << val_size << std::endl;
             val_len = val_size;
             return -1;
         }
-        val_len = val_p->size;
-        fam_invalidate(&val_p->val, val_len);
-        fam_memcpy((char *)val, (char *)val_p->val, val_len);
+        val_len = val_size;
+        ReadVal(kv_ptr.second.gptr(), val, val_len);
     }
 
     return 0;
 }
 
 int KVSRadixTree::Get(Gptr const key_ptr, TagGptr &val_ptr, char *val,
-                      size_t &val_len, bool get_value) {
+                      size_t &val_len, bool get_value, uint64_t const key_gen) {
     // std::cout << "GET" << " " << std::string(key, key_len) << std::endl;
 
     if (val_len > kMaxValLen)
@@ -478,7 +818,11 @@ int KVSRadixTree::Get(Gptr const key_ptr, TagGptr &val_ptr, char *val,
 
     Eop op(emgr_);
 
+    if (KeyPtrStale(key_gen))
+        return STALE_KEY_PTR;
     TagGptr val_ptr_cur = tree_->getC(key_ptr);
+    if (RadixTree::pruned(val_ptr_cur))
+        return STALE_KEY_PTR;
 
     if (val_ptr_cur == val_ptr && get_value == false) {
         // val_ptr is not stale
@@ -487,24 +831,81 @@ int KVSRadixTree::Get(Gptr const key_ptr, TagGptr &val_ptr, char *val,
         // val_ptr is stale or we always want to get the value
         if (val_ptr_cur.IsValid()) {
             // cur val ptr is not null
-            ValBuf *val_p = (ValBuf *)mmgr_->GlobalToLocal(val_ptr_cur.gptr());
-            fam_invalidate(&val_p->size, sizeof(size_t));
-            size_t val_size = val_p->size;
+            size_t val_size = ValLen(val_ptr_cur.gptr());
             if (val_len < val_size) {
                 std::cout << "  val buffer is too small: " << val_len << " -> "
                           << val_size << std::endl;
                 val_len = val_size;
                 return -1;
             }
-            val_len = val_p->size;
-            fam_invalidate(&val_p->val, val_len);
-            fam_memcpy((char *)val, (char *)val_p->val, val_len);
+            val_len = val_size;
+            ReadVal(val_ptr_cur.gptr(), val, val_len);
         }
         val_ptr = val_ptr_cur;
         return 0;
     }
 }
 
+int KVSRadixTree::Get(char const *key, size_t const key_len, ValAlloc const &alloc,
+                      Gptr &key_ptr, TagGptr &val_ptr) {
+    if (key_len > kMaxKeyLen)
+        return -1;
+
+    Eop op(emgr_);
+
+    std::pair<Gptr, TagGptr> kv_ptr = tree_->getC(key, key_len);
+
+    key_ptr = kv_ptr.first;  // key_ptr could be null
+    val_ptr = kv_ptr.second; // val_ptr could be null
+
+    if (!kv_ptr.first.IsValid() || !kv_ptr.second.IsValid())
+        return 0;
+    return CopyVal(kv_ptr.second.gptr(), alloc);
+}
+
+int KVSRadixTree::Get(Gptr const key_ptr, TagGptr &val_ptr, ValAlloc const &alloc,
+                      bool get_value, uint64_t const key_gen) {
+    Eop op(emgr_);
+
+    if (KeyPtrStale(key_gen))
+        return STALE_KEY_PTR;
+    TagGptr val_ptr_cur = tree_->getC(key_ptr);
+    if (RadixTree::pruned(val_ptr_cur))
+        return STALE_KEY_PTR;
+
+    if (val_ptr_cur == val_ptr && get_value == false) {
+        // val_ptr is not stale
+        return 0;
+    }
+    // val_ptr is stale or we always want to get the value
+    val_ptr = val_ptr_cur;
+    if (!val_ptr_cur.IsValid())
+        return 0;
+    return CopyVal(val_ptr_cur.gptr(), alloc);
+}
+
+int KVSRadixTree::Get(char const *key, size_t const key_len, ValAlloc const &alloc,
+                      Gptr &key_ptr, TagGptr &val_ptr, KeyMiss &miss) {
+    if (key_len > kMaxKeyLen)
+        return -1;
+
+    Eop op(emgr_);
+
+    std::pair<Gptr, TagGptr> kv_ptr = tree_->getC(key, key_len, miss);
+
+    key_ptr = kv_ptr.first;  // key_ptr could be null (then miss is set)
+    val_ptr = kv_ptr.second; // val_ptr could be null
+
+    if (!kv_ptr.first.IsValid() || !kv_ptr.second.IsValid())
+        return 0;
+    return CopyVal(kv_ptr.second.gptr(), alloc);
+}
+
+bool KVSRadixTree::Absent(KeyMiss const &miss) {
+    Eop op(emgr_);
+    return tree_->absent(miss);
+}
+
 int KVSRadixTree::Del(char const *key, size_t const key_len, Gptr &key_ptr,
                       TagGptr &val_ptr) {
     // std::cout << "DEL" << " " << std::string(key, key_len) << std::endl;
@@ -527,21 +928,85 @@ int KVSRadixTree::Del(char const *key, size_t const key_len, Gptr &key_ptr,
     // key node exists
     if (old_value.IsValid()) {
         // old_value is not null
-        heap_->Free(op, old_value.gptr());
+        FreeVal(op, old_value.gptr());
     }
 
     return 0;
 }
 
-int KVSRadixTree::Del(Gptr const key_ptr, TagGptr &val_ptr) {
+int KVSRadixTree::Del(Gptr const key_ptr, TagGptr &val_ptr, uint64_t const key_gen) {
     // std::cout << "DEL" << " " << std::string(key, key_len) << std::endl;
     Eop op(emgr_);
 
+    if (KeyPtrStale(key_gen))
+        return STALE_KEY_PTR;
     TagGptr old_value;
-    val_ptr = tree_->destroyC(key_ptr, old_value);
+    TagGptr new_value = tree_->destroyC(key_ptr, old_value);
+    if (RadixTree::pruned(new_value))
+        return STALE_KEY_PTR;
+    val_ptr = new_value;
     if (old_value.IsValid()) {
-        heap_->Free(op, old_value.gptr());
+        FreeVal(op, old_value.gptr());
+    }
+    return 0;
+}
+
+Gptr KVSRadixTree::NewVal(char const *val, size_t const val_len) {
+    if (val_len <= kMaxInlineLen) {
+        uint64_t word = kInlineBit | (val_len << 2);
+        for (size_t i = 0; i < val_len; i++)
+            word |= (uint64_t)(uint8_t)val[i] << (8 * (i + 1));
+        return Gptr(word);
     }
+
+    Gptr val_gptr = slab_->Alloc(val_len + sizeof(ValBuf));
+    if (!val_gptr.IsValid())
+        return Gptr();
+
+    ValBuf *val_p = (ValBuf *)mmgr_->GlobalToLocal(val_gptr);
+    val_p->size = val_len;
+    memcpy((char *)val_p->val, val, val_len);
+    fam_persist(val_p, sizeof(ValBuf) + val_len);
+    return val_gptr;
+}
+
+void KVSRadixTree::FreeVal(Eop &op, Gptr val_gptr) {
+    if (!IsInline(val_gptr))
+        slab_->Free(op, val_gptr, ValLen(val_gptr) + sizeof(ValBuf));
+}
+
+void KVSRadixTree::PrefetchVal(Gptr val_gptr) {
+    if (!IsInline(val_gptr))
+        __builtin_prefetch(mmgr_->GlobalToLocal(val_gptr));
+}
+
+size_t KVSRadixTree::ValLen(Gptr val_gptr) {
+    if (IsInline(val_gptr))
+        return ((uint64_t)val_gptr >> 2) & 7;
+    ValBuf *val_p = (ValBuf *)mmgr_->GlobalToLocal(val_gptr);
+    fam_invalidate(&val_p->size, sizeof(size_t));
+    return val_p->size;
+}
+
+// a value buffer is not changed once it is in the tree, and the epoch op of the caller keeps it
+// from being freed while it is read
+void KVSRadixTree::ReadVal(Gptr val_gptr, char *val, size_t const val_len) {
+    if (IsInline(val_gptr)) {
+        for (size_t i = 0; i < val_len; i++)
+            val[i] = (char)((uint64_t)val_gptr >> (8 * (i + 1)));
+        return;
+    }
+    ValBuf *val_p = (ValBuf *)mmgr_->GlobalToLocal(val_gptr);
+    fam_invalidate(&val_p->val, val_len);
+    fam_memcpy(val, (char *)val_p->val, val_len);
+}
+
+int KVSRadixTree::CopyVal(Gptr val_gptr, ValAlloc const &alloc) {
+    size_t val_len = ValLen(val_gptr);
+    char *val = alloc(val_len);
+    if (!val)
+        return -1;
+    ReadVal(val_gptr, val, val_len);
     return 0;
 }
 
@@ -571,22 +1036,9 @@ int KVSRadixTree::FindOrCreate(char const *key, size_t const key_len,
 
     Eop op(emgr_);
 
-    Gptr val_gptr = heap_->Alloc(op, val_len + sizeof(ValBuf));
-    if (!val_gptr.IsValid()) {
-        size_t size = heap_->Size();
-        nvmm::ErrorCode ret = heap_->Resize(2 * size);
-        if (ret != NO_ERROR)
-            return -1;
-        val_gptr = heap_->Alloc(op, val_len + sizeof(ValBuf));
-        if (!val_gptr.IsValid())
-            return -1;
-    }
-
-    ValBuf *val_ptr = (ValBuf *)mmgr_->GlobalToLocal(val_gptr);
-
-    val_ptr->size = val_len;
-    memcpy((char *)val_ptr->val, (char const *)val, val_len);
-    fam_persist(val_ptr, sizeof(ValBuf) + val_len);
+    Gptr val_gptr = NewVal(val, val_len);
+    if (!val_gptr.IsValid())
+        return -1;
 
     TagGptr old_value = tree_->put(key, key_len, val_gptr, FIND_OR_CREATE);
     if (old_value.IsValid()) {
@@ -594,11 +1046,9 @@ int KVSRadixTree::FindOrCreate(char const *key, size_t const key_len,
         LOG(trace)
             << "KVSRadixTree::FindOrCreate(): Returning the found Entry\n"
             << std::endl;
-        heap_->Free(op, val_gptr);
+        FreeVal(op, val_gptr);
 
-        ValBuf *val_p = (ValBuf *)mmgr_->GlobalToLocal(old_value.gptr());
-        fam_invalidate(&val_p->size, sizeof(size_t));
-        size_t val_size = val_p->size;
+        size_t val_size = ValLen(old_value.gptr());
         if (ret_len < val_size) {
             LOG(trace) << "  val buffer is too small: " << ret_len << " -> "
                        << val_size << std::endl;
@@ -606,9 +1056,8 @@ int KVSRadixTree::FindOrCreate(char const *key, size_t const key_len,
             return -1;
         }
         ret_len = val_size;
-        fam_invalidate(&val_p->val, ret_len);
         assert(ret_val != nullptr);
-        fam_memcpy((char *)ret_val, (char *)val_p->val, ret_len);
+        ReadVal(old_value.gptr(), ret_val, ret_len);
         return -3;
     } else {
         LOG(trace) << "  successfully inserted " << std::string(key, key_len)
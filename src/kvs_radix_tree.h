@@ -42,7 +42,9 @@
 #include "radixtree/kvs.h"
 #include "radixtree/radix_tree.h"
 
+#include "kvs_iter_table.h"
 #include "kvs_metrics.h"
+#include "slab_heap.h"
 
 
 namespace radixtree {
@@ -53,26 +55,58 @@ using Eop = nvmm::EpochOp;
 
 class KVSRadixTree : public KeyValueStore {
 public:
-    static size_t const kMaxKeyLen = RadixTree::MAX_KEY_LEN; // 40 bytes for now
+    static size_t const kMaxKeyLen = RadixTree::MAX_KEY_LEN;
+    // values of up to kMaxInlineLen bytes are kept in the tree itself (see NewVal)
     static size_t const kMaxValLen = std::numeric_limits<size_t>::max();
+    // number of lookups MultiGet keeps in flight (see RadixTree::get)
+    static size_t const kLookupWidth = 8;
+    // ParallelScan: keys a worker gathers per epoch op, and the number of subranges per worker
+    // it aims for, so that workers that finish early can take over more of the range
+    static size_t const kScanBatch = 256;
+    static size_t const kScanPartsPerWorker = 8;
 
     KVSRadixTree(Gptr root, std::string base, std::string user, size_t heap_size, nvmm::PoolId heap_id, RadixTreeMetrics* kvs_metrics);
     ~KVSRadixTree();
 
     void Maintenance();
 
+    int Compact (size_t &pruned);
+
     int Put (char const *key, size_t const key_len,
 	     char const *val, size_t const val_len);
 
     int Get (char const *key, size_t const key_len,
 	     char *val, size_t &val_len);
 
+    // zero-copy: the value goes from FAM straight into alloc(val_len)
+    int Get (char const *key, size_t const key_len, ValAlloc const &alloc);
+
     int FindOrCreate(char const *key, size_t const key_len,
         char const *val, size_t const val_len,
         char *ret_val, size_t &ret_len);
 
     int Del (char const *key, size_t const key_len);
 
+    // batched APIs: one epoch op for the whole batch
+    // MultiGet interleaves the lookups of kLookupWidth keys; MultiPut and MultiDel walk the
+    // tree in key order
+    int MultiPut (std::vector<std::string> const &keys,
+                  std::vector<std::string> const &vals,
+                  std::vector<int> &rets);
+
+    int MultiGet (std::vector<std::string> const &keys,
+                  std::vector<std::string> &vals,
+                  std::vector<int> &rets);
+
+    int MultiDel (std::vector<std::string> const &keys,
+                  std::vector<int> &rets);
+
+    // the workers write the values, each a stripe of them, and then build the new parts of the
+    // tree (RadixTree::load())
+    int BulkLoad (std::vector<std::string> const &keys,
+                  std::vector<std::string> const &vals,
+                  std::vector<int> &rets, size_t threads=0);
+
     int Scan (int &iter_handle,
               char *key, size_t &key_len,
               char *val, size_t &val_len,
@@ -85,6 +119,23 @@ public:
                 char *key, size_t &key_len,
                 char *val, size_t &val_len);
 
+    int CloseIter(int iter_handle);
+
+    // gathers the value ptrs of the whole batch in one traversal, then copies the values out
+    int ScanBatch(char const *begin_key, size_t const begin_key_len,
+                  bool const begin_key_inclusive,
+                  char const *end_key, size_t const end_key_len,
+                  bool const end_key_inclusive,
+                  size_t const limit, char *buf, size_t &buf_len, size_t &cnt);
+
+    // the workers come from a pool that lives for the call and takes subranges off a shared
+    // counter, in key order
+    int ParallelScan(char const *begin_key, size_t const begin_key_len,
+                     bool const begin_key_inclusive,
+                     char const *end_key, size_t const end_key_len,
+                     bool const end_key_inclusive,
+                     size_t threads, bool ordered, ScanCallback f);
+
     Gptr Location () {return root_;}
 
     size_t MaxKeyLen() {return kMaxKeyLen;}
@@ -96,6 +147,8 @@ public:
 
       val_ptr is always the up-to-date val_ptr in FAM
     */
+    uint64_t KeyGen();
+
     // for non-cached put
     int Put (char const *key, size_t const key_len,
 	     char const *val, size_t const val_len,
@@ -103,7 +156,8 @@ public:
 
     // for cached put
     int Put (Gptr const key_ptr, TagGptr &val_ptr,
-	     char const *val, size_t const val_len);
+	     char const *val, size_t const val_len,
+             uint64_t const key_gen=NO_KEY_GEN);
 
     // for non-cached Get
     int Get (char const *key, size_t const key_len,
@@ -115,44 +169,81 @@ public:
     // otherwise, only when the given val_ptr is stale we fetch the value from FAM (for full caching)
     // return 1 if the val_ptr is up-to-date
     int Get (Gptr const key_ptr, TagGptr &val_ptr,
-	     char *val, size_t &val_len, bool get_value=false);
+	     char *val, size_t &val_len, bool get_value=false,
+             uint64_t const key_gen=NO_KEY_GEN);
+
+    // zero-copy versions of the two Gets above
+    int Get (char const *key, size_t const key_len, ValAlloc const &alloc,
+             Gptr &key_ptr, TagGptr &val_ptr);
+    int Get (Gptr const key_ptr, TagGptr &val_ptr,
+             ValAlloc const &alloc, bool get_value=false,
+             uint64_t const key_gen=NO_KEY_GEN);
+
+    // for negative caching
+    int Get (char const *key, size_t const key_len, ValAlloc const &alloc,
+             Gptr &key_ptr, TagGptr &val_ptr, KeyMiss &miss);
+    bool Absent (KeyMiss const &miss);
 
     // for non-cached Del
     int Del (char const *key, size_t const key_len,
              Gptr &key_ptr, TagGptr &val_ptr);
 
     // for cached Del
-    int Del (Gptr const key_ptr, TagGptr &val_ptr);
+    int Del (Gptr const key_ptr, TagGptr &val_ptr,
+             uint64_t const key_gen=NO_KEY_GEN);
 
     void ReportMetrics();
 
 private:
+    // with an epoch op held: a key ptr from key_gen may have been pruned by Compact()
+    bool KeyPtrStale(uint64_t const key_gen);
+
     struct ValBuf {
         size_t size;
         char val[0];
     };
 
+    // a value of up to kMaxInlineLen bytes lives in the value word of its leaf instead of a
+    // ValBuf (see RadixTree::INLINE_VALUE); the tag stays the version, so the word is only 8 bytes
+    static size_t const kMaxInlineLen = RadixTree::MAX_INLINE_LEN;
+    static uint64_t const kInlineBit = RadixTree::INLINE_VALUE;
+    static bool IsInline(Gptr val_gptr) { return RadixTree::inline_value(val_gptr); }
+
+    // an inline value, or a new ValBuf holding val; null if the heap is full
+    Gptr NewVal(char const *val, size_t const val_len);
+    void FreeVal(Eop &op, Gptr val_gptr);
+    void PrefetchVal(Gptr val_gptr);
+    size_t ValLen(Gptr val_gptr);
+    // copies the first val_len bytes of the value at val_gptr into val
+    void ReadVal(Gptr val_gptr, char *val, size_t const val_len);
+
     nvmm::PoolId heap_id_;
     size_t heap_size_;
 
     Mmgr *mmgr_;
     Emgr *emgr_;
     Heap *heap_;
+    SlabHeap *slab_; // the tree's nodes and the values
 
     RadixTree *tree_;
     Gptr root_;
     RadixTreeMetrics *metrics_;
 
-    // TODO: remove mutex?
-    std::mutex mutex_; // for iterator deque
-    // TODO: clean up used iters
-    //std::vector<RadixTree::Iter*> iters_;
-    std::deque<RadixTree::Iter*> iters_;
+    IterTable iters_;
 
 
     int Open();
     int Close();
 
+    // copies the value at val_gptr into alloc(its size); returns -1 if alloc gives up
+    int CopyVal(Gptr val_gptr, ValAlloc const &alloc);
+
+    // scans [begin_key, end_key] (bounds as in Scan) kScanBatch keys at a time, with no epoch op
+    // held while f runs
+    void ScanRange(std::string begin_key, bool begin_key_inclusive,
+                   std::string const &end_key, bool end_key_inclusive,
+                   std::function<void(std::string const &key, std::string const &val)> f);
+
 };
 
 } // namespace radixtree
@@ -122,12 +122,6 @@ int KVSRadixTreeTiny::Close() {
         delete heap_;
         heap_ = nullptr;
     }
-
-    // delete all iters
-    for (auto iter:iters_) {
-        if (iter)
-            delete iter;
-    }
     return 0;
 }
 
@@ -140,6 +134,8 @@ int KVSRadixTreeTiny::Put (char const *key, size_t const key_len,
     if (val_len > kMaxValLen)
         return -1;
 
+    Eop op(emgr_);
+
     Gptr val_gptr = CHAR2UINT64_CONST(val);
     TagGptr old_value = tree_->put(key, key_len, val_gptr, UPDATE);
     return 0;
@@ -154,6 +150,8 @@ int KVSRadixTreeTiny::Get (char const *key, size_t const key_len,
     // if (val_len > kMaxValLen)
     //     return -1;
 
+    Eop op(emgr_);
+
     TagGptr val_ptr = tree_->get(key, key_len);
     CHAR2UINT64(val) = val_ptr.gptr_nomark();
     val_len=kMaxValLen;
@@ -169,6 +167,8 @@ int KVSRadixTreeTiny::Del (char const *key, size_t const key_len) {
     if (key_len > kMaxKeyLen)
         return -1;
 
+    Eop op(emgr_);
+
     TagGptr val_ptr = tree_->destroy(key, key_len);
     if (!val_ptr.IsValid()) {
         //std::cout << val_ptr.gptr_nomark() << std::endl;
@@ -193,22 +193,24 @@ int KVSRadixTreeTiny::Scan (
     if (val_len > kMaxValLen)
         return -1;
 
-    RadixTree::Iter *iter=new RadixTree::Iter();
+    RadixTree::Iter *iter=iters_.Open(iter_handle);
+    if (!iter)
+        return -1; // too many open iterators
+
+    Eop op(emgr_);
+
     TagGptr val_gptr;
     int ret = tree_->scan(*iter,
                           key, key_len, val_gptr,
                           begin_key, begin_key_len, begin_key_inclusive,
                           end_key, end_key_len, end_key_inclusive);
-    if (ret!=0)
+    if (ret!=0) {
+        iters_.Close(iter_handle);
         return -2; // no key in range
+    }
 
     CHAR2UINT64(val) = val_gptr.gptr_nomark();
     val_len=kMaxValLen;
-
-    // assign iter handle
-    std::lock_guard<std::mutex> lock(mutex_);
-    iters_.push_back(iter);
-    iter_handle = (int)(iters_.size()-1);
     return 0;
 }
 
@@ -219,20 +221,19 @@ int KVSRadixTreeTiny::GetNext(int iter_handle,
         return -1;
     if (val_len > kMaxValLen)
         return -1;
-    if (iter_handle <0 || iter_handle >= (int)iters_.size())
+    RadixTree::Iter *iter = iters_.Find(iter_handle);
+    if (!iter)
         return -1;
 
-    TagGptr val_gptr;
+    Eop op(emgr_);
 
-    RadixTree::Iter *iter;
-    {
-        //std::lock_guard<std::mutex> lock(mutex_);
-        iter = iters_[iter_handle];
-    }
+    TagGptr val_gptr;
     int ret = tree_->get_next(*iter,
                               key, key_len, val_gptr);
-    if (ret!=0)
+    if (ret!=0) {
+        iters_.Close(iter_handle);
         return -2; // no next key
+    }
 
     CHAR2UINT64(val) = val_gptr.gptr_nomark();
     val_len=kMaxValLen;
@@ -240,6 +241,10 @@ int KVSRadixTreeTiny::GetNext(int iter_handle,
     return 0;
 }
 
+int KVSRadixTreeTiny::CloseIter(int iter_handle) {
+    return iters_.Close(iter_handle);
+}
+
 
 /*
   for consistent DRAM caching
@@ -254,6 +259,8 @@ int KVSRadixTreeTiny::Put (char const *key, size_t const key_len,
     if (val_len > kMaxValLen)
         return -1;
 
+    Eop op(emgr_);
+
     Gptr val_gptr = CHAR2UINT64_CONST(val);
     TagGptr old_value;
     std::pair<Gptr, TagGptr> kv_ptr = tree_->putC(key, key_len, val_gptr, old_value);
@@ -264,12 +271,14 @@ int KVSRadixTreeTiny::Put (char const *key, size_t const key_len,
 }
 
 int KVSRadixTreeTiny::Put (Gptr const key_ptr, TagGptr &val_ptr,
-                       char const *val, size_t const val_len) {
+                       char const *val, size_t const val_len, uint64_t const key_gen) {
     //std::cout << "PUT" << " " << std::string(key, key_len) << " " << std::string(val, val_len) << std::endl;
 
     if (val_len > kMaxValLen)
         return -1;
 
+    Eop op(emgr_);
+
     Gptr val_gptr = CHAR2UINT64_CONST(val);
     TagGptr old_value;
     val_ptr = tree_->putC(key_ptr, val_gptr, old_value);
@@ -284,6 +293,8 @@ int KVSRadixTreeTiny::Get (char const *key, size_t const key_len,
     if (key_len > kMaxKeyLen)
         return -1;
 
+    Eop op(emgr_);
+
     std::pair<Gptr, TagGptr> kv_ptr = tree_->getC(key, key_len);
 
     key_ptr=kv_ptr.first; // key_ptr could be null
@@ -302,9 +313,11 @@ int KVSRadixTreeTiny::Get (char const *key, size_t const key_len,
 }
 
 int KVSRadixTreeTiny::Get (Gptr const key_ptr, TagGptr &val_ptr,
-                       char *val, size_t &val_len, bool get_value) {
+                       char *val, size_t &val_len, bool get_value, uint64_t const key_gen) {
     //std::cout << "GET" << " " << std::string(key, key_len) << std::endl;
 
+    Eop op(emgr_);
+
     TagGptr val_ptr_cur = tree_->getC(key_ptr);
 
     if(val_ptr_cur == val_ptr && get_value==false) {
@@ -327,6 +340,8 @@ int KVSRadixTreeTiny::Del (char const *key, size_t const key_len,
     if (key_len > kMaxKeyLen)
         return -1;
 
+    Eop op(emgr_);
+
     TagGptr old_value;
     std::pair<Gptr, TagGptr> kv_ptr = tree_->destroyC(key, key_len, old_value);
 
@@ -337,8 +352,10 @@ int KVSRadixTreeTiny::Del (char const *key, size_t const key_len,
 }
 
 
-int KVSRadixTreeTiny::Del (Gptr const key_ptr, TagGptr &val_ptr) {
+int KVSRadixTreeTiny::Del (Gptr const key_ptr, TagGptr &val_ptr, uint64_t const key_gen) {
     //std::cout << "DEL" << " " << std::string(key, key_len) << std::endl;
+    Eop op(emgr_);
+
     TagGptr old_value;
     val_ptr = tree_->destroyC(key_ptr, old_value);
     return 0;
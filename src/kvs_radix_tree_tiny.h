@@ -42,6 +42,7 @@
 #include "radixtree/kvs.h"
 #include "radixtree/radix_tree.h"
 
+#include "kvs_iter_table.h"
 #include "kvs_metrics.h"
 
 namespace radixtree {
@@ -52,7 +53,7 @@ using Eop = nvmm::EpochOp;
 
 class KVSRadixTreeTiny : public KeyValueStore {
 public:
-    static size_t const kMaxKeyLen = RadixTree::MAX_KEY_LEN; // 40 bytes for now
+    static size_t const kMaxKeyLen = RadixTree::MAX_KEY_LEN;
     static size_t const kMaxValLen = 8; // 8 byte
 
     KVSRadixTreeTiny(Gptr root, std::string base, std::string user, size_t heap_size, nvmm::PoolId heap_id, KVSMetrics* metrics);
@@ -84,6 +85,8 @@ public:
                 char *key, size_t &key_len,
                 char *val, size_t &val_len);
 
+    int CloseIter(int iter_handle);
+
     Gptr Location () {return root_;}
 
     size_t MaxKeyLen() {return kMaxKeyLen;}
@@ -94,6 +97,7 @@ public:
       for consistent DRAM caching
 
       val_ptr is always the up-to-date val_ptr in FAM
+      there is no Compact(), so key ptrs never go stale (key_gen is not checked)
     */
     // for non-cached put
     int Put (char const *key, size_t const key_len,
@@ -102,7 +106,8 @@ public:
 
     // for cached put
     int Put (Gptr const key_ptr, TagGptr &val_ptr,
-	     char const *val, size_t const val_len);
+	     char const *val, size_t const val_len,
+             uint64_t const key_gen=NO_KEY_GEN);
 
     // for non-cached Get
     int Get (char const *key, size_t const key_len,
@@ -114,14 +119,16 @@ public:
     // otherwise, only when the given val_ptr is stale we fetch the value from FAM (for full caching)
     // return 1 if the val_ptr is up-to-date
     int Get (Gptr const key_ptr, TagGptr &val_ptr,
-	     char *val, size_t &val_len, bool get_value=false);
+	     char *val, size_t &val_len, bool get_value=false,
+             uint64_t const key_gen=NO_KEY_GEN);
 
     // for non-cached Del
     int Del (char const *key, size_t const key_len,
              Gptr &key_ptr, TagGptr &val_ptr);
 
     // for cached Del
-    int Del (Gptr const key_ptr, TagGptr &val_ptr);
+    int Del (Gptr const key_ptr, TagGptr &val_ptr,
+             uint64_t const key_gen=NO_KEY_GEN);
 
     void ReportMetrics();
 
@@ -142,11 +149,7 @@ private:
     Gptr root_;
     KVSMetrics *metrics_;
 
-    // TODO: remove mutex?
-    std::mutex mutex_; // for iterator deque
-    // TODO: clean up used iters
-    //std::vector<RadixTree::Iter*> iters_;
-    std::deque<RadixTree::Iter*> iters_;
+    IterTable iters_;
 
 
     int Open();
@@ -131,10 +131,6 @@ int KVSSplitOrdered::Put (char const *key, size_t const key_len,
 
     Eop op(emgr_);
 
-    SplitOrderedList::ByteKey key_buf;
-    memset(&key_buf, 0, sizeof(key_buf));
-    memcpy((char*)&key_buf, key, key_len);
-
     Gptr val_gptr = heap_->Alloc(op, val_len+sizeof(ValBuf));
     if (!val_gptr.IsValid())
         return -1;
@@ -146,8 +142,9 @@ int KVSSplitOrdered::Put (char const *key, size_t const key_len,
     fam_persist(val_ptr, sizeof(ValBuf)+val_len);
 
     Gptr old_val_gptr;
-    int success = sol_->InsertOrUpdate(op, key_buf, (int)key_len, val_gptr, &old_val_gptr);
-    if (!success) {
+    int success = sol_->InsertOrUpdate(op, key, (int)key_len, val_gptr, &old_val_gptr);
+    if (success != 1) {
+        heap_->Free(op, val_gptr);
         return -1;
     }
     if (old_val_gptr) {
@@ -179,11 +176,7 @@ int KVSSplitOrdered::Get (char const *key, size_t const key_len,
 
     Eop op(emgr_);
 
-    SplitOrderedList::ByteKey key_buf;
-    memset(&key_buf, 0, sizeof(key_buf));
-    memcpy((char*)&key_buf, key, key_len);
-
-    Gptr val_gptr = sol_->Find(op, key_buf, (int)key_len);
+    Gptr val_gptr = sol_->Find(op, key, (int)key_len);
     if (!val_gptr)
         return -1;
 
@@ -211,13 +204,9 @@ int KVSSplitOrdered::Del (char const *key, size_t const key_len) {
 
     Eop op(emgr_);
 
-    SplitOrderedList::ByteKey key_buf;
-    memset(&key_buf, 0, sizeof(key_buf));
-    memcpy((char*)&key_buf, key, key_len);
-
     Gptr val_gptr;
-    int success = sol_->Delete(op, key_buf, (int)key_len, &val_gptr);
-    if (success) {
+    int success = sol_->Delete(op, key, (int)key_len, &val_gptr);
+    if (success == 1) {
 #ifdef DEBUG
         std::cout << "  successfully deleted " << std::string(key, key_len);
         ValBuf *val_ptr = (ValBuf*)mmgr_->GlobalToLocal(val_gptr);
@@ -51,7 +51,7 @@ using Eop = nvmm::EpochOp;
 
 class KVSSplitOrdered : public KeyValueStore {
 public:
-    static size_t const kMaxKeyLen = sizeof(SplitOrderedList::ByteKey); // 40 bytes
+    static size_t const kMaxKeyLen = SplitOrderedList::MAX_KEY_LEN;
     static size_t const kMaxValLen = std::numeric_limits<size_t>::max();
 
     KVSSplitOrdered(Gptr descriptor, std::string base, std::string user, size_t heap_size, nvmm::PoolId heap_id, SplitOrderedMetrics* kvs_metrics);
@@ -24,10 +24,15 @@
  */
 
 
+#include <algorithm> // stable_sort
+#include <atomic>
 #include <cstring>
+#include <functional>
 #include <list>
+#include <mutex>
 #include <string>
 #include <stack>
+#include <thread>
 #include <tuple>
 #include <queue>
 #include <utility> // pair
@@ -37,22 +42,155 @@
 #include "nvmm/memory_manager.h"
 #include "nvmm/heap.h"
 #include "nvmm/fam.h"
+#include "nvmm/epoch_manager.h"
 
 #include "radixtree/common.h"
 #include "radixtree/radix_tree.h"
 #include "radix_tree_metrics.h"
+#include "slab_heap.h"
 
 namespace radixtree {
 
 constexpr char const *RadixTree::OPEN_BOUNDARY_KEY;
 
+/*
+  Node layout
+
+  - A leaf holds exactly one key and its value and has no child pointers. Leaves
+  never move once linked, so a leaf ptr can be handed out as a key ptr (putC,
+  getC, destroyC).
+  - An inner node holds 4, 16, 48 or 256 child pointers (as in ART), plus a
+  "leaf" slot for the key that is equal to its prefix.
+  - Every node stores its whole key (leaf) or prefix (inner node) from the root,
+  so once published only the slots of an inner node ever change. The key is
+  stored at the end of the node and sized to fit, so short keys do not pay for
+  long ones.
+  - An inner node that runs out of slots is copied into a node of the right size
+  and the parent pointer is swung with cas64(). Before copying, every slot of
+  the old node is marked (bit 0, including empty slots), so that concurrent
+  inserts into the old node fail and retry against its replacement.
+  - The root is a Node256 and is never replaced.
+  - compact() prunes the leaves of deleted keys: the value of such a leaf is
+  marked PRUNED (so it can no longer be updated), and then the leaf is unlinked
+  by whoever gets to CAS its slot to 0 first. Inner nodes that are left with at
+  most one child are frozen and swung out of the tree the same way they are
+  replaced. As a pruned leaf may be freed, key ptrs are only safe to use within
+  the key generation they were taken in (key_ptr_valid()).
+  - A node that is swung out of the tree bumps its replacement count (one of
+  REPLACED_COUNTS words, picked by its address) before it is retired. Readers
+  that hold on to a node past their epoch op (paused iterators, misses, the
+  DRAM mirror) take its count while it is linked, and trust the node only as
+  long as the count is unchanged.
+*/
+static uint64_t const LEAF = 0;
+static uint64_t const NODE4 = 4;
+static uint64_t const NODE16 = 16;
+static uint64_t const NODE48 = 48;
+static uint64_t const NODE256 = 256;
+
+// the tag of a pruned leaf has this bit set; versions never get there
+static uint64_t const PRUNED = 1ULL << 63;
+// the versions of a new leaf start at the number of compactions begun, shifted
+// up by this, so that the versions of a key keep growing when its pruned leaf is
+// followed by a new one
+static int const VERSION_BITS = 40;
+// the key generation counts the compactions begun above this, and the ones
+// still running below it
+static int const RUNNING_BITS = 16;
+// the nodes swung out of the tree are counted in this many words (see
+// replaced_count())
+static int const REPLACED_BITS = 12;
+static size_t const REPLACED_COUNTS = 1ULL << REPLACED_BITS;
+
+// header shared by all node types
 struct RadixTree::Node {
-  public:
-    char key[RadixTree::MAX_KEY_LEN]; // NOTE: we are actually storing unsigned
-                                      // char
-    size_t prefix_size;
-    Gptr child[256];
+    uint64_t type; // LEAF or the capacity of an inner node
+    size_t prefix_size; // the key size for a leaf
+
+    // the key is stored inline at the end of each node, so a node takes
+    // only as much space as its own key
+    static size_t size_of(uint64_t type, size_t prefix_size);
+
+    bool is_leaf() const { return type == LEAF; }
+    char *prefix();
+
+    // inner nodes only
+    Gptr *leaf_slot();
+    Gptr *children();
+    void init(uint64_t type, const char *prefix, size_t prefix_size);
+    // returns the slot of the child at byte, or NULL if there is none
+    Gptr *find_child(unsigned char byte);
+    // same as find_child(), but assigns a slot to byte if there is none yet;
+    // returns NULL if the node is full
+    Gptr *claim_child(unsigned char byte);
+    // the word that claim_child(byte) changes when byte has no slot yet
+    uint64_t *claim_word(unsigned char byte);
+    // returns the first child at or after byte from, and its byte; 0 if none
+    Gptr next_child(unsigned int from, unsigned int &byte);
+    // i-th child of a node that is not yet published
+    void init_child(size_t i, unsigned char byte, Gptr child);
+    // mark every slot so that no update to this node can succeed any more
+    void freeze();
+};
+
+struct RadixTree::Leaf : RadixTree::Node {
     TagGptr value;
+    char key[0]; // NOTE: we are actually storing unsigned char
+};
+
+struct RadixTree::Node4 : RadixTree::Node {
+    union Keys {
+        uint64_t u64;
+        unsigned char b[8]; // b[0]: number of claimed slots; b[1+i]: byte of child[i]
+    };
+
+    Gptr leaf;
+    Keys keys;
+    Gptr child[4];
+    char key[0];
+};
+
+struct RadixTree::Node16 : RadixTree::Node {
+    // byte of child[i]; an unclaimed entry repeats b[0]
+    union Keys {
+        int64_t i64[2];
+        unsigned char b[16];
+
+        // number of claimed entries
+        int count() const {
+            for (int i = 1; i < 16; i++)
+                if (b[i] == b[0])
+                    return i;
+            return 16;
+        }
+    };
+
+    Gptr leaf;
+    uint64_t reserved; // keeps keys 16-byte aligned
+    Keys keys;
+    Gptr child[16];
+    char key[0];
+};
+
+struct RadixTree::Node48 : RadixTree::Node {
+    union Index {
+        uint64_t u64;
+        unsigned char b[8];
+    };
+
+    Gptr leaf;
+    uint64_t count; // number of claimed slots; may run past 48 once full
+    unsigned char index[256]; // 1 + slot of the child at each byte; 0: none
+    Gptr child[48];
+    char key[0];
+};
+
+struct RadixTree::Node256 : RadixTree::Node {
+    Gptr leaf;
+    Gptr replaced; // root only: the replacement counts (see replaced_count())
+    uint64_t key_gen; // root only: see compact()
+    Gptr child[256];
+    char key[0];
 };
 
 static inline Gptr cas64(Gptr *target, Gptr old_value, Gptr new_value) {
@@ -60,6 +198,11 @@ static inline Gptr cas64(Gptr *target, Gptr old_value, Gptr new_value) {
         (uint64_t *)target, (uint64_t)old_value, (uint64_t)new_value);
 }
 
+static inline uint64_t cas64(uint64_t *target, uint64_t old_value,
+                             uint64_t new_value) {
+    return fam_atomic_u64_compare_and_store(target, old_value, new_value);
+}
+
 static inline TagGptr casTagGptr(TagGptr *target, TagGptr old_value,
                                  TagGptr new_value) {
     TagGptr result;
@@ -72,33 +215,441 @@ static inline void loadTagGptr(TagGptr *target, TagGptr &ptr) {
     fam_atomic_128_read((int64_t *)target, ptr.i64);
 }
 
+static inline TagGptr readTagGptr(TagGptr *target) {
+    TagGptr ptr;
+#ifdef PMEM
+    fam_invalidate(target, sizeof(TagGptr));
+    ptr = *target;
+#else
+    loadTagGptr(target, ptr);
+#endif
+    return ptr;
+}
+
+static inline uint64_t load64(uint64_t *target) {
+#ifdef PMEM
+    fam_invalidate(target, sizeof(uint64_t));
+    return *target;
+#else
+    return fam_atomic_u64_read(target);
+#endif
+}
+
+static inline Gptr loadGptr(Gptr *target) {
+    return load64((uint64_t *)target);
+}
+
+static inline void load128(int64_t *target, int64_t result[2]) {
+#ifdef PMEM
+    fam_invalidate(target, 2 * sizeof(int64_t));
+    result[0] = target[0];
+    result[1] = target[1];
+#else
+    fam_atomic_128_read(target, result);
+#endif
+}
+
+static inline bool is_marked(Gptr ptr) { return ((uint64_t)ptr & 1) != 0; }
+
+static inline Gptr unmark(Gptr ptr) {
+    return Gptr((uint64_t)ptr & ~(uint64_t)1);
+}
+
+static inline bool is_pruned(TagGptr value) { return (value.tag() & PRUNED) != 0; }
+
+static inline void mark(Gptr *target) {
+    Gptr ptr = loadGptr(target);
+    while (!is_marked(ptr)) {
+        Gptr seen = cas64(target, ptr, Gptr((uint64_t)ptr | 1));
+        if (seen == ptr)
+            break;
+        ptr = seen;
+    }
+}
+
+//********************************
+// Node Helpers                  *
+//********************************
+size_t RadixTree::Node::size_of(uint64_t type, size_t prefix_size) {
+    switch (type) {
+    case LEAF:
+        return sizeof(Leaf) + prefix_size;
+    case NODE4:
+        return sizeof(Node4) + prefix_size;
+    case NODE16:
+        return sizeof(Node16) + prefix_size;
+    case NODE48:
+        return sizeof(Node48) + prefix_size;
+    default:
+        assert(type == NODE256);
+        return sizeof(Node256) + prefix_size;
+    }
+}
+
+char *RadixTree::Node::prefix() {
+    switch (type) {
+    case LEAF:
+        return static_cast<Leaf *>(this)->key;
+    case NODE4:
+        return static_cast<Node4 *>(this)->key;
+    case NODE16:
+        return static_cast<Node16 *>(this)->key;
+    case NODE48:
+        return static_cast<Node48 *>(this)->key;
+    default:
+        return static_cast<Node256 *>(this)->key;
+    }
+}
+
+Gptr *RadixTree::Node::leaf_slot() {
+    switch (type) {
+    case NODE4:
+        return &static_cast<Node4 *>(this)->leaf;
+    case NODE16:
+        return &static_cast<Node16 *>(this)->leaf;
+    case NODE48:
+        return &static_cast<Node48 *>(this)->leaf;
+    default:
+        assert(type == NODE256);
+        return &static_cast<Node256 *>(this)->leaf;
+    }
+}
+
+Gptr *RadixTree::Node::children() {
+    switch (type) {
+    case NODE4:
+        return static_cast<Node4 *>(this)->child;
+    case NODE16:
+        return static_cast<Node16 *>(this)->child;
+    case NODE48:
+        return static_cast<Node48 *>(this)->child;
+    default:
+        assert(type == NODE256);
+        return static_cast<Node256 *>(this)->child;
+    }
+}
+
+void RadixTree::Node::init(uint64_t Type, const char *Prefix,
+                           size_t Prefix_size) {
+    assert(Type != LEAF);
+    type = Type;
+    prefix_size = Prefix_size;
+    memcpy(prefix(), Prefix, Prefix_size);
+    *leaf_slot() = 0;
+    memset((void *)children(), 0, type * sizeof(Gptr));
+    if (type == NODE4) {
+        static_cast<Node4 *>(this)->keys.u64 = 0;
+    } else if (type == NODE48) {
+        static_cast<Node48 *>(this)->count = 0;
+        memset(static_cast<Node48 *>(this)->index, 0, 256);
+    } else if (type == NODE256) {
+        static_cast<Node256 *>(this)->replaced = Gptr(0);
+        static_cast<Node256 *>(this)->key_gen = 0;
+    }
+    // a Node16 is only ever built with its first children in place (see
+    // init_child())
+}
+
+Gptr *RadixTree::Node::find_child(unsigned char byte) {
+    switch (type) {
+    case NODE4: {
+        Node4 *n = static_cast<Node4 *>(this);
+        Node4::Keys keys;
+        keys.u64 = load64(&n->keys.u64);
+        for (int i = 0; i < keys.b[0]; i++)
+            if (keys.b[i + 1] == byte)
+                return &n->child[i];
+        return NULL;
+    }
+    case NODE16: {
+        Node16 *n = static_cast<Node16 *>(this);
+        Node16::Keys keys;
+        load128(n->keys.i64, keys.i64);
+        // an unclaimed entry can only match b[0], which comes first
+        for (int i = 0; i < 16; i++)
+            if (keys.b[i] == byte)
+                return &n->child[i];
+        return NULL;
+    }
+    case NODE48: {
+        Node48 *n = static_cast<Node48 *>(this);
+        Node48::Index index;
+        index.u64 = load64((uint64_t *)&n->index[byte & ~7]);
+        unsigned char slot = index.b[byte & 7];
+        return slot ? &n->child[slot - 1] : NULL;
+    }
+    case NODE256:
+        return &static_cast<Node256 *>(this)->child[byte];
+    default:
+        return NULL;
+    }
+}
+
+Gptr *RadixTree::Node::claim_child(unsigned char byte) {
+    switch (type) {
+    case NODE4: {
+        Node4 *n = static_cast<Node4 *>(this);
+        Node4::Keys keys;
+        keys.u64 = load64(&n->keys.u64);
+        for (;;) {
+            int cnt = keys.b[0];
+            for (int i = 0; i < cnt; i++)
+                if (keys.b[i + 1] == byte)
+                    return &n->child[i];
+            if (cnt == 4)
+                return NULL;
+            Node4::Keys new_keys = keys;
+            new_keys.b[0] = (unsigned char)(cnt + 1);
+            new_keys.b[cnt + 1] = byte;
+            uint64_t seen = cas64(&n->keys.u64, keys.u64, new_keys.u64);
+            if (seen == keys.u64)
+                return &n->child[cnt];
+            keys.u64 = seen;
+        }
+    }
+    case NODE16: {
+        Node16 *n = static_cast<Node16 *>(this);
+        Node16::Keys keys;
+        load128(n->keys.i64, keys.i64);
+        for (;;) {
+            for (int i = 0; i < 16; i++)
+                if (keys.b[i] == byte)
+                    return &n->child[i];
+            int cnt = keys.count();
+            if (cnt == 16)
+                return NULL;
+            Node16::Keys new_keys = keys;
+            new_keys.b[cnt] = byte;
+            Node16::Keys seen;
+            fam_atomic_128_compare_and_store(n->keys.i64, keys.i64,
+                                             new_keys.i64, seen.i64);
+            if (seen.i64[0] == keys.i64[0] && seen.i64[1] == keys.i64[1])
+                return &n->child[cnt];
+            keys = seen;
+        }
+    }
+    case NODE48: {
+        Node48 *n = static_cast<Node48 *>(this);
+        uint64_t *word = (uint64_t *)&n->index[byte & ~7];
+        Node48::Index index;
+        index.u64 = load64(word);
+        if (index.b[byte & 7])
+            return &n->child[index.b[byte & 7] - 1];
+        uint64_t slot = fam_atomic_u64_fetch_and_add(&n->count, 1);
+        if (slot >= 48)
+            return NULL;
+        for (;;) {
+            Node48::Index new_index = index;
+            new_index.b[byte & 7] = (unsigned char)(slot + 1);
+            uint64_t seen = cas64(word, index.u64, new_index.u64);
+            if (seen == index.u64)
+                return &n->child[slot];
+            index.u64 = seen;
+            // lost the race for this byte; our slot is simply left unused
+            if (index.b[byte & 7])
+                return &n->child[index.b[byte & 7] - 1];
+        }
+    }
+    case NODE256:
+        return &static_cast<Node256 *>(this)->child[byte];
+    default:
+        return NULL;
+    }
+}
+
+uint64_t *RadixTree::Node::claim_word(unsigned char byte) {
+    switch (type) {
+    case NODE4:
+        return &static_cast<Node4 *>(this)->keys.u64;
+    case NODE16: {
+        // the half of the keys that holds the next entry to be claimed
+        Node16 *n = static_cast<Node16 *>(this);
+        Node16::Keys keys;
+        load128(n->keys.i64, keys.i64);
+        int cnt = keys.count();
+        return (uint64_t *)&n->keys.i64[cnt < 8 ? 0 : 1];
+    }
+    case NODE48:
+        return (uint64_t *)&static_cast<Node48 *>(this)->index[byte & ~7];
+    default:
+        assert(type == NODE256);
+        return (uint64_t *)&static_cast<Node256 *>(this)->child[byte];
+    }
+}
+
+Gptr RadixTree::Node::next_child(unsigned int from, unsigned int &byte) {
+    switch (type) {
+    case NODE4:
+    case NODE16: {
+        // few entries in no particular order: pick the smallest byte >= from
+        Gptr *child;
+        unsigned char b[16];
+        int cnt;
+        if (type == NODE4) {
+            Node4 *n = static_cast<Node4 *>(this);
+            Node4::Keys keys;
+            keys.u64 = load64(&n->keys.u64);
+            cnt = keys.b[0];
+            memcpy(b, &keys.b[1], 4);
+            child = n->child;
+        } else {
+            Node16 *n = static_cast<Node16 *>(this);
+            Node16::Keys keys;
+            load128(n->keys.i64, keys.i64);
+            cnt = keys.count();
+            memcpy(b, keys.b, 16);
+            child = n->child;
+        }
+        Gptr result = 0;
+        byte = 256;
+        for (int i = 0; i < cnt; i++) {
+            if (b[i] < from || b[i] >= byte)
+                continue;
+            Gptr q = unmark(loadGptr(&child[i]));
+            if (q != 0) {
+                result = q;
+                byte = b[i];
+            }
+        }
+        return result;
+    }
+    case NODE48: {
+        Node48 *n = static_cast<Node48 *>(this);
+        Node48::Index index;
+        for (byte = from; byte < 256; byte++) {
+            if (byte == from || (byte & 7) == 0)
+                index.u64 = load64((uint64_t *)&n->index[byte & ~7u]);
+            unsigned char slot = index.b[byte & 7];
+            if (slot) {
+                Gptr q = unmark(loadGptr(&n->child[slot - 1]));
+                if (q != 0)
+                    return q;
+            }
+        }
+        return 0;
+    }
+    case NODE256: {
+        Node256 *n = static_cast<Node256 *>(this);
+        for (byte = from; byte < 256; byte++) {
+            Gptr q = unmark(loadGptr(&n->child[byte]));
+            if (q != 0)
+                return q;
+        }
+        return 0;
+    }
+    default:
+        byte = 256;
+        return 0;
+    }
+}
+
+void RadixTree::Node::init_child(size_t i, unsigned char byte, Gptr child) {
+    switch (type) {
+    case NODE4: {
+        Node4 *n = static_cast<Node4 *>(this);
+        n->keys.b[0] = (unsigned char)(i + 1);
+        n->keys.b[i + 1] = byte;
+        n->child[i] = child;
+        break;
+    }
+    case NODE16: {
+        Node16 *n = static_cast<Node16 *>(this);
+        if (i == 0)
+            memset(n->keys.b, byte, 16);
+        n->keys.b[i] = byte;
+        n->child[i] = child;
+        break;
+    }
+    case NODE48: {
+        Node48 *n = static_cast<Node48 *>(this);
+        n->index[byte] = (unsigned char)(i + 1);
+        n->count = i + 1;
+        n->child[i] = child;
+        break;
+    }
+    default:
+        static_cast<Node256 *>(this)->child[byte] = child;
+        break;
+    }
+}
+
+void RadixTree::Node::freeze() {
+    assert(type != LEAF && type != NODE256);
+    mark(leaf_slot());
+    Gptr *child = children();
+    for (uint64_t i = 0; i < type; i++)
+        mark(&child[i]);
+}
+
+// the inner nodes of the upper levels of the tree, in breadth-first order from
+// the root
+struct RadixTree::Mirror {
+    struct Node {
+        Gptr node; // in FAM
+        uint64_t replaced; // the replacement count of node when it was read
+        std::string prefix;
+        Gptr child[256];  // as they were read when the mirror was built
+        uint64_t child_replaced[256]; // and their replacement counts
+        int32_t sub[256]; // index of the copy of child[byte]; -1: none
+    };
+
+    std::vector<Node> nodes;
+};
+
+struct RadixTree::Mirrors {
+    Mirrors() : current(nullptr), levels(0), budget(0), stale_walks(0) {}
+    ~Mirrors() {
+        delete current.load();
+        for (auto &r : retired)
+            delete r.second;
+    }
+
+    std::atomic<Mirror *> current;
+    std::atomic<size_t> levels;
+    size_t budget;
+    // lookups that walked from the root since the mirror went stale
+    std::atomic<size_t> stale_walks;
+    std::mutex mutex; // one build at a time
+    // mirrors that were replaced, with the epoch they were replaced in
+    std::vector<std::pair<nvmm::EpochCounter, Mirror *>> retired;
+};
+
 RadixTree::RadixTree(Mmgr *Mmgr, Heap *Heap, RadixTreeMetrics *Metrics,
-                     Gptr Root)
-    : mmgr(Mmgr), heap(Heap), metrics(Metrics), root(Root) {
+                     Gptr Root, SlabHeap *Slab)
+    : mmgr(Mmgr), heap(Heap), slab(Slab), own_slab(Slab == nullptr),
+      metrics(Metrics), root(Root), emgr(nvmm::EpochManager::GetInstance()),
+      mirrors(new Mirrors()) {
     assert(mmgr != NULL);
     assert(heap != NULL);
+    if (own_slab)
+        slab = new SlabHeap(heap, emgr);
     //std::cout << "RadixTree(): user passed Root: " << Root << " updated class member root: " << root << std::endl;
     if (root == 0) {
-        root = heap->Alloc(sizeof(Node));
-        if (!root.IsValid()) {
-            size_t size = heap->Size();
-            nvmm::ErrorCode ret = heap->Resize(2 * size);
-            assert(ret == nvmm::NO_ERROR);
-            root = heap->Alloc(sizeof(Node));
-            assert(root.IsValid());
-        }
-        Node *root_node = (Node *)toLocal(root);
+        Gptr counts = alloc_node(REPLACED_COUNTS * sizeof(uint64_t));
+        replaced = (uint64_t *)toLocal(counts);
+        assert(replaced);
+        memset(replaced, 0, REPLACED_COUNTS * sizeof(uint64_t));
+        fam_persist(replaced, REPLACED_COUNTS * sizeof(uint64_t));
+
+        root = alloc_node(Node::size_of(NODE256, 0));
+        Node256 *root_node = (Node256 *)toLocal(root);
         assert(root_node);
-        root_node->prefix_size = 0;
-        for (int i = 0; i < 256; i++) {
-            root_node->child[i] = 0;
-        }
-        root_node->value = TagGptr();
-        fam_persist(root_node, sizeof(Node));
+        root_node->init(NODE256, "", 0);
+        root_node->replaced = counts;
+        fam_persist(root_node, Node::size_of(NODE256, 0));
+    } else {
+        Node256 *root_node = (Node256 *)toLocal(root);
+        assert(root_node);
+        replaced = (uint64_t *)toLocal(root_node->replaced);
+        assert(replaced);
     }
 }
 
-RadixTree::~RadixTree() {}
+RadixTree::~RadixTree() {
+    delete mirrors;
+    if (own_slab)
+        delete slab;
+}
 
 //********************************
 // Common Helpers                *
@@ -107,6 +658,510 @@ void *RadixTree::toLocal(const Gptr &gptr) { return mmgr->GlobalToLocal(gptr); }
 
 Gptr RadixTree::get_root() { return root; }
 
+Gptr RadixTree::alloc_node(size_t size) {
+    Gptr ptr = slab->Alloc(size);
+    assert(ptr.IsValid());
+    return ptr;
+}
+
+// frees a node of size bytes that was never linked into the tree
+void RadixTree::free_node(Gptr node, size_t size) { slab->Free(node, size); }
+
+// a node that has been swung out of the tree may still be read by concurrent
+// operations, so it is only reclaimed once every epoch that could have seen it
+// has ended; it is counted first, to tell paused readers (see replaced_count())
+void RadixTree::retire(Gptr node) {
+    Node *n = (Node *)toLocal(node);
+    assert(n);
+    fam_atomic_u64_fetch_and_add(replaced_count(node), 1);
+    nvmm::EpochOp op(emgr);
+    slab->Free(op, node, Node::size_of(n->type, n->prefix_size));
+}
+
+// the count of the nodes that were swung out of the tree, of those that hash
+// to the same count as node; it is bumped after the node is unlinked and before
+// it is retired, so a reader that took the count while the node was still
+// linked, and finds it unchanged later, knows the node is still in the tree
+// (a node whose parent is replaced stays linked from the copy)
+// - spread over REPLACED_COUNTS words, so that replacements in one part of the
+// tree do not stall readers (or writers) elsewhere
+uint64_t *RadixTree::replaced_count(Gptr node) {
+    uint64_t h = (uint64_t)node * 0x9E3779B97F4A7C15ULL;
+    return &replaced[h >> (64 - REPLACED_BITS)];
+}
+
+// the replacement count of the node in slot p, seen being the value (maybe
+// marked) read from p before; the count is taken between two reads of the
+// slot, so that the node was still linked from p when it was taken
+// seen is updated if the slot has moved on
+uint64_t RadixTree::replaced_of(Gptr *p, Gptr &seen) {
+    for (;;) {
+        uint64_t count = load64(replaced_count(unmark(seen)));
+        Gptr again = loadGptr(p);
+        if (again == seen)
+            return count;
+        seen = again;
+    }
+}
+
+uint64_t *RadixTree::key_gen_word() {
+    Node256 *root_node = (Node256 *)toLocal(root);
+    assert(root_node);
+    return &root_node->key_gen;
+}
+
+// the value a new leaf starts with
+TagGptr RadixTree::first_value(Gptr value) {
+    return TagGptr(value, (load64(key_gen_word()) >> RUNNING_BITS) << VERSION_BITS);
+}
+
+Gptr RadixTree::new_leaf(const char *key, const size_t key_size, TagGptr value) {
+    Gptr leaf_ptr = alloc_node(Node::size_of(LEAF, key_size));
+    Leaf *leaf = (Leaf *)toLocal(leaf_ptr);
+    assert(leaf);
+    leaf->type = LEAF;
+    leaf->prefix_size = key_size;
+    leaf->value = value;
+    memcpy(leaf->key, key, key_size);
+    fam_persist(leaf, Node::size_of(LEAF, key_size));
+    return leaf_ptr;
+}
+
+// returns the value of the key stored at n (a leaf, or the leaf slot of an
+// inner node); a pruned leaf holds no key
+TagGptr RadixTree::value_of(Node *n) {
+    if (!n->is_leaf()) {
+        Gptr leaf_ptr = unmark(loadGptr(n->leaf_slot()));
+        if (leaf_ptr == 0)
+            return TagGptr();
+        n = (Node *)toLocal(leaf_ptr);
+        assert(n);
+    }
+    TagGptr value = readTagGptr(&static_cast<Leaf *>(n)->value);
+    return is_pruned(value) ? TagGptr() : value;
+}
+
+// swap in a new value (or null, to delete) and bump the version
+// a pruned leaf cannot be updated: its (pruned) value is returned instead
+TagGptr RadixTree::update_value(Gptr leaf_ptr, Gptr value,
+                                TagGptr &old_value) {
+    Leaf *leaf = (Leaf *)toLocal(leaf_ptr);
+    assert(leaf);
+    TagGptr *tp = &leaf->value;
+    TagGptr tq = readTagGptr(tp);
+    for (;;) {
+        if (is_pruned(tq)) {
+            old_value = TagGptr();
+            return tq;
+        }
+        TagGptr new_value = TagGptr(value, tq.tag() + 1);
+        TagGptr seen_tq = casTagGptr(tp, tq, new_value);
+        if (seen_tq == tq) {
+            old_value = tq;
+            return new_value;
+        }
+        tq = seen_tq;
+    }
+}
+
+// the smallest node type with room for cnt children plus one more
+static uint64_t fit_type(size_t cnt) {
+    return cnt < NODE4 ? NODE4 : cnt < NODE16 ? NODE16
+                               : cnt < NODE48 ? NODE48 : NODE256;
+}
+
+// unlink the pruned leaf q from slot p; fails if the slot has moved on or is
+// frozen (then q is unlinked later, from wherever it ends up)
+bool RadixTree::unlink_leaf(Gptr *p, Gptr q) {
+    if (cas64(p, q, Gptr(0)) != q)
+        return false;
+    retire(q);
+    return true;
+}
+
+// copy the inner node q, which is linked from slot p, into a node that is just
+// big enough for its children plus one more, and swing p to the copy
+// this is how nodes grow (and shrink); it is also how a writer that runs into
+// a frozen node helps finish its replacement
+void RadixTree::replace(Gptr *p, Gptr q) {
+    assert(p != NULL && q != root);
+    Node *n = (Node *)toLocal(q);
+    assert(n);
+    n->freeze();
+
+    // the slots can no longer change
+    unsigned char bytes[256];
+    Gptr child[256];
+    size_t cnt = 0;
+    unsigned int byte = 0;
+    while (byte < 256) {
+        Gptr c = n->next_child(byte, byte);
+        if (c == 0)
+            break;
+        bytes[cnt] = (unsigned char)byte;
+        child[cnt++] = c;
+        byte++;
+    }
+
+    uint64_t type = fit_type(cnt);
+    size_t size = Node::size_of(type, n->prefix_size);
+    Gptr new_node_ptr = alloc_node(size);
+    Node *new_node = (Node *)toLocal(new_node_ptr);
+    assert(new_node);
+    new_node->init(type, n->prefix(), n->prefix_size);
+    *new_node->leaf_slot() = unmark(loadGptr(n->leaf_slot()));
+    for (size_t i = 0; i < cnt; i++)
+        new_node->init_child(i, bytes[i], child[i]);
+    fam_persist(new_node, size);
+
+    Gptr seen_q = cas64(p, q, new_node_ptr);
+    if (seen_q == q)
+        retire(q);
+    else
+        free_node(new_node_ptr, size); // someone else got there first
+}
+
+// returns the leaf holding the key, or 0 if there is none
+Gptr RadixTree::find_leaf(const char *key, const size_t key_size) {
+    Gptr q;
+    size_t depth;
+    if (mirror_start(key, key_size, q, depth)) {
+        q = find_leaf(key, key_size, q, depth, NULL);
+        if (q != 0) {
+            mirror_count(true);
+            return q;
+        }
+    }
+    mirror_count(false);
+    return find_leaf(key, key_size, root, 0, NULL);
+}
+
+// same as above, but starts from node q, the first depth bytes of whose prefix
+// are known to match the key; the inner nodes visited are appended to path
+Gptr RadixTree::find_leaf(const char *key, const size_t key_size, Gptr q,
+                          size_t depth, Path *path) {
+    int pointer_traversals = 0;
+
+    while (!find_leaf_step(key, key_size, q, depth, path))
+        pointer_traversals++;
+
+    if (q != 0)
+        METRIC_HISTOGRAM_UPDATE(metrics, pointer_traversal_,
+                                pointer_traversals);
+    return q;
+}
+
+// one level of find_leaf(): returns true when the walk is over, with q the leaf
+// holding the key or 0; otherwise moves q and depth on to the next node
+bool RadixTree::find_leaf_step(const char *key, const size_t key_size, Gptr &q,
+                               size_t &depth, Path *path) {
+    if (q == 0)
+        return true;
+
+    Node *n = (Node *)toLocal(q);
+    assert(n);
+
+    size_t prefix_size = n->prefix_size;
+    if (key_size < prefix_size ||
+        fam_memcmp(key + depth, n->prefix() + depth, prefix_size - depth) != 0) {
+        q = 0;
+        return true;
+    }
+
+    if (n->is_leaf()) {
+        if (key_size != prefix_size)
+            q = 0;
+        return true;
+    }
+
+    if (path)
+        path->push_back(std::make_pair(q, prefix_size));
+
+    Gptr *p;
+    if (key_size == prefix_size) {
+        p = n->leaf_slot();
+        depth = prefix_size;
+    } else {
+        p = n->find_child((unsigned char)key[prefix_size]);
+        if (p == NULL) {
+            q = 0;
+            return true;
+        }
+        depth = prefix_size + 1;
+    }
+    q = unmark(loadGptr(p));
+    return false;
+}
+
+// pull in the first bytes of a node (its header and the slots or value that
+// follow) ahead of the find_leaf_step() that reads it
+void RadixTree::prefetch(Gptr q) {
+    char *n = (char *)toLocal(q);
+    __builtin_prefetch(n);
+    __builtin_prefetch(n + 64);
+}
+
+// same as above, for a key that follows prev_key (if not NULL) in sorted
+// order; path holds the inner nodes visited for prev_key, and the walk resumes
+// from the deepest of them whose prefix the two keys share
+Gptr RadixTree::find_leaf(std::string const &key, std::string const *prev_key,
+                          Path &path) {
+    size_t shared = 0;
+    if (prev_key) {
+        size_t max_shared = std::min(key.size(), prev_key->size());
+        while (shared < max_shared && key[shared] == (*prev_key)[shared])
+            shared++;
+    }
+    while (!path.empty() && path.back().second > shared)
+        path.pop_back();
+    if (path.empty())
+        return find_leaf(key.data(), key.size(), root, 0, &path);
+
+    std::pair<Gptr, size_t> start = path.back();
+    path.pop_back();
+    return find_leaf(key.data(), key.size(), start.first, start.second, &path);
+}
+
+// same as find_leaf(key, key_size), but when there is no leaf, miss is set to
+// the word an insert of the key has to change first: the empty slot that would
+// link its leaf, the claimed bytes of the node that would get a slot for it, or
+// the slot of the node that it would split
+// the word is read before the node is looked at, so a change in between only
+// makes the miss stale; a node that has moved on (or whose parent is frozen) by
+// the time its replacement count is taken leaves a null miss
+Gptr RadixTree::find_leaf(const char *key, const size_t key_size,
+                          KeyMiss &miss) {
+    Gptr *pp = NULL;       // the slot parent was read from
+    Gptr seen_parent = 0;  // the value read from pp
+    Gptr parent = 0;  // the node that holds p
+    Gptr *p = NULL;   // the slot q was read from
+    Gptr seen_q = 0;  // the value read from p (q, maybe marked)
+    Gptr q = root;
+
+    // miss.node was read from slot s as seen (s=NULL: the root)
+    auto count = [&](Gptr *s, Gptr seen) {
+        if (s == NULL) {
+            miss.replaced = load64(replaced_count(miss.node));
+            return;
+        }
+        Gptr again = seen;
+        miss.replaced = replaced_of(s, again);
+        if (again != seen || is_marked(seen))
+            miss.node = 0;
+    };
+
+    size_t depth = 0; // key bytes known to match
+    for (;;) {
+        Node *n = (Node *)toLocal(q);
+        assert(n);
+        size_t prefix_size = n->prefix_size;
+        if (key_size < prefix_size ||
+            fam_memcmp(key + depth, n->prefix() + depth, prefix_size - depth) != 0 ||
+            (n->is_leaf() && key_size != prefix_size)) {
+            // an insert splits q (never the root, whose prefix is empty)
+            assert(p != NULL);
+            miss.node = parent;
+            miss.offset = (char *)p - (char *)toLocal(parent);
+            miss.word = seen_q;
+            count(pp, seen_parent);
+            return 0;
+        }
+
+        if (n->is_leaf())
+            return q;
+
+        Gptr *slot;
+        if (key_size == prefix_size) {
+            slot = n->leaf_slot();
+            depth = prefix_size;
+        } else {
+            unsigned char byte = (unsigned char)key[prefix_size];
+            uint64_t *w = n->claim_word(byte);
+            uint64_t claimed = load64(w);
+            slot = n->find_child(byte);
+            if (slot == NULL) {
+                // an insert claims a slot for byte
+                miss.node = q;
+                miss.offset = (char *)w - (char *)n;
+                miss.word = claimed;
+                count(p, seen_q);
+                return 0;
+            }
+            depth = prefix_size + 1;
+        }
+
+        Gptr child = loadGptr(slot);
+        if (unmark(child) == 0) {
+            // an insert links its leaf here
+            miss.node = q;
+            miss.offset = (char *)slot - (char *)n;
+            miss.word = child;
+            count(p, seen_q);
+            return 0;
+        }
+        pp = p;
+        seen_parent = seen_q;
+        parent = q;
+        p = slot;
+        seen_q = child;
+        q = unmark(child);
+    }
+}
+
+// returns the leaf holding the key; a new leaf with the given value is linked
+// in if there is none (created=true, and first is the value it starts with)
+// a pruned leaf of the key is unlinked on the way, as an insert has to replace it
+Gptr RadixTree::find_or_create_leaf(const char *key, const size_t key_size,
+                                    Gptr value, bool &created, TagGptr &first) {
+    Gptr leaf_ptr = 0;  // our new leaf
+    Gptr split_ptr = 0; // our new inner node when we have to split
+    size_t split_cap = 0; // the longest prefix split_ptr has room for
+    created = false;
+
+    // readies our new leaf right before it is linked, so that its versions go
+    // on from those of any leaf of the key that was pruned before
+    auto ready_leaf = [&]() {
+        first = first_value(value);
+        if (leaf_ptr == 0) {
+            leaf_ptr = new_leaf(key, key_size, first);
+        } else {
+            Leaf *leaf = (Leaf *)toLocal(leaf_ptr);
+            leaf->value = first;
+            fam_persist(&leaf->value, sizeof(TagGptr));
+        }
+    };
+
+    for (;;) {
+        // Find current correct insertion point:
+        Gptr *p = NULL;
+        Gptr q = root;
+        size_t depth = 0; // key bytes known to match
+        bool restart = false;
+        while (!restart) {
+            Node *n = (Node *)toLocal(q);
+            assert(n);
+            char *prefix = n->prefix();
+            size_t prefix_size = n->prefix_size;
+            size_t i, max_i = std::min(key_size, prefix_size);
+            for (i = depth; i < max_i; i++)
+                if (key[i] != prefix[i])
+                    break;
+
+            if (i < prefix_size || (n->is_leaf() && i < key_size)) {
+                // split: a new Node4 with prefix key[0..i) takes the place of
+                // q, with q and our new leaf as its children
+                ready_leaf();
+                if (split_ptr != 0 && split_cap < i) {
+                    // a retry that has to split further down the key
+                    free_node(split_ptr, Node::size_of(NODE4, split_cap));
+                    split_ptr = 0;
+                }
+                if (split_ptr == 0) {
+                    split_ptr = alloc_node(Node::size_of(NODE4, i));
+                    split_cap = i;
+                }
+                Node *split = (Node *)toLocal(split_ptr);
+                assert(split);
+                split->init(NODE4, key, i);
+                size_t cnt = 0;
+                if (i == prefix_size)
+                    *split->leaf_slot() = q;
+                else
+                    split->init_child(cnt++, (unsigned char)prefix[i], q);
+                if (i == key_size)
+                    *split->leaf_slot() = leaf_ptr;
+                else
+                    split->init_child(cnt++, (unsigned char)key[i], leaf_ptr);
+                fam_persist(split, Node::size_of(NODE4, i));
+
+                Gptr seen_q = cas64(p, q, split_ptr);
+                if (seen_q == q) {
+                    created = true;
+                    return leaf_ptr;
+                }
+                if (is_marked(seen_q) || seen_q == 0)
+                    restart = true; // the parent is being replaced, or q was pruned
+                else
+                    q = seen_q;
+                continue;
+            }
+
+            if (n->is_leaf()) {
+                if (is_pruned(readTagGptr(&static_cast<Leaf *>(n)->value))) {
+                    unlink_leaf(p, q);
+                    restart = true;
+                    continue;
+                }
+                // the key exists
+                if (split_ptr)
+                    free_node(split_ptr, Node::size_of(NODE4, split_cap));
+                if (leaf_ptr)
+                    free_node(leaf_ptr, Node::size_of(LEAF, key_size));
+                return q;
+            }
+
+            // the key so far has matched the entire prefix of an inner node
+            Gptr *slot;
+            if (key_size == prefix_size) {
+                slot = n->leaf_slot();
+            } else {
+                unsigned char byte = (unsigned char)key[prefix_size];
+                slot = n->find_child(byte);
+                if (slot == NULL)
+                    slot = n->claim_child(byte);
+                if (slot == NULL) {
+                    // the node is full
+                    replace(p, q);
+                    restart = true;
+                    continue;
+                }
+            }
+
+            Gptr child = loadGptr(slot);
+            if (child == 0) {
+                ready_leaf();
+                child = cas64(slot, child, leaf_ptr);
+                if (child == 0) {
+                    if (split_ptr)
+                        free_node(split_ptr, Node::size_of(NODE4, split_cap));
+                    created = true;
+                    return leaf_ptr;
+                }
+            }
+
+            if (key_size == prefix_size && unmark(child) != 0) {
+                Leaf *leaf = (Leaf *)toLocal(unmark(child));
+                assert(leaf);
+                if (is_pruned(readTagGptr(&leaf->value))) {
+                    if (is_marked(child))
+                        replace(p, q);
+                    else
+                        unlink_leaf(slot, child);
+                    restart = true;
+                    continue;
+                }
+                // the key exists
+                if (split_ptr)
+                    free_node(split_ptr, Node::size_of(NODE4, split_cap));
+                if (leaf_ptr)
+                    free_node(leaf_ptr, Node::size_of(LEAF, key_size));
+                return unmark(child);
+            }
+
+            if (is_marked(child)) {
+                // n is being replaced; help finish that before going on
+                replace(p, q);
+                restart = true;
+                continue;
+            }
+
+            p = slot;
+            q = child;
+            depth = prefix_size + 1;
+        }
+    }
+}
+
 void RadixTree::list(std::function<void(const char *, const size_t, Gptr)> f) {
     Gptr p = root;
     uint64_t level = 0;
@@ -117,7 +1172,10 @@ void RadixTree::list(std::function<void(const char *, const size_t, Gptr)> f) {
     printf("\nDepth %lu\n", depth);
     printf("\nValues %lu\n", value_cnt);
     printf("\nNodes %lu\n", node_cnt);
-    printf("\nNode size %lu\n", sizeof(Node));
+    printf("\nNode size %lu (leaf) %lu (node4) %lu (node16) %lu (node48) %lu "
+           "(node256) + key size\n",
+           sizeof(Leaf), sizeof(Node4), sizeof(Node16), sizeof(Node48),
+           sizeof(Node256));
 }
 
 void RadixTree::recursive_list(
@@ -129,31 +1187,38 @@ void RadixTree::recursive_list(
     Node *n = (Node *)toLocal(parent);
     assert(n);
     fam_invalidate(n, sizeof(Node));
+    fam_invalidate(n, Node::size_of(n->type, n->prefix_size));
 
 #ifdef DEBUG_VERBOSE
-    printf("[%ld: %s (%d)]\n", parent, n->key, n->prefix_size);
-    if (n->value.IsValid())
-        printf("  * -> %ld\n", n->value.gptr_nomark());
-    for (int j = 0; j < 256; j++)
-        if (n->child[j] != 0)
-            printf("  %c (0x%x) -> %ld\n", j, j, n->child[j]);
+    printf("[%ld: %s (%d)]\n", parent, n->prefix(), n->prefix_size);
 #endif
-    if (n->value.IsValid()) {
-        value_cnt++;
-        // printf("%s[%lu] ", std::string(level, ' ').c_str(), level);
-        f(n->key, n->prefix_size, n->value.gptr_nomark());
-    } else {
-        std::string key((char *)n->key, n->prefix_size);
-        // printf("%s[%lu] prefix %s\n", std::string(level, ' ').c_str(), level,
-        // key.c_str());
+    if (n->is_leaf()) {
+        TagGptr tq = static_cast<Leaf *>(n)->value;
+        if (tq.IsValid()) {
+            value_cnt++;
+            // printf("%s[%lu] ", std::string(level, ' ').c_str(), level);
+            f(n->prefix(), n->prefix_size, tq.gptr_nomark());
+        }
     }
 
     node_cnt++;
     depth = std::max(level, depth);
 
+    if (n->is_leaf())
+        return;
+
     level++;
-    for (int i = 0; i < 256; i++)
-        recursive_list(n->child[i], f, level, depth, value_cnt, node_cnt);
+    // the key equal to the prefix comes before those of the children
+    recursive_list(unmark(*n->leaf_slot()), f, level, depth, value_cnt,
+                   node_cnt);
+    unsigned int byte = 0;
+    while (byte < 256) {
+        Gptr child = n->next_child(byte, byte);
+        if (child == 0)
+            break;
+        recursive_list(child, f, level, depth, value_cnt, node_cnt);
+        byte++;
+    }
     level--;
 }
 
@@ -172,21 +1237,19 @@ struct RadixTree::TreeStructure {
             out << "Level " << l << std::endl;
             out << "\tNodes " << nodes_at_level[l].size() << std::endl;
             int value_cnt = 0;
+            int type_cnt[5] = {0};
             for (auto &it : nodes_at_level[l]) {
                 Node *n = it;
-                if (n->value.IsValid()) {
+                if (n->is_leaf() && static_cast<Leaf *>(n)->value.IsValid()) {
                     value_cnt++;
                 }
+                type_cnt[n->type == LEAF ? 0 : n->type == NODE4 ? 1
+                         : n->type == NODE16 ? 2 : n->type == NODE48 ? 3 : 4]++;
             }
             out << "\tValues " << value_cnt << std::endl;
-            for (auto &it : nodes_at_level[l]) {
-                Node *n = it;
-                if (n->value.IsValid()) {
-                    std::string key((char *)n->key, n->prefix_size);
-                    //                    out << key << " ";
-                }
-            }
-            //            out << std::endl;
+            out << "\tLeaves " << type_cnt[0] << " Node4 " << type_cnt[1]
+                << " Node16 " << type_cnt[2] << " Node48 " << type_cnt[3]
+                << " Node256 " << type_cnt[4] << std::endl;
         }
     }
 
@@ -211,17 +1274,28 @@ void RadixTree::recursive_structure(Gptr parent, int level,
     Node *n = (Node *)toLocal(parent);
     assert(n);
     fam_invalidate(n, sizeof(Node));
+    fam_invalidate(n, Node::size_of(n->type, n->prefix_size));
 
     structure.AddNode(level, n);
 
     structure.node_cnt++;
     structure.depth = std::max(level, structure.depth);
 
-    for (int i = 0; i < 256; i++)
-        recursive_structure(n->child[i], level + 1, structure);
+    if (n->is_leaf())
+        return;
+
+    recursive_structure(unmark(*n->leaf_slot()), level + 1, structure);
+    unsigned int byte = 0;
+    while (byte < 256) {
+        Gptr child = n->next_child(byte, byte);
+        if (child == 0)
+            break;
+        recursive_structure(child, level + 1, structure);
+        byte++;
+    }
 }
 
-int RadixTree::printNodeInfo(Node *n,
+int RadixTree::printNodeInfo(const char *key,
                 void *vptr,
                 int level,
                 bool flag_rec,
@@ -247,7 +1321,7 @@ int RadixTree::printNodeInfo(Node *n,
         prev_level = level;
     }
 
-    nbytes = snprintf(node_info, NODE_INFO_LEN, "%s%s-%ld", delimiter, n->key, *vp);
+    nbytes = snprintf(node_info, NODE_INFO_LEN, "%s%s-%ld", delimiter, key, *vp);
     if(nbytes >= NODE_INFO_LEN){
 	// Internal buffer is not big enough to hold entire information
 	partial_info++;
@@ -260,7 +1334,7 @@ int RadixTree::printNodeInfo(Node *n,
         // complete information, return.
 #if 0
 	printf("User buffer cannot accomodate complete information\n");
-	printf("At present %ld bytes: (%s), couldnt append %d bytes (%s)\n", 
+	printf("At present %ld bytes: (%s), couldnt append %d bytes (%s)\n",
 			strlen(ubuf), ubuf, nbytes, node_info);
 #endif
         return 2;
@@ -282,29 +1356,36 @@ int RadixTree::visitNode(Node *n,
                 size_t ubuf_size)
 {
 
-    n->key[n->prefix_size] = 0;
-
-    TagGptr *tp = &n->value;
-    TagGptr tq;
+    std::string key(n->prefix(), n->prefix_size);
 
-    loadTagGptr(tp, tq);
+    TagGptr tq = value_of(n);
 
     if (tq.IsValid()) {
 
-        void *vptr = (void *)toLocal(tq.gptr());
+        // the first 8 bytes of the value, or the bytes of an inline value
+        uint64_t value;
+        if (inline_value(tq.gptr())) {
+            uint64_t word = (uint64_t)tq.gptr();
+            size_t len = (word >> 2) & 7;
+            value = len ? (word >> 8) & (~0ULL >> (64 - 8 * len)) : 0;
+        } else {
+            uint64_t *vptr = (uint64_t *)toLocal(tq.gptr());
+            fam_invalidate(vptr, sizeof(uint64_t));
+            value = *vptr;
+        }
 
-        return printNodeInfo(n, vptr, level,
+        return printNodeInfo(key.c_str(), &value, level,
                     flag_rec, ubuf, ubuf_size);
 
     }else{
 #if 0
 	char ni[NODE_INFO_LEN] = {0};
-	sprintf(ni, " _NV_%s", n->key);
+	sprintf(ni, " _NV_%s", key.c_str());
         strcat(ubuf, ni);
 #endif
-	// non recursive case - we shouldnt be here with higher levels 
+	// non recursive case - we shouldnt be here with higher levels
 	// recursive case - return if level is zero
-	// i.e., if(!flag_rec) || (flag_rec && !level) 
+	// i.e., if(!flag_rec) || (flag_rec && !level)
 	if(!level) {
 	    return 1;
 	}
@@ -334,7 +1415,7 @@ int RadixTree::traverse(Gptr startRoot,
             Node *n = (Node *)toLocal(q);
             assert(n);
 
-            int kdifferent = fam_memcmp(tkey, n->key,
+            int kdifferent = fam_memcmp(tkey, n->prefix(),
                         std::min(n->prefix_size, tksize));
 
             if (kdifferent){
@@ -345,11 +1426,11 @@ int RadixTree::traverse(Gptr startRoot,
                 break;
             }
 
-            if (tksize < n->prefix_size) {
+            if (tksize < n->prefix_size || n->is_leaf()) {
                 return 0;
             } else {
-                p = &n->child[(unsigned char)tkey[n->prefix_size]];
-                q = fam_atomic_u64_read((uint64_t *)p);
+                p = n->find_child((unsigned char)tkey[n->prefix_size]);
+                q = p ? unmark(loadGptr(p)) : Gptr(0);
             }
 
         }
@@ -360,7 +1441,7 @@ int RadixTree::traverse(Gptr startRoot,
 
     }
 
-    int i, pushlevel = 0, poplevel, done;
+    int pushlevel = 0, poplevel, done;
 
     memset(ubuf, 0, ubuf_size);
 
@@ -380,7 +1461,7 @@ int RadixTree::traverse(Gptr startRoot,
         Node *n = (Node *)toLocal(current);
         assert(n);
 
-	//std::cout << "visitNode(n{" << n->key << "(";
+	//std::cout << "visitNode(n{" << n->prefix() << "(";
 	//std::cout << n->prefix_size << ")}, poplevel: ";
 	//std::cout << poplevel << ", flag_rec: ";
 	//std::cout << flag_rec << ", ubuf, ubuf_size);" << std::endl;
@@ -391,21 +1472,23 @@ int RadixTree::traverse(Gptr startRoot,
 
         pushlevel = poplevel + 1;
 
-        for( i = 0 ; i < 256 ; i++ ){
+        // the value of an inner node (its leaf slot) was visited with it
+        unsigned int byte = 0;
+        while (!n->is_leaf() && byte < 256) {
 
-            p = &n->child[(unsigned char)i];
-            q = fam_atomic_u64_read((uint64_t *)p);
+            q = n->next_child(byte, byte);
 
             if(q == 0){
-                continue;
+                break;
             }else{
                 /* Found a node */
                 node_level_tuple = std::make_tuple(q, pushlevel);
                 nodesQ.push(node_level_tuple);
             }
+            byte++;
         }
 
-        nodesQ.pop(); 
+        nodesQ.pop();
     }
 
     return 0;
@@ -415,317 +1498,669 @@ TagGptr RadixTree::put(const char *key, const size_t key_size, Gptr value,
                        UpdateFlags update) {
     assert(key_size > 0 && key_size <= MAX_KEY_LEN);
 
-    Gptr *p = NULL;
-    Gptr q = root;
-
-    Gptr new_leaf_ptr = 0;
-    Gptr intermediate_node_ptr = 0;
-    Node *intermediate_node = nullptr;
-    size_t prefix_size = 0;
-    unsigned char existing = 0;
     for (;;) {
-        // Find current correct insertion point:
-        while (q != 0) {
-            Node *n = (Node *)toLocal(q);
-            assert(n);
-            size_t i, max_i = std::min(key_size, n->prefix_size);
-            for (i = 0; i < max_i; i++)
-                if (key[i] != n->key[i])
-                    break;
+        bool created;
+        TagGptr first;
+        Gptr q = find_or_create_leaf(key, key_size, value, created, first);
+        if (created)
+            return TagGptr();
 
-#ifdef PMEM
-            fam_invalidate(&n->child, sizeof(n->child) + sizeof(n->value));
-#endif
-            if (i < n->prefix_size) {
-                // does not match the entire prefix, we have to do a split
-                prefix_size = i;
-                existing = (unsigned char)n->key[i];
-                break;
-                // will always go to case 2
-            } else {
-                // the key so far has matched the entire prefix
-                if (!update)
-                    assert(i == n->prefix_size);
-
-                // assert(key_size >= n->prefix_size);
-                // assert(i==n->prefix_size);
-                if (key_size == i) {
-                    // match the entire prefix
-                    if (intermediate_node_ptr)
-                        heap->Free(intermediate_node_ptr);
-                    if (new_leaf_ptr)
-                        heap->Free(new_leaf_ptr);
-
-                    TagGptr *tp = &n->value;
-                    TagGptr tq;
-#ifdef PMEM
-                    tq = *tp;
-#else
-                    loadTagGptr(tp, tq);
-#endif
-                    /* When there is a key match, if update is set, that means
-                     * It will update the vaule associated with the key with the
-                     * new value given.
-                     */
-                    if (update) {
-                        for (;;) {
-                            TagGptr seen_tq = casTagGptr(
-                                tp, tq, TagGptr(value, tq.tag() + 1));
-                            if (seen_tq == tq) {
-                                return tq;
-                            }
-                            tq = seen_tq;
-                        }
-                    } else {
-                        /* In this case update is not set, that means it found
-                         * a vlue for the key and the same value is returned if
-                         * the node posses a valid value.
-                         */
-                        if (tq.IsValid()) {
-                            return tq;
-                        } else {
-                            /* Here, the key match happened, just update the
-                             * value to make the node valid (possess a valid
-                             * value) instead of recreating the node with same
-                             * key, where it may loose existing child nodes if
-                             * any.
-                             */
-                            for (;;) {
-                                TagGptr seen_tq = casTagGptr(
-                                    tp, tq, TagGptr(value, tq.tag() + 1));
-                                if (seen_tq == tq) {
-                                    return tq;
-                                }
-                                tq = seen_tq;
-                            }
-                        }
-                    }
-                } else {
-                    // the key is longer
-                    p = &n->child[(unsigned char)key[i]];
-#ifdef PMEM
-                    q = *p;
-#else
-                    q = fam_atomic_u64_read((uint64_t *)p);
-#endif
-                    // will always go to case 1 if q==0
-                }
+        Leaf *n = (Leaf *)toLocal(q);
+        assert(n);
+        TagGptr *tp = &n->value;
+        TagGptr tq = readTagGptr(tp);
+        // the leaf may be pruned under us; then we insert again
+        while (!is_pruned(tq)) {
+            /* When update is not set, a valid value found for the key is
+             * returned as is; a deleted key (null value) gets the new value,
+             * just like an update.
+             */
+            if (!update && tq.IsValid())
+                return tq;
+            TagGptr seen_tq = casTagGptr(tp, tq, TagGptr(value, tq.tag() + 1));
+            if (seen_tq == tq) {
+                return tq;
             }
+            tq = seen_tq;
         }
+    }
+}
 
-        // case 1:
-        // no split but need to insert a new leaf node:
-        if (q == 0) {
-            if (new_leaf_ptr == 0) {
-                int cnt = alloc_retry_cnt;
-                while (new_leaf_ptr == 0 && (cnt--) > 0)
-                    new_leaf_ptr = heap->Alloc(sizeof(Node));
-                if (!new_leaf_ptr.IsValid()) {
-                    size_t size = heap->Size();
-                    nvmm::ErrorCode ret = heap->Resize(2 * size);
-                    assert(ret == nvmm::NO_ERROR);
-                    new_leaf_ptr = heap->Alloc(sizeof(Node));
-                    assert(new_leaf_ptr.IsValid());
-                }
-                Node *new_leaf = (Node *)toLocal(new_leaf_ptr);
-                assert(new_leaf);
-                memcpy(new_leaf->key, key, key_size);
-                new_leaf->prefix_size = key_size;
-                new_leaf->value = TagGptr(value, 0);
-                fam_persist(new_leaf, sizeof(Node));
-            }
+TagGptr RadixTree::get(const char *key, const size_t key_size) {
+    assert(key_size > 0 && key_size <= MAX_KEY_LEN);
 
-            Gptr seen_q = cas64(p, q, new_leaf_ptr);
-            if (seen_q == q) {
-                if (intermediate_node_ptr)
-                    heap->Free(intermediate_node_ptr);
-                return TagGptr();
-            }
-            q = seen_q;
+    Gptr q = find_leaf(key, key_size);
+    if (q == 0)
+        return TagGptr();
+
+    Leaf *n = (Leaf *)toLocal(q);
+    assert(n);
+    return value_of(n);
+}
+
+TagGptr RadixTree::destroy(const char *key, const size_t key_size) {
+    assert(key_size > 0 && key_size <= MAX_KEY_LEN);
+
+    Gptr q = find_leaf(key, key_size);
+    if (q == 0)
+        return TagGptr();
+
+    // a pruned leaf gives a null old value, as for a key that does not exist
+    TagGptr old_value;
+    update_value(q, 0, old_value);
+    return old_value;
+}
+
+// indices of the keys in sorted order; equal keys keep their relative order, so
+// the last of them wins in a batched put
+static std::vector<size_t> sorted_order(std::vector<std::string> const &keys) {
+    std::vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(),
+              [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+    return order;
+}
+
+void RadixTree::put(std::vector<std::string> const &keys,
+                    std::vector<Gptr> const &values, UpdateFlags update,
+                    std::vector<TagGptr> &old_values) {
+    assert(keys.size() == values.size());
+    old_values.assign(keys.size(), TagGptr());
+    // inserts may restructure the nodes on the way down, so every key starts
+    // from the root; the sorted order still keeps the upper levels warm
+    for (size_t i : sorted_order(keys))
+        old_values[i] = put(keys[i].data(), keys[i].size(), values[i], update);
+}
+
+void RadixTree::get(std::vector<std::string> const &keys,
+                    std::vector<TagGptr> &values) {
+    values.assign(keys.size(), TagGptr());
+    Path path;
+    std::string const *prev_key = NULL;
+    for (size_t i : sorted_order(keys)) {
+        assert(keys[i].size() > 0 && keys[i].size() <= MAX_KEY_LEN);
+        Gptr q = find_leaf(keys[i], prev_key, path);
+        prev_key = &keys[i];
+        if (q == 0)
             continue;
-        }
+        Leaf *n = (Leaf *)toLocal(q);
+        assert(n);
+        values[i] = value_of(n);
+    }
+}
 
-        // case 2:
-        // split
-        if (intermediate_node_ptr == 0) {
-            int cnt = alloc_retry_cnt;
-            while (intermediate_node_ptr == 0 && (cnt--) > 0)
-                intermediate_node_ptr = heap->Alloc(sizeof(Node));
-            if (!intermediate_node_ptr.IsValid()) {
-                size_t size = heap->Size();
-                nvmm::ErrorCode ret = heap->Resize(2 * size);
-                assert(ret == nvmm::NO_ERROR);
-                intermediate_node_ptr = heap->Alloc(sizeof(Node));
-                assert(intermediate_node_ptr.IsValid());
-            }
-            intermediate_node = (Node *)toLocal(intermediate_node_ptr);
-            assert(intermediate_node);
-            // we don't just copy the current common prefix because the prefix
-            // at this node may
-            // change when the final pointer swing fails
-            // so it is easier to just copy the entire key and update the
-            // prefix_size later
-            memcpy(intermediate_node->key, key, key_size);
-            for (int i = 0; i < 256; i++)
-                intermediate_node->child[i] = 0;
+void RadixTree::get(std::vector<std::string> const &keys,
+                    std::vector<TagGptr> &values, size_t width) {
+    struct Lookup {
+        size_t i; // index of the key
+        Gptr q;
+        size_t depth;
+        bool mirrored; // started below the mirror (see find_leaf())
+    };
+    auto start = [&](size_t i) {
+        assert(keys[i].size() > 0 && keys[i].size() <= MAX_KEY_LEN);
+        Lookup l{i, root, 0, false};
+        l.mirrored = mirror_start(keys[i].data(), keys[i].size(), l.q, l.depth);
+        prefetch(l.q);
+        return l;
+    };
+
+    values.assign(keys.size(), TagGptr());
+    if (width == 0)
+        width = 1;
+
+    std::vector<Lookup> lookups;
+    lookups.reserve(width);
+    size_t next = 0;
+    while (next < keys.size() && lookups.size() < width)
+        lookups.push_back(start(next++));
+
+    // round robin: each lookup moves down one level, prefetches its next node
+    // and yields, so that the misses of different lookups overlap
+    size_t j = 0;
+    while (!lookups.empty()) {
+        if (j >= lookups.size())
+            j = 0;
+        Lookup &l = lookups[j];
+        std::string const &key = keys[l.i];
+        if (!find_leaf_step(key.data(), key.size(), l.q, l.depth, NULL)) {
+            if (l.q != 0)
+                prefetch(l.q);
+            j++;
+            continue;
         }
 
-        // where do we store this value?
-        if (prefix_size == key_size) {
-            // no extra node needed
-            intermediate_node->value = TagGptr(value, 0);
-
-            // link q
-            intermediate_node->prefix_size = prefix_size;
-            intermediate_node->child[existing] = q;
-            fam_persist(intermediate_node, sizeof(Node));
-
-            Gptr seen_q = cas64(p, q, intermediate_node_ptr);
-            if (seen_q == q) {
-                if (new_leaf_ptr)
-                    heap->Free(new_leaf_ptr);
-                return TagGptr();
-            }
+        if (l.q == 0 && l.mirrored) {
+            l = Lookup{l.i, root, 0, false};
+            prefetch(root);
+            j++;
+            continue;
+        }
+        mirror_count(l.q != 0 && l.mirrored);
+        if (l.q != 0) {
+            Leaf *n = (Leaf *)toLocal(l.q);
+            assert(n);
+            values[l.i] = value_of(n);
+        }
 
-            q = seen_q;
+        // this slot goes to the next key, or the last lookup takes its place
+        if (next < keys.size()) {
+            l = start(next++);
+            j++;
         } else {
-            // need a new leaf node
-            if (new_leaf_ptr == 0) {
-                int cnt = alloc_retry_cnt;
-                while (new_leaf_ptr == 0 && (cnt--) > 0)
-                    new_leaf_ptr = heap->Alloc(sizeof(Node));
-                if (!new_leaf_ptr.IsValid()) {
-                    size_t size = heap->Size();
-                    nvmm::ErrorCode ret = heap->Resize(2 * size);
-                    assert(ret == nvmm::NO_ERROR);
-                    new_leaf_ptr = heap->Alloc(sizeof(Node));
-                    assert(new_leaf_ptr.IsValid());
-                }
-                Node *new_leaf = (Node *)toLocal(new_leaf_ptr);
-                assert(new_leaf);
-                memcpy(new_leaf->key, key, key_size);
-                new_leaf->prefix_size = key_size;
-                new_leaf->value = TagGptr(value, 0);
-                fam_persist(new_leaf, sizeof(Node));
-            }
-            intermediate_node->child[(unsigned char)key[prefix_size]] =
-                new_leaf_ptr;
+            l = lookups.back();
+            lookups.pop_back();
+        }
+    }
+}
 
-            // link q
-            intermediate_node->prefix_size = prefix_size;
-            intermediate_node->child[existing] = q;
-            fam_persist(intermediate_node, sizeof(Node));
+void RadixTree::destroy(std::vector<std::string> const &keys,
+                        std::vector<TagGptr> &old_values) {
+    old_values.assign(keys.size(), TagGptr());
+    Path path;
+    std::string const *prev_key = NULL;
+    for (size_t i : sorted_order(keys)) {
+        assert(keys[i].size() > 0 && keys[i].size() <= MAX_KEY_LEN);
+        Gptr q = find_leaf(keys[i], prev_key, path);
+        prev_key = &keys[i];
+        if (q != 0)
+            update_value(q, 0, old_values[i]);
+    }
+}
 
-            Gptr seen_q = cas64(p, q, intermediate_node_ptr);
-            if (seen_q == q)
-                return TagGptr();
+//********************************
+// Mirror of the Upper Levels    *
+//********************************
 
-            q = seen_q;
-        }
+void RadixTree::set_mirror(size_t levels, size_t budget) {
+    std::lock_guard<std::mutex> lock(mirrors->mutex);
+    if (budget < sizeof(Mirror::Node))
+        levels = 0; // not even the root fits
+    mirrors->levels.store(levels);
+    mirrors->budget = budget;
+    Mirror *old = mirrors->current.exchange(nullptr);
+    if (old) {
+        nvmm::EpochOp op(emgr);
+        mirrors->retired.push_back(std::make_pair(op.reported_epoch(), old));
     }
+    mirrors->stale_walks.store(0);
 }
 
-TagGptr RadixTree::get(const char *key, const size_t key_size) {
-    assert(key_size > 0 && key_size <= MAX_KEY_LEN);
-    Gptr *p = NULL;
-    Gptr q = root;
+// where a lookup of the key starts: the node right below the mirrored nodes on
+// its way (or the mirrored node whose slot for the key was empty, to read the
+// slot again), and the key bytes known to match
+// returns false, leaving q and depth alone, if there is no mirror, the key is not
+// in it, or the node it points to has been swung out of the tree since
+bool RadixTree::mirror_start(const char *key, const size_t key_size, Gptr &q,
+                             size_t &depth) {
+    if (mirrors->levels.load(std::memory_order_relaxed) == 0)
+        return false;
+    Mirror *m = mirrors->current.load(std::memory_order_acquire);
+    auto stale = [&]() -> bool {
+        size_t cost = m ? m->nodes.size() : 0;
+        if (mirrors->stale_walks.fetch_add(1, std::memory_order_relaxed) >= cost)
+            mirror_build();
+        return false;
+    };
+    if (m == nullptr)
+        return stale();
+
+    // the node the lookup would start from, and its replacement count then
+    auto start = [&](Gptr node, uint64_t replaced, size_t d) -> bool {
+        if (node != root && load64(replaced_count(node)) != replaced)
+            return stale();
+        q = node;
+        depth = d;
+        return true;
+    };
+
+    Mirror::Node const *n = &m->nodes[0];
+    size_t d = 0; // key bytes known to match
+    for (;;) {
+        size_t prefix_size = n->prefix.size();
+        if (key_size < prefix_size ||
+            memcmp(key + d, n->prefix.data() + d, prefix_size - d) != 0)
+            return false;
+        if (key_size == prefix_size)
+            return start(n->node, n->replaced, prefix_size);
+        unsigned char byte = (unsigned char)key[prefix_size];
+        if (n->sub[byte] >= 0) {
+            n = &m->nodes[n->sub[byte]];
+            d = prefix_size + 1;
+            continue;
+        }
+        if (n->child[byte] == 0)
+            return start(n->node, n->replaced, prefix_size);
+        return start(n->child[byte], n->child_replaced[byte], prefix_size + 1);
+    }
+}
 
-    int pointer_traversals = 0;
+// counts a lookup by key, once it is done, as a hit (it found its leaf from
+// where the mirror took it) or a miss of the mirror, if the mirror is on
+void RadixTree::mirror_count(bool hit) {
+    if (mirrors->levels.load(std::memory_order_relaxed) == 0)
+        return;
+    if (hit) {
+        METRIC_COUNTER_INC(metrics, mirror_hit_);
+    } else {
+        METRIC_COUNTER_INC(metrics, mirror_miss_);
+    }
+}
 
-    //std::cout << "GET start @ q: " << q << " key: |" << key << "|(" << key_size << ")" << std::endl;
-    while (q != 0) {
+// copies the inner nodes of the upper levels, breadth first, until the budget
+// is used up; lookups that find another lookup building go on without a mirror
+void RadixTree::mirror_build() {
+    std::unique_lock<std::mutex> lock(mirrors->mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+        return;
+    size_t levels = mirrors->levels.load();
+    Mirror *old = mirrors->current.load();
+    if (levels == 0 ||
+        (old && mirrors->stale_walks.load() < old->nodes.size()))
+        return; // turned off, or just rebuilt
+
+    nvmm::EpochOp op(emgr);
+
+    // the old mirrors that no lookup can still be reading (see SlabHeap::reclaim())
+    nvmm::EpochCounter frontier = emgr->frontier_epoch();
+    auto &retired = mirrors->retired;
+    size_t kept = 0;
+    for (size_t i = 0; i < retired.size(); i++) {
+        if (retired[i].first + 1 < frontier)
+            delete retired[i].second;
+        else
+            retired[kept++] = retired[i];
+    }
+    retired.resize(kept);
+
+    // the children are read with their replacement counts, so that one that
+    // is replaced meanwhile is stale in the new mirror right away
+    Mirror *m = new Mirror();
+    std::vector<size_t> level;
+    size_t bytes = 0;
+    auto copy = [&](Gptr q, uint64_t replaced, size_t l) -> int32_t {
         Node *n = (Node *)toLocal(q);
         assert(n);
+        size_t size = sizeof(Mirror::Node) + n->prefix_size;
+        if (bytes + size > mirrors->budget)
+            return -1;
+        bytes += size;
+        m->nodes.emplace_back();
+        Mirror::Node &c = m->nodes.back();
+        c.node = q;
+        c.replaced = replaced;
+        c.prefix.assign(n->prefix(), n->prefix_size);
+        for (int i = 0; i < 256; i++) {
+            c.child[i] = 0;
+            c.child_replaced[i] = 0;
+            c.sub[i] = -1;
+        }
+        unsigned int byte = 0;
+        for (Gptr child; (child = n->next_child(byte, byte)) != 0; byte++) {
+            c.child_replaced[byte] =
+                replaced_of(n->find_child((unsigned char)byte), child);
+            c.child[byte] = unmark(child);
+        }
+        level.push_back(l);
+        return (int32_t)(m->nodes.size() - 1);
+    };
+
+    copy(root, 0, 0);
+    bool full = false;
+    for (size_t i = 0; i < m->nodes.size() && !full; i++) {
+        if (level[i] + 1 >= levels)
+            continue;
+        for (int byte = 0; byte < 256; byte++) {
+            Gptr child = m->nodes[i].child[byte];
+            if (child == 0 || ((Node *)toLocal(child))->is_leaf())
+                continue;
+            int32_t j = copy(child, m->nodes[i].child_replaced[byte], level[i] + 1);
+            if (j < 0) {
+                full = true;
+                break;
+            }
+            m->nodes[i].sub[byte] = j;
+        }
+    }
 
-        //std::cout << "GET @ q: " << q << " n->key: |" << n->key << "|(" << n->prefix_size << ")" << std::endl;
-        int result =
-            fam_memcmp(key, n->key, std::min(n->prefix_size, key_size));
-        if (result != 0)
-            return TagGptr();
+    mirrors->current.store(m, std::memory_order_release);
+    mirrors->stale_walks.store(0, std::memory_order_relaxed);
+    if (old)
+        retired.push_back(std::make_pair(op.reported_epoch(), old));
+}
 
-#ifdef PMEM
-        fam_invalidate(&n->child, sizeof(n->child) + sizeof(n->value));
-#endif
+//********************************
+// Bulk Load                     *
+//********************************
 
-        if (n->prefix_size == key_size) {
-            TagGptr *tp = &n->value;
-            TagGptr tq;
-#ifdef PMEM
-            tq = *tp;
-#else
-            loadTagGptr(tp, tq);
-#endif
-            METRIC_HISTOGRAM_UPDATE(metrics, pointer_traversal_,
-                                    pointer_traversals);
+// ranges of keys that have more than this per worker are split among workers
+static size_t const LOAD_PARTS_PER_WORKER = 4;
+
+// a bulk load (see load())
+struct RadixTree::Load {
+    // a range of keys that is built into a subtree for slot; the subtree is
+    // either published (linked into the tree with a cas), or stored in a node
+    // that is itself still being built
+    struct Part {
+        size_t lo, hi;
+        Gptr *slot;
+        bool publish;
+        Gptr node; // the top of a subtree that is built in pieces
+    };
+
+    Load(std::vector<std::string> const &Keys, std::vector<Gptr> const &Values,
+         std::vector<TagGptr> &Old_values)
+        : keys(Keys), values(Values), old_values(Old_values) {}
+
+    std::vector<std::string> const &keys;
+    std::vector<Gptr> const &values;
+    std::vector<TagGptr> &old_values;
+    // the keys to load, in sorted order, and for each of them the index its
+    // old value goes to (of equal keys, the last is loaded and the first gets
+    // the old value)
+    std::vector<size_t> idx;
+    std::vector<size_t> old_at;
+    uint64_t tag; // the version of the new leaves
+    size_t max_part;
+
+    std::vector<Part> parts; // built by the workers
+    std::vector<Part> tops;  // built over parts by the planner
+    std::vector<std::pair<size_t, size_t>> rest; // put key by key
+    std::mutex mutex; // for rest, while the workers run
+
+    std::string const &key(size_t k) const { return keys[idx[k]]; }
+};
 
-            return tq;
+// runs f(0) .. f(cnt-1) on up to threads workers
+static void run_workers(size_t threads, size_t cnt,
+                        std::function<void(size_t)> const &f) {
+    std::atomic<size_t> next(0);
+    auto work = [&]() {
+        for (size_t i; (i = next++) < cnt;)
+            f(i);
+    };
+    std::vector<std::thread> pool;
+    for (size_t t = 1; t < std::min(threads, cnt); t++)
+        pool.emplace_back(work);
+    work();
+    for (auto &t : pool)
+        t.join();
+}
+
+void RadixTree::load(std::vector<std::string> const &keys,
+                     std::vector<Gptr> const &values,
+                     std::vector<TagGptr> &old_values, size_t threads) {
+    assert(keys.size() == values.size());
+    old_values.assign(keys.size(), TagGptr());
+    if (threads == 0)
+        threads = 1;
+
+    Load l(keys, values, old_values);
+    std::vector<size_t> order;
+    if (std::is_sorted(keys.begin(), keys.end())) {
+        order.resize(keys.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = i;
+    } else {
+        order = sorted_order(keys);
+    }
+    for (size_t i : order) {
+        assert(keys[i].size() > 0 && keys[i].size() <= MAX_KEY_LEN);
+        if (!l.idx.empty() && keys[l.idx.back()] == keys[i]) {
+            // as if the one before had been put and then overwritten
+            old_values[i] = TagGptr(values[l.idx.back()], 0);
+            l.idx.back() = i;
+            continue;
+        }
+        l.idx.push_back(i);
+        l.old_at.push_back(i);
+    }
+    if (l.idx.empty())
+        return;
+    l.tag = first_value(0).tag();
+    l.max_part = std::max<size_t>(
+        1, l.idx.size() / (threads * LOAD_PARTS_PER_WORKER));
+
+    load_plan(l, 0, l.idx.size(), NULL);
+
+    run_workers(threads, l.parts.size(), [&](size_t i) {
+        Load::Part &part = l.parts[i];
+        std::vector<Gptr> nodes;
+        Gptr q = load_build(l, part.lo, part.hi, nodes);
+        for (Gptr n : nodes) {
+            Node *node = (Node *)toLocal(n);
+            fam_persist(node, Node::size_of(node->type, node->prefix_size));
         }
+        if (!part.publish)
+            *part.slot = q; // the node that holds slot is persisted later
+        else
+            load_publish(l, part.lo, part.hi, part.slot, q);
+    });
+
+    // the split parts are all in place: finish their tops bottom-up
+    for (size_t i = l.tops.size(); i-- > 0;) {
+        Load::Part &top = l.tops[i];
+        Node *node = (Node *)toLocal(top.node);
+        fam_persist(node, Node::size_of(node->type, node->prefix_size));
+        if (top.publish)
+            load_publish(l, top.lo, top.hi, top.slot, top.node);
+    }
 
-        // assert(n->prefix_size<key_size);
-        if (key_size < n->prefix_size) {
-            return TagGptr();
-        } else {
-            p = &n->child[(unsigned char)key[n->prefix_size]];
+    run_workers(threads, l.rest.size(), [&](size_t i) {
+        nvmm::EpochOp op(emgr);
+        for (size_t k = l.rest[i].first; k < l.rest[i].second; k++) {
+            std::string const &key = l.key(k);
+            l.old_values[l.old_at[k]] =
+                put(key.data(), key.size(), l.values[l.idx[k]], UPDATE);
         }
+    });
+}
 
-#ifdef PMEM
-        q = *p;
-#else
-        q = fam_atomic_u64_read((uint64_t *)p);
-#endif
+// puts the k-th key to load right away
+void RadixTree::load_put(Load &l, size_t k) {
+    std::string const &key = l.key(k);
+    l.old_values[l.old_at[k]] =
+        put(key.data(), key.size(), l.values[l.idx[k]], UPDATE);
+}
 
-        pointer_traversals++;
+// finds where the keys [lo, hi) go: the ones that fall into empty slots
+// become parts (or tops), the others go to rest; p is the slot of the subtree
+// that takes all of them (NULL: the root)
+// a node whose prefix does not take all of them is split by putting one of the
+// keys, and then they are planned again
+void RadixTree::load_plan(Load &l, size_t lo, size_t hi, Gptr *p) {
+    while (lo < hi) {
+        Gptr q = root;
+        if (p != NULL) {
+            q = loadGptr(p);
+            if (q == 0) {
+                load_split(l, lo, hi, p, true);
+                return;
+            }
+        }
+        Node *n = (Node *)toLocal(unmark(q));
+        assert(n);
+        std::string const &first = l.key(lo);
+        std::string const &last = l.key(hi - 1);
+        size_t prefix_size = n->prefix_size;
+        bool covered = !is_marked(q) && !n->is_leaf() &&
+                       first.size() >= prefix_size &&
+                       last.size() >= prefix_size &&
+                       fam_memcmp(first.data(), n->prefix(), prefix_size) == 0 &&
+                       fam_memcmp(last.data(), n->prefix(), prefix_size) == 0;
+        if (!covered) {
+            if (hi - lo == 1 || is_marked(q)) {
+                l.rest.push_back(std::make_pair(lo, hi));
+                return;
+            }
+            // put the key whose insert splits q at a prefix of all the keys
+            size_t shared = 0, max_shared = std::min(first.size(), prefix_size);
+            while (shared < max_shared && first[shared] == n->prefix()[shared])
+                shared++;
+            size_t range_shared = 0;
+            max_shared = std::min(first.size(), last.size());
+            while (range_shared < max_shared &&
+                   first[range_shared] == last[range_shared])
+                range_shared++;
+            if (shared <= range_shared)
+                load_put(l, lo++);
+            else
+                load_put(l, --hi);
+            continue;
+        }
+
+        size_t k = lo;
+        if (first.size() == prefix_size) {
+            // the key of the leaf slot
+            l.rest.push_back(std::make_pair(k, k + 1));
+            k++;
+        }
+        while (k < hi) {
+            unsigned char byte = (unsigned char)l.key(k)[prefix_size];
+            size_t j = k + 1;
+            while (j < hi && (unsigned char)l.key(j)[prefix_size] == byte)
+                j++;
+            Gptr *slot = n->find_child(byte);
+            if (slot == NULL)
+                slot = n->claim_child(byte);
+            if (slot == NULL || is_marked(loadGptr(slot)))
+                break; // n is full, or being replaced
+            load_plan(l, k, j, slot);
+            k = j;
+        }
+        if (k == hi)
+            return;
+        // put() replaces n, and then the rest of the keys start over from p
+        load_put(l, k++);
+        lo = k;
     }
+}
 
-    return TagGptr();
+// makes the keys [lo, hi) a part, or, if there are too many of them, builds
+// the top node over them right away and makes the keys under each of its
+// children a part of its own
+void RadixTree::load_split(Load &l, size_t lo, size_t hi, Gptr *slot,
+                           bool publish) {
+    if (hi - lo <= l.max_part) {
+        l.parts.push_back(Load::Part{lo, hi, slot, publish, 0});
+        return;
+    }
+    std::vector<Gptr> nodes;
+    std::vector<std::pair<size_t, size_t>> groups;
+    Gptr q = load_node(l, lo, hi, nodes, groups);
+    if (nodes.size() > 1) {
+        // the leaf in the leaf slot
+        Node *leaf = (Node *)toLocal(nodes[1]);
+        fam_persist(leaf, Node::size_of(LEAF, leaf->prefix_size));
+    }
+    l.tops.push_back(Load::Part{lo, hi, slot, publish, q});
+    if (!publish)
+        *slot = q;
+    Node *n = (Node *)toLocal(q);
+    size_t prefix_size = n->prefix_size;
+    for (auto const &g : groups)
+        load_split(l, g.first, g.second,
+                   n->find_child((unsigned char)l.key(g.first)[prefix_size]),
+                   false);
 }
 
-TagGptr RadixTree::destroy(const char *key, const size_t key_size) {
-    assert(key_size > 0 && key_size <= MAX_KEY_LEN);
-    Gptr *p = NULL;
-    Gptr q = root;
+// allocates the inner node over the keys [lo, hi) (at least two), with the
+// key that equals its prefix, if any, in its leaf slot, and a slot claimed (but
+// still null) for each of the groups of the other keys that share a next byte
+// the new nodes (the inner node first) are appended to nodes
+Gptr RadixTree::load_node(Load &l, size_t lo, size_t hi,
+                          std::vector<Gptr> &nodes,
+                          std::vector<std::pair<size_t, size_t>> &groups) {
+    assert(hi - lo >= 2);
+    std::string const &first = l.key(lo);
+    std::string const &last = l.key(hi - 1);
+    size_t prefix_size = 0, max_size = std::min(first.size(), last.size());
+    while (prefix_size < max_size && first[prefix_size] == last[prefix_size])
+        prefix_size++;
+
+    size_t k = lo;
+    if (first.size() == prefix_size)
+        k++;
+    groups.clear();
+    while (k < hi) {
+        unsigned char byte = (unsigned char)l.key(k)[prefix_size];
+        size_t j = k + 1;
+        while (j < hi && (unsigned char)l.key(j)[prefix_size] == byte)
+            j++;
+        groups.push_back(std::make_pair(k, j));
+        k = j;
+    }
 
-    while (q != 0) {
-        Node *n = (Node *)toLocal(q);
-        assert(n);
+    // room for one more child, as in replace()
+    uint64_t type = fit_type(groups.size());
+    Gptr q = alloc_node(Node::size_of(type, prefix_size));
+    Node *n = (Node *)toLocal(q);
+    assert(n);
+    n->init(type, first.data(), prefix_size);
+    nodes.push_back(q);
+    if (first.size() == prefix_size)
+        *n->leaf_slot() = load_leaf(l, lo, nodes);
+    for (size_t i = 0; i < groups.size(); i++)
+        n->init_child(i, (unsigned char)l.key(groups[i].first)[prefix_size], 0);
+    return q;
+}
 
-        int result =
-            fam_memcmp(key, n->key, std::min(n->prefix_size, key_size));
-        if (result != 0)
-            return TagGptr();
+Gptr RadixTree::load_leaf(Load &l, size_t k, std::vector<Gptr> &nodes) {
+    std::string const &key = l.key(k);
+    Gptr leaf_ptr = alloc_node(Node::size_of(LEAF, key.size()));
+    Leaf *leaf = (Leaf *)toLocal(leaf_ptr);
+    assert(leaf);
+    leaf->type = LEAF;
+    leaf->prefix_size = key.size();
+    leaf->value = TagGptr(l.values[l.idx[k]], l.tag);
+    memcpy(leaf->key, key.data(), key.size());
+    nodes.push_back(leaf_ptr);
+    return leaf_ptr;
+}
 
-#ifdef PMEM
-        fam_invalidate(&n->child, sizeof(n->child) + sizeof(n->value));
-#endif
-        if (n->prefix_size == key_size) {
-            TagGptr *tp = &n->value;
-            TagGptr tq;
-#ifdef PMEM
-            tq = *tp;
-#else
-            loadTagGptr(tp, tq);
-#endif
-            for (;;) {
-                TagGptr seen_tq = casTagGptr(tp, tq, TagGptr(0, tq.tag() + 1));
-                if (seen_tq == tq) {
-                    return tq;
-                }
-                tq = seen_tq;
-            }
-        }
-        if (key_size < n->prefix_size) {
-            return TagGptr();
-        } else {
-            p = &n->child[(unsigned char)key[n->prefix_size]];
-        }
-#ifdef PMEM
-        q = *p;
-#else
-        q = fam_atomic_u64_read((uint64_t *)p);
-#endif
+// builds the subtree of the keys [lo, hi) bottom-up; nothing is persisted yet,
+// the new nodes are appended to nodes
+Gptr RadixTree::load_build(Load &l, size_t lo, size_t hi,
+                           std::vector<Gptr> &nodes) {
+    if (hi - lo == 1)
+        return load_leaf(l, lo, nodes);
+    std::vector<std::pair<size_t, size_t>> groups;
+    Gptr q = load_node(l, lo, hi, nodes, groups);
+    Node *n = (Node *)toLocal(q);
+    size_t prefix_size = n->prefix_size;
+    for (size_t i = 0; i < groups.size(); i++) {
+        Gptr child = load_build(l, groups[i].first, groups[i].second, nodes);
+        *n->find_child((unsigned char)l.key(groups[i].first)[prefix_size]) = child;
     }
+    return q;
+}
+
+// links the subtree q of the keys [lo, hi) into the empty slot p, unless the
+// slot has been taken since, or a compaction has begun since the load did (it
+// may prune a leaf of one of the keys, whose versions the new leaf would have
+// to go on from); then q is freed and the keys are put one by one
+void RadixTree::load_publish(Load &l, size_t lo, size_t hi, Gptr *p, Gptr q) {
+    if (first_value(0).tag() == l.tag && cas64(p, Gptr(0), q) == 0)
+        return;
+    free_subtree(q);
+    std::lock_guard<std::mutex> lock(l.mutex);
+    l.rest.push_back(std::make_pair(lo, hi));
+}
 
-    return TagGptr();
+// frees a subtree that was never linked into the tree
+void RadixTree::free_subtree(Gptr q) {
+    Node *n = (Node *)toLocal(q);
+    assert(n);
+    if (!n->is_leaf()) {
+        Gptr leaf = loadGptr(n->leaf_slot());
+        if (leaf != 0)
+            free_subtree(leaf);
+        unsigned int byte = 0;
+        for (Gptr child; (child = n->next_child(byte, byte)) != 0; byte++)
+            free_subtree(child);
+    }
+    free_node(q, Node::size_of(n->type, n->prefix_size));
 }
 
 // find the next key within the requested range
@@ -736,176 +2171,92 @@ bool RadixTree::next_value(Iter &iter) {
     char const *key = iter.end_key.data();
     size_t key_size = iter.end_key.size();
 
-    // std::cout << "next_value: end_key " << key_size << std::endl;
-    // for(int i=0; i<key_size; i++) {
-    //     std::cout << (uint64_t)key[i] << " ";
-    // }
-    // std::cout << std::endl;
-
-    Gptr *p, q;
     while (iter.node != 0) {
         while (iter.next_pos == 257) {
             if (iter.path.empty())
                 return false;
-            auto parent = iter.path.top();
-            iter.path.pop();
-            iter.node = parent.first;
-            iter.next_pos = parent.second + 1 + 1;
-            // std::cout << "next_value going up at " << iter.next_pos-1 <<
-            // std::endl;
+            Iter::Step const &parent = iter.path.back();
+            iter.node = parent.node;
+            iter.replaced = parent.replaced;
+            iter.next_pos = parent.byte + 1 + 1;
+            iter.path.pop_back();
         }
 
         Node *n = (Node *)toLocal(iter.node);
         assert(n);
-
-        // std::cout << "next_value: current node key " << n->prefix_size <<
-        // std::endl;
-        // for(int i=0; i<n->prefix_size; i++) {
-        //     std::cout << (uint64_t)n->key[i] << " ";
-        // }
-        // std::cout << std::endl;
+        char *prefix = n->prefix();
+        size_t prefix_size = n->prefix_size;
 
         // TODO: cache comparison result in iter?
         int result;
         if (iter.end_key_open)
             result = 1;
         else
-            result =
-                fam_memcmp(key, n->key, std::min(n->prefix_size, key_size));
+            result = fam_memcmp(key, prefix, std::min(prefix_size, key_size));
         if (result < 0) {
-            // std::cout << "next_value result < 0 " << std::endl;
+            iter.node = 0; // indicating there is no more valid keys
             return false;
-        } else if (result > 0) {
-// std::cout << "next_value result > 0 " << std::endl;
-// every key in this subtree is valid
-// so we go through all the child pointers
-
-// std::cout << "next_value !!! next_pos " << iter.next_pos << std::endl;
-
-#ifdef PMEM
-            fam_invalidate(&n->child, sizeof(n->child) + sizeof(n->value));
-#endif
-
-            // special case: check the value ptr
-            if (iter.next_pos == 0) {
-                // std::cout << "next_value checking value " << std::endl;
-                iter.next_pos++;
+        }
 
-                TagGptr *tp = &n->value;
-                TagGptr tq;
-#ifdef PMEM
-                tq = *tp;
-#else
-                loadTagGptr(tp, tq);
-#endif
+        if (result == 0 && key_size <= prefix_size) {
+            // every key in this subtree is >= the end key, and only n's own key
+            // can be equal to it
+            iter.node = 0; // indicating there is no more valid keys
+            if (key_size == prefix_size && iter.end_key_inclusive &&
+                iter.next_pos == 0) {
+                TagGptr tq = value_of(n);
                 if (tq.IsValid()) {
-                    iter.key = std::string((char *)&n->key, n->prefix_size);
+                    iter.key.assign(prefix, prefix_size);
                     iter.value = tq;
                     return true;
                 }
             }
+            return false;
+        }
 
-            // check the next child ptr
-            for (; iter.next_pos <= 256; iter.next_pos++) {
-                // std::cout << "next_value checking ptr at " << iter.next_pos-1
-                // << std::endl;
-                p = &n->child[iter.next_pos - 1];
-#ifdef PMEM
-                q = *p;
-#else
-                q = fam_atomic_u64_read((uint64_t *)p);
-#endif
-                if (q) {
-                    // std::cout << "next_value going down at " <<
-                    // iter.next_pos-1 << std::endl;
-                    iter.path.push(
-                        std::make_pair(iter.node, iter.next_pos - 1));
-                    iter.node = q;
-                    iter.next_pos = 0;
-                    break;
-                }
+        // result > 0: every key in this subtree is valid
+        // result == 0: the end key extends n's key, so we check n's key and
+        // the child pointers up to key[prefix_size]
+        unsigned int upper_bound =
+            result > 0 ? 255 : (unsigned char)key[prefix_size];
+
+        // special case: check the value ptr
+        if (iter.next_pos == 0) {
+            iter.next_pos++;
+            TagGptr tq = value_of(n);
+            if (tq.IsValid()) {
+                iter.key.assign(prefix, prefix_size);
+                iter.value = tq;
+                return true;
             }
+        }
 
-            // then we go up
-        } else {
-            // std::cout << "next_value result == 0 " << std::endl;
-            // assert(result == 0);
-            if (n->prefix_size == key_size) {
-                iter.node = 0; // indicating there is no more valid keys
-                if (iter.end_key_inclusive) {
-                    // node->value would be the last valid key
-                    // so we just check the value ptr
-                    TagGptr *tp = &n->value;
-                    TagGptr tq;
-#ifdef PMEM
-                    tq = *tp;
-#else
-                    loadTagGptr(tp, tq);
-#endif
-
-                    if (iter.next_pos == 0 && tq.IsValid()) {
-
-                        iter.key = std::string((char *)&n->key, n->prefix_size);
-                        iter.value = tq;
-                        return true;
-                    }
-                    return false;
-                } else {
-                    return false;
-                }
-            } else {
-                // assert(n->prefix_size < key_size);
-                // we check all child pointers up to key[n->prefix_size]
-
-                // special case: check the value ptr
-                if (iter.next_pos == 0) {
-                    iter.next_pos++;
-                    TagGptr *tp = &n->value;
-                    TagGptr tq;
-#ifdef PMEM
-                    tq = *tp;
-#else
-                    loadTagGptr(tp, tq);
-#endif
-                    if (tq.IsValid()) {
-                        iter.key = std::string((char *)&n->key, n->prefix_size);
-                        iter.value = tq;
-                        return true;
-                    }
-                }
-                // check the next child ptr
-                if (key_size < n->prefix_size) {
-                    return false;
-                } else {
-                    uint64_t upper_bound =
-                        (uint64_t)key[std::min(n->prefix_size, key_size)];
-                    for (; iter.next_pos <= upper_bound + 1; iter.next_pos++) {
-                        // std::cout << "next_value checking ptr at " <<
-                        // iter.next_pos-1 << std::endl;
-                        p = &n->child[iter.next_pos - 1];
-#ifdef PMEM
-                        q = *p;
-#else
-                        q = fam_atomic_u64_read((uint64_t *)p);
-#endif
-                        if (q) {
-                            // std::cout << "next_value going down at " <<
-                            // iter.next_pos-1 << std::endl;
-                            iter.path.push(
-                                std::make_pair(iter.node, iter.next_pos - 1));
-                            iter.node = q;
-                            iter.next_pos = 0;
-                            break;
-                        }
-                    }
-
-                    if (iter.next_pos > upper_bound + 1) {
-                        // then we are done!
-                        iter.node = 0;
-                        return false;
-                    }
-                }
+        // check the next child ptr
+        unsigned int byte = 256;
+        Gptr q = 0;
+        if (!n->is_leaf() && iter.next_pos - 1 <= upper_bound)
+            q = n->next_child((unsigned int)iter.next_pos - 1, byte);
+        if (q != 0 && byte <= upper_bound) {
+            Gptr *p = n->find_child((unsigned char)byte);
+            assert(p != NULL);
+            Gptr seen = q;
+            uint64_t replaced = replaced_of(p, seen);
+            if (unmark(seen) == 0) {
+                // pruned meanwhile
+                iter.next_pos = byte + 1 + 1;
+                continue;
             }
+            iter.path.push_back(Iter::Step{iter.node, (uint64_t)byte, iter.replaced});
+            iter.node = unmark(seen);
+            iter.replaced = replaced;
+            iter.next_pos = 0;
+        } else if (result == 0) {
+            // then we are done!
+            iter.node = 0;
+            return false;
+        } else {
+            // then we go up
+            iter.next_pos = 257;
         }
     }
 
@@ -918,97 +2269,69 @@ bool RadixTree::next_value(Iter &iter) {
 // begin_key_inclusive==true) the begin key
 bool RadixTree::lower_bound(Iter &iter) {
     iter.node = root;
+    iter.replaced = 0; // the root is never replaced
     iter.next_pos = 0;
     assert(iter.key.empty());
     iter.value = TagGptr();
 
     char const *key = iter.begin_key.data();
     size_t key_size = iter.begin_key.size();
-    // std::cout << "lower_bound: begin_key " << key_size << std::endl;
-    // for(int i=0; i<key_size; i++) {
-    //     std::cout << (uint64_t)key[i] << " ";
-    // }
-    // std::cout << std::endl;
 
     while (iter.node != 0) {
         Node *n = (Node *)toLocal(iter.node);
         assert(n);
 
-        // std::cout << "lower_bound !!! current node key " << n->prefix_size <<
-        // std::endl;
-        // for(int i=0; i<n->prefix_size; i++) {
-        //     std::cout << (uint64_t)n->key[i] << " ";
-        // }
-        // std::cout << std::endl;
-
         int result;
         if (iter.begin_key_open)
             result = -1;
         else
             result =
-                fam_memcmp(key, n->key, std::min(n->prefix_size, key_size));
+                fam_memcmp(key, n->prefix(), std::min(n->prefix_size, key_size));
 
         if (result > 0) {
-            // std::cout << "lower_bound !!! result > 0 " << std::endl;
             // oops, begin key > n->key
             // we have to go up and the next node is our starting point
             iter.next_pos =
                 257; // indicating we are done with this node and want to go up
             return next_value(iter);
         } else if (result < 0) {
-            // std::cout << "lower_bound !!! result < 0 " << std::endl;
             // begin key < n->key
             // current node is our starting point
-            // assert(iter.next_pos == 0);
             return next_value(iter);
         } else {
-            // std::cout << "lower_bound !!! result == 0 " << std::endl;
-            // assert(result == 0);
             if (n->prefix_size == key_size) {
                 // begin key == n->key
                 if (iter.begin_key_inclusive) {
                     // current node is our starting point
-                    // assert(iter.next_pos == 0);
-                    // std::cout << "lower_bound now !!!" << std::endl;
                     return next_value(iter);
                 } else {
                     // the first child is our starting point
                     iter.next_pos = 1;
                     return next_value(iter);
                 }
+            } else if (key_size < n->prefix_size) {
+                return next_value(iter);
+            } else if (n->is_leaf()) {
+                // begin key > n->key, which is a prefix of it
+                iter.next_pos = 257;
+                return next_value(iter);
             } else {
-                // assert(n->prefix_size < key_size);
-                if (key_size < n->prefix_size) {
-                    return next_value(iter);
+                unsigned char idx = (unsigned char)key[n->prefix_size];
+                Gptr *p = n->find_child(idx);
+                Gptr seen = p ? loadGptr(p) : Gptr(0);
+                uint64_t replaced = unmark(seen) ? replaced_of(p, seen) : 0;
+                Gptr q = unmark(seen);
+                if (q) {
+                    // we have not yet found the starting point
+                    // keep going down
+                    iter.path.push_back(Iter::Step{iter.node, (uint64_t)idx, iter.replaced});
+                    iter.node = q;
+                    iter.replaced = replaced;
+                    continue;
                 } else {
-                    unsigned char idx =
-                        (unsigned char)key[std::min(n->prefix_size, key_size)];
-#ifdef PMEM
-                    fam_invalidate(&n->child,
-                                   sizeof(n->child) + sizeof(n->value));
-#endif
-                    Gptr *p, q;
-                    p = &n->child[(unsigned char)idx];
-#ifdef PMEM
-                    q = *p;
-#else
-                    q = fam_atomic_u64_read((uint64_t *)p);
-#endif
-                    if (q) {
-                        // we have not yet found the starting point
-                        // keep going down
-                        // std::cout << "lower_bound !!! going down at " <<
-                        // (uint64_t)idx << std::endl;
-                        iter.path.push(std::make_pair(iter.node, idx));
-                        iter.node = q;
-                        continue;
-                    } else {
-                        // the next node is our starting point
-                        // std::cout << "lower_bound !!! next node " <<
-                        // (uint64_t)idx << std::endl;
-                        iter.next_pos = idx + 1;
-                        return next_value(iter);
-                    }
+                    // the next node is our starting point
+                    iter.next_pos = idx + 1;
+                    return next_value(iter);
                 }
             }
         }
@@ -1024,23 +2347,22 @@ int RadixTree::scan(Iter &iter, char *key, size_t &key_size, TagGptr &val,
     assert(begin_key_size > 0 && begin_key_size <= MAX_KEY_LEN);
     assert(end_key_size > 0 && end_key_size <= MAX_KEY_LEN);
 
+    // iter may be reused from an earlier scan; reset it without giving up the
+    // memory it holds
     iter.node = 0;
     iter.next_pos = 0;
     iter.key.clear();
     iter.value = TagGptr();
-    {
-        std::stack<std::pair<Gptr, uint64_t> > tmp;
-        tmp.swap(iter.path);
-    }
+    iter.path.clear();
 
     // std::cout << ">>> scan " << std::endl;
     static const std::string OPEN_BOUNDARY_STR =
         std::string((char const *)OPEN_BOUNDARY_KEY, OPEN_BOUNDARY_KEY_SIZE);
-    iter.begin_key = std::string(begin_key, begin_key_size);
+    iter.begin_key.assign(begin_key, begin_key_size);
     iter.begin_key_inclusive = begin_key_inclusive;
 
     if (iter.begin_key == OPEN_BOUNDARY_STR &&
-        iter.end_key_inclusive == false) {
+        iter.begin_key_inclusive == false) {
         // a valid open begin key
         iter.begin_key_open = true;
         // std::cout << " open begin key" << std::endl;
@@ -1048,7 +2370,7 @@ int RadixTree::scan(Iter &iter, char *key, size_t &key_size, TagGptr &val,
         iter.begin_key_open = false;
     }
 
-    iter.end_key = std::string(end_key, end_key_size);
+    iter.end_key.assign(end_key, end_key_size);
     iter.end_key_inclusive = end_key_inclusive;
 
     if (iter.end_key == OPEN_BOUNDARY_STR && iter.end_key_inclusive == false) {
@@ -1085,9 +2407,36 @@ int RadixTree::scan(Iter &iter, char *key, size_t &key_size, TagGptr &val,
     return -1; // key not found
 }
 
+// whether the nodes iter holds on to are all still in the tree; they cannot be
+// freed under us after that, as we are in an epoch op
+bool RadixTree::path_valid(Iter const &iter) {
+    if (iter.node != root &&
+        load64(replaced_count(iter.node)) != iter.replaced)
+        return false;
+    for (auto const &step : iter.path)
+        if (step.node != root &&
+            load64(replaced_count(step.node)) != step.replaced)
+            return false;
+    return true;
+}
+
 int RadixTree::get_next(Iter &iter, char *key, size_t &key_size, TagGptr &val) {
     // std::cout << ">>> get_next " << std::endl;
-    if (next_value(iter)) {
+    bool found;
+    if (iter.node != 0 && !path_valid(iter)) {
+        // nodes on the path were swung out of the tree (and may have been
+        // freed) since we were there, so we look for the first key after the
+        // current one again
+        iter.begin_key.swap(iter.key);
+        iter.key.clear();
+        iter.begin_key_inclusive = false;
+        iter.begin_key_open = false;
+        iter.path.clear();
+        found = lower_bound(iter);
+    } else {
+        found = next_value(iter);
+    }
+    if (found) {
         val = iter.value;
         key_size = (int)iter.key.size();
         memcpy(key, iter.key.data(), key_size);
@@ -1096,6 +2445,90 @@ int RadixTree::get_next(Iter &iter, char *key, size_t &key_size, TagGptr &val) {
     return -1; // key not found
 }
 
+int RadixTree::scan_batch(std::vector<std::string> &keys,
+                          std::vector<TagGptr> &values, size_t limit,
+                          const char *begin_key, const size_t begin_key_size,
+                          const bool begin_key_inclusive, const char *end_key,
+                          const size_t end_key_size,
+                          const bool end_key_inclusive) {
+    assert(limit > 0);
+    keys.clear();
+    values.clear();
+
+    Iter iter;
+    char key[MAX_KEY_LEN];
+    size_t key_size;
+    TagGptr val;
+    if (scan(iter, key, key_size, val, begin_key, begin_key_size,
+             begin_key_inclusive, end_key, end_key_size,
+             end_key_inclusive) != 0)
+        return -1; // key not found
+    keys.emplace_back(key, key_size);
+    values.push_back(val);
+
+    // we stay in the caller's epoch, so the nodes on iter.path cannot be freed
+    // under us and we can keep walking them
+    while (keys.size() < limit && next_value(iter)) {
+        keys.push_back(iter.key);
+        values.push_back(iter.value);
+    }
+    return 0;
+}
+
+void RadixTree::scan_split(std::vector<std::string> &bounds, size_t min_parts,
+                           const char *begin_key, const size_t begin_key_size,
+                           const bool begin_key_inclusive, const char *end_key,
+                           const size_t end_key_size,
+                           const bool end_key_inclusive) {
+    assert(begin_key_size > 0 && begin_key_size <= MAX_KEY_LEN);
+    assert(end_key_size > 0 && end_key_size <= MAX_KEY_LEN);
+    bounds.clear();
+
+    static const std::string OPEN_BOUNDARY_STR =
+        std::string((char const *)OPEN_BOUNDARY_KEY, OPEN_BOUNDARY_KEY_SIZE);
+    std::string const begin(begin_key, begin_key_size);
+    std::string const end(end_key, end_key_size);
+    bool const begin_open = begin == OPEN_BOUNDARY_STR && !begin_key_inclusive;
+    bool const end_open = end == OPEN_BOUNDARY_STR && !end_key_inclusive;
+
+    // every key in the subtree of a node is >= the node's prefix, so the
+    // prefixes of the nodes of one level, in order, split the key space
+    std::vector<Gptr> level;
+    Node *r = (Node *)toLocal(root);
+    unsigned int byte = 0;
+    for (Gptr q; (q = r->next_child(byte, byte)) != 0; byte++)
+        level.push_back(q);
+
+    std::vector<Gptr> split;
+    if (level.size() + 1 < min_parts) {
+        for (auto q : level) {
+            split.push_back(q);
+            Node *n = (Node *)toLocal(q);
+            if (n->is_leaf())
+                continue;
+            byte = 0;
+            for (Gptr c; (c = n->next_child(byte, byte)) != 0; byte++)
+                split.push_back(c);
+        }
+    } else {
+        split.swap(level);
+    }
+
+    for (auto q : split) {
+        Node *n = (Node *)toLocal(q);
+        std::string bound(n->prefix(), n->prefix_size);
+        // "\0" is the smallest key, and as an exclusive end key it would mean
+        // +inf, so it never splits anything
+        if (bound == OPEN_BOUNDARY_STR)
+            continue;
+        if (!begin_open && bound <= begin)
+            continue;
+        if (!end_open && bound >= end)
+            break;
+        bounds.push_back(bound);
+    }
+}
+
 /*
   for consistent DRAM caching
 */
@@ -1103,356 +2536,200 @@ std::pair<Gptr, TagGptr> RadixTree::putC(const char *key, const size_t key_size,
                                          Gptr value, TagGptr &old_value) {
     assert(key_size > 0 && key_size <= MAX_KEY_LEN);
 
-    Gptr *p = NULL;
-    Gptr q = root;
-
-    Gptr new_leaf_ptr = 0;
-    Gptr intermediate_node_ptr = 0;
-    Node *intermediate_node = nullptr;
-    size_t prefix_size = 0;
-    unsigned char existing = 0;
     for (;;) {
-        // Find current correct insertion point:
-        while (q != 0) {
-            Node *n = (Node *)toLocal(q);
-            assert(n);
-            size_t i, maxi = std::min(key_size, n->prefix_size);
-            for (i = 0; i < maxi; i++)
-                if (key[i] != n->key[i])
-                    break;
-
-#ifdef PMEM
-            fam_invalidate(&n->child, sizeof(n->child) + sizeof(n->value));
-#endif
-            if (i < n->prefix_size) {
-                // does not match the entire prefix, we have to do a split
-                prefix_size = i;
-                existing = (unsigned char)n->key[i];
-                break;
-                // will always go to case 2
-            } else {
-                // the key so far has matched the entire prefix
-                // assert(key_size >= n->prefix_size);
-                // assert(i==n->prefix_size);
-                if (key_size == i) {
-                    // UPDATE
-                    // match the entire prefix
-                    if (intermediate_node_ptr)
-                        heap->Free(intermediate_node_ptr);
-                    if (new_leaf_ptr)
-                        heap->Free(new_leaf_ptr);
-
-                    TagGptr *tp = &n->value;
-                    TagGptr tq;
-#ifdef PMEM
-                    tq = *tp;
-#else
-                    loadTagGptr(tp, tq);
-#endif
-                    for (;;) {
-                        TagGptr new_value = TagGptr(value, tq.tag() + 1);
-                        TagGptr seen_tq = casTagGptr(tp, tq, new_value);
-                        if (seen_tq == tq) {
-                            old_value = tq;
-                            return std::make_pair(q, new_value);
-                        }
-                        tq = seen_tq;
-                    }
-                } else {
-                    // the key is longer
-                    p = &n->child[(unsigned char)key[i]];
-#ifdef PMEM
-                    q = *p;
-#else
-                    q = fam_atomic_u64_read((uint64_t *)p);
-#endif
-                    // will always go to case 1 if q==0
-                }
-            }
-        }
-
-        // INSERT
-        // case 1:
-        // no split but need to insert a new leaf node:
-        if (q == 0) {
-            if (new_leaf_ptr == 0) {
-                int cnt = alloc_retry_cnt;
-                while (new_leaf_ptr == 0 && (cnt--) > 0)
-                    new_leaf_ptr = heap->Alloc(sizeof(Node));
-                if (!new_leaf_ptr.IsValid()) {
-                    size_t size = heap->Size();
-                    nvmm::ErrorCode ret = heap->Resize(2 * size);
-                    assert(ret == nvmm::NO_ERROR);
-                    new_leaf_ptr = heap->Alloc(sizeof(Node));
-                    assert(new_leaf_ptr.IsValid());
-                }
-                Node *new_leaf = (Node *)toLocal(new_leaf_ptr);
-                assert(new_leaf);
-                memcpy(new_leaf->key, key, key_size);
-                new_leaf->prefix_size = key_size;
-                new_leaf->value = TagGptr(value, 0);
-                fam_persist(new_leaf, sizeof(Node));
-            }
-
-            Gptr seen_q = cas64(p, q, new_leaf_ptr);
-            if (seen_q == q) {
-                if (intermediate_node_ptr)
-                    heap->Free(intermediate_node_ptr);
-                old_value = TagGptr();
-                TagGptr new_value = TagGptr(value, 0);
-                return std::make_pair(new_leaf_ptr, new_value);
-            }
-            q = seen_q;
-            continue;
+        bool created;
+        TagGptr first;
+        Gptr q = find_or_create_leaf(key, key_size, value, created, first);
+        if (created) {
+            // INSERT
+            old_value = TagGptr();
+            return std::make_pair(q, first);
         }
 
-        // case 2:
-        // split
-        if (intermediate_node_ptr == 0) {
-            int cnt = alloc_retry_cnt;
-            while (intermediate_node_ptr == 0 && (cnt--) > 0)
-                intermediate_node_ptr = heap->Alloc(sizeof(Node));
-            if (!intermediate_node_ptr.IsValid()) {
-                size_t size = heap->Size();
-                nvmm::ErrorCode ret = heap->Resize(2 * size);
-                assert(ret == nvmm::NO_ERROR);
-                intermediate_node_ptr = heap->Alloc(sizeof(Node));
-                assert(intermediate_node_ptr.IsValid());
-            }
-            intermediate_node = (Node *)toLocal(intermediate_node_ptr);
-            assert(intermediate_node);
-            // we don't just copy the current common prefix because the prefix
-            // at this node may
-            // change when the final pointer swing fails
-            // so it is easier to just copy the entire key and update the
-            // prefix_size later
-            memcpy(intermediate_node->key, key, key_size);
-            for (int i = 0; i < 256; i++)
-                intermediate_node->child[i] = 0;
-        }
-
-        // where do we store this value?
-        if (prefix_size == key_size) {
-            // no extra node needed
-            intermediate_node->value = TagGptr(value, 0);
-
-            // link q
-            intermediate_node->prefix_size = prefix_size;
-            intermediate_node->child[existing] = q;
-            fam_persist(intermediate_node, sizeof(Node));
-
-            Gptr seen_q = cas64(p, q, intermediate_node_ptr);
-            if (seen_q == q) {
-                if (new_leaf_ptr)
-                    heap->Free(new_leaf_ptr);
-                old_value = TagGptr();
-                TagGptr new_value = TagGptr(value, 0);
-                return std::make_pair(intermediate_node_ptr, new_value);
-            }
-            q = seen_q;
-        } else {
-            // need a new leaf node
-            if (new_leaf_ptr == 0) {
-                int cnt = alloc_retry_cnt;
-                while (new_leaf_ptr == 0 && (cnt--) > 0)
-                    new_leaf_ptr = heap->Alloc(sizeof(Node));
-                if (!new_leaf_ptr.IsValid()) {
-                    size_t size = heap->Size();
-                    nvmm::ErrorCode ret = heap->Resize(2 * size);
-                    assert(ret == nvmm::NO_ERROR);
-                    new_leaf_ptr = heap->Alloc(sizeof(Node));
-                    assert(new_leaf_ptr.IsValid());
-                }
-                Node *new_leaf = (Node *)toLocal(new_leaf_ptr);
-                assert(new_leaf);
-                memcpy(new_leaf->key, key, key_size);
-                new_leaf->prefix_size = key_size;
-                new_leaf->value = TagGptr(value, 0);
-                fam_persist(new_leaf, sizeof(Node));
-            }
-            intermediate_node->child[(unsigned char)key[prefix_size]] =
-                new_leaf_ptr;
-
-            // link q
-            intermediate_node->prefix_size = prefix_size;
-            intermediate_node->child[existing] = q;
-            fam_persist(intermediate_node, sizeof(Node));
-
-            Gptr seen_q = cas64(p, q, intermediate_node_ptr);
-            if (seen_q == q) {
-                old_value = TagGptr();
-                TagGptr new_value = TagGptr(value, 0);
-                return std::make_pair(new_leaf_ptr, new_value);
-            }
-            q = seen_q;
-        }
+        // UPDATE, unless the leaf was pruned under us
+        TagGptr new_value = update_value(q, value, old_value);
+        if (!is_pruned(new_value))
+            return std::make_pair(q, new_value);
     }
 }
 
 TagGptr RadixTree::putC(Gptr const key_ptr, Gptr value, TagGptr &old_value) {
-    Gptr q = key_ptr;
-    assert(q != 0);
-    Node *n = (Node *)toLocal(q);
-    assert(n);
-
-#ifdef PMEM
-    fam_invalidate(&n->value, sizeof(n->value));
-#endif
-
-    TagGptr *tp = &n->value;
-    TagGptr tq;
-#ifdef PMEM
-    tq = *tp;
-#else
-    loadTagGptr(tp, tq);
-#endif
-    for (;;) {
-        TagGptr new_value = TagGptr(value, tq.tag() + 1);
-        TagGptr seen_tq = casTagGptr(tp, tq, new_value);
-        if (seen_tq == tq) {
-            old_value = tq;
-            return new_value;
-        }
-        tq = seen_tq;
-    }
+    assert(key_ptr != 0);
+    return update_value(key_ptr, value, old_value);
 }
 
 std::pair<Gptr, TagGptr> RadixTree::getC(const char *key,
                                          const size_t key_size) {
     assert(key_size > 0 && key_size <= MAX_KEY_LEN);
-    Gptr *p = NULL;
-    Gptr q = root;
-
-    while (q != 0) {
-        Node *n = (Node *)toLocal(q);
-        assert(n);
 
-        int result =
-            fam_memcmp(key, n->key, std::min(n->prefix_size, key_size));
-        if (result != 0)
-            return std::make_pair(Gptr(), TagGptr());
-
-#ifdef PMEM
-        fam_invalidate(&n->child, sizeof(n->child) + sizeof(n->value));
-#endif
+    Gptr q = find_leaf(key, key_size);
+    TagGptr value = q != 0 ? getC(q) : TagGptr();
+    if (q == 0 || is_pruned(value))
+        return std::make_pair(Gptr(), TagGptr());
+    return std::make_pair(q, value);
+}
 
-        if (n->prefix_size == key_size) {
-            TagGptr *tp = &n->value;
-            TagGptr tq;
-#ifdef PMEM
-            tq = *tp;
-#else
-            loadTagGptr(tp, tq);
-#endif
-            return std::make_pair(q, tq);
-        }
+std::pair<Gptr, TagGptr> RadixTree::getC(const char *key,
+                                         const size_t key_size,
+                                         KeyMiss &miss) {
+    assert(key_size > 0 && key_size <= MAX_KEY_LEN);
 
-        // assert(n->prefix_size<key_size);
-        p = &n->child[(unsigned char)key[std::min(n->prefix_size, key_size)]];
-#ifdef PMEM
-        q = *p;
-#else
-        q = fam_atomic_u64_read((uint64_t *)p);
-#endif
-    }
+    miss = KeyMiss();
+    Gptr q = find_leaf(key, key_size, miss);
+    TagGptr value = q != 0 ? getC(q) : TagGptr();
+    if (q == 0 || is_pruned(value))
+        return std::make_pair(Gptr(), TagGptr()); // a pruned leaf leaves a null miss
+    return std::make_pair(q, value);
+}
 
-    return std::make_pair(Gptr(), TagGptr());
+// an insert of the key of a miss would have changed its word, either in place or,
+// if the node was being replaced, in the copy; a replacement freezes the node
+// (marks its leaf slot) before the copy is linked, and counts the node before it
+// is retired, so:
+// - if the node's replacement count is unchanged since the lookup, the node is
+// still in the tree and, as we are in an epoch, cannot be reused under us
+// - if then the word is unchanged and the node is not frozen, there has been no
+// insert
+bool RadixTree::absent(KeyMiss const &miss) {
+    if (miss.node == 0 || load64(replaced_count(miss.node)) != miss.replaced)
+        return false;
+    Node *n = (Node *)toLocal(miss.node);
+    assert(n);
+    if (load64((uint64_t *)((char *)n + miss.offset)) != miss.word)
+        return false;
+    return !is_marked(loadGptr(n->leaf_slot()));
 }
 
 TagGptr RadixTree::getC(Gptr const key_ptr) {
     Gptr q = key_ptr;
     assert(q != 0);
-    Node *n = (Node *)toLocal(q);
+    Leaf *n = (Leaf *)toLocal(q);
     assert(n);
-
-#ifdef PMEM
-    fam_invalidate(&n->value, sizeof(n->value));
-#endif
-
-    TagGptr *tp = &n->value;
-    TagGptr tq;
-#ifdef PMEM
-    tq = *tp;
-#else
-    loadTagGptr(tp, tq);
-#endif
-    return tq;
+    return readTagGptr(&n->value);
 }
 
 std::pair<Gptr, TagGptr> RadixTree::destroyC(const char *key,
                                              const size_t key_size,
                                              TagGptr &old_value) {
     assert(key_size > 0 && key_size <= MAX_KEY_LEN);
-    Gptr *p = NULL;
-    Gptr q = root;
 
-    while (q != 0) {
-        Node *n = (Node *)toLocal(q);
-        assert(n);
+    Gptr q = find_leaf(key, key_size);
+    if (q == 0)
+        return std::make_pair(Gptr(), TagGptr());
+    TagGptr new_value = update_value(q, 0, old_value);
+    if (is_pruned(new_value))
+        return std::make_pair(Gptr(), TagGptr());
+    return std::make_pair(q, new_value);
+}
 
-        int result =
-            fam_memcmp(key, n->key, std::min(n->prefix_size, key_size));
-        if (result != 0)
-            return std::make_pair(Gptr(), TagGptr());
+TagGptr RadixTree::destroyC(Gptr const key_ptr, TagGptr &old_value) {
+    assert(key_ptr != 0);
+    return update_value(key_ptr, 0, old_value);
+}
 
-#ifdef PMEM
-        fam_invalidate(&n->child, sizeof(n->child) + sizeof(n->value));
-#endif
-        if (n->prefix_size == key_size) {
-            TagGptr *tp = &n->value;
-            TagGptr tq;
-#ifdef PMEM
-            tq = *tp;
-#else
-            loadTagGptr(tp, tq);
-#endif
-            for (;;) {
-                TagGptr new_value = TagGptr(0, tq.tag() + 1);
-                TagGptr seen_tq = casTagGptr(tp, tq, new_value);
-                if (seen_tq == tq) {
-                    old_value = tq;
-                    return std::make_pair(q, new_value);
-                }
-                tq = seen_tq;
-            }
+/*
+  compaction
+
+  A pass prunes the leaves of keys that were deleted before it began (the
+  versions of leaves created since start at the pass, see first_value()), so
+  that a key that is inserted again after its leaf is pruned still gets a
+  higher version than before.
+
+  The key generation counts the passes begun and the passes running; a leaf
+  can only be pruned by a pass that begins after a key ptr to it was taken, or
+  that was running at the time, so a key ptr is safe to use while the generation
+  it was taken in is unchanged and no pass is running (key_ptr_valid()). Passes
+  do not keep each other out; a pass that dies half way leaves the generation
+  running, which only turns down key ptrs.
+*/
+size_t RadixTree::compact() {
+    uint64_t gen = fam_atomic_u64_fetch_and_add(
+                       key_gen_word(), (1ULL << RUNNING_BITS) + 1) +
+                   (1ULL << RUNNING_BITS) + 1;
+    uint64_t before = (gen >> RUNNING_BITS) << VERSION_BITS;
+    size_t pruned = compact(NULL, root, before);
+    fam_atomic_u64_fetch_and_add(key_gen_word(), (uint64_t)-1);
+    return pruned;
+}
+
+// the pass of compact() over the subtree of q, which is linked from slot p (the
+// root has none); returns the number of leaves pruned
+size_t RadixTree::compact(Gptr *p, Gptr q, uint64_t before) {
+    Node *n = (Node *)toLocal(q);
+    assert(n);
+    if (n->is_leaf()) {
+        Leaf *leaf = static_cast<Leaf *>(n);
+        TagGptr tq = readTagGptr(&leaf->value);
+        while (!is_pruned(tq)) {
+            if (tq.IsValid() || tq.tag() >= before)
+                return 0;
+            TagGptr seen_tq =
+                casTagGptr(&leaf->value, tq, TagGptr(Gptr(0), tq.tag() | PRUNED));
+            if (seen_tq == tq)
+                break;
+            tq = seen_tq;
         }
-        p = &n->child[(unsigned char)key[std::min(n->prefix_size, key_size)]];
-#ifdef PMEM
-        q = *p;
-#else
-        q = fam_atomic_u64_read((uint64_t *)p);
-#endif
+        return unlink_leaf(p, q) ? 1 : 0;
     }
 
-    return std::make_pair(Gptr(), TagGptr());
+    size_t pruned = 0;
+    Gptr child = loadGptr(n->leaf_slot());
+    if (child != 0 && !is_marked(child))
+        pruned += compact(n->leaf_slot(), child, before);
+    unsigned int byte = 0;
+    while (n->next_child(byte, byte) != 0) {
+        Gptr *slot = n->find_child((unsigned char)byte);
+        child = loadGptr(slot);
+        if (child != 0 && !is_marked(child))
+            pruned += compact(slot, child, before);
+        byte++;
+    }
+    if (q != root)
+        shrink(p, q);
+    return pruned;
 }
 
-TagGptr RadixTree::destroyC(Gptr const key_ptr, TagGptr &old_value) {
-    Gptr q = key_ptr;
-    assert(q != 0);
+// an inner node left with a single child (or none) is swung out of the tree, as
+// every node holds its whole prefix and the child can take its place; one left
+// with fewer children than its type is for is replaced by a smaller one
+void RadixTree::shrink(Gptr *p, Gptr q) {
     Node *n = (Node *)toLocal(q);
     assert(n);
-
-#ifdef PMEM
-    fam_invalidate(&n->value, sizeof(n->value));
-#endif
-
-    TagGptr *tp = &n->value;
-    TagGptr tq;
-#ifdef PMEM
-    tq = *tp;
-#else
-    loadTagGptr(tp, tq);
-#endif
+    bool frozen = false;
     for (;;) {
-        TagGptr new_value = TagGptr(0, tq.tag() + 1);
-        TagGptr seen_tq = casTagGptr(tp, tq, new_value);
-        if (seen_tq == tq) {
-            old_value = tq;
-            return new_value;
+        size_t cnt = 0;
+        unsigned int byte = 0;
+        for (; n->next_child(byte, byte) != 0; byte++)
+            cnt++;
+        if (cnt + (unmark(loadGptr(n->leaf_slot())) != 0) > 1) {
+            // (a frozen node has to be replaced in any case)
+            if (frozen || fit_type(cnt) < n->type)
+                replace(p, q);
+            return;
         }
-        tq = seen_tq;
+        if (frozen)
+            break;
+        // a frozen node cannot change, so we count again
+        n->freeze();
+        frozen = true;
     }
+
+    Gptr only = unmark(loadGptr(n->leaf_slot()));
+    unsigned int byte = 0;
+    if (only == 0)
+        only = n->next_child(0, byte);
+    if (cas64(p, q, only) == q)
+        retire(q);
 }
 
+uint64_t RadixTree::key_gen() { return load64(key_gen_word()); }
+
+bool RadixTree::key_ptr_valid(uint64_t key_gen) {
+    uint64_t gen = load64(key_gen_word());
+    return gen == key_gen &&
+           (gen & ((1ULL << RUNNING_BITS) - 1)) == 0;
+}
+
+bool RadixTree::pruned(TagGptr value) { return is_pruned(value); }
+
 } // end namespace bold
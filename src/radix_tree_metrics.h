@@ -47,11 +47,17 @@ public:
     int Init()
     {
         pointer_traversal_ = &registry_.NewHistogram({"kvs", "radixtree", "pointer_traversal"});
+        // lookups that found their key through the DRAM mirror of the upper levels, and those
+        // that had to walk from the root (see RadixTree::set_mirror())
+        mirror_hit_ = &registry_.NewCounter({"kvs", "radixtree", "mirror_hit"});
+        mirror_miss_ = &registry_.NewCounter({"kvs", "radixtree", "mirror_miss"});
         return 0;
     }
 
 public:
     medida::Histogram* pointer_traversal_;
+    medida::Counter* mirror_hit_;
+    medida::Counter* mirror_miss_;
 };
 
 #else // METRICS
@@ -0,0 +1,210 @@
+/*
+ *  (c) Copyright 2016-2021 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This software is available to you under a choice of one of two
+ *  licenses. You may choose to be licensed under the terms of the
+ *  GNU Lesser General Public License Version 3, or (at your option)
+ *  later with exceptions included below, or under the terms of the
+ *  MIT license (Expat) available in COPYING file in the source tree.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+
+#include <assert.h>
+#include <algorithm> // min
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "nvmm/global_ptr.h"
+#include "nvmm/heap.h"
+#include "nvmm/epoch_manager.h"
+
+#include "slab_heap.h"
+
+namespace radixtree {
+
+using Gptr = nvmm::GlobalPtr;
+
+SlabHeap::SlabHeap(nvmm::Heap *heap, nvmm::EpochManager *emgr)
+    : heap_(heap), emgr_(emgr), min_size_(heap->MinAllocSize()) {
+    assert(heap_ != NULL);
+    assert(emgr_ != NULL);
+}
+
+SlabHeap::~SlabHeap() {
+    nvmm::EpochOp op(emgr_);
+    for (size_t i = 0; i < kThreadCaches; i++) {
+        Cache &c = caches_[i];
+        for (size_t cls = 0; cls < kClasses; cls++)
+            for (Gptr ptr : c.free[cls])
+                heap_->Free(ptr);
+        for (Retired const &r : c.retired)
+            heap_->Free(op, r.ptr);
+    }
+    for (size_t cls = 0; cls < kClasses; cls++)
+        for (Gptr ptr : depots_[cls].free)
+            heap_->Free(ptr);
+}
+
+Gptr SlabHeap::Alloc(size_t size) {
+    size_t cls = size_class(size);
+    if (cls == kClasses)
+        return heap_alloc(size);
+
+    Cache &c = my_cache();
+    std::lock_guard<std::mutex> lock(c.mutex);
+    std::vector<Gptr> &free = c.free[cls];
+    if (free.empty())
+        refill(c, cls);
+    if (free.empty())
+        return Gptr();
+    Gptr ptr = free.back();
+    free.pop_back();
+    return ptr;
+}
+
+void SlabHeap::Free(Gptr ptr, size_t size) {
+    size_t cls = size_class(size);
+    if (cls == kClasses) {
+        heap_->Free(ptr);
+        return;
+    }
+
+    Cache &c = my_cache();
+    std::lock_guard<std::mutex> lock(c.mutex);
+    c.free[cls].push_back(ptr);
+    if (c.free[cls].size() > kCacheCap)
+        drain(c, cls);
+}
+
+void SlabHeap::Free(nvmm::EpochOp &op, Gptr ptr, size_t size) {
+    size_t cls = size_class(size);
+    if (cls == kClasses) {
+        heap_->Free(op, ptr);
+        return;
+    }
+
+    Cache &c = my_cache();
+    std::lock_guard<std::mutex> lock(c.mutex);
+    c.retired.push_back(Retired{op.reported_epoch(), cls, ptr});
+    if (c.retired.size() % kBatch == 0)
+        reclaim(c);
+    // an epoch that does not move on must not hold on to more and more blocks; the heap frees
+    // them as late as it would have freed them in the first place
+    while (c.retired.size() > kRetiredCap) {
+        heap_->Free(op, c.retired.front().ptr);
+        c.retired.pop_front();
+    }
+}
+
+size_t SlabHeap::size_class(size_t size) {
+    size_t cls = 0;
+    while (cls < kClasses && (min_size_ << cls) < size)
+        cls++;
+    return cls;
+}
+
+SlabHeap::Cache &SlabHeap::my_cache() {
+    static std::atomic<size_t> next_slot(0);
+    static thread_local size_t const slot = next_slot++ % kThreadCaches;
+    return caches_[slot];
+}
+
+Gptr SlabHeap::heap_alloc(size_t size) {
+    Gptr ptr = 0;
+    int cnt = alloc_retry_cnt;
+    while (ptr == 0 && (cnt--) > 0)
+        ptr = heap_->Alloc(size);
+    if (!ptr.IsValid()) {
+        size_t heap_size = heap_->Size();
+        nvmm::ErrorCode ret = heap_->Resize(2 * heap_size);
+        if (ret != nvmm::NO_ERROR)
+            return Gptr();
+        ptr = heap_->Alloc(size);
+    }
+    return ptr;
+}
+
+void SlabHeap::refill(Cache &c, size_t cls) {
+    reclaim(c);
+    std::vector<Gptr> &free = c.free[cls];
+    if (!free.empty())
+        return;
+
+    {
+        Depot &d = depots_[cls];
+        std::lock_guard<std::mutex> lock(d.mutex);
+        size_t n = std::min(kBatch, d.free.size());
+        free.insert(free.end(), d.free.end() - n, d.free.end());
+        d.free.resize(d.free.size() - n);
+    }
+    if (!free.empty())
+        return;
+
+    // only the first block is worth growing the heap for
+    Gptr ptr = heap_alloc(min_size_ << cls);
+    if (!ptr.IsValid())
+        return;
+    free.push_back(ptr);
+    for (size_t i = 1; i < kBatch; i++) {
+        ptr = heap_->Alloc(min_size_ << cls);
+        if (!ptr.IsValid())
+            break;
+        free.push_back(ptr);
+    }
+}
+
+// hands the oldest kBatch free blocks of a class over to the depot, or to the heap once the
+// depot is full
+void SlabHeap::drain(Cache &c, size_t cls) {
+    std::vector<Gptr> &free = c.free[cls];
+    size_t n = std::min(kBatch, free.size());
+    std::vector<Gptr> excess;
+    {
+        Depot &d = depots_[cls];
+        std::lock_guard<std::mutex> lock(d.mutex);
+        for (size_t i = 0; i < n; i++) {
+            if (d.free.size() < kDepotCap)
+                d.free.push_back(free[i]);
+            else
+                excess.push_back(free[i]);
+        }
+    }
+    free.erase(free.begin(), free.begin() + n);
+    for (Gptr ptr : excess)
+        heap_->Free(ptr);
+}
+
+// a block retired in epoch e may still be read by ops that started in e or in the epoch after
+// it (the epoch an op reports lags the current one by at most one); once the frontier has moved
+// past e + 1, all of them have ended
+void SlabHeap::reclaim(Cache &c) {
+    if (c.retired.empty())
+        return;
+    nvmm::EpochCounter frontier = emgr_->frontier_epoch();
+    while (!c.retired.empty() && c.retired.front().epoch + 1 < frontier) {
+        Retired const &r = c.retired.front();
+        c.free[r.cls].push_back(r.ptr);
+        c.retired.pop_front();
+    }
+    for (size_t cls = 0; cls < kClasses; cls++)
+        while (c.free[cls].size() > kCacheCap)
+            drain(c, cls);
+}
+
+} // namespace radixtree
@@ -0,0 +1,119 @@
+/*
+ *  (c) Copyright 2016-2021 Hewlett Packard Enterprise Development Company LP.
+ *
+ *  This software is available to you under a choice of one of two
+ *  licenses. You may choose to be licensed under the terms of the
+ *  GNU Lesser General Public License Version 3, or (at your option)
+ *  later with exceptions included below, or under the terms of the
+ *  MIT license (Expat) available in COPYING file in the source tree.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  As an exception, the copyright holders of this Library grant you permission
+ *  to (i) compile an Application with the Library, and (ii) distribute the
+ *  Application containing code generated by the Library and added to the
+ *  Application during this compilation process under terms of your choice,
+ *  provided you also meet the terms and conditions of the Application license.
+ *
+ */
+
+
+#ifndef SLAB_HEAP_H
+#define SLAB_HEAP_H
+
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "nvmm/global_ptr.h"
+#include "nvmm/heap.h"
+#include "nvmm/epoch_manager.h"
+
+namespace radixtree {
+
+// per-thread caches of heap blocks in front of a shared nvmm::Heap, for the nodes of a radix
+// tree and the values of a KVS
+// - blocks come in size classes of MinAllocSize() << 0..kClasses-1, the sizes the heap itself
+// hands out; larger requests go straight to the heap
+// - each thread takes blocks from its own cache, which is refilled kBatch blocks at a time, from
+// the blocks other caches gave up (the depot) or else from the heap
+// - a block freed through an epoch op waits in the cache of the freeing thread until no op can
+// still read it; the caches check the epoch frontier once per kBatch such frees
+// every block is a heap block of its own, so any block can still be given back to the heap
+// directly, and the destructor gives back all cached blocks; the blocks cached when a process
+// dies are lost, as a block is that was allocated but not yet linked in
+class SlabHeap {
+public:
+    static size_t const kClasses = 7;
+    static size_t const kBatch = 32;
+    static size_t const kCacheCap = 4 * kBatch;    // free blocks per class in a thread cache
+    static size_t const kRetiredCap = 64 * kBatch; // blocks waiting for their epoch, per cache
+    static size_t const kDepotCap = 64 * kBatch;   // free blocks per class in the depot
+    static size_t const kThreadCaches = 64;        // threads beyond this share caches
+
+    SlabHeap(nvmm::Heap *heap, nvmm::EpochManager *emgr);
+    ~SlabHeap();
+
+    // a block of at least size bytes; null if the heap is full even after growing it
+    nvmm::GlobalPtr Alloc(size_t size);
+
+    // frees a block of size bytes that no one else has seen
+    void Free(nvmm::GlobalPtr ptr, size_t size);
+
+    // frees a block of size bytes that ops may still read; it is reused once they have ended
+    void Free(nvmm::EpochOp &op, nvmm::GlobalPtr ptr, size_t size);
+
+private:
+    // when under high contention, the heap may return 0 even if there is free space (false
+    // negative); our best option is to retry
+    static int const alloc_retry_cnt = 1000;
+
+    struct Retired {
+        nvmm::EpochCounter epoch;
+        size_t cls;
+        nvmm::GlobalPtr ptr;
+    };
+
+    struct Cache {
+        std::mutex mutex; // taken by its threads only, unless more than kThreadCaches allocate
+        std::vector<nvmm::GlobalPtr> free[kClasses];
+        std::deque<Retired> retired; // in the order of their epochs
+        char pad[64];                // no false sharing with the next cache
+    };
+
+    struct Depot {
+        std::mutex mutex;
+        std::vector<nvmm::GlobalPtr> free;
+    };
+
+    nvmm::Heap *heap_;
+    nvmm::EpochManager *emgr_;
+    size_t min_size_;
+
+    Cache caches_[kThreadCaches];
+    Depot depots_[kClasses];
+
+    // the size class of a block of size bytes; kClasses if there is none
+    size_t size_class(size_t size);
+    Cache &my_cache();
+    nvmm::GlobalPtr heap_alloc(size_t size);
+    // with the cache lock held
+    void refill(Cache &c, size_t cls);
+    void drain(Cache &c, size_t cls);
+    void reclaim(Cache &c);
+
+    SlabHeap(const SlabHeap&);              // disable copying
+    SlabHeap& operator=(const SlabHeap&);   // disable assignment
+};
+
+} // namespace radixtree
+
+#endif
@@ -29,6 +29,7 @@
  * TODO: Use byte arrays for keys hashed to a 64-bit code (using cityhash)
  */
 
+#include <cstddef> // offsetof
 #include <cstring>
 
 #include "nvmm/memory_manager.h"
@@ -44,24 +45,77 @@
 namespace radixtree {
 
 struct SplitOrderedList::Node {
-    SplitOrderedList::ByteKey byte_key;
-    size_t byte_key_size;
+    TagGptr next; // first, so that it stays 16-byte aligned for 128-bit atomics
     SplitOrderedList::SoKey key;
     SplitOrderedList::Value value;
-    TagGptr next;
+    uint32_t byte_key_size;
+    // followed by byte_key_size bytes of key; dummy nodes have none
+
+    // the key starts right after byte_key_size: nodes are allocated without
+    // the padding at the end of sizeof(Node)
+    static size_t key_offset() {
+        return offsetof(Node, byte_key_size) + sizeof(uint32_t);
+    }
+    static size_t size_of(size_t byte_key_size) {
+        return key_offset() + byte_key_size;
+    }
+    char* byte_key() {
+        return (char*)this + key_offset();
+    }
 };
 
+/*
+  Key tags
+
+  The tag of a next pointer holds an ABA counter in its low 48 bits and, in its
+  high 16 bits, the top 16 bits of the so key of the node it points to. A walk
+  down a list can then tell that the next node's key is larger than the one it
+  is looking for without reading the node. A key tag that is too small (e.g., 0)
+  only loses that shortcut, so pointers that are not (re)linked by ListInsert or
+  ListDelete need not carry one.
+*/
+static const uint64_t COUNT_MASK = ((uint64_t)1 << 48) - 1;
+
+static inline uint64_t key_tag(SplitOrderedList::SoKey key)
+{
+    return key >> 48;
+}
+
+static inline uint64_t key_tag(TagGptr ptr)
+{
+    return ptr.tag() >> 48;
+}
+
+// the tag that replaces old_tag in a pointer to a node with key tag ktag
+static inline TagGptr::Tag next_tag(TagGptr::Tag old_tag, uint64_t ktag)
+{
+    return ((old_tag + 1) & COUNT_MASK) | (ktag << 48);
+}
+
+/*
+  Bucket directory
+
+  The buckets live in segments of SEGMENT_BUCKETS that are allocated the first
+  time one of their buckets is used and never move, so growing the table copies
+  nothing (as in Shalev and Shavit's extensible hashing). The descriptor points
+  to directory blocks of DIR_SEGMENTS segment pointers each, also allocated on
+  first use. Every allocation is one block or one segment, however large the
+  table gets, and a new table only pays for one of each.
+*/
+static const uint64_t SEGMENT_BUCKETS = 1024;
+static const uint64_t DIR_SEGMENTS = 1024;
+static const size_t MAX_DIRS = 1024;
+static const uint64_t MAX_BUCKETS = SEGMENT_BUCKETS * DIR_SEGMENTS * MAX_DIRS;
+
 struct SplitOrderedList::Descriptor {
-    Gptr table;
     uint64_t count;
     uint64_t size;
+    Gptr dir[MAX_DIRS]; // 0: not allocated yet
 };
 
 
 typedef SplitOrderedList::SoKey so_key_t;
 
-const int hard_max_buckets = 1024*1024;
-
 #define MAX_LOAD     0.75
 
 #define MSB (((uint64_t)1) << 63)
@@ -177,7 +231,7 @@ Gptr SplitOrderedList::toGlobal(T* ptr) {
 SplitOrderedList::Value
 SplitOrderedList::ListFind (Eop& op, 
                       TagGptr *head_tgptr,
-                      const ByteKey& byte_key,
+                      const char *byte_key,
                       const size_t byte_key_size,
                       SoKey key,
                       TagGptr **oprev_tgptr,
@@ -198,14 +252,16 @@ SplitOrderedList::ListFind (Eop& op,
         pointer_traversals = 0;
         while (1) {
             Node* real_cur_tgptr = toLocal<Node>(cur_tgptr.gptr());
-            if (real_cur_tgptr == NULL) {
+            // the end of the list, or a node that the key tag in its pointer
+            // already shows to be past key
+            if (real_cur_tgptr == NULL || key_tag(cur_tgptr) > key_tag(key)) {
                 if (oprev_tgptr) { *oprev_tgptr = prev_tgptr; }
                 if (ocur_tgptr) { *ocur_tgptr = cur_tgptr; }
                 if (onext_tgptr) { *onext_tgptr = next_tgptr; }
                 return 0;
             }
 #ifdef PMEM
-            fam_invalidate(real_cur_tgptr, sizeof(Node));
+            fam_invalidate(real_cur_tgptr, Node::key_offset());
             next_tgptr = real_cur_tgptr->next;
             ckey = real_cur_tgptr->key;
             cval = real_cur_tgptr->value;
@@ -222,8 +278,9 @@ SplitOrderedList::ListFind (Eop& op,
                     if (ocur_tgptr) { *ocur_tgptr = cur_tgptr; }
                     if (onext_tgptr) { *onext_tgptr = next_tgptr; }
                     if (ckey == key) {
-                        fam_invalidate(real_cur_tgptr->byte_key, real_cur_tgptr->byte_key_size);
-                        if (memcmp(real_cur_tgptr->byte_key, byte_key, real_cur_tgptr->byte_key_size) == 0) {
+                        fam_invalidate(real_cur_tgptr->byte_key(), real_cur_tgptr->byte_key_size);
+                        if (real_cur_tgptr->byte_key_size == byte_key_size &&
+                            memcmp(real_cur_tgptr->byte_key(), byte_key, byte_key_size) == 0) {
 #ifndef PMEM
                             cval = atomic_load(&real_cur_tgptr->value);
 #endif
@@ -240,7 +297,7 @@ SplitOrderedList::ListFind (Eop& op,
             } else {
                 if (atomic_compare_and_swap(prev_tgptr, 
                                             TagGptr(0, cur_tgptr.gptr(), cur_tgptr.tag()), 
-                                            TagGptr(0, next_tgptr.gptr(), cur_tgptr.tag()+1)) ==
+                                            TagGptr(0, next_tgptr.gptr(), next_tag(cur_tgptr.tag(), key_tag(next_tgptr)))) ==
                     TagGptr(0, cur_tgptr.gptr(), cur_tgptr.tag())) 
                 {
                     heap_->Free(op, cur_tgptr.gptr()); 
@@ -267,15 +324,15 @@ int SplitOrderedList::ListInsert(Eop& op,
         TagGptr *lprev_tgptr;
         TagGptr cur_tgptr;
 
-        if (ListFind(op, head_tgptr, node->byte_key, node->byte_key_size, key, &lprev_tgptr, &cur_tgptr, NULL) != 0) {   
+        if (ListFind(op, head_tgptr, node->byte_key(), node->byte_key_size, key, &lprev_tgptr, &cur_tgptr, NULL) != 0) {   
             if (ocur_tgptr) { *ocur_tgptr = cur_tgptr; }
             return 0;
         }
         node = toLocal<Node>(node_tgptr.gptr());
-        node->next = TagGptr(0, cur_tgptr.gptr(), 0);
+        node->next = TagGptr(0, cur_tgptr.gptr(), key_tag(cur_tgptr) << 48);
         if (atomic_compare_and_swap(lprev_tgptr, 
                                     TagGptr(0, cur_tgptr.gptr(), cur_tgptr.tag()), 
-                                    TagGptr(0, node_tgptr.gptr(), cur_tgptr.tag()+1)) == 
+                                    TagGptr(0, node_tgptr.gptr(), next_tag(cur_tgptr.tag(), key_tag(key)))) == 
             TagGptr(0, cur_tgptr.gptr(), cur_tgptr.tag())) 
         {
             if (ocur_tgptr) { *ocur_tgptr = cur_tgptr; }
@@ -284,7 +341,7 @@ int SplitOrderedList::ListInsert(Eop& op,
     }
 }
 
-int SplitOrderedList::ListDelete(Eop& op, TagGptr *head_tgptr, const ByteKey& byte_key, const size_t byte_key_size, SoKey sokey, TagGptr* ocur_tgptr)
+int SplitOrderedList::ListDelete(Eop& op, TagGptr *head_tgptr, const char *byte_key, const size_t byte_key_size, SoKey sokey, TagGptr* ocur_tgptr)
 {
     while (1) {
         TagGptr *lprev_tgptr;
@@ -294,14 +351,14 @@ int SplitOrderedList::ListDelete(Eop& op, TagGptr *head_tgptr, const ByteKey& by
         if (ListFind(op, head_tgptr, byte_key, byte_key_size, sokey, &lprev_tgptr, &lcur_tgptr, &lnext_tgptr) == 0) { return 0; }
         if (atomic_compare_and_swap(&toLocal<Node>(lcur_tgptr.gptr())->next, 
                                     TagGptr(0, lnext_tgptr.gptr(), lnext_tgptr.tag()), 
-                                    TagGptr(1, lnext_tgptr.gptr(), lnext_tgptr.tag()+1)) != 
+                                    TagGptr(1, lnext_tgptr.gptr(), next_tag(lnext_tgptr.tag(), key_tag(lnext_tgptr)))) != 
             TagGptr(0, lnext_tgptr.gptr(), lnext_tgptr.tag())) 
         { 
             continue; 
         }
         if (atomic_compare_and_swap(lprev_tgptr, 
                                     TagGptr(0, lcur_tgptr.gptr(), lcur_tgptr.tag()), 
-                                    TagGptr(0, lnext_tgptr.gptr(), lcur_tgptr.tag()+1)) == 
+                                    TagGptr(0, lnext_tgptr.gptr(), next_tag(lcur_tgptr.tag(), key_tag(lnext_tgptr)))) == 
             TagGptr(0, lcur_tgptr.gptr(), lcur_tgptr.tag())) 
         {
             if (ocur_tgptr) {
@@ -317,33 +374,94 @@ int SplitOrderedList::ListDelete(Eop& op, TagGptr *head_tgptr, const ByteKey& by
 }
 
 
-void
+int
 SplitOrderedList::InitializeBucket (Eop& op, uint64_t bucket)
 {
     size_t parent = get_parent(bucket);
     TagGptr cur_tgptr;
 
-    TagGptr* table = toLocal<TagGptr>(descriptor_->table);
+    TagGptr* parent_head = BucketHead(parent);
+    TagGptr* head = BucketHead(bucket);
+    if (!parent_head || !head) {
+        return -1;
+    }
 
     TagGptr tmp_tgptr;
-    atomic_load(&table[parent], tmp_tgptr.i64);
+    atomic_load(parent_head, tmp_tgptr.i64);
     if (tmp_tgptr == TagGptr()) {
-        InitializeBucket(op, parent);
+        if (InitializeBucket(op, parent) != 0) {
+            return -1;
+        }
+    }
+    Gptr dummy_gptr = heap_->Alloc(Node::size_of(0)); 
+    if (!dummy_gptr.IsValid()) {
+        return -1;
     }
-    Gptr dummy_gptr = heap_->Alloc(sizeof(Node)); 
     Node* dummy = toLocal<Node>(dummy_gptr);
-    assert(dummy);
     dummy->byte_key_size = 0;
     dummy->key   = so_dummykey(bucket);
     dummy->value = 0;
     dummy->next  = TagGptr();
-    fam_persist(dummy, sizeof(Node));
+    fam_persist(dummy, Node::size_of(0));
     TagGptr dummy_tgptr(0, dummy_gptr, 0);
-    if (!ListInsert(op, &(table[parent]), dummy_tgptr, &cur_tgptr)) {
+    if (!ListInsert(op, parent_head, dummy_tgptr, &cur_tgptr)) {
         heap_->Free(op, dummy_gptr);
         dummy_tgptr = cur_tgptr;
     }
-    atomic_store(&table[bucket], TagGptr(0, dummy_tgptr.gptr(), dummy_tgptr.tag()).i64);
+    atomic_store(head, TagGptr(0, dummy_tgptr.gptr(), dummy_tgptr.tag()).i64);
+    return 0;
+}
+
+TagGptr*
+SplitOrderedList::InitializedBucketHead (Eop& op, uint64_t bucket)
+{
+    TagGptr* head = BucketHead(bucket);
+    if (head && *head == TagGptr()) {
+        if (InitializeBucket(op, bucket) != 0) {
+            return NULL;
+        }
+    }
+    return head;
+}
+
+Gptr
+SplitOrderedList::InstallBlock (Gptr* slot, size_t size)
+{
+    Gptr gptr = atomic_load(slot);
+    if (gptr != 0) {
+        return gptr;
+    }
+    // the first use of this block; whoever installs their copy first wins, and
+    // the others give theirs back
+    Gptr new_gptr = heap_->Alloc(size);
+    if (!new_gptr.IsValid()) {
+        return Gptr(0);
+    }
+    void* block = toLocal<void>(new_gptr);
+    memset(block, 0, size);
+    fam_persist(block, size);
+    gptr = atomic_compare_and_swap(slot, Gptr(0), new_gptr);
+    if (gptr != 0) {
+        heap_->Free(new_gptr); // never published
+        return gptr;
+    }
+    return new_gptr;
+}
+
+TagGptr*
+SplitOrderedList::BucketHead (uint64_t bucket)
+{
+    assert(bucket < MAX_BUCKETS);
+    uint64_t seg = bucket / SEGMENT_BUCKETS;
+    Gptr dir_gptr = InstallBlock(&descriptor_->dir[seg / DIR_SEGMENTS], DIR_SEGMENTS * sizeof(Gptr));
+    if (dir_gptr == 0) {
+        return NULL;
+    }
+    Gptr seg_gptr = InstallBlock(toLocal<Gptr>(dir_gptr) + seg % DIR_SEGMENTS, SEGMENT_BUCKETS * sizeof(TagGptr));
+    if (seg_gptr == 0) {
+        return NULL;
+    }
+    return toLocal<TagGptr>(seg_gptr) + bucket % SEGMENT_BUCKETS;
 }
 
 
@@ -358,15 +476,21 @@ SplitOrderedList::SplitOrderedList(Mmgr *mmgr, Heap *heap, SplitOrderedMetrics*
         descriptor_ = toLocal<Descriptor>(descriptor_ptr_);
         descriptor_->count = 0;
         descriptor_->size = 2;
-        descriptor_->table = heap_->Alloc(hard_max_buckets * sizeof(TagGptr));
+        for (size_t i = 0; i < MAX_DIRS; i++)
+            descriptor_->dir[i] = 0;
         fam_persist(descriptor_, sizeof(*descriptor_));
- 
-        TagGptr* table = toLocal<TagGptr>(descriptor_->table);
+
+        TagGptr* head = BucketHead(0);
+        assert(head);
     
-        Gptr dummy_ptr = heap_->Alloc(sizeof(Node)); 
+        Gptr dummy_ptr = heap_->Alloc(Node::size_of(0)); 
         Node* dummy = toLocal<Node>(dummy_ptr);
+        dummy->byte_key_size = 0;
         dummy->key = so_dummykey(0);
-        atomic_store(&table[0], TagGptr(0, dummy_ptr, 0).i64);
+        dummy->value = 0;
+        dummy->next = TagGptr();
+        fam_persist(dummy, Node::size_of(0));
+        atomic_store(head, TagGptr(0, dummy_ptr, 0).i64);
     } else {
         descriptor_ = toLocal<Descriptor>(descriptor_ptr_);
     }
@@ -378,31 +502,34 @@ Gptr SplitOrderedList::get_descriptor() {
     return descriptor_ptr_;
 }
 
-int SplitOrderedList::FindOrInsert(Eop& op, const ByteKey& byte_key, const size_t byte_key_size, SplitOrderedList::Value& value)
+int SplitOrderedList::FindOrInsert(Eop& op, const char *byte_key, const size_t byte_key_size, SplitOrderedList::Value& value)
 {
-    Gptr node_gptr = heap_->Alloc(sizeof(Node));
+    Gptr node_gptr = heap_->Alloc(Node::size_of(byte_key_size));
+    if (!node_gptr.IsValid()) {
+        return -1;
+    }
     Node* node = toLocal<Node>(node_gptr);
     size_t bucket;
     uint64_t lkey = Hash64(byte_key, byte_key_size);
 
     bucket = lkey % descriptor_->size;
 
-    assert(node);
     assert((lkey & MSB) == 0);
-    memcpy(node->byte_key, byte_key, byte_key_size);
-    node->byte_key_size = byte_key_size;
+    memcpy(node->byte_key(), byte_key, byte_key_size);
+    node->byte_key_size = (uint32_t)byte_key_size;
     node->key  = so_regularkey(lkey);
     node->value = value;
     node->next  = TagGptr();
-    fam_persist(node, sizeof(*node));
+    fam_persist(node, Node::size_of(byte_key_size));
 
-    TagGptr* table = toLocal<TagGptr>(descriptor_->table);
-    if (table[bucket] == TagGptr()) {
-        InitializeBucket(op, bucket);
+    TagGptr* head = InitializedBucketHead(op, bucket);
+    if (!head) {
+        heap_->Free(node_gptr); // never published
+        return -1;
     }
     TagGptr cur_tgptr;
     TagGptr node_tgptr(0, node_gptr, 0);
-    if (!ListInsert(op, &(table[bucket]), node_tgptr, &cur_tgptr)) {
+    if (!ListInsert(op, head, node_tgptr, &cur_tgptr)) {
         Node* cur_node = toLocal<Node>(cur_tgptr.gptr());
         value = cur_node->value;
         heap_->Free(op, node_gptr);
@@ -410,43 +537,46 @@ int SplitOrderedList::FindOrInsert(Eop& op, const ByteKey& byte_key, const size_
     }
     size_t csize = descriptor_->size;
     if (static_cast<double>(atomic_fetch_and_add(&descriptor_->count, 1)) / static_cast<double>(csize) > MAX_LOAD) {
-        if (2 * csize <= hard_max_buckets) { // this caps the size of the hash
+        if (2 * csize <= MAX_BUCKETS) { // this caps the size of the hash
             atomic_compare_and_swap(&descriptor_->size, csize, 2 * csize);
         }
     }
     return 1;
 }
 
-int SplitOrderedList::Insert(Eop& op, const ByteKey& byte_key, const size_t byte_key_size, SplitOrderedList::Value value)
+int SplitOrderedList::Insert(Eop& op, const char *byte_key, const size_t byte_key_size, SplitOrderedList::Value value)
 {
-    Gptr node_gptr = heap_->Alloc(sizeof(Node));
+    Gptr node_gptr = heap_->Alloc(Node::size_of(byte_key_size));
+    if (!node_gptr.IsValid()) {
+        return -1;
+    }
     Node* node = toLocal<Node>(node_gptr);
     size_t bucket;
     uint64_t lkey = Hash64(byte_key, byte_key_size);
 
     bucket = lkey % descriptor_->size;
 
-    assert(node);
     assert((lkey & MSB) == 0);
-    memcpy(node->byte_key, byte_key, byte_key_size);
-    node->byte_key_size = byte_key_size;
+    memcpy(node->byte_key(), byte_key, byte_key_size);
+    node->byte_key_size = (uint32_t)byte_key_size;
     node->key  = so_regularkey(lkey);
     node->value = value;
     node->next  = TagGptr();
-    fam_persist(node, sizeof(*node));
+    fam_persist(node, Node::size_of(byte_key_size));
 
-    TagGptr* table = toLocal<TagGptr>(descriptor_->table);
-    if (table[bucket] == TagGptr()) {
-        InitializeBucket(op, bucket);
+    TagGptr* head = InitializedBucketHead(op, bucket);
+    if (!head) {
+        heap_->Free(node_gptr); // never published
+        return -1;
     }
     TagGptr node_tgptr(0, node_gptr, 0);
-    if (!ListInsert(op, &(table[bucket]), node_tgptr, NULL)) {
+    if (!ListInsert(op, head, node_tgptr, NULL)) {
         heap_->Free(op, node_gptr);
         return 0;
     }
     size_t csize = descriptor_->size;
     if (static_cast<double>(atomic_fetch_and_add(&descriptor_->count, 1)) / static_cast<double>(csize) > MAX_LOAD) {
-        if (2 * csize <= hard_max_buckets) { // this caps the size of the hash
+        if (2 * csize <= MAX_BUCKETS) { // this caps the size of the hash
             atomic_compare_and_swap(&descriptor_->size, csize, 2 * csize);
         }
     }
@@ -454,31 +584,34 @@ int SplitOrderedList::Insert(Eop& op, const ByteKey& byte_key, const size_t byte
 }
 
 
-int SplitOrderedList::InsertOrUpdate(Eop& op, const ByteKey& byte_key, const size_t byte_key_size, SplitOrderedList::Value value, Gptr* old_gptr)
+int SplitOrderedList::InsertOrUpdate(Eop& op, const char *byte_key, const size_t byte_key_size, SplitOrderedList::Value value, Gptr* old_gptr)
 {
-    Gptr node_gptr = heap_->Alloc(sizeof(Node));
+    Gptr node_gptr = heap_->Alloc(Node::size_of(byte_key_size));
+    if (!node_gptr.IsValid()) {
+        return -1;
+    }
     Node* node = toLocal<Node>(node_gptr);
     size_t bucket;
     uint64_t lkey = Hash64(byte_key, byte_key_size);
 
     bucket = lkey % descriptor_->size;
 
-    assert(node);
     assert((lkey & MSB) == 0);
-    memcpy(node->byte_key, byte_key, byte_key_size);
-    node->byte_key_size = byte_key_size;
+    memcpy(node->byte_key(), byte_key, byte_key_size);
+    node->byte_key_size = (uint32_t)byte_key_size;
     node->key  = so_regularkey(lkey);
     node->value = value;
     node->next  = TagGptr();
-    fam_persist(node, sizeof(*node));
+    fam_persist(node, Node::size_of(byte_key_size));
 
-    TagGptr* table = toLocal<TagGptr>(descriptor_->table);
-    if (table[bucket] == TagGptr()) {
-        InitializeBucket(op, bucket);
+    TagGptr* head = InitializedBucketHead(op, bucket);
+    if (!head) {
+        heap_->Free(node_gptr); // never published
+        return -1;
     }
     TagGptr cur_tgptr;
     TagGptr node_tgptr(0, node_gptr, 0);
-    if (!ListInsert(op, &(table[bucket]), node_tgptr, &cur_tgptr)) {
+    if (!ListInsert(op, head, node_tgptr, &cur_tgptr)) {
         *old_gptr = node_tgptr.gptr();
         Node* cur_node = toLocal<Node>(cur_tgptr.gptr());
         cur_node->value = value;
@@ -488,40 +621,43 @@ int SplitOrderedList::InsertOrUpdate(Eop& op, const ByteKey& byte_key, const siz
     }
     size_t csize = descriptor_->size;
     if (static_cast<double>(atomic_fetch_and_add(&descriptor_->count, 1)) / static_cast<double>(csize) > MAX_LOAD) {
-        if (2 * csize <= hard_max_buckets) { // this caps the size of the hash
+        if (2 * csize <= MAX_BUCKETS) { // this caps the size of the hash
             atomic_compare_and_swap(&descriptor_->size, csize, 2 * csize);
         }
     }
     return 1;
 }
 
-SplitOrderedList::Value SplitOrderedList::Find(Eop& op, const ByteKey& byte_key, const size_t byte_key_size)
+SplitOrderedList::Value SplitOrderedList::Find(Eop& op, const char *byte_key, const size_t byte_key_size)
 {
     size_t   bucket;
     uint64_t lkey = Hash64(byte_key, byte_key_size);
     
     bucket = lkey % descriptor_->size;
 
-    TagGptr* table = toLocal<TagGptr>(descriptor_->table);
-    if (table[bucket] == TagGptr()) {
-        InitializeBucket(op, bucket);
+    TagGptr* head = InitializedBucketHead(op, bucket);
+    while (!head) {
+        // out of memory for the bucket; its keys are also on the list of its
+        // parent, further down (bucket 0 is always there)
+        bucket = get_parent(bucket);
+        head = InitializedBucketHead(op, bucket);
     }
-    return ListFind(op, &(table[bucket]), byte_key, byte_key_size, so_regularkey(lkey), NULL, NULL, NULL);
+    return ListFind(op, head, byte_key, byte_key_size, so_regularkey(lkey), NULL, NULL, NULL);
 }
 
-int SplitOrderedList::Delete(Eop& op, const ByteKey& byte_key, const size_t byte_key_size, Gptr* ocur_ptr)
+int SplitOrderedList::Delete(Eop& op, const char *byte_key, const size_t byte_key_size, Gptr* ocur_ptr)
 {
     size_t   bucket;
     uint64_t lkey = Hash64(byte_key, byte_key_size);
 
     bucket = lkey % descriptor_->size;
 
-    TagGptr* table = toLocal<TagGptr>(descriptor_->table);
-    if (table[bucket] == TagGptr()) {
-        InitializeBucket(op, bucket);
+    TagGptr* head = InitializedBucketHead(op, bucket);
+    if (!head) {
+        return -1;
     }
     TagGptr cur_tgptr;
-    if (!ListDelete(op, &(table[bucket]), byte_key, byte_key_size, so_regularkey(lkey), &cur_tgptr)) {
+    if (!ListDelete(op, head, byte_key, byte_key_size, so_regularkey(lkey), &cur_tgptr)) {
         return 0;
     }
     if (ocur_ptr) {
@@ -531,14 +667,13 @@ int SplitOrderedList::Delete(Eop& op, const ByteKey& byte_key, const size_t byte
     return 1;
 }
 
-void SplitOrderedList::foreach(std::function<void(SplitOrderedList*, SplitOrderedList::ByteKey, size_t, SplitOrderedList::Value)> f)
+void SplitOrderedList::foreach(std::function<void(SplitOrderedList*, char*, size_t, SplitOrderedList::Value)> f)
 {
-	TagGptr* table = toLocal<TagGptr>(descriptor_->table);
-	TagGptr cur_tgptr = table[0];
+	TagGptr cur_tgptr = *BucketHead(0);
 
 	for (; cur_tgptr.gptr(); cur_tgptr = toLocal<Node>(cur_tgptr.gptr())->next) {
         Node* cur = toLocal<Node>(cur_tgptr.gptr());
-        f(this, cur->byte_key, cur->byte_key_size, cur->value);
+        f(this, cur->byte_key(), cur->byte_key_size, cur->value);
 	}
 }
 
@@ -29,9 +29,17 @@
 #include <string>
 #include <gtest/gtest.h>
 #include <random>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <set>
+#include <thread>
+#include <utility> // pair
+#include <vector>
 
 #include "cluster/config.h"
 #include "cluster/cluster.h"
+#include "cluster/replica_selector.h"
 
 using namespace radixtree;
 
@@ -50,6 +58,286 @@ TEST(Cluster, loadConfigfile) {
     c.Print();
 }
 
+TEST(Cluster, rangePartition) {
+    std::string path = "test_cluster.yaml";
+
+    Config config;
+    config.LoadConfigFile(path);
+    assert(config.IsValid());
+
+    // hash: a range may be anywhere
+    {
+        Cluster c;
+        c.Init(config);
+        EXPECT_EQ(config.GetPartitionCnt(), c.LocateRange(ResourceName("k1"), ResourceName("k2")).size());
+        c.Final();
+    }
+
+    // range: partition i holds [k<i>, k<i+1>)
+    std::vector<std::string> split_keys;
+    for(size_t i=1; i<config.GetPartitionCnt(); i++)
+        split_keys.push_back("k"+std::to_string(i));
+    config.SetPartitionScheme(Config::PartitionScheme::RANGE);
+    config.SetSplitKeys(std::vector<std::string>(split_keys.begin(), split_keys.end()-1));
+    EXPECT_FALSE(config.IsValid());
+    config.SetSplitKeys(std::vector<std::string>(split_keys.rbegin(), split_keys.rend()));
+    EXPECT_FALSE(config.IsValid());
+    config.SetSplitKeys(split_keys);
+    EXPECT_TRUE(config.IsValid());
+
+    Cluster c;
+    c.Init(config);
+    EXPECT_EQ(1UL, c.LocateRange(ResourceName("k1"), ResourceName("k1")).size());
+    EXPECT_EQ(1UL, c.LocateRange(ResourceName("k2"), ResourceName("k2~")).size());
+    EXPECT_EQ(3UL, c.LocateRange(ResourceName("k15"), ResourceName("k35")).size());
+    EXPECT_EQ(config.GetPartitionCnt(), c.LocateRange(ResourceName("a"), ResourceName("")).size());
+    EXPECT_EQ(2UL, c.LocateRange(ResourceName("k8"), ResourceName("")).size());
+
+    // a key and the range of just that key go to the same partition
+    for(auto &k : {"a", "k1", "k15", "k5", "k9", "z"}) {
+        std::vector<Location> locs = c.LocateRange(ResourceName(k), ResourceName(k));
+        ASSERT_EQ(1UL, locs.size());
+        EXPECT_EQ(c.Locate(ResourceName(k)), locs[0]);
+    }
+    c.Final();
+}
+
+TEST(Cluster, splitPartition) {
+    std::string path = "test_cluster.yaml";
+
+    Config config;
+    config.LoadConfigFile(path);
+    assert(config.IsValid());
+    size_t partition_cnt = config.GetPartitionCnt();
+    std::vector<std::string> split_keys;
+    for(size_t i=1; i<partition_cnt; i++)
+        split_keys.push_back("k"+std::to_string(i));
+    config.SetPartitionScheme(Config::PartitionScheme::RANGE);
+    config.SetSplitKeys(split_keys);
+    ASSERT_TRUE(config.IsValid());
+
+    KVS kvs = config.GetPartitions().at(1);
+    kvs["shelf_base"] = config.GetShelfBaseForPartition(partition_cnt);
+    kvs["shelf_user"] = config.GetShelfUserForPartition(partition_cnt);
+
+    // the split key has to be inside [k1, k2)
+    PartitionID new_pid;
+    EXPECT_EQ(-1, config.SplitPartition(1, "k1", kvs, new_pid));
+    EXPECT_EQ(-1, config.SplitPartition(1, "k2", kvs, new_pid));
+    EXPECT_EQ(-1, config.SplitPartition(1, "k0", kvs, new_pid));
+    EXPECT_EQ(partition_cnt, config.GetPartitionCnt());
+    ASSERT_EQ(0, config.SplitPartition(1, "k15", kvs, new_pid));
+    EXPECT_EQ(partition_cnt, new_pid);
+    EXPECT_EQ(partition_cnt+1, config.GetPartitionCnt());
+    EXPECT_TRUE(config.IsValid());
+
+    // the routing survives a save and a reload
+    std::string new_path = "test_cluster_split.yaml";
+    ASSERT_EQ(0, config.SaveConfigFile(new_path));
+    Config new_config;
+    ASSERT_EQ(0, new_config.LoadConfigFile(new_path));
+    remove(new_path.c_str());
+
+    Cluster c, new_c;
+    c.Init(config);
+    new_c.Init(new_config);
+    for(auto &k : {"a", "k1", "k12", "k15", "k17", "k2", "z"}) {
+        EXPECT_EQ(c.Locate(ResourceName(k)), new_c.Locate(ResourceName(k)));
+    }
+    EXPECT_EQ(c.Locate(ResourceName("k1")), c.Locate(ResourceName("k12")));
+    EXPECT_FALSE(c.Locate(ResourceName("k1"))==c.Locate(ResourceName("k15")));
+    EXPECT_EQ(c.Locate(ResourceName("k15")), c.Locate(ResourceName("k17")));
+    EXPECT_EQ(3UL, c.LocateRange(ResourceName("k1"), ResourceName("k2")).size());
+    c.Final();
+    new_c.Final();
+}
+
+TEST(Cluster, replicaSelection) {
+    std::string path = "test_cluster.yaml";
+
+    Config config;
+    config.LoadConfigFile(path);
+    assert(config.IsValid());
+    assert(config.GetReplicationFactor()==3);
+
+    Cluster c;
+    c.Init(config);
+
+    // find the replicas of a key
+    ResourceName r("hello");
+    std::vector<Location> replicas;
+    for(int i=0; i<1000; i++) {
+        Location loc = c.Locate(r, true);
+        if(std::find(replicas.begin(), replicas.end(), loc)==replicas.end())
+            replicas.push_back(loc);
+    }
+    ASSERT_EQ(3UL, replicas.size());
+
+    // one slow replica is never picked: it always loses to the other one sampled
+    for(size_t i=0; i<replicas.size(); i++) {
+        c.StartRequest(replicas[i]);
+        c.FinishRequest(replicas[i], i==0 ? 100000 : 100);
+    }
+    for(int i=0; i<1000; i++)
+        EXPECT_FALSE(c.Locate(r, true)==replicas[0]);
+
+    // nor is one with too many requests outstanding
+    for(int i=0; i<10000; i++)
+        c.StartRequest(replicas[1]);
+    for(int i=0; i<1000; i++)
+        EXPECT_FALSE(c.Locate(r, true)==replicas[1]);
+    for(int i=0; i<10000; i++)
+        c.FinishRequest(replicas[1], 100);
+
+    // a failed request counts as a slow one
+    c.StartRequest(replicas[2]);
+    c.FinishRequest(replicas[2], 100, true);
+    for(int i=0; i<1000; i++)
+        EXPECT_FALSE(c.Locate(r, true)==replicas[2]);
+    c.Final();
+}
+
+// a replica that is down gets no more requests, so its latency is never updated again and would
+// decay to 0, winning over the live replica; once marked failed, it is not picked at all
+TEST(Cluster, replicaFailed) {
+    uint64_t const decay_us = 100;
+    ReplicaSelector selector(decay_us);
+    Location live("127.0.0.1", 10000), dead("127.0.0.1", 10001);
+    std::vector<size_t> ids = {selector.Add(live), selector.Add(dead)};
+
+    selector.Start(dead);
+    selector.Finish(dead, 100, true);
+    EXPECT_TRUE(selector.MarkFailed(dead));
+    EXPECT_FALSE(selector.MarkFailed(dead));
+
+    // well past 64 halvings of the dead replica's latency, while the live one keeps answering
+    auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(100*decay_us);
+    while(std::chrono::steady_clock::now() < end) {
+        EXPECT_TRUE(selector.Select(ids)==live);
+        selector.Start(live);
+        selector.Finish(live, 1000);
+        std::this_thread::sleep_for(std::chrono::microseconds(decay_us/10));
+    }
+    for(int i=0; i<1000; i++)
+        EXPECT_TRUE(selector.Select(ids)==live);
+
+    // with every replica down, one of them is still returned
+    EXPECT_TRUE(selector.MarkFailed(live));
+    Location loc = selector.Select(ids);
+    EXPECT_TRUE(loc==live || loc==dead);
+}
+
+TEST(Cluster, consistentHashing) {
+    std::string path = "test_cluster.yaml";
+    size_t const partition_cnt = 1000;
+
+    Config config;
+    config.LoadConfigFile(path);
+    assert(config.IsValid());
+    assert(config.GetReplicationScheme()==Config::ReplicationScheme::DYNAMO);
+    config.SetPartitionCnt(partition_cnt);
+    for(PartitionID pid=0; pid<partition_cnt; pid++)
+        config.UpdateRoot(pid, "[33:4096]");
+    config.SetVnodeCnt(64);
+    ASSERT_TRUE(config.IsValid());
+
+    // node id -> shelf_base of the partitions it serves
+    auto placement = [](Config &config) {
+        std::vector<std::set<std::string>> partitions(config.GetNodeCnt());
+        std::set<uint64_t> ports;
+        Cluster c;
+        c.Init(config);
+        for(NodeID nid=0; nid<config.GetNodeCnt(); nid++) {
+            std::vector<KVS> kvs = c.FindPartitions(nid);
+            std::vector<uint64_t> node_ports = c.FindPorts(nid);
+            EXPECT_EQ(kvs.size(), node_ports.size());
+            for(size_t slot=0; slot<kvs.size(); slot++) {
+                if(kvs[slot].empty())
+                    continue;
+                partitions[nid].insert(kvs[slot]["shelf_base"]);
+                ports.insert(node_ports[slot]);
+            }
+        }
+        // every replica of every partition has its own port
+        EXPECT_EQ(config.GetPartitionCnt()*config.GetReplicationFactor(), ports.size());
+        c.Final();
+        return partitions;
+    };
+
+    std::vector<std::set<std::string>> before = placement(config);
+    size_t node_cnt = config.GetNodeCnt();
+    size_t replica_cnt = partition_cnt*config.GetReplicationFactor();
+    for(NodeID nid=0; nid<node_cnt; nid++) {
+        EXPECT_GT(before[nid].size(), replica_cnt/node_cnt/2);
+        EXPECT_LT(before[nid].size(), replica_cnt/node_cnt*3/2);
+    }
+
+    // one more node: the existing nodes only lose partitions (to the new one), about 1/N of them
+    config.SetNodeCnt(node_cnt+1);
+    std::vector<std::set<std::string>> after = placement(config);
+    size_t moved=0;
+    for(NodeID nid=0; nid<node_cnt; nid++) {
+        for(auto &p:after[nid])
+            EXPECT_TRUE(before[nid].count(p));
+        moved += before[nid].size()-after[nid].size();
+    }
+    EXPECT_EQ(moved, after[node_cnt].size());
+    EXPECT_LT(moved, replica_cnt*2/(node_cnt+1));
+
+    // a node of weight 3 serves about 3 times as many partitions
+    config.SetNodeCnt(node_cnt);
+    config.SetNodeWeight(0, 3);
+    after = placement(config);
+    EXPECT_GT(after[0].size(), 2*after[1].size());
+}
+
+// the slot and port a node serves a partition on do not depend on the other nodes, so adding a
+// node leaves the servers of the existing nodes as they are
+TEST(Cluster, stablePorts) {
+    std::string path = "test_cluster.yaml";
+    size_t const partition_cnt = 100;
+
+    Config config;
+    config.LoadConfigFile(path);
+    assert(config.IsValid());
+    config.SetPartitionCnt(partition_cnt);
+    for(PartitionID pid=0; pid<partition_cnt; pid++)
+        config.UpdateRoot(pid, "[33:4096]");
+    config.SetVnodeCnt(64);
+    ASSERT_TRUE(config.IsValid());
+
+    // (node id, shelf_base of a partition it serves) -> (slot, port)
+    auto servers = [](Config &config) {
+        std::map<std::pair<NodeID, std::string>, std::pair<size_t, uint64_t>> servers;
+        Cluster c;
+        c.Init(config);
+        for(NodeID nid=0; nid<config.GetNodeCnt(); nid++) {
+            std::vector<KVS> kvs = c.FindPartitions(nid);
+            std::vector<uint64_t> ports = c.FindPorts(nid);
+            for(size_t slot=0; slot<kvs.size(); slot++) {
+                if(!kvs[slot].empty())
+                    servers[{nid, kvs[slot]["shelf_base"]}] = {slot, ports[slot]};
+            }
+        }
+        c.Final();
+        return servers;
+    };
+
+    auto before = servers(config);
+    size_t node_cnt = config.GetNodeCnt();
+    config.SetNodeCnt(node_cnt+1);
+    auto after = servers(config);
+    size_t kept=0;
+    for(auto &s:after) {
+        if(s.first.first==node_cnt)
+            continue;
+        ASSERT_TRUE(before.count(s.first));
+        EXPECT_EQ(before[s.first], s.second);
+        kept++;
+    }
+    EXPECT_GT(kept, before.size()/2);
+}
+
 // TEST(Cluster, updateConfigfile) {
 //     // load config file
 //     std::string path = "test_cluster.yaml";
@@ -54,6 +54,56 @@ void rccpause(){
     scanf("%d", &t);
 }
 
+// famls over values kept in the value words (inline values, as KVSRadixTree stores short
+// values) and in heap buffers
+TEST(RadixTree, FAMLSInlineValues) {
+    PoolId const heap_id = 2; // RCCFAMLS keeps heap 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    RadixTree *tree = new RadixTree(mm, heap, NULL);
+    EXPECT_NE(nullptr, tree);
+    Gptr root = tree->get_root();
+
+    auto inline_value = [](char const *val, size_t len) {
+        uint64_t word = RadixTree::INLINE_VALUE | (len << 2);
+        for (size_t i = 0; i < len; i++)
+            word |= (uint64_t)(uint8_t)val[i] << (8 * (i + 1));
+        return Gptr(word);
+    };
+
+    GlobalPtr value_gptr = heap->Alloc(sizeof(uint64_t));
+    uint64_t *value_ptr = (uint64_t*)mm->GlobalToLocal(value_gptr);
+    *value_ptr = 7;
+    fam_persist(value_ptr, sizeof(uint64_t));
+
+    tree->put("a", 1, inline_value("\x01\x02", 2), UPDATE);
+    tree->put("ab", 2, value_gptr, UPDATE);
+    tree->put("abc", 3, inline_value("", 0), UPDATE);
+    tree->put("abd", 3, inline_value("\xff\xff\xff\xff\xff\xff\xff", 7), UPDATE);
+
+    // the bytes of an inline value read as a little-endian number, like the first 8 bytes of a
+    // value buffer
+    char mybuf[MYBUF_SIZE] = {""};
+    char key[] = "a";
+    EXPECT_EQ(0, tree->traverse(root, key, true, mybuf, MYBUF_SIZE));
+    EXPECT_STREQ("\na-513\nab-7\nabc-0\tabd-72057594037927935", mybuf);
+
+    delete tree;
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
 // famls
 TEST(RadixTree, RCCFAMLS) {
     PoolId const heap_id = 1; // assuming we only use heap id 1
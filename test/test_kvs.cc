@@ -26,12 +26,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <gtest/gtest.h>
 #include <random>
 #include <limits>
+#include <atomic>
+#include <thread>
 
 #include "radixtree/kvs.h"
+#include "radixtree/kvs_migration.h"
 
 #include "nvmm/memory_manager.h"
 #include "nvmm/epoch_manager.h"
@@ -218,6 +223,198 @@ TEST(KeyValueStore, SingleProcess) {
     delete kvs;
 }
 
+TEST(KeyValueStore, SingleProcessMulti) {
+    KeyValueStore *kvs;
+
+    // create a new radix tree
+    kvs = KeyValueStore::MakeKVS(KVSTYPE, 0);
+    EXPECT_NE(nullptr, kvs);
+
+    size_t const max_val_len = kvs->MaxValLen()<1024?kvs->MaxValLen():1024;
+
+    // keys with common prefixes, in no particular order, plus one that is too long
+    std::vector<std::string> keys, vals, get_vals;
+    std::vector<int> rets;
+    for (uint64_t i = 0; i < 200; i++) {
+        keys.push_back(num2str((i * 37) % 200));
+        vals.push_back(rand_string(1, max_val_len));
+    }
+    keys.push_back("a");
+    vals.push_back("A");
+    keys.push_back(std::string(kvs->MaxKeyLen() + 1, 'x'));
+    vals.push_back("X");
+    size_t const count = keys.size();
+
+    EXPECT_EQ(-1, kvs->MultiPut(keys, vals, rets));
+    EXPECT_EQ(count, rets.size());
+    for (size_t i = 0; i < count - 1; i++)
+        EXPECT_EQ(0, rets[i]);
+    EXPECT_EQ(-1, rets[count - 1]);
+
+    // multi get agrees with get
+    EXPECT_EQ(-1, kvs->MultiGet(keys, get_vals, rets));
+    EXPECT_EQ(count, get_vals.size());
+    for (size_t i = 0; i < count - 1; i++) {
+        EXPECT_EQ(0, rets[i]);
+        EXPECT_EQ(vals[i], get_vals[i]);
+    }
+    EXPECT_EQ(-1, rets[count - 1]);
+
+    char val_buf[max_val_len];
+    size_t val_len = max_val_len;
+    EXPECT_EQ(0, kvs->Get(keys[5].c_str(), keys[5].size(), val_buf, val_len));
+    EXPECT_EQ(vals[5], std::string(val_buf, val_len));
+
+    // delete every other key, then some keys that do not exist
+    std::vector<std::string> del_keys;
+    for (size_t i = 0; i < count - 1; i += 2)
+        del_keys.push_back(keys[i]);
+    del_keys.push_back("b");
+    EXPECT_EQ(0, kvs->MultiDel(del_keys, rets));
+    for (size_t i = 0; i < del_keys.size() - 1; i++)
+        EXPECT_EQ(0, rets[i]);
+    EXPECT_EQ(-2, rets[del_keys.size() - 1]);
+
+    keys.pop_back();
+    EXPECT_EQ(0, kvs->MultiGet(keys, get_vals, rets));
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (i % 2 == 0) {
+            EXPECT_EQ(-2, rets[i]);
+        } else {
+            EXPECT_EQ(0, rets[i]);
+            EXPECT_EQ(vals[i], get_vals[i]);
+        }
+    }
+
+    delete kvs;
+}
+
+TEST(KeyValueStore, SingleProcessBulkLoad) {
+    KeyValueStore *kvs;
+
+    // create a new radix tree
+    kvs = KeyValueStore::MakeKVS(KVSTYPE, 0);
+    EXPECT_NE(nullptr, kvs);
+
+    size_t const max_val_len = kvs->MaxValLen()<1024?kvs->MaxValLen():1024;
+
+    // a key that is already there, keys with common prefixes in no particular order, and one
+    // that is too long
+    EXPECT_EQ(0, kvs->Put("a", 1, "old", 3));
+    std::vector<std::string> keys, vals, get_vals;
+    std::vector<int> rets;
+    for (uint64_t i = 0; i < 1000; i++) {
+        keys.push_back(num2str((i * 37) % 1000));
+        vals.push_back(rand_string(1, max_val_len));
+    }
+    keys.push_back("a");
+    vals.push_back("A");
+    keys.push_back(std::string(kvs->MaxKeyLen() + 1, 'x'));
+    vals.push_back("X");
+    size_t const count = keys.size();
+
+    EXPECT_EQ(-1, kvs->BulkLoad(keys, vals, rets, 4));
+    EXPECT_EQ(count, rets.size());
+    for (size_t i = 0; i < count - 1; i++)
+        EXPECT_EQ(0, rets[i]);
+    EXPECT_EQ(-1, rets[count - 1]);
+
+    keys.pop_back();
+    EXPECT_EQ(0, kvs->MultiGet(keys, get_vals, rets));
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(0, rets[i]);
+        EXPECT_EQ(vals[i], get_vals[i]);
+    }
+
+    // the loaded keys take updates and deletes as usual
+    EXPECT_EQ(0, kvs->Put(keys[5].c_str(), keys[5].size(), "new", 3));
+    EXPECT_EQ(0, kvs->Del(keys[6].c_str(), keys[6].size()));
+    char val_buf[max_val_len];
+    size_t val_len = max_val_len;
+    EXPECT_EQ(0, kvs->Get(keys[5].c_str(), keys[5].size(), val_buf, val_len));
+    EXPECT_EQ("new", std::string(val_buf, val_len));
+    val_len = max_val_len;
+    EXPECT_EQ(-2, kvs->Get(keys[6].c_str(), keys[6].size(), val_buf, val_len));
+
+    delete kvs;
+}
+
+TEST(KeyValueStore, SingleProcessSmallValues) {
+    KeyValueStore *kvs;
+
+    // create a new radix tree
+    kvs = KeyValueStore::MakeKVS(KVSTYPE, 0);
+    EXPECT_NE(nullptr, kvs);
+    GlobalPtr root = kvs->Location();
+
+    // values around the size that fits in the value word, with zero and 0xff bytes
+    size_t const max_val_len = kvs->MaxValLen()<16?kvs->MaxValLen():16;
+    std::vector<std::string> keys, vals, get_vals;
+    std::vector<int> rets;
+    for (size_t len = 0; len <= max_val_len; len++) {
+        keys.push_back("small" + num2str(len));
+        std::string val(len, '\0');
+        for (size_t i = 0; i < len; i++)
+            val[i] = (char)(i % 2 ? 0xff : i);
+        vals.push_back(val);
+        EXPECT_EQ(0, kvs->Put(keys.back().c_str(), keys.back().size(), val.data(), len));
+    }
+
+    char val_buf[max_val_len + 1];
+    size_t val_len;
+    for (size_t i = 0; i < keys.size(); i++) {
+        val_len = max_val_len;
+        EXPECT_EQ(0, kvs->Get(keys[i].c_str(), keys[i].size(), val_buf, val_len));
+        EXPECT_EQ(vals[i], std::string(val_buf, val_len));
+    }
+    EXPECT_EQ(0, kvs->MultiGet(keys, get_vals, rets));
+    for (size_t i = 0; i < keys.size(); i++)
+        EXPECT_EQ(vals[i], get_vals[i]);
+
+    // a value that grows out of the value word and shrinks back into it
+    std::string const key = keys[1];
+    std::string const big(max_val_len, 'b');
+    EXPECT_EQ(0, kvs->Put(key.c_str(), key.size(), big.data(), big.size()));
+    val_len = max_val_len;
+    EXPECT_EQ(0, kvs->Get(key.c_str(), key.size(), val_buf, val_len));
+    EXPECT_EQ(big, std::string(val_buf, val_len));
+    EXPECT_EQ(0, kvs->Put(key.c_str(), key.size(), "s", 1));
+    val_len = max_val_len;
+    EXPECT_EQ(0, kvs->Get(key.c_str(), key.size(), val_buf, val_len));
+    EXPECT_EQ("s", std::string(val_buf, val_len));
+    vals[1] = "s";
+
+    // the version still changes when the same small value is written again
+    GlobalPtr key_ptr;
+    TagGptr val_ptr, new_val_ptr;
+    val_len = max_val_len;
+    EXPECT_EQ(0, kvs->Get(key.c_str(), key.size(), val_buf, val_len, key_ptr, val_ptr));
+    EXPECT_EQ(0, kvs->Put(key_ptr, new_val_ptr, "s", 1));
+    EXPECT_NE(val_ptr, new_val_ptr);
+
+    // a too small buffer gets the size of the value
+    val_len = 1;
+    EXPECT_EQ(-1, kvs->Get(keys[3].c_str(), keys[3].size(), val_buf, val_len));
+    EXPECT_EQ(3u, val_len);
+
+    EXPECT_EQ(0, kvs->Del(keys[2].c_str(), keys[2].size()));
+    val_len = max_val_len;
+    EXPECT_EQ(-2, kvs->Get(keys[2].c_str(), keys[2].size(), val_buf, val_len));
+    keys.erase(keys.begin() + 2);
+    vals.erase(vals.begin() + 2);
+    delete kvs;
+
+    // the values are still there in the reopened tree
+    kvs = KeyValueStore::MakeKVS(KVSTYPE, root);
+    EXPECT_NE(nullptr, kvs);
+    EXPECT_EQ(0, kvs->MultiGet(keys, get_vals, rets));
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(0, rets[i]);
+        EXPECT_EQ(vals[i], get_vals[i]);
+    }
+    delete kvs;
+}
+
 TEST(KeyValueStore, SingleProcessCachingAPI) {
     KeyValueStore *kvs;
 
@@ -348,6 +545,131 @@ TEST(KeyValueStore, SingleProcessCachingAPI) {
     delete kvs;
 }
 
+TEST(KeyValueStore, SingleProcessZeroCopyGet) {
+    KeyValueStore *kvs = KeyValueStore::MakeKVS(KVSTYPE, 0);
+    EXPECT_NE(nullptr, kvs);
+
+    // values larger than any fixed-size buffer of a caller
+    size_t const val_len = kvs->MaxValLen()<65536?kvs->MaxValLen():65536;
+    std::string buf;
+    size_t alloc_cnt = 0;
+    KeyValueStore::ValAlloc alloc = [&](size_t len) {
+        alloc_cnt++;
+        buf.assign(len, '\0');
+        return &buf[0];
+    };
+    KeyValueStore::ValAlloc no_alloc = [&](size_t len) -> char * {
+        alloc_cnt++;
+        return nullptr;
+    };
+
+    std::string key = "1";
+    std::string val = rand_string(val_len, val_len);
+    Gptr key_ptr;
+    TagGptr val_ptr, old_val_ptr;
+    int ret;
+
+    // no key: alloc is not called
+    EXPECT_EQ(-2, kvs->Get(key.c_str(), key.size(), alloc));
+    EXPECT_EQ(0, kvs->Get(key.c_str(), key.size(), alloc, key_ptr, val_ptr));
+    EXPECT_FALSE(key_ptr.IsValid());
+    EXPECT_EQ(0u, alloc_cnt);
+
+    ret = kvs->Put(key.c_str(), key.size(), val.c_str(), val.size());
+    EXPECT_EQ(0, ret);
+
+    EXPECT_EQ(0, kvs->Get(key.c_str(), key.size(), alloc));
+    EXPECT_EQ(val, buf);
+    buf.clear();
+    EXPECT_EQ(0, kvs->Get(key.c_str(), key.size(), alloc, key_ptr, val_ptr));
+    EXPECT_TRUE(key_ptr.IsValid());
+    EXPECT_TRUE(val_ptr.IsValid());
+    EXPECT_EQ(val, buf);
+    EXPECT_EQ(2u, alloc_cnt);
+
+    // up-to-date val_ptr: nothing to copy, unless get_value
+    old_val_ptr = val_ptr;
+    EXPECT_EQ(0, kvs->Get(key_ptr, val_ptr, alloc));
+    EXPECT_EQ(old_val_ptr, val_ptr);
+    EXPECT_EQ(2u, alloc_cnt);
+    buf.clear();
+    EXPECT_EQ(0, kvs->Get(key_ptr, val_ptr, alloc, true));
+    EXPECT_EQ(val, buf);
+    EXPECT_EQ(3u, alloc_cnt);
+
+    // stale val_ptr: the new value is copied
+    val = rand_string(val_len, val_len);
+    ret = kvs->Put(key_ptr, val_ptr, val.c_str(), val.size());
+    EXPECT_EQ(0, ret);
+    EXPECT_EQ(0, kvs->Get(key_ptr, old_val_ptr, alloc));
+    EXPECT_EQ(val_ptr, old_val_ptr);
+    EXPECT_EQ(val, buf);
+
+    // alloc gives up
+    EXPECT_EQ(-1, kvs->Get(key.c_str(), key.size(), no_alloc));
+    EXPECT_EQ(-1, kvs->Get(key_ptr, val_ptr, no_alloc, true));
+
+    // deleted: no value
+    ret = kvs->Del(key.c_str(), key.size());
+    EXPECT_EQ(0, ret);
+    alloc_cnt = 0;
+    EXPECT_EQ(-2, kvs->Get(key.c_str(), key.size(), alloc));
+    EXPECT_EQ(0, kvs->Get(key_ptr, val_ptr, alloc, true));
+    EXPECT_FALSE(val_ptr.IsValid());
+    EXPECT_EQ(0u, alloc_cnt);
+
+    delete kvs;
+}
+
+TEST(KeyValueStore, SingleProcessCompact) {
+    KeyValueStore *kvs = KeyValueStore::MakeKVS(KeyValueStore::RADIX_TREE, 0);
+    EXPECT_NE(nullptr, kvs);
+
+    std::string key = "1", val = "one";
+    char val_buf[64];
+    size_t val_len = sizeof(val_buf);
+    Gptr key_ptr, live_key_ptr;
+    TagGptr val_ptr, live_val_ptr;
+    size_t pruned;
+
+    // a key ptr and the generation it was taken in
+    uint64_t key_gen = kvs->KeyGen();
+    EXPECT_EQ(0, kvs->Put(key.c_str(), key.size(), val.c_str(), val.size(), key_ptr, val_ptr));
+    EXPECT_EQ(0, kvs->Put("2", 1, val.c_str(), val.size(), live_key_ptr, live_val_ptr));
+    EXPECT_EQ(0, kvs->Get(key_ptr, val_ptr, val_buf, val_len, false, key_gen));
+
+    // nothing to prune: key ptrs go stale all the same
+    EXPECT_EQ(0, kvs->Compact(pruned));
+    EXPECT_EQ(0u, pruned);
+    EXPECT_EQ(KeyValueStore::STALE_KEY_PTR,
+              kvs->Get(key_ptr, val_ptr, val_buf, val_len, false, key_gen));
+    key_gen = kvs->KeyGen();
+    EXPECT_EQ(0, kvs->Get(key_ptr, val_ptr, val_buf, val_len, false, key_gen));
+
+    // the key node of a deleted key is pruned, and key ptrs to it are turned down
+    EXPECT_EQ(0, kvs->Del(key_ptr, val_ptr, key_gen));
+    EXPECT_EQ(0, kvs->Compact(pruned));
+    EXPECT_EQ(1u, pruned);
+    EXPECT_EQ(KeyValueStore::STALE_KEY_PTR, kvs->Put(key_ptr, val_ptr, val.c_str(), val.size(), key_gen));
+    EXPECT_EQ(KeyValueStore::STALE_KEY_PTR, kvs->Del(key_ptr, val_ptr, key_gen));
+
+    // going back to the key
+    key_gen = kvs->KeyGen();
+    val_len = sizeof(val_buf);
+    EXPECT_EQ(0, kvs->Get(key.c_str(), key.size(), val_buf, val_len, key_ptr, val_ptr));
+    EXPECT_FALSE(key_ptr.IsValid());
+    EXPECT_EQ(0, kvs->Put(key.c_str(), key.size(), val.c_str(), val.size(), key_ptr, val_ptr));
+    EXPECT_TRUE(key_ptr.IsValid());
+    EXPECT_EQ(0, kvs->Put(key_ptr, val_ptr, val.c_str(), val.size(), key_gen));
+
+    // the other key is untouched
+    val_len = sizeof(val_buf);
+    EXPECT_EQ(0, kvs->Get("2", 1, val_buf, val_len));
+    EXPECT_EQ(val, std::string(val_buf, val_len));
+
+    delete kvs;
+}
+
 TEST(KeyValueStore, SingleProcessScan) {
     KeyValueStore *kvs;
 
@@ -1164,6 +1486,342 @@ TEST(KeyValueStore, SingleProcessScan) {
 }
 
 
+TEST(KeyValueStore, SingleProcessScanHandles) {
+    KeyValueStore *kvs;
+
+    // create a new radix tree
+    kvs = KeyValueStore::MakeKVS(KVSTYPE, 0);
+    EXPECT_NE(nullptr, kvs);
+
+    size_t const max_val_len = kvs->MaxValLen()<1024?kvs->MaxValLen():1024;
+    size_t const max_key_len = kvs->MaxKeyLen();
+
+    for(uint64_t i=0; i<10; i++) {
+        std::string key = num2str(i);
+        EXPECT_EQ(0, kvs->Put(key.c_str(), key.size(), key.c_str(), key.size()));
+    }
+
+    std::string begin_key = num2str(0);
+    std::string end_key = num2str(10);
+    char key_buf[max_key_len];
+    size_t key_len;
+    char val_buf[max_val_len];
+    size_t val_len;
+    int iter, ret;
+
+    // many more scans than there are iterator slots, each one stopped early
+    for (int n = 0; n < 10000; n++) {
+        ResetBuf(key_buf, key_len, max_key_len);
+        ResetBuf(val_buf, val_len, max_val_len);
+        ret = kvs->Scan(iter,
+                        key_buf, key_len,
+                        val_buf, val_len,
+                        begin_key.c_str(), begin_key.size(), true,
+                        end_key.c_str(), end_key.size(), false);
+        EXPECT_EQ(0, ret);
+        EXPECT_EQ(num2str(0), std::string(key_buf, key_len));
+        EXPECT_EQ(0, kvs->CloseIter(iter));
+
+        // a closed handle is rejected, even if its slot is in use again
+        EXPECT_EQ(-1, kvs->CloseIter(iter));
+        ResetBuf(key_buf, key_len, max_key_len);
+        ResetBuf(val_buf, val_len, max_val_len);
+        EXPECT_EQ(-1, kvs->GetNext(iter, key_buf, key_len, val_buf, val_len));
+    }
+
+    // a scan that runs to the end of the range releases its handle
+    ResetBuf(key_buf, key_len, max_key_len);
+    ResetBuf(val_buf, val_len, max_val_len);
+    ret = kvs->Scan(iter,
+                    key_buf, key_len,
+                    val_buf, val_len,
+                    begin_key.c_str(), begin_key.size(), true,
+                    end_key.c_str(), end_key.size(), false);
+    EXPECT_EQ(0, ret);
+    for (uint64_t i=1; i<10; i++) {
+        ResetBuf(key_buf, key_len, max_key_len);
+        ResetBuf(val_buf, val_len, max_val_len);
+        EXPECT_EQ(0, kvs->GetNext(iter, key_buf, key_len, val_buf, val_len));
+        EXPECT_EQ(num2str(i), std::string(key_buf, key_len));
+    }
+    ResetBuf(key_buf, key_len, max_key_len);
+    ResetBuf(val_buf, val_len, max_val_len);
+    EXPECT_EQ(-2, kvs->GetNext(iter, key_buf, key_len, val_buf, val_len));
+    EXPECT_EQ(-1, kvs->CloseIter(iter));
+
+    delete kvs;
+}
+
+TEST(KeyValueStore, SingleProcessScanBatch) {
+    KeyValueStore *kvs;
+
+    // create a new radix tree
+    kvs = KeyValueStore::MakeKVS(KVSTYPE, 0);
+    EXPECT_NE(nullptr, kvs);
+
+    for(uint64_t i=0; i<100; i++) {
+        std::string key = num2str(i);
+        EXPECT_EQ(0, kvs->Put(key.c_str(), key.size(), key.c_str(), key.size()));
+    }
+
+    std::string end_key = num2str(90);
+    uint64_t buf[512]; // 8-byte aligned
+    size_t buf_len, cnt;
+    int ret;
+
+    // page through [10, 90) in batches of at most 7 records
+    std::string begin_key = num2str(10);
+    bool begin_key_inclusive = true;
+    uint64_t next = 10;
+    for (;;) {
+        buf_len = sizeof(buf);
+        ret = kvs->ScanBatch(begin_key.c_str(), begin_key.size(), begin_key_inclusive,
+                             end_key.c_str(), end_key.size(), false,
+                             7, (char *)buf, buf_len, cnt);
+        if (ret == -2)
+            break;
+        EXPECT_EQ(0, ret);
+        EXPECT_LE(cnt, 7UL);
+        char *p = (char *)buf;
+        for (size_t j = 0; j < cnt; j++) {
+            KeyValueStore::ScanRecord *rec = (KeyValueStore::ScanRecord *)p;
+            EXPECT_EQ(num2str(next), std::string(rec->key(), rec->key_len));
+            EXPECT_EQ(num2str(next), std::string(rec->val(), rec->val_len));
+            begin_key.assign(rec->key(), rec->key_len);
+            next++;
+            p += rec->size();
+        }
+        EXPECT_EQ(buf_len, (size_t)(p - (char *)buf));
+        begin_key_inclusive = false;
+    }
+    EXPECT_EQ(90UL, next);
+
+    // a buffer that holds only some of the records
+    size_t rec_size = KeyValueStore::ScanRecord::size(num2str(0).size(), num2str(0).size());
+    buf_len = 3 * rec_size + rec_size / 2;
+    ret = kvs->ScanBatch(KeyValueStore::OPEN_BOUNDARY_KEY, KeyValueStore::OPEN_BOUNDARY_KEY_SIZE, false,
+                         KeyValueStore::OPEN_BOUNDARY_KEY, KeyValueStore::OPEN_BOUNDARY_KEY_SIZE, false,
+                         100, (char *)buf, buf_len, cnt);
+    EXPECT_EQ(0, ret);
+    EXPECT_EQ(3UL, cnt);
+    EXPECT_EQ(3 * rec_size, buf_len);
+
+    // a buffer too small for the first record
+    buf_len = rec_size - 1;
+    ret = kvs->ScanBatch(begin_key.c_str(), begin_key.size(), true,
+                         end_key.c_str(), end_key.size(), true,
+                         100, (char *)buf, buf_len, cnt);
+    EXPECT_EQ(-1, ret);
+    EXPECT_EQ(rec_size, buf_len);
+
+    delete kvs;
+}
+
+TEST(KeyValueStore, SingleProcessParallelScan) {
+    KeyValueStore *kvs;
+
+    // create a new radix tree
+    kvs = KeyValueStore::MakeKVS(KVSTYPE, 0);
+    EXPECT_NE(nullptr, kvs);
+
+    // keys with many different first and second bytes, so that the range splits
+    std::vector<std::string> keys;
+    for(uint64_t i=0; i<5000; i++) {
+        std::string key = num2str(i*0x0101010101010101ULL + i*13);
+        keys.push_back(key);
+        EXPECT_EQ(0, kvs->Put(key.c_str(), key.size(), key.c_str(), key.size()));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::string open_key(KeyValueStore::OPEN_BOUNDARY_KEY, KeyValueStore::OPEN_BOUNDARY_KEY_SIZE);
+    size_t const threads = 8;
+
+    // ordered
+    std::vector<std::string> result;
+    int ret = kvs->ParallelScan(open_key.c_str(), open_key.size(), false,
+                                open_key.c_str(), open_key.size(), false,
+                                threads, true,
+                                [&](size_t worker, char const *key, size_t key_len,
+                                    char const *val, size_t val_len) {
+                                    EXPECT_LT(worker, threads);
+                                    EXPECT_EQ(std::string(key, key_len), std::string(val, val_len));
+                                    result.push_back(std::string(key, key_len));
+                                });
+    EXPECT_EQ(0, ret);
+    EXPECT_EQ(keys, result);
+
+    // unordered, within [keys[1000], keys[4000]]
+    std::vector<std::vector<std::string>> worker_result(threads);
+    ret = kvs->ParallelScan(keys[1000].c_str(), keys[1000].size(), true,
+                            keys[4000].c_str(), keys[4000].size(), true,
+                            threads, false,
+                            [&](size_t worker, char const *key, size_t key_len,
+                                char const *val, size_t val_len) {
+                                worker_result[worker].push_back(std::string(key, key_len));
+                            });
+    EXPECT_EQ(0, ret);
+    result.clear();
+    for (auto &r : worker_result)
+        result.insert(result.end(), r.begin(), r.end());
+    std::sort(result.begin(), result.end());
+    EXPECT_EQ(std::vector<std::string>(keys.begin()+1000, keys.begin()+4001), result);
+
+    delete kvs;
+}
+
+TEST(KeyValueStore, SingleProcessMigration) {
+    KeyValueStore *src = KeyValueStore::MakeKVS(KVSTYPE, 0);
+    KeyValueStore *dst = KeyValueStore::MakeKVS(KVSTYPE, 0);
+    EXPECT_NE(nullptr, src);
+    EXPECT_NE(nullptr, dst);
+
+    uint64_t const key_cnt = 12000;
+    for(uint64_t i=0; i<key_cnt; i++) {
+        std::string key = num2str(i);
+        EXPECT_EQ(0, src->Put(key.c_str(), key.size(), key.c_str(), key.size()));
+    }
+
+    // move [1000, 11000), more keys than one ScanBatch of Copy() takes, while writers keep
+    // updating and deleting keys all over; half of them use the calls of the DRAM caching layer,
+    // whose writes by key pointer go back to the key
+    KVSMigration migration(src, dst, num2str(1000), num2str(11000));
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> writers;
+    for(int t=0; t<4; t++) {
+        writers.push_back(std::thread([&, t]() {
+                    std::default_random_engine e(t);
+                    std::uniform_int_distribution<uint64_t> dist(0, key_cnt-1);
+                    while(!stop) {
+                        std::string key = num2str(dist(e));
+                        if(t%2==1) {
+                            Gptr key_ptr;
+                            TagGptr val_ptr;
+                            if(dist(e)%4==0) {
+                                EXPECT_EQ(0, migration.Del(key.c_str(), key.size(), key_ptr, val_ptr));
+                                if(key_ptr.IsValid())
+                                    EXPECT_EQ(KeyValueStore::STALE_KEY_PTR, migration.Del(key_ptr, val_ptr));
+                            }
+                            else {
+                                std::string val = rand_string(1, 100);
+                                EXPECT_EQ(0, migration.Put(key.c_str(), key.size(), val.c_str(), val.size(),
+                                                           key_ptr, val_ptr));
+                                EXPECT_EQ(KeyValueStore::STALE_KEY_PTR,
+                                          migration.Put(key_ptr, val_ptr, val.c_str(), val.size()));
+                            }
+                        }
+                        else if(dist(e)%4==0) {
+                            int ret = migration.Del(key.c_str(), key.size());
+                            EXPECT_TRUE(ret==0 || ret==-2);
+                        }
+                        else {
+                            std::string val = rand_string(1, 100);
+                            EXPECT_EQ(0, migration.Put(key.c_str(), key.size(), val.c_str(), val.size()));
+                        }
+                    }
+                }));
+    }
+
+    EXPECT_EQ(-1, migration.Copy()); // not started
+    EXPECT_EQ(0, migration.Start());
+    EXPECT_EQ(0, migration.Copy());
+    EXPECT_EQ(0, migration.CatchUp());
+    std::this_thread::sleep_for(std::chrono::milliseconds(100)); // dual writes
+    stop = true;
+    for(auto &w : writers)
+        w.join();
+    EXPECT_EQ(-1, migration.Purge()); // not finished
+    EXPECT_EQ(0, migration.Finish());
+
+    // dst has exactly what src has in the range
+    char val[1024];
+    size_t val_len;
+    char dst_val[1024];
+    size_t dst_val_len;
+    for(uint64_t i=0; i<key_cnt; i++) {
+        std::string key = num2str(i);
+        ResetBuf(val, val_len, sizeof(val));
+        ResetBuf(dst_val, dst_val_len, sizeof(dst_val));
+        int ret = src->Get(key.c_str(), key.size(), val, val_len);
+        int dst_ret = dst->Get(key.c_str(), key.size(), dst_val, dst_val_len);
+        if(i<1000 || i>=11000) {
+            EXPECT_EQ(-2, dst_ret);
+            continue;
+        }
+        EXPECT_EQ(ret, dst_ret);
+        if(ret==0)
+            EXPECT_EQ(std::string(val, val_len), std::string(dst_val, dst_val_len));
+    }
+
+    // the range is gone from src, and the rest is still there
+    EXPECT_EQ(0, migration.Purge());
+    for(uint64_t i=0; i<key_cnt; i++) {
+        std::string key = num2str(i);
+        ResetBuf(val, val_len, sizeof(val));
+        int ret = src->Get(key.c_str(), key.size(), val, val_len);
+        if(i>=1000 && i<11000)
+            EXPECT_EQ(-2, ret);
+    }
+
+    delete src;
+    delete dst;
+}
+
+// the tiny KVS under concurrent puts that keep growing and replacing inner nodes, while other
+// threads read keys that are always there
+TEST(KeyValueStore, SingleProcessTinyConcurrent) {
+    KeyValueStore *kvs = KeyValueStore::MakeKVS(KeyValueStore::RADIX_TREE_TINY, 0);
+    EXPECT_NE(nullptr, kvs);
+
+    size_t const stable = 1000;
+    for(uint64_t i=0; i<stable; i++) {
+        std::string key = num2str(i);
+        uint64_t val = i+1;
+        EXPECT_EQ(0, kvs->Put(key.c_str(), key.size(), (char const*)&val, sizeof(val)));
+    }
+
+    size_t const writers = 4;
+    size_t const readers = 4;
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> errors(0);
+    std::vector<std::thread> workers;
+    for(size_t w=0; w<writers; w++) {
+        workers.push_back(std::thread([&, w]() {
+            // every new first byte under "new" grows the same nodes again
+            for(uint64_t i=0; i<20000; i++) {
+                std::string key = "new" + num2str((i%256)<<56 | i<<8 | w);
+                uint64_t val = i+1;
+                if(kvs->Put(key.c_str(), key.size(), (char const*)&val, sizeof(val))!=0)
+                    errors++;
+                if(i%3==0)
+                    (void)kvs->Del(key.c_str(), key.size());
+            }
+        }));
+    }
+    for(size_t r=0; r<readers; r++) {
+        workers.push_back(std::thread([&]() {
+            char val[8];
+            size_t val_len;
+            while(!done) {
+                for(uint64_t i=0; i<stable; i++) {
+                    std::string key = num2str(i);
+                    val_len = sizeof(val);
+                    if(kvs->Get(key.c_str(), key.size(), val, val_len)!=0 ||
+                       *(uint64_t*)val!=i+1)
+                        errors++;
+                }
+            }
+        }));
+    }
+    for(size_t w=0; w<writers; w++)
+        workers[w].join();
+    done = true;
+    for(size_t r=0; r<readers; r++)
+        workers[writers+r].join();
+    EXPECT_EQ(0UL, errors.load());
+
+    delete kvs;
+}
+
 // multi-process
 static int const process_count = 16;
 static int const loop_count = 5000;
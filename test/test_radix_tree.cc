@@ -26,11 +26,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <map>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 #include <gtest/gtest.h>
 #include <random>
 
 #include "radixtree/radix_tree.h"
+#include "slab_heap.h"
 
 #include "nvmm/memory_manager.h"
 #include "nvmm/epoch_manager.h"
@@ -630,7 +636,7 @@ TEST(RadixTree, SingleProcessScan) {
     }
 
     // with open boundary
-    // scan (-inf, +inf)
+    // scan (-inf, +inf) => both open, whatever iter was used for before
     {
         begin_key_num = 5;
         end_key_num = 499;
@@ -644,13 +650,11 @@ TEST(RadixTree, SingleProcessScan) {
                          begin_key_buf, begin_key_size, false,
                          end_key_buf, end_key_size, false);
         EXPECT_EQ(0, ret);
-        uint64_t i=begin_key_num;
-        EXPECT_EQ(i, convert(*((uint64_t*)&key_buf)));
-        EXPECT_EQ((int)sizeof(i), key_size);
-        value_ptr = (uint64_t*)mm->GlobalToLocal(result.gptr());
-        EXPECT_EQ(i, *value_ptr);
-        i++;
+        EXPECT_EQ((int)RadixTree::OPEN_BOUNDARY_KEY_SIZE, key_size);
+        EXPECT_EQ(0, memcmp((char const *)RadixTree::OPEN_BOUNDARY_KEY, (char *)key_buf, key_size));
+        EXPECT_EQ('\0', *((char*)mm->GlobalToLocal(result.gptr())));
 
+        uint64_t i=begin_key_num;
         for(; i<=end_key_num; i++) {
             ret = tree->get_next(iter, key_buf, key_size, result);
             EXPECT_EQ(0, ret);
@@ -806,6 +810,665 @@ TEST(RadixTree, SingleProcessScan) {
     EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
 }
 
+// single process: inner nodes grow from 4 to 256 children
+TEST(RadixTree, SingleProcessNodeGrowth) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    RadixTree *tree = new RadixTree(mm, heap, NULL);
+    EXPECT_NE(nullptr, tree);
+
+    char key_buf[RadixTree::MAX_KEY_LEN];
+    size_t key_size;
+    GlobalPtr prefix_value_gptr, value_gptr[256];
+    TagGptr result, old_value;
+
+    // "pp" and then "pp"+i, in a scrambled order, all under the same inner node
+    memcpy(key_buf, "pp", 2);
+    prefix_value_gptr = heap->Alloc(sizeof(uint64_t));
+    result = tree->put(key_buf, 2, prefix_value_gptr, UPDATE);
+    EXPECT_EQ(0UL, result.gptr());
+    std::pair<GlobalPtr, TagGptr> prefix_key = tree->getC(key_buf, 2);
+    EXPECT_EQ(prefix_value_gptr, prefix_key.second.gptr());
+
+    key_size = 3;
+    for (int i = 0; i < 256; i++) {
+        key_buf[2] = (char)((i * 7) % 256); // 7 and 256 are coprime
+        value_gptr[(i * 7) % 256] = heap->Alloc(sizeof(uint64_t));
+        result = tree->put(key_buf, key_size, value_gptr[(i * 7) % 256], UPDATE);
+        EXPECT_EQ(0UL, result.gptr());
+
+        // nothing is lost when the node is replaced by a bigger one
+        for (int j = 0; j <= i; j++) {
+            key_buf[2] = (char)((j * 7) % 256);
+            result = tree->get(key_buf, key_size);
+            EXPECT_EQ(value_gptr[(j * 7) % 256], result.gptr());
+        }
+        EXPECT_EQ(prefix_value_gptr, tree->get("pp", 2).gptr());
+    }
+
+    // the key ptr of a key never moves
+    EXPECT_EQ(prefix_key.first, tree->getC("pp", 2).first);
+    EXPECT_EQ(prefix_value_gptr, tree->getC(prefix_key.first).gptr());
+
+    // scan returns the keys in order
+    RadixTree::Iter iter;
+    char begin_key_buf[RadixTree::MAX_KEY_LEN], end_key_buf[RadixTree::MAX_KEY_LEN];
+    memcpy(begin_key_buf, "pp", 2);
+    memcpy(end_key_buf, "pq", 2);
+    int ret = tree->scan(iter,
+                         key_buf, key_size, result,
+                         begin_key_buf, 2, true,
+                         end_key_buf, 2, false);
+    EXPECT_EQ(0, ret);
+    EXPECT_EQ(2UL, key_size);
+    for (int i = 0; i < 256; i++) {
+        ret = tree->get_next(iter, key_buf, key_size, result);
+        EXPECT_EQ(0, ret);
+        EXPECT_EQ(3UL, key_size);
+        EXPECT_EQ(i, (int)(unsigned char)key_buf[2]);
+        EXPECT_EQ(value_gptr[i], result.gptr());
+    }
+    ret = tree->get_next(iter, key_buf, key_size, result);
+    EXPECT_EQ(-1, ret);
+
+    // keys that split a grown node
+    memcpy(key_buf, "p", 1);
+    result = tree->put(key_buf, 1, value_gptr[1], UPDATE);
+    EXPECT_EQ(0UL, result.gptr());
+    EXPECT_EQ(value_gptr[1], tree->get("p", 1).gptr());
+    EXPECT_EQ(prefix_value_gptr, tree->get("pp", 2).gptr());
+    key_buf[2] = (char)255;
+    EXPECT_EQ(value_gptr[255], tree->get(key_buf, 3).gptr());
+
+    delete tree;
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
+
+// negative lookups: a miss stays absent until the key is inserted
+TEST(RadixTree, SingleProcessNegativeLookup) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    RadixTree *tree = new RadixTree(mm, heap, NULL);
+    EXPECT_NE(nullptr, tree);
+
+    GlobalPtr value_gptr = heap->Alloc(sizeof(uint64_t));
+    TagGptr old_value;
+    KeyMiss miss, miss2;
+    std::pair<GlobalPtr, TagGptr> kv;
+
+    // an empty slot of the root
+    kv = tree->getC("abc", 3, miss);
+    EXPECT_FALSE(kv.first.IsValid());
+    EXPECT_TRUE(tree->absent(miss));
+    tree->put("abc", 3, value_gptr, UPDATE);
+    EXPECT_FALSE(tree->absent(miss));
+    kv = tree->getC("abc", 3, miss);
+    EXPECT_TRUE(kv.first.IsValid());
+    EXPECT_EQ(value_gptr, kv.second.gptr());
+
+    // a leaf that an insert would split; an unrelated key leaves the miss alone
+    kv = tree->getC("abd", 3, miss);
+    EXPECT_FALSE(kv.first.IsValid());
+    EXPECT_TRUE(tree->absent(miss));
+    tree->put("xyz", 3, value_gptr, UPDATE);
+    EXPECT_TRUE(tree->absent(miss));
+    tree->put("abd", 3, value_gptr, UPDATE);
+    EXPECT_FALSE(tree->absent(miss));
+
+    // a byte without a slot in an inner node ("ab"), and its empty leaf slot
+    kv = tree->getC("abe", 3, miss);
+    EXPECT_FALSE(kv.first.IsValid());
+    EXPECT_TRUE(tree->absent(miss));
+    kv = tree->getC("ab", 2, miss2);
+    EXPECT_FALSE(kv.first.IsValid());
+    EXPECT_TRUE(tree->absent(miss2));
+    tree->put("ab", 2, value_gptr, UPDATE);
+    EXPECT_TRUE(tree->absent(miss));
+    EXPECT_FALSE(tree->absent(miss2));
+    tree->put("abe", 3, value_gptr, UPDATE);
+    EXPECT_FALSE(tree->absent(miss));
+
+    // the node holding the miss grows
+    kv = tree->getC("ab0", 3, miss);
+    EXPECT_FALSE(kv.first.IsValid());
+    EXPECT_TRUE(tree->absent(miss));
+    char key_buf[3] = {'a', 'b', 0};
+    for (char c = 'f'; c <= 'z'; c++) {
+        key_buf[2] = c;
+        tree->put(key_buf, 3, value_gptr, UPDATE);
+    }
+    EXPECT_FALSE(tree->absent(miss));
+    kv = tree->getC("ab0", 3, miss);
+    EXPECT_FALSE(kv.first.IsValid());
+    EXPECT_TRUE(tree->absent(miss));
+
+    // a deleted key still has its key node, so there is no miss
+    tree->destroyC("abc", 3, old_value);
+    kv = tree->getC("abc", 3, miss);
+    EXPECT_TRUE(kv.first.IsValid());
+    EXPECT_FALSE(kv.second.IsValid());
+    EXPECT_FALSE(tree->absent(miss));
+
+    delete tree;
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
+
+TEST(RadixTree, SingleProcessLongKeys) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    RadixTree *tree = new RadixTree(mm, heap, NULL);
+    EXPECT_NE(nullptr, tree);
+
+    // composite keys: a 200-byte common part followed by a 56-byte suffix
+    // that only differs in its last byte, plus the common part itself
+    int const count = 16;
+    std::string common(200, 'k');
+    std::string keys[count];
+    GlobalPtr prefix_value_gptr, value_gptr[count];
+    TagGptr result;
+
+    for (int i = 0; i < count; i++) {
+        keys[i] = common + std::string(55, 's') + (char)('a' + i);
+        EXPECT_EQ(256UL, keys[i].size());
+        value_gptr[i] = heap->Alloc(sizeof(uint64_t));
+        result = tree->put(keys[i].data(), keys[i].size(), value_gptr[i], UPDATE);
+        EXPECT_EQ(0UL, result.gptr());
+    }
+    prefix_value_gptr = heap->Alloc(sizeof(uint64_t));
+    result = tree->put(common.data(), common.size(), prefix_value_gptr, UPDATE);
+    EXPECT_EQ(0UL, result.gptr());
+
+    for (int i = 0; i < count; i++) {
+        result = tree->get(keys[i].data(), keys[i].size());
+        EXPECT_EQ(value_gptr[i], result.gptr());
+    }
+    EXPECT_EQ(prefix_value_gptr, tree->get(common.data(), common.size()).gptr());
+
+    // keys that differ from the stored ones only past byte 40 are not found
+    std::string other = common + std::string(56, 't');
+    EXPECT_EQ(0UL, tree->get(other.data(), other.size()).gptr());
+    EXPECT_EQ(0UL, tree->get(keys[0].data(), 255).gptr());
+
+    // scan returns the keys in order
+    RadixTree::Iter iter;
+    char key_buf[RadixTree::MAX_KEY_LEN];
+    size_t key_size;
+    std::string end_key = common + "t";
+    int ret = tree->scan(iter,
+                         key_buf, key_size, result,
+                         common.data(), common.size(), true,
+                         end_key.data(), end_key.size(), false);
+    EXPECT_EQ(0, ret);
+    EXPECT_EQ(common, std::string(key_buf, key_size));
+    for (int i = 0; i < count; i++) {
+        ret = tree->get_next(iter, key_buf, key_size, result);
+        EXPECT_EQ(0, ret);
+        EXPECT_EQ(keys[i], std::string(key_buf, key_size));
+        EXPECT_EQ(value_gptr[i], result.gptr());
+    }
+    ret = tree->get_next(iter, key_buf, key_size, result);
+    EXPECT_EQ(-1, ret);
+
+    // update and delete
+    result = tree->put(keys[3].data(), keys[3].size(), value_gptr[4], UPDATE);
+    EXPECT_EQ(value_gptr[3], result.gptr());
+    result = tree->destroy(keys[3].data(), keys[3].size());
+    EXPECT_EQ(value_gptr[4], result.gptr());
+    EXPECT_EQ(0UL, tree->get(keys[3].data(), keys[3].size()).gptr());
+
+    delete tree;
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
+TEST(RadixTree, SingleProcessBatch) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    RadixTree *tree = new RadixTree(mm, heap, NULL);
+    EXPECT_NE(nullptr, tree);
+
+    // even keys go in; every key is looked up
+    int const count = 500;
+    std::vector<std::string> keys, all_keys;
+    std::vector<GlobalPtr> values;
+    std::vector<TagGptr> results;
+    for (int i = 0; i < count; i++) {
+        uint64_t key = (uint64_t)((i * 7) % count);
+        all_keys.push_back(std::string((char *)&key, sizeof(key)));
+        if (key % 2 == 0) {
+            keys.push_back(all_keys.back());
+            values.push_back(heap->Alloc(sizeof(uint64_t)));
+        }
+    }
+    tree->put(keys, values, UPDATE, results);
+    EXPECT_EQ(keys.size(), results.size());
+    for (size_t i = 0; i < results.size(); i++)
+        EXPECT_EQ(0UL, results[i].gptr());
+
+    // the batched and the interleaved gets agree with get
+    std::vector<TagGptr> interleaved;
+    tree->get(all_keys, results);
+    for (size_t width = 1; width <= 16; width *= 4) {
+        tree->get(all_keys, interleaved, width);
+        EXPECT_EQ(all_keys.size(), interleaved.size());
+        for (size_t i = 0; i < all_keys.size(); i++) {
+            TagGptr expected = tree->get(all_keys[i].data(), all_keys[i].size());
+            EXPECT_EQ(expected.gptr(), results[i].gptr());
+            EXPECT_EQ(expected.gptr(), interleaved[i].gptr());
+        }
+    }
+    for (size_t i = 0; i < keys.size(); i++)
+        EXPECT_EQ(values[i], tree->get(keys[i].data(), keys[i].size()).gptr());
+
+    // destroy everything; only the even keys had a value
+    tree->destroy(all_keys, results);
+    for (size_t i = 0; i < all_keys.size(); i++) {
+        uint64_t key;
+        memcpy((char *)&key, all_keys[i].data(), sizeof(key));
+        EXPECT_EQ(key % 2 == 0, results[i].IsValid());
+    }
+    tree->get(all_keys, interleaved, 8);
+    for (size_t i = 0; i < all_keys.size(); i++)
+        EXPECT_FALSE(interleaved[i].IsValid());
+
+    delete tree;
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
+TEST(RadixTree, SingleProcessBulkLoad) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    RadixTree *tree = new RadixTree(mm, heap, NULL);
+    EXPECT_NE(nullptr, tree);
+
+    // a leaf in the way of the new keys, and one off to the side
+    GlobalPtr in_the_way = heap->Alloc(sizeof(uint64_t));
+    GlobalPtr aside = heap->Alloc(sizeof(uint64_t));
+    EXPECT_EQ(0UL, tree->put("user5", 5, in_the_way, UPDATE).gptr());
+    EXPECT_EQ(0UL, tree->put("a", 1, aside, UPDATE).gptr());
+
+    // unsorted keys that share a first byte, with user5 among them and user7 twice
+    int const count = 2000;
+    std::vector<std::string> keys;
+    std::vector<GlobalPtr> values;
+    std::map<std::string, GlobalPtr> expected;
+    for (int i = 0; i < count; i++) {
+        keys.push_back("user" + std::to_string((i * 7) % count));
+        values.push_back(heap->Alloc(sizeof(uint64_t)));
+    }
+    keys.push_back("user7");
+    values.push_back(heap->Alloc(sizeof(uint64_t)));
+    keys.push_back("b");
+    values.push_back(heap->Alloc(sizeof(uint64_t)));
+    for (size_t i = 0; i < keys.size(); i++)
+        expected[keys[i]] = values[i];
+    expected["a"] = aside;
+
+    std::vector<TagGptr> old_values;
+    tree->load(keys, values, old_values, 4);
+    EXPECT_EQ(keys.size(), old_values.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i] == "user5")
+            EXPECT_EQ(in_the_way, old_values[i].gptr());
+        else if (keys[i] == "user7" && i == keys.size() - 2)
+            EXPECT_EQ(values[1], old_values[i].gptr()); // the first user7 is overwritten
+        else
+            EXPECT_EQ(0UL, old_values[i].gptr());
+    }
+
+    // every key is there, in order
+    std::vector<std::string> scanned;
+    std::vector<TagGptr> scanned_values;
+    EXPECT_EQ(0, tree->scan_batch(scanned, scanned_values, count * 2,
+                                  RadixTree::OPEN_BOUNDARY_KEY, RadixTree::OPEN_BOUNDARY_KEY_SIZE, false,
+                                  RadixTree::OPEN_BOUNDARY_KEY, RadixTree::OPEN_BOUNDARY_KEY_SIZE, false));
+    EXPECT_EQ(expected.size(), scanned.size());
+    size_t j = 0;
+    for (auto const &kv : expected) {
+        EXPECT_EQ(kv.first, scanned[j]);
+        EXPECT_EQ(kv.second, scanned_values[j].gptr());
+        EXPECT_EQ(kv.second, tree->get(kv.first.data(), kv.first.size()).gptr());
+        j++;
+    }
+
+    // sorted keys that land among the loaded ones, and the loaded nodes still grow
+    keys.clear();
+    values.clear();
+    for (int i = count; i < 2 * count; i++) {
+        keys.push_back("user" + std::to_string(i));
+        values.push_back(heap->Alloc(sizeof(uint64_t)));
+    }
+    std::sort(keys.begin(), keys.end());
+    tree->load(keys, values, old_values, 4);
+    for (size_t i = 0; i < keys.size(); i++) {
+        EXPECT_EQ(0UL, old_values[i].gptr());
+        EXPECT_EQ(values[i], tree->get(keys[i].data(), keys[i].size()).gptr());
+    }
+    for (int i = 0; i < 64; i++) {
+        std::string key = "user1x" + std::to_string(i);
+        GlobalPtr value = heap->Alloc(sizeof(uint64_t));
+        EXPECT_EQ(0UL, tree->put(key.data(), key.size(), value, UPDATE).gptr());
+        EXPECT_EQ(value, tree->get(key.data(), key.size()).gptr());
+    }
+    EXPECT_EQ(expected["user1"], tree->get("user1", 5).gptr());
+
+    delete tree;
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
+TEST(RadixTree, SingleProcessScanWhileGrowing) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    RadixTree *tree = new RadixTree(mm, heap, NULL);
+    EXPECT_NE(nullptr, tree);
+
+    char key_buf[RadixTree::MAX_KEY_LEN];
+    size_t key_size;
+    GlobalPtr value_gptr = heap->Alloc(sizeof(uint64_t));
+    TagGptr result;
+
+    // "g"+0 and "g"+255, under a node with room for only two more children
+    key_buf[0] = 'g';
+    key_buf[1] = (char)0;
+    tree->put(key_buf, 2, value_gptr, UPDATE);
+    key_buf[1] = (char)255;
+    tree->put(key_buf, 2, value_gptr, UPDATE);
+
+    RadixTree::Iter iter;
+    char begin_key_buf[RadixTree::MAX_KEY_LEN], end_key_buf[RadixTree::MAX_KEY_LEN];
+    memcpy(begin_key_buf, "g", 1);
+    memcpy(end_key_buf, "h", 1);
+    int ret = tree->scan(iter,
+                         key_buf, key_size, result,
+                         begin_key_buf, 1, true,
+                         end_key_buf, 1, false);
+    EXPECT_EQ(0, ret);
+    EXPECT_EQ(2UL, key_size);
+    EXPECT_EQ(0, (int)(unsigned char)key_buf[1]);
+
+    // each new key lands right after the current one; on the way, the node the
+    // scan is in is replaced by a bigger one several times
+    for (int i = 1; i < 255; i++) {
+        char new_key[2] = {'g', (char)i};
+        tree->put(new_key, 2, value_gptr, UPDATE);
+
+        ret = tree->get_next(iter, key_buf, key_size, result);
+        EXPECT_EQ(0, ret);
+        EXPECT_EQ(2UL, key_size);
+        EXPECT_EQ(i, (int)(unsigned char)key_buf[1]);
+    }
+    ret = tree->get_next(iter, key_buf, key_size, result);
+    EXPECT_EQ(0, ret);
+    EXPECT_EQ(255, (int)(unsigned char)key_buf[1]);
+    ret = tree->get_next(iter, key_buf, key_size, result);
+    EXPECT_EQ(-1, ret);
+
+    delete tree;
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
+// a paused scan goes on from its key when nodes on its path are pruned or
+// replaced, and is not disturbed by replacements elsewhere
+TEST(RadixTree, SingleProcessScanPaused) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    RadixTree *tree = new RadixTree(mm, heap, NULL);
+    EXPECT_NE(nullptr, tree);
+
+    char key_buf[RadixTree::MAX_KEY_LEN];
+    size_t key_size;
+    GlobalPtr value_gptr = heap->Alloc(sizeof(uint64_t));
+    TagGptr result;
+
+    // "a"+0 to "a"+19 under a Node48, and "b"+0 to "b"+2 under a Node4
+    for (int i = 0; i < 20; i++) {
+        char key[2] = {'a', (char)i};
+        tree->put(key, 2, value_gptr, UPDATE);
+    }
+    for (int i = 0; i < 3; i++) {
+        char key[2] = {'b', (char)i};
+        tree->put(key, 2, value_gptr, UPDATE);
+    }
+
+    RadixTree::Iter iter;
+    int ret = tree->scan(iter,
+                         key_buf, key_size, result,
+                         "a", 1, true,
+                         "c", 1, false);
+    EXPECT_EQ(0, ret);
+    EXPECT_EQ(2UL, key_size);
+    EXPECT_EQ(0, (int)(unsigned char)key_buf[1]);
+
+    // the "b" node grows, away from the path
+    for (int i = 3; i < 10; i++) {
+        char key[2] = {'b', (char)i};
+        tree->put(key, 2, value_gptr, UPDATE);
+    }
+    ret = tree->get_next(iter, key_buf, key_size, result);
+    EXPECT_EQ(0, ret);
+    EXPECT_EQ(1, (int)(unsigned char)key_buf[1]);
+
+    // the current key and the next ones are pruned, and the "a" node shrinks
+    // into a Node16
+    for (int i = 1; i < 10; i++) {
+        char key[2] = {'a', (char)i};
+        tree->destroy(key, 2);
+    }
+    EXPECT_EQ(9UL, tree->compact());
+    for (int i = 10; i < 20; i++) {
+        ret = tree->get_next(iter, key_buf, key_size, result);
+        EXPECT_EQ(0, ret);
+        EXPECT_EQ('a', key_buf[0]);
+        EXPECT_EQ(i, (int)(unsigned char)key_buf[1]);
+    }
+    for (int i = 0; i < 10; i++) {
+        ret = tree->get_next(iter, key_buf, key_size, result);
+        EXPECT_EQ(0, ret);
+        EXPECT_EQ('b', key_buf[0]);
+        EXPECT_EQ(i, (int)(unsigned char)key_buf[1]);
+    }
+    ret = tree->get_next(iter, key_buf, key_size, result);
+    EXPECT_EQ(-1, ret);
+
+    delete tree;
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
+// compaction: the key nodes of deleted keys are pruned, and so are the inner
+// nodes they leave behind
+TEST(RadixTree, SingleProcessCompact) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    RadixTree *tree = new RadixTree(mm, heap, NULL);
+    EXPECT_NE(nullptr, tree);
+
+    char key_buf[RadixTree::MAX_KEY_LEN];
+    size_t key_size;
+    GlobalPtr value_gptr = heap->Alloc(sizeof(uint64_t));
+    TagGptr result, old_value;
+
+    // "c", "ca", "cab", "cb", and "d"+0 to "d"+19 under a Node48
+    char const *c_keys[] = {"c", "ca", "cab", "cb"};
+    for (auto key : c_keys)
+        tree->put(key, strlen(key), value_gptr, UPDATE);
+    key_buf[0] = 'd';
+    for (int i = 0; i < 20; i++) {
+        key_buf[1] = (char)i;
+        tree->put(key_buf, 2, value_gptr, UPDATE);
+    }
+
+    // nothing to prune yet
+    EXPECT_EQ(0UL, tree->compact());
+
+    // a key ptr, and the generation it was taken in
+    uint64_t key_gen = tree->key_gen();
+    EXPECT_TRUE(tree->key_ptr_valid(key_gen));
+    std::pair<GlobalPtr, TagGptr> cb_key = tree->getC("cb", 2);
+    EXPECT_TRUE(cb_key.first.IsValid());
+
+    std::pair<GlobalPtr, TagGptr> cab_key = tree->destroyC("cab", 3, old_value);
+    EXPECT_TRUE(cab_key.first.IsValid());
+    tree->destroy("ca", 2);
+    for (int i = 2; i < 20; i++) {
+        key_buf[1] = (char)i;
+        tree->destroy(key_buf, 2);
+    }
+    EXPECT_EQ(20UL, tree->compact());
+
+    // key ptrs taken before the compaction are no longer good
+    EXPECT_NE(key_gen, tree->key_gen());
+    EXPECT_FALSE(tree->key_ptr_valid(key_gen));
+    EXPECT_TRUE(tree->key_ptr_valid(tree->key_gen()));
+
+    // the other keys are still there, and the pruned ones do not exist any more
+    EXPECT_EQ(value_gptr, tree->get("c", 1).gptr());
+    EXPECT_EQ(value_gptr, tree->get("cb", 2).gptr());
+    EXPECT_EQ(cb_key.first, tree->getC("cb", 2).first);
+    EXPECT_FALSE(tree->getC("cab", 3).first.IsValid());
+    EXPECT_FALSE(tree->getC("ca", 2).first.IsValid());
+    for (int i = 0; i < 20; i++) {
+        key_buf[1] = (char)i;
+        EXPECT_EQ(i < 2, tree->get(key_buf, 2).IsValid());
+    }
+
+    // a key inserted again gets a newer version than it had before it was pruned
+    std::pair<GlobalPtr, TagGptr> kv = tree->putC("cab", 3, value_gptr, old_value);
+    EXPECT_FALSE(old_value.IsValid());
+    EXPECT_LT(cab_key.second.tag(), kv.second.tag());
+    EXPECT_EQ(value_gptr, tree->get("cab", 3).gptr());
+
+    // scan returns the keys in order
+    RadixTree::Iter iter;
+    char const *scan_keys[] = {"c", "cab", "cb"};
+    int ret = tree->scan(iter, key_buf, key_size, result, "c", 1, true, "d", 1, false);
+    for (auto key : scan_keys) {
+        EXPECT_EQ(0, ret);
+        EXPECT_EQ(std::string(key), std::string(key_buf, key_size));
+        ret = tree->get_next(iter, key_buf, key_size, result);
+    }
+    EXPECT_EQ(-1, ret);
+
+    // everything goes
+    for (auto key : c_keys)
+        tree->destroy(key, strlen(key));
+    key_buf[0] = 'd';
+    for (int i = 0; i < 2; i++) {
+        key_buf[1] = (char)i;
+        tree->destroy(key_buf, 2);
+    }
+    EXPECT_EQ(5UL, tree->compact());
+    ret = tree->scan(iter, key_buf, key_size, result, "\0", 1, false, "\0", 1, false);
+    EXPECT_EQ(-1, ret);
+
+    delete tree;
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
 // multi-process: put, get, destroy
 static int const process_count = 16;
 static int const loop_count = 5000;
@@ -917,6 +1580,169 @@ void DoWork(GlobalPtr root, PoolId heap_id)
     delete tree;
 }
 
+// lookups through the DRAM mirror of the upper levels see what has changed since
+// the mirror was built
+TEST(RadixTree, SingleProcessMirror) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    RadixTree *tree = new RadixTree(mm, heap, NULL);
+    EXPECT_NE(nullptr, tree);
+
+    // "key" + x + "_" + y: the root, a node "key", nodes "keyX_" and their leaves
+    std::map<std::string, GlobalPtr> kvs;
+    for (char x = 'a'; x < 'q'; x++) {
+        for (char y = 'a'; y < 'q'; y++) {
+            std::string key = std::string("key") + x + "_" + y;
+            kvs[key] = heap->Alloc(sizeof(uint64_t));
+            tree->put(key.data(), key.size(), kvs[key], UPDATE);
+        }
+    }
+    auto check = [&]() {
+        std::vector<std::string> keys;
+        std::vector<TagGptr> values;
+        for (auto &kv : kvs) {
+            keys.push_back(kv.first);
+            EXPECT_EQ(kv.second, tree->get(kv.first.data(), kv.first.size()).gptr());
+            EXPECT_EQ(kv.second, tree->getC(kv.first.data(), kv.first.size()).second.gptr());
+        }
+        keys.push_back("keyz_a");
+        keys.push_back("kez");
+        keys.push_back("key");
+        tree->get(keys, values, 8);
+        for (size_t i = 0; i < keys.size(); i++) {
+            auto it = kvs.find(keys[i]);
+            EXPECT_EQ(it == kvs.end() ? GlobalPtr() : it->second, values[i].gptr());
+        }
+    };
+
+    for (size_t levels : {1, 2, 8}) {
+        tree->set_mirror(levels);
+        check();
+        check();
+
+        // a split below a mirrored node, and a new child of one
+        std::string split = std::string("key") + (char)('a' + levels) + "-";
+        std::string child = std::string("key") + (char)('q' + levels) + "_a";
+        for (std::string const &key : {split, child}) {
+            kvs[key] = heap->Alloc(sizeof(uint64_t));
+            tree->put(key.data(), key.size(), kvs[key], UPDATE);
+        }
+        check();
+    }
+
+    // replaced nodes make the mirror stale
+    {
+        EpochOp op(EpochManager::GetInstance());
+        for (char y = 'a'; y < 'p'; y++) {
+            std::string key = std::string("keyc_") + y;
+            tree->destroy(key.data(), key.size());
+            kvs.erase(key);
+        }
+        EXPECT_EQ(15UL, tree->compact());
+    }
+    check();
+
+    // a budget too small for the root turns the mirror off
+    tree->set_mirror(2, 1);
+    check();
+
+    delete tree;
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
+// the per-thread block caches in front of the heap
+TEST(RadixTree, SingleProcessSlabHeap) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    EpochManager *emgr = EpochManager::GetInstance();
+    SlabHeap *slab = new SlabHeap(heap, emgr);
+
+    // blocks of all classes and beyond do not overlap
+    std::vector<std::pair<GlobalPtr, size_t>> blocks;
+    for (size_t i = 0; i < 2000; i++) {
+        size_t size = (size_t)rand_uint64(1, 5000);
+        GlobalPtr ptr = slab->Alloc(size);
+        EXPECT_TRUE(ptr.IsValid());
+        memset(heap->GlobalToLocal(ptr), (int)(i & 0xff), size);
+        blocks.push_back(std::make_pair(ptr, size));
+    }
+    for (size_t i = 0; i < blocks.size(); i++) {
+        unsigned char *p = (unsigned char *)heap->GlobalToLocal(blocks[i].first);
+        EXPECT_EQ(i & 0xff, p[0]);
+        EXPECT_EQ(i & 0xff, p[blocks[i].second - 1]);
+    }
+
+    // a block no one has seen is reused right away; a retired one not while an op may read it
+    GlobalPtr ptr = blocks.back().first;
+    size_t size = blocks.back().second;
+    blocks.pop_back();
+    slab->Free(ptr, size);
+    EXPECT_EQ(ptr, slab->Alloc(size));
+    {
+        EpochOp op(emgr);
+        slab->Free(op, ptr, size);
+        EXPECT_NE(ptr, slab->Alloc(size));
+    }
+    for (auto &b : blocks)
+        slab->Free(b.first, b.second);
+
+    // threads allocating and freeing at once never get the same block
+    size_t const thread_cnt = SlabHeap::kThreadCaches + 8;
+    std::vector<std::vector<GlobalPtr>> kept(thread_cnt);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < thread_cnt; t++) {
+        workers.emplace_back([&, t]() {
+            std::vector<GlobalPtr> mine;
+            for (size_t i = 0; i < 2000; i++) {
+                mine.push_back(slab->Alloc(100));
+                if (i % 3 == 2) {
+                    slab->Free(mine.back(), 100);
+                    mine.pop_back();
+                }
+            }
+            kept[t].swap(mine);
+        });
+    }
+    for (auto &w : workers)
+        w.join();
+    std::set<uint64_t> seen;
+    for (auto &k : kept) {
+        for (GlobalPtr p : k) {
+            EXPECT_TRUE(p.IsValid());
+            EXPECT_TRUE(seen.insert((uint64_t)p).second);
+        }
+    }
+
+    delete slab;
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
 TEST(RadixTree, MultiProcessStress) {
     PoolId const heap_id = 1; // assuming we only use heap id 1
     size_t const heap_size = 1024*1024*1024; // 1024MB
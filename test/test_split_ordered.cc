@@ -27,9 +27,12 @@
 #include <stdlib.h>
 #include <string.h>
 #include <string>
+#include <map>
+#include <vector>
 #include <gtest/gtest.h>
 
 #include "radixtree/split_ordered.h"
+#include "city.h"
 
 #include "nvmm/memory_manager.h"
 #include "nvmm/epoch_manager.h"
@@ -40,13 +43,13 @@
 using namespace radixtree;
 using namespace nvmm;
 
-void print_kv(SplitOrderedList* so, SplitOrderedList::ByteKey key, size_t key_size, SplitOrderedList::Value val)
+void print_kv(SplitOrderedList* so, char *key, size_t key_size, SplitOrderedList::Value val)
 {
     Gptr val_ptr = val;
     std::cout << key << ": " << val << std::endl;
 }
 
-void print_kv2(SplitOrderedList* so, SplitOrderedList::ByteKey key, size_t key_size, SplitOrderedList::Value val)
+void print_kv2(SplitOrderedList* so, char *key, size_t key_size, SplitOrderedList::Value val)
 {
     Gptr val_ptr = val;
     if (val != 0) {
@@ -93,9 +96,9 @@ TEST(SplitOrderedList, SingleProcess) {
 
         EpochOp op(em);
 
-        SplitOrderedList::ByteKey key1 = "9";
-        SplitOrderedList::ByteKey key2 = "10";
-        SplitOrderedList::ByteKey key3 = "11";
+        char key1[] = "9";
+        char key2[] = "10";
+        char key3[] = "11";
         so->Insert(op, key1, strlen(key1)+1, 9);
         so->Insert(op, key2, strlen(key2)+1, 10);
         so->Insert(op, key3, strlen(key3)+1, 11);
@@ -113,9 +116,9 @@ TEST(SplitOrderedList, SingleProcess) {
 
         EpochOp op(em);
 
-        SplitOrderedList::ByteKey key1 = "9";
-        SplitOrderedList::ByteKey key2 = "10";
-        SplitOrderedList::ByteKey key3 = "11";
+        char key1[] = "9";
+        char key2[] = "10";
+        char key3[] = "11";
         EXPECT_EQ(9LLU, so->Find(op, key1, strlen(key1)+1));
         EXPECT_EQ(10LLU, so->Find(op, key2, strlen(key2)+1));
         EXPECT_EQ(11LLU, so->Find(op, key3, strlen(key3)+1));
@@ -132,7 +135,7 @@ TEST(SplitOrderedList, SingleProcess) {
 
         EpochOp op(em);
 
-        SplitOrderedList::ByteKey key1 = "9";
+        char key1[] = "9";
         EXPECT_EQ(1, so->Delete(op, key1, strlen(key1)+1, NULL));
         EXPECT_EQ(0LLU, so->Find(op, key1, strlen(key1)+1));
  
@@ -190,6 +193,196 @@ TEST(SplitOrderedList, SingleProcess) {
     EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
 }
 
+TEST(SplitOrderedList, SingleProcessGrowth) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    EpochManager *em = EpochManager::GetInstance();
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    // enough keys for the table to grow through several segments of buckets
+    uint64_t const count = 50000;
+    GlobalPtr sod;
+
+    // begin a new lexical scope so that epoch terminates when we exit scope
+    {
+        SplitOrderedList *so = new SplitOrderedList(mm, heap, NULL);
+        EXPECT_NE(nullptr, so);
+        sod = so->get_descriptor();
+
+        EpochOp op(em);
+
+        for (uint64_t i = 0; i < count; i++) {
+            std::string key = std::to_string(i);
+            EXPECT_EQ(1, so->Insert(op, key.c_str(), key.size(), i + 1));
+        }
+
+        delete so;
+    }
+
+    // begin a new lexical scope so that epoch terminates when we exit scope
+    {
+        // open an existing list
+        SplitOrderedList *so = new SplitOrderedList(mm, heap, NULL, sod);
+        EXPECT_NE(nullptr, so);
+
+        EpochOp op(em);
+
+        for (uint64_t i = 0; i < count; i++) {
+            std::string key = std::to_string(i);
+            EXPECT_EQ(i + 1, so->Find(op, key.c_str(), key.size()));
+        }
+        for (uint64_t i = 0; i < count; i += 2) {
+            std::string key = std::to_string(i);
+            EXPECT_EQ(1, so->Delete(op, key.c_str(), key.size(), NULL));
+        }
+        for (uint64_t i = 0; i < count; i++) {
+            std::string key = std::to_string(i);
+            EXPECT_EQ(i % 2 ? i + 1 : 0, so->Find(op, key.c_str(), key.size()));
+        }
+
+        delete so;
+    }
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
+// once the heap is full, inserts fail instead of crashing, and the keys already in stay there
+TEST(SplitOrderedList, SingleProcessOutOfMemory) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 16*1024*1024; // 16MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    EpochManager *em = EpochManager::GetInstance();
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    // begin a new lexical scope so that epoch terminates when we exit scope
+    {
+        SplitOrderedList *so = new SplitOrderedList(mm, heap, NULL);
+        EXPECT_NE(nullptr, so);
+
+        EpochOp op(em);
+
+        uint64_t count = 0;
+        int ret;
+        do {
+            std::string key = std::to_string(count);
+            ret = so->Insert(op, key.c_str(), key.size(), count + 1);
+        } while (ret == 1 && ++count < heap_size); // a node takes more than a byte
+        EXPECT_EQ(-1, ret);
+        EXPECT_LT(0UL, count);
+
+        for (uint64_t i = 0; i < count; i++) {
+            std::string key = std::to_string(i);
+            EXPECT_EQ(i + 1, so->Find(op, key.c_str(), key.size()));
+        }
+        std::string key = std::to_string(count);
+        EXPECT_EQ(0UL, so->Find(op, key.c_str(), key.size()));
+
+        delete so;
+    }
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
+// keys whose hashes share their low 16 bits carry the same key tag in the next pointers (the top
+// 16 bits of the so key), so a walk down their list has to compare them in full; keys with other
+// tags are skipped on the tag alone
+TEST(SplitOrderedList, SingleProcessKeyTags) {
+    PoolId const heap_id = 1; // assuming we only use heap id 1
+    size_t const heap_size = 1024*1024*1024; // 1024MB
+
+    // init memory manager and heap
+    MemoryManager *mm = MemoryManager::GetInstance();
+    Heap *heap = nullptr;
+    EXPECT_EQ(NO_ERROR, mm->CreateHeap(heap_id, heap_size));
+    EXPECT_EQ(NO_ERROR, mm->FindHeap(heap_id, &heap));
+    EXPECT_NE(nullptr, heap);
+
+    EpochManager *em = EpochManager::GetInstance();
+
+    // open the heap
+    EXPECT_EQ(NO_ERROR, heap->Open());
+
+    // keys of 1 to 300 bytes, grouped by tag
+    std::map<uint64_t, std::vector<std::string>> tags;
+    std::vector<std::string> colliding;
+    for (uint64_t i = 0; colliding.size() < 4; i++) {
+        std::string key = std::to_string(i);
+        key = std::string(i % 300, 'k').substr(0, 300 - key.size()) + key;
+        std::vector<std::string> &same = tags[CityHash64(key.data(), key.size()) & 0xffff];
+        same.push_back(key);
+        if (same.size() == 4)
+            colliding = same;
+    }
+    std::vector<std::string> others;
+    for (auto &t : tags) {
+        if (t.second != colliding)
+            others.push_back(t.second[0]);
+        if (others.size() == 200)
+            break;
+    }
+
+    {
+        // a new list has 2 buckets, so all these keys are on one or two long lists
+        SplitOrderedList *so = new SplitOrderedList(mm, heap, NULL);
+        EXPECT_NE(nullptr, so);
+
+        EpochOp op(em);
+
+        // colliding[3] is never inserted
+        for (size_t i = 0; i < 3; i++)
+            EXPECT_EQ(1, so->Insert(op, colliding[i].c_str(), colliding[i].size(), i + 1));
+        for (size_t i = 0; i < others.size(); i += 2)
+            EXPECT_EQ(1, so->Insert(op, others[i].c_str(), others[i].size(), 100 + i));
+
+        for (size_t i = 0; i < 3; i++)
+            EXPECT_EQ(i + 1, so->Find(op, colliding[i].c_str(), colliding[i].size()));
+        EXPECT_EQ(0UL, so->Find(op, colliding[3].c_str(), colliding[3].size()));
+        for (size_t i = 0; i < others.size(); i++)
+            EXPECT_EQ(i % 2 ? 0 : 100 + i, so->Find(op, others[i].c_str(), others[i].size()));
+
+        // a key that is a prefix of a colliding key, with the same bytes up to its length
+        std::string prefix = colliding[0].substr(0, colliding[0].size() - 1);
+        EXPECT_EQ(0UL, so->Find(op, prefix.c_str(), prefix.size()));
+
+        // unlinking a node relinks its predecessor with the tag of the node after it
+        EXPECT_EQ(1, so->Delete(op, colliding[1].c_str(), colliding[1].size(), NULL));
+        EXPECT_EQ(1UL, so->Find(op, colliding[0].c_str(), colliding[0].size()));
+        EXPECT_EQ(0UL, so->Find(op, colliding[1].c_str(), colliding[1].size()));
+        EXPECT_EQ(3UL, so->Find(op, colliding[2].c_str(), colliding[2].size()));
+        for (size_t i = 0; i < others.size(); i += 2) {
+            EXPECT_EQ(1, so->Delete(op, others[i].c_str(), others[i].size(), NULL));
+            EXPECT_EQ(0UL, so->Find(op, others[i].c_str(), others[i].size()));
+        }
+        EXPECT_EQ(3UL, so->Find(op, colliding[2].c_str(), colliding[2].size()));
+
+        delete so;
+    }
+
+    EXPECT_EQ(NO_ERROR, heap->Close());
+    EXPECT_EQ(NO_ERROR, mm->DestroyHeap(heap_id));
+}
+
 // multi-process
 void DoWork(GlobalPtr descriptor, PoolId heap_id)
 {
@@ -219,7 +412,7 @@ void DoWork(GlobalPtr descriptor, PoolId heap_id)
 #if 0
     pid_t pid = getpid();
 
-    SplitOrderedList::ByteKey key_buf;
+    char key_buf[SplitOrderedList::MAX_KEY_LEN];
     int key_size;
     memset(&key_buf, 0, sizeof(key_buf));
     uint64_t key, value;